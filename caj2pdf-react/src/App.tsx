@@ -1,7 +1,6 @@
 import { Upload, Spin, Row, Typography } from 'antd';
 import 'antd/dist/reset.css';
 import './App.css';
-import { Base64 } from './utils/base64';
 
 import { InboxOutlined } from '@ant-design/icons';
 import { useState } from 'react';
@@ -24,6 +23,136 @@ function download(filename: any, content: any) {
   }, 5);
 }
 
+function binaryString(bytes: Uint8Array) {
+  var str = '';
+  for (var i = 0; i < bytes.length; i += 0x8000) {
+    str += String.fromCharCode.apply(null, Array.from(bytes.subarray(i, i + 0x8000)));
+  }
+  return str;
+}
+
+// Copy bytes straight into wasm memory, rather than through ccall's 'array'
+// type, which puts them on the (much smaller) stack
+function toWasm(bytes: Uint8Array) {
+  const ptr = window.Module.ccall('mupdf_clean_alloc', 'number', ['number'], [bytes.length]);
+  if (ptr)
+    new Uint8Array(window.Module.asm.memory.buffer, ptr, bytes.length).set(bytes);
+  return ptr;
+}
+
+// Base64 text from the Go parser is written out as is and decoded by mupdf
+function base64ToWasm(text: string) {
+  const ptr = window.Module.ccall('mupdf_clean_alloc', 'number', ['number'], [text.length]);
+  if (ptr)
+    new TextEncoder().encodeInto(text, new Uint8Array(window.Module.asm.memory.buffer, ptr, text.length));
+  return ptr;
+}
+
+// One conversion session for the lifetime of the page, so later files reuse
+// the fonts, colorspaces and caches loaded for the first one
+let cleanSession = 0;
+function getCleanSession() {
+  if (!cleanSession)
+    cleanSession = window.Module.ccall('mupdf_clean_session_new', 'number', ['number'], [64]);
+  return cleanSession;
+}
+
+// The session entry points need a mutool.js built from this tree. An older
+// build lacks them, and reading a runtime method it did not export aborts,
+// so look at the property itself rather than its value
+function hasCleanSession() {
+  const m = window.Module;
+  const addFunction = Object.getOwnPropertyDescriptor(m, 'addFunction');
+  return '_mupdf_clean_session_stream_base64' in m && '_mupdf_clean_alloc' in m &&
+    addFunction !== undefined && typeof addFunction.value === 'function';
+}
+
+function parseWithGo(input: Uint8Array) {
+  const output_obj = window.caj2pdf(btoa(binaryString(input)));
+  return { file: output_obj.file as string, outline: new TextEncoder().encode(output_obj.outline + '\0') };
+}
+
+type Parsed = ReturnType<typeof parseWithGo>;
+
+// Run the Go parser at most once per file, however many clean paths ask
+function parseOnce(input: Uint8Array) {
+  var parsed: Parsed | null = null;
+  return function (): Parsed {
+    if (!parsed)
+      parsed = parseWithGo(input);
+    return parsed;
+  };
+}
+
+// Stream the cleaned PDF out of a session. CAJ containers are opened
+// natively by mupdf, anything else still goes through the Go parser.
+// Returns null if mupdf could not produce a file.
+function cleanWithSession(input: Uint8Array, parse: () => Parsed) {
+  var outline = new Uint8Array([0]);
+  var isCaj = input.length >= 3 && input[0] === 0x43 && input[1] === 0x41 && input[2] === 0x4a;
+  var output_file = '';
+  if (!isCaj) {
+    const parsed = parse();
+    outline = parsed.outline;
+    output_file = parsed.file;
+  }
+
+  const session = getCleanSession();
+  if (!session)
+    return null;
+
+  // The output arrives in fixed-size chunks while it is being written,
+  // so wasm memory never has to hold the whole file
+  const chunks: Uint8Array[] = [];
+  const onChunk = window.Module.addFunction(function (ptr: number, len: number) {
+    chunks.push(new Uint8Array(window.Module.asm.memory.buffer, ptr, len).slice());
+  }, 'vii');
+  const pdf_input = isCaj ? toWasm(input) : base64ToWasm(output_file);
+  var pdf_length = -1;
+  if (pdf_input) {
+    if (isCaj)
+      pdf_length = window.Module.ccall('mupdf_clean_session_stream', 'number', ['number', 'number', 'number', 'array', 'number', 'number'], [session, pdf_input, input.length, outline, 1 << 20, onChunk]);
+    else
+      pdf_length = window.Module.ccall('mupdf_clean_session_stream_base64', 'number', ['number', 'number', 'number', 'array', 'number', 'number'], [session, pdf_input, output_file.length, outline, 1 << 20, onChunk]);
+    window.Module.ccall('mupdf_clean_free', null, ['number'], [pdf_input]);
+  }
+  window.Module.removeFunction(onChunk);
+  return pdf_length >= 0 ? new Blob(chunks) : null;
+}
+
+// The one-shot path: the Go parser for all input, and the whole file
+// copied out of wasm memory. A build from this tree hands back a result
+// handle, so the file is cleaned once and its memory released; the older
+// mutool.js only has mupdf_clean_length and mupdf_clean, which clean the
+// file twice and leave the buffer behind, as it exports no way to free it.
+// If the session path already parsed the input, that result is reused
+function cleanOnce(parse: () => Parsed) {
+  const parsed = parse();
+  const bytes = Uint8Array.from(atob(parsed.file), c => c.charCodeAt(0));
+  if (!('_mupdf_clean_run' in window.Module)) {
+    const pdf_length = window.Module.ccall('mupdf_clean_length', 'number', ['array', 'number', 'array'], [bytes, bytes.length, parsed.outline]);
+    if (pdf_length <= 0)
+      return null;
+    const pdf_ptr = window.Module.ccall('mupdf_clean', 'number', ['array', 'number', 'array'], [bytes, bytes.length, parsed.outline]);
+    if (!pdf_ptr)
+      return null;
+    return new Blob([new Uint8Array(window.Module.asm.memory.buffer, pdf_ptr, pdf_length).slice()]);
+  }
+
+  const pdf_input = toWasm(bytes);
+  if (!pdf_input)
+    return null;
+  const result = window.Module.ccall('mupdf_clean_run', 'number', ['number', 'number', 'array'], [pdf_input, bytes.length, parsed.outline]);
+  window.Module.ccall('mupdf_clean_free', null, ['number'], [pdf_input]);
+  if (!result)
+    return null;
+  const pdf_ptr = window.Module.ccall('mupdf_clean_result_data', 'number', ['number'], [result]);
+  const pdf_length = window.Module.ccall('mupdf_clean_result_length', 'number', ['number'], [result]);
+  const pdf = pdf_ptr && pdf_length > 0 ? new Blob([new Uint8Array(window.Module.asm.memory.buffer, pdf_ptr, pdf_length).slice()]) : null;
+  window.Module.ccall('mupdf_clean_result_free', null, ['number'], [result]);
+  return pdf;
+}
+
 const App = function () {
   const [loading, setLoading] = useState(false)
   const props = {
@@ -32,23 +161,16 @@ const App = function () {
     beforeUpload: function (file: any) {
       setLoading(true)
       var reader = new FileReader();
-      reader.readAsBinaryString(file);    // 解析成base64格式
+      reader.readAsArrayBuffer(file);
       reader.onload = function () {
-        var output_obj = window.caj2pdf(Base64.encode(this.result?.toString()))
-        var pdf_encoded = output_obj.file;
-        var outline = new TextEncoder().encode(output_obj.outline);
-        var pdf_output = Base64.decode(pdf_encoded)
-
-        const pdf_length = window.Module.ccall('mupdf_clean_length', 'number', ['array', 'number', 'array'], [pdf_output, pdf_output.length, outline]);
-        const pdf_ptr = window.Module.ccall('mupdf_clean', 'number', ['array', 'number', 'array'], [pdf_output, pdf_output.length, outline]);
-        const arr = [];
-        const memoryView = new Uint8Array(window.Module.asm.memory.buffer);
-        for (var i = 0; i < pdf_length; i++) {
-          arr.push(memoryView[i + pdf_ptr]);
-        }
-        const ret = new Uint8Array(arr)
+        var input = new Uint8Array(this.result as ArrayBuffer);
+        var parse = parseOnce(input);
+        var pdf = hasCleanSession() ? cleanWithSession(input, parse) : null;
+        if (!pdf)
+          pdf = cleanOnce(parse);
         setLoading(false)
-        download("output.pdf", ret)
+        if (pdf)
+          download("output.pdf", pdf)
       }
       return false
     }
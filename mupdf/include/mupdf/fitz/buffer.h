@@ -115,6 +115,16 @@ fz_buffer *fz_clone_buffer(fz_context *ctx, fz_buffer *buf);
 */
 fz_buffer *fz_new_buffer_from_base64(fz_context *ctx, const char *data, size_t size);
 
+/**
+	Decode size characters of base64 data into out, which must have
+	room for size / 4 * 3 + 3 bytes. out may be the same as data, to
+	decode in place. White space is skipped; decoding stops with a
+	warning at the first invalid character.
+
+	Returns the number of bytes written.
+*/
+size_t fz_decode_base64(fz_context *ctx, unsigned char *out, const char *data, size_t size);
+
 /**
 	Ensure that a buffer has a given capacity,
 	truncating data if required.
@@ -50,6 +50,7 @@
 /* #define FZ_ENABLE_XPS 1 */
 /* #define FZ_ENABLE_SVG 1 */
 /* #define FZ_ENABLE_CBZ 1 */
+/* #define FZ_ENABLE_CAJ 1 */
 /* #define FZ_ENABLE_IMG 1 */
 /* #define FZ_ENABLE_HTML 1 */
 /* #define FZ_ENABLE_EPUB 1 */
@@ -171,6 +172,10 @@
 #define FZ_ENABLE_CBZ 1
 #endif /* FZ_ENABLE_CBZ */
 
+#ifndef FZ_ENABLE_CAJ
+#define FZ_ENABLE_CAJ 1
+#endif /* FZ_ENABLE_CAJ */
+
 #ifndef FZ_ENABLE_IMG
 #define FZ_ENABLE_IMG 1
 #endif /* FZ_ENABLE_IMG */
@@ -207,6 +212,12 @@
 #define FZ_ENABLE_ICC 1
 #endif /* FZ_ENABLE_ICC */
 
+/* CAJ documents are opened as PDF, so need the PDF interpreter */
+#if FZ_ENABLE_PDF == 0
+#undef FZ_ENABLE_CAJ
+#define FZ_ENABLE_CAJ 0
+#endif
+
 /* If Epub and HTML are both disabled, disable SIL fonts */
 #if FZ_ENABLE_HTML == 0 && FZ_ENABLE_EPUB == 0
 #undef TOFU_SIL
@@ -365,6 +365,23 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/**
+	Set the number of threads the smooth image scaler may use.
+
+	Large scales (such as reducing a high resolution scan to a
+	thumbnail) are then split into bands of destination rows, which
+	are scaled on worker threads at the same time. Smaller ones are
+	still done on the calling thread.
+
+	threads: The number of threads to use, counting the calling
+	one. 0 or 1 (the default) to scale on the calling thread only.
+
+	Worker threads are only available when MuPDF is built with
+	thread support. Callers that already render on several threads
+	will usually want to leave this alone.
+*/
+void fz_tune_image_scale_threads(fz_context *ctx, int threads);
+
 /**
 	Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -96,6 +96,35 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 */
 void fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix ctm, fz_rect scissor, fz_cookie *cookie);
 
+/**
+	Draw a display list onto a pixmap using several threads.
+
+	This does the same as running the list through a draw device
+	made by fz_new_draw_device(ctx, fz_identity, pixmap), but splits
+	the pixmap into bands of rows, and draws those on worker threads
+	at the same time. Each worker has its own clone of ctx, and its
+	own draw device for each band it draws. The result matches a
+	single pass exactly, except with the edgebuffer rasterizers
+	(anti-aliasing set to 9 or 10 bits), where edges that cross the
+	edge of a band may come out very slightly differently.
+
+	Cloning needs ctx to have been made with locking functions (see
+	fz_new_context). Without them, or without thread support in the
+	build, the list is drawn on the calling thread.
+
+	ctm: Transform to apply to display list contents, as for
+	fz_run_display_list.
+
+	pixmap: Target pixmap. As with fz_new_draw_device, it is not
+	cleared first.
+
+	nthreads: The number of threads to draw with, counting the
+	calling one.
+
+	Errors on any thread are thrown once all threads have finished.
+*/
+void fz_render_display_list_parallel(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *pixmap, int nthreads);
+
 /**
 	Increment the reference count for a display list. Returns the
 	same pointer.
@@ -148,6 +148,22 @@ fz_output *fz_new_output_with_path(fz_context *, const char *filename, int appen
 */
 fz_output *fz_new_output_with_buffer(fz_context *ctx, fz_buffer *buf);
 
+/**
+	Open an output stream that hands its data on in fixed-size
+	chunks, so that arbitrarily large output can be consumed with
+	bounded memory.
+
+	chunk_size: The number of bytes passed to each call of emit.
+	Only the final chunk, emitted when the output is closed, may
+	be shorter.
+
+	emit: Called with arg as its state for each chunk. The data is
+	only valid for the duration of the call.
+
+	The output can report its position, but cannot seek.
+*/
+fz_output *fz_new_output_with_chunks(fz_context *ctx, size_t chunk_size, fz_output_write_fn *emit, void *arg);
+
 /**
 	Retrieve an fz_output that directs to stdout.
 
@@ -362,6 +362,16 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase);
 */
 int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 
+/**
+	The number of times the store has had to evict items to make
+	room for an allocation, or been shrunk with fz_shrink_store.
+
+	Caches kept outside the store can watch this to notice that
+	memory is short, and shed what they can at the next point where
+	that is safe for them.
+*/
+int fz_store_scavenge_count(fz_context *ctx);
+
 /**
 	Evict items from the store until the total size of
 	the objects in the store is reduced to a given percentage of its
@@ -55,6 +55,20 @@ typedef struct fz_stream fz_stream;
 */
 fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 
+/**
+	As fz_open_file, but on Linux a regular file is memory mapped
+	and exposed as a single window over its whole contents (see
+	fz_stream_is_memory), so seeking and reading make no system
+	calls. Elsewhere, and for files that cannot be mapped, this is
+	the same as fz_open_file.
+
+	Only use this for files nothing else will change while the
+	stream is open. If another process truncates a mapped file,
+	reading the part that is gone raises SIGBUS rather than
+	throwing; editors saving in place, for instance, do this.
+*/
+fz_stream *fz_open_file_mapped(fz_context *ctx, const char *filename);
+
 #ifdef _WIN32
 /**
 	Open the named file and wrap it in a stream.
@@ -80,6 +94,27 @@ fz_stream *fz_open_file_w(fz_context *ctx, const wchar_t *filename);
 */
 fz_stream *fz_open_memory(fz_context *ctx, const unsigned char *data, size_t len);
 
+/**
+	Whether all of stm's data is held in memory as one window that
+	does not move while the stream is open: streams from
+	fz_open_memory, fz_open_buffer, and memory mapped files.
+
+	Filters reading from such a stream may point into it rather
+	than copy out of it.
+*/
+int fz_stream_is_memory(fz_context *ctx, fz_stream *stm);
+
+/**
+	Whether stm is a memory mapped file (see fz_open_file_mapped),
+	and the file it maps is the one at filename.
+
+	Anything that shortens a mapped file, such as truncating it to
+	write it afresh, makes reading the part that is gone raise
+	SIGBUS rather than return an error. Callers about to write to
+	filename must stop reading stm through the mapping first.
+*/
+int fz_stream_maps_file(fz_context *ctx, fz_stream *stm, const char *filename);
+
 /**
 	Open a buffer as a stream.
 
@@ -29,6 +29,106 @@
 	Read infile, and write selected pages to outfile with the given options.
 */
 int pdf_clean_file(fz_context *ctx, char *infile,int size, char* outline, char **out, char *password, pdf_write_options *opts, int retainlen, char *retainlist[]);
+
+/*
+	As pdf_clean_file, but write to out (which is closed, but not
+	dropped, on success) rather than collecting the output in memory.
+*/
+void pdf_clean_file_to_output(fz_context *ctx, char *infile, int size, char *outline, fz_output *out, char *password, pdf_write_options *opts, int retainlen, char *retainlist[]);
 char* mupdf_clean(char *input,int size,char *outline);
 int mupdf_clean_length(char *input,int size,char *outline);
+
+/*
+	Result of a single clean pass. The data is owned by the result
+	and stays valid until mupdf_clean_result_free is called, so
+	callers can read it in place rather than copying it out.
+
+	The data lives in a buffer allocated by the context that did
+	the clean; the remaining fields are private and only there so
+	that the buffer can be dropped through that same context.
+*/
+typedef struct
+{
+	char *data;
+	int length;
+	fz_context *ctx;
+	int owns_ctx;
+	fz_buffer *buffer;
+} mupdf_clean_result;
+
+/*
+	Clean input once and return a handle to the output, or NULL if
+	out of memory. On failure the handle has a NULL data pointer
+	and zero length.
+*/
+mupdf_clean_result* mupdf_clean_run(char *input,int size,char *outline);
+char* mupdf_clean_result_data(mupdf_clean_result *result);
+int mupdf_clean_result_length(mupdf_clean_result *result);
+void mupdf_clean_result_free(mupdf_clean_result *result);
+
+/*
+	Receives one chunk of cleaned output. The data is only valid
+	for the duration of the call.
+*/
+typedef void (mupdf_clean_chunk_fn)(const char *data, int length);
+
+/*
+	Clean input, passing the output to fn in chunks of chunk_size
+	bytes (1MB if zero or negative) as it is written; only the last
+	chunk may be shorter. Memory use does not grow with the size of
+	the output. Returns the total length, or -1 on failure, in which
+	case the chunks already delivered should be discarded.
+*/
+int mupdf_clean_stream(char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn);
+
+/*
+	A long-lived conversion context. Reusing one session for a batch
+	of documents keeps the store and the font, colorspace, CMap and
+	glyph caches warm between them, rather than starting cold each
+	time.
+
+	mupdf_clean_session_new: store_mb bounds the resource store, in
+	megabytes (0 for the default of 256). Returns NULL on failure.
+
+	mupdf_clean_session_clone: Create a session for use on another
+	thread that shares the caches of the given one. Each session
+	must only be used by one thread at a time, and clones must be
+	freed before the session they were cloned from. Returns NULL
+	in builds without threads, where sessions have no locks.
+
+	mupdf_clean_session_set_compact: If compact is set, later cleans
+	in this session remove duplicate and unused objects and write
+	the rest into object streams. The files are smaller, but differ
+	from the default output. Off by default; clones start with the
+	setting of the session they were cloned from.
+*/
+typedef struct mupdf_clean_session mupdf_clean_session;
+
+mupdf_clean_session* mupdf_clean_session_new(int store_mb);
+mupdf_clean_session* mupdf_clean_session_clone(mupdf_clean_session *session);
+void mupdf_clean_session_free(mupdf_clean_session *session);
+void mupdf_clean_session_set_compact(mupdf_clean_session *session,int compact);
+
+/*
+	As mupdf_clean_run and mupdf_clean_stream, but using the
+	session's context. Results hold on to the session's context,
+	so they must be freed before the session is.
+*/
+mupdf_clean_result* mupdf_clean_session_run(mupdf_clean_session *session,char *input,int size,char *outline);
+int mupdf_clean_session_stream(mupdf_clean_session *session,char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn);
+
+/*
+	Memory for input that the caller fills in place, for instance
+	from JavaScript through the wasm heap, rather than having it
+	copied in on the stack. Free it with mupdf_clean_free once the
+	clean has returned.
+*/
+char* mupdf_clean_alloc(int size);
+void mupdf_clean_free(char *data);
+
+/*
+	As mupdf_clean_session_stream, but input holds size characters
+	of base64. The decoded file overwrites the start of input.
+*/
+int mupdf_clean_session_stream_base64(mupdf_clean_session *session,char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn);
 #endif
\ No newline at end of file
@@ -179,6 +179,35 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	Open a PDF document, with accelerator data.
+
+	A file with a broken xref has to be repaired by scanning every
+	byte of it. Once repaired, fz_save_accelerator records the
+	rebuilt xref; passing that data back here skips the scan as
+	long as the file itself is unchanged. Accelerator data that is
+	missing, stale or broken is ignored.
+
+	Only the file's length, modification time and the bytes outside
+	its stream data are checked. A file opened from a stream has no
+	modification time, so an edit that writes "endstream" inside the
+	data of a stream, without changing the length of the file, is
+	not noticed.
+*/
+pdf_document *pdf_open_accelerated_document(fz_context *ctx, const char *filename, const char *accel);
+pdf_document *pdf_open_accelerated_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel);
+
+/*
+	Opens the PDF document embedded in a CAJ container.
+
+	The PDF body is read in place from the container stream, its
+	page tree and catalog are reconstructed where missing, and the
+	table of contents from the CAJ header is added as the document
+	outline. Increments the reference count of the stream.
+*/
+pdf_document *pdf_open_caj_document_with_stream(fz_context *ctx, fz_stream *file);
+pdf_document *pdf_open_caj_accelerated_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel);
+
 /*
 	Closes and frees an opened PDF document.
 
@@ -189,6 +218,59 @@ void pdf_drop_document(fz_context *ctx, pdf_document *doc);
 
 pdf_document *pdf_keep_document(fz_context *ctx, pdf_document *doc);
 
+/*
+	Load objects from the file into an arena owned by the document
+	from now on, rather than allocating each one separately. This
+	makes parsing cheaper and keeps the heap from fragmenting.
+
+	Arena objects, numbers and strings included, are only freed
+	with the document, so none may be kept beyond
+	pdf_drop_document; use pdf_graft_object to move objects to another
+	document. Arrays and dicts that are grown by later edits move
+	their items out onto the heap.
+
+	Nothing in the arena is reclaimed before then, even for objects
+	that are replaced or parsed again after a repair, so it is meant
+	for documents that are read through once. The arena stops growing
+	at PDF_OBJECT_ARENA_MAX bytes, after which objects are allocated
+	one by one again.
+*/
+void pdf_enable_object_arena(fz_context *ctx, pdf_document *doc);
+
+#define PDF_OBJECT_ARENA_MAX ((size_t)256 << 20)
+
+/*
+	Set how many arrays and dicts parsed from the file the document
+	keeps cached, or 0 to keep everything it ever loads. The default
+	is PDF_OBJECT_CACHE_DEFAULT, which keeps everything; a limit of
+	PDF_OBJECT_CACHE_SUGGESTED suits callers that make one pass over
+	a long document and can live with the rules below.
+
+	Above the limit, objects that nothing else holds a reference to
+	and that have not been looked up since the page before last are
+	dropped when the next page is loaded, least recently used first,
+	to be parsed again if needed. When the store has had to scavenge
+	for memory, every such object is dropped regardless of the limit.
+	Objects that are held or have been edited are never dropped.
+
+	Setting a limit changes the rules for borrowed pointers. The
+	objects returned by pdf_dict_get, pdf_array_get,
+	pdf_resolve_indirect and the like carry no reference of their
+	own, and normally live as long as the document. With a limit
+	they are freed once two further pages have been loaded, leaving
+	the caller with a dangling pointer. Take a reference with
+	pdf_keep_obj, or use pdf_load_object, for anything that must
+	outlive the next pdf_load_page; only set a limit when every
+	caller sharing the document does so.
+
+	Nothing is dropped from documents with an object arena, and
+	nothing after a document has been saved other than incrementally.
+*/
+void pdf_set_object_cache_size(fz_context *ctx, pdf_document *doc, int max);
+
+#define PDF_OBJECT_CACHE_DEFAULT 0
+#define PDF_OBJECT_CACHE_SUGGESTED 16384
+
 /*
 	down-cast a fz_document to a pdf_document.
 	Returns NULL if underlying document is not PDF
@@ -224,6 +306,36 @@ fz_outline *pdf_load_outline(fz_context *ctx, pdf_document *doc);
 
 fz_outline_iterator *pdf_new_outline_iterator(fz_context *ctx, pdf_document *doc);
 
+/*
+	One item of a flattened outline, in document order.
+
+	level: Nesting depth. An entry becomes a child of the nearest
+	preceding entry with a smaller level.
+
+	page: Zero based page number of the destination, or -1 for none.
+
+	title: UTF-8 title text.
+
+	is_open: Non-zero if the item's children are shown when the
+	outline is first displayed.
+*/
+typedef struct
+{
+	int level;
+	int page;
+	const char *title;
+	int is_open;
+} pdf_outline_entry;
+
+/*
+	Replace the document outline with the n given entries.
+
+	The whole tree is built in one pass, resolving all the page
+	destinations up front, so this takes linear time in the number
+	of entries (unlike repeated outline iterator inserts).
+*/
+void pdf_set_outline_tree(fz_context *ctx, pdf_document *doc, int n, const pdf_outline_entry *entries);
+
 void pdf_invalidate_xfa(fz_context *ctx, pdf_document *doc);
 
 /*
@@ -432,8 +544,21 @@ struct pdf_document
 	pdf_obj **fwd_page_map;
 	int page_tree_broken;
 
+	/* Where the last lazy page lookup ended: kid number 'kid' of
+	 * page tree node 'node', which holds 'count' pages starting at
+	 * page 'base'. The kid is page 'page'. */
+	pdf_obj *page_tree_hint;
+	int page_tree_hint_base;
+	int page_tree_hint_count;
+	int page_tree_hint_kid;
+	int page_tree_hint_page;
+
 	int repair_attempted;
 	int repair_in_progress;
+	/* Modification time of the file when it was opened by name, or 0
+	 * when opened from a stream. Saved repair data is only used for
+	 * the same stamp. */
+	int64_t file_stamp;
 	int non_structural_change; /* True if we are modifying the document in a way that does not change the (page) structure */
 
 	/* State indicating which file parsing method we are using */
@@ -502,6 +627,20 @@ struct pdf_document
 	fz_xml_doc *xfa;
 
 	pdf_journal *journal;
+
+	fz_pool *obj_arena;
+	int obj_arena_loading; /* Allocate from obj_arena while non-zero. */
+
+	/* Parsed objects in the xref; see pdf_trim_object_cache. */
+	int obj_cache_max;
+	int obj_cache_count; /* roughly how many are cached */
+	int obj_cache_epoch; /* bumped with every page load */
+	int obj_cache_scavenges; /* fz_store_scavenge_count at the last trim */
+
+	/* Non-standard names seen by the parser, shared between uses. */
+	int names_count;
+	int names_cap;
+	pdf_obj **names;
 };
 
 pdf_document *pdf_create_document(fz_context *ctx);
@@ -715,6 +854,10 @@ typedef struct
 	char upwd_utf8[128]; /* User password. */
 	int do_snapshot; /* Do not use directly. Use the snapshot functions. */
 	int do_preserve_metadata; /* When cleaning, preserve metadata unchanged. */
+	int do_objstms; /* Pack non-stream objects into compressed object streams, with an xref stream. */
+	int compress_threads; /* Number of threads to deflate streams with; 0 or 1 to compress serially. */
+	int compression_effort; /* 0 for zlib's default, otherwise 1 (fastest) to 100 (smallest). */
+	int do_skip_incompressible; /* When compressing, store noise-like data and keep JPEG and JBIG2 images encoded. */
 } pdf_write_options;
 
 FZ_DATA extern const pdf_write_options pdf_default_write_options;
@@ -46,6 +46,29 @@ pdf_obj *pdf_new_real(fz_context *ctx, float f);
 pdf_obj *pdf_new_name(fz_context *ctx, const char *str);
 pdf_obj *pdf_new_string(fz_context *ctx, const char *str, size_t len);
 
+/*
+	Constructors used by the parser. While doc is loading objects
+	from its file into its object arena (see pdf_enable_object_arena)
+	these allocate from the arena; otherwise they are the same as the
+	plain constructors. Arrays, dicts and indirect references take the
+	document already, and follow the same rule.
+
+	pdf_new_parsed_name interns names that are not in the standard
+	name table in doc, so every /F1 or /R12 parsed from the same
+	document is the same object.
+
+	pdf_obj_in_arena: Whether obj lives in an object arena, and so
+	must not outlive the document it was loaded from. Such objects
+	that can be keys in the store (arrays, dicts and indirect
+	references) are always bound to that document, so emptying its
+	store removes them; names are never allocated in an arena.
+*/
+pdf_obj *pdf_new_parsed_int(fz_context *ctx, pdf_document *doc, int64_t i);
+pdf_obj *pdf_new_parsed_real(fz_context *ctx, pdf_document *doc, float f);
+pdf_obj *pdf_new_parsed_name(fz_context *ctx, pdf_document *doc, const char *str);
+pdf_obj *pdf_new_parsed_string(fz_context *ctx, pdf_document *doc, const char *str, size_t len);
+int pdf_obj_in_arena(fz_context *ctx, pdf_obj *obj);
+
 /*
 	Create a PDF 'text string' by encoding input string as either ASCII or UTF-16BE.
 	In theory, we could also use PDFDocEncoding.
@@ -92,6 +115,13 @@ int pdf_objcmp_resolve(fz_context *ctx, pdf_obj *a, pdf_obj *b);
  */
 int pdf_objcmp_deep(fz_context *ctx, pdf_obj *a, pdf_obj *b);
 
+/* Hash an object structurally. Objects that match according to
+ * pdf_objcmp (resp. pdf_objcmp_deep) have identical hashes.
+ * The deep variant also hashes the raw contents of streams.
+ */
+uint32_t pdf_objhash(fz_context *ctx, pdf_obj *obj);
+uint32_t pdf_objhash_deep(fz_context *ctx, pdf_obj *obj);
+
 int pdf_name_eq(fz_context *ctx, pdf_obj *a, pdf_obj *b);
 
 int pdf_obj_marked(fz_context *ctx, pdf_obj *obj);
@@ -232,6 +262,14 @@ int pdf_obj_refs(fz_context *ctx, pdf_obj *ref);
 
 int pdf_obj_parent_num(fz_context *ctx, pdf_obj *obj);
 
+/*
+	The object cache epoch in which an array or dict loaded from the
+	file was last looked up (see pdf_trim_object_cache). Returns -1
+	for other kinds of object, which are never evicted.
+*/
+void pdf_set_obj_last_used(fz_context *ctx, pdf_obj *obj, int epoch);
+int pdf_obj_last_used(fz_context *ctx, pdf_obj *obj);
+
 char *pdf_sprint_obj(fz_context *ctx, char *buf, size_t cap, size_t *len, pdf_obj *obj, int tight, int ascii);
 void pdf_print_obj(fz_context *ctx, fz_output *out, pdf_obj *obj, int tight, int ascii);
 void pdf_print_encrypted_obj(fz_context *ctx, fz_output *out, pdf_obj *obj, int tight, int ascii, pdf_crypt *crypt, int num, int gen);
@@ -305,6 +343,14 @@ pdf_document *pdf_get_bound_document(fz_context *ctx, pdf_obj *obj);
 */
 pdf_document *pdf_pin_document(fz_context *ctx, pdf_obj *obj);
 
+/*
+	Small integers are encoded in the pdf_obj pointer itself rather
+	than allocated, so the same value may be shared by any number of
+	objects. pdf_set_int can only change an integer created by
+	pdf_new_boxed_int, which is always allocated on its own; use that
+	for placeholders that are filled in later.
+*/
+pdf_obj *pdf_new_boxed_int(fz_context *ctx, int64_t i);
 void pdf_set_int(fz_context *ctx, pdf_obj *obj, int64_t i);
 
 /* Voodoo to create PDF_NAME(Foo) macros from name-table.h */
@@ -191,6 +191,24 @@ void pdf_repair_xref(fz_context *ctx, pdf_document *doc);
 void pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc);
 void pdf_repair_trailer(fz_context *ctx, pdf_document *doc);
 
+/*
+	Save the xref table and trailer rebuilt by a repair, together
+	with the file length, its modification time when it was opened
+	by name, and a digest of every byte the repair lexed (all but
+	the stream data), so that a later open of the same file can
+	skip the repair scan. Edits made after the repair are not
+	included. Throws if the document was not repaired.
+*/
+void pdf_write_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_output *out);
+
+/*
+	Populate the xref of a freshly created document from data
+	written by pdf_write_repair_accelerator. Returns 0, leaving the
+	document untouched, if the data is for another file (or another
+	version of this one); throws if the data is corrupt.
+*/
+int pdf_load_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel);
+
 /*
 	Ensure that the current populating xref has a single subsection
 	that covers the entire range.
@@ -200,6 +218,14 @@ void pdf_mark_xref(fz_context *ctx, pdf_document *doc);
 void pdf_clear_xref(fz_context *ctx, pdf_document *doc);
 void pdf_clear_xref_to_mark(fz_context *ctx, pdf_document *doc);
 
+/*
+	Start a new object cache epoch, and if the document holds more
+	parsed objects than its budget (see pdf_set_object_cache_size),
+	drop the least recently used ones that can be loaded again from
+	the file. Called as each page is loaded.
+*/
+void pdf_trim_object_cache(fz_context *ctx, pdf_document *doc);
+
 int pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root);
 
 pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum);
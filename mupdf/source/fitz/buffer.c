@@ -22,6 +22,8 @@
 
 #include "mupdf/fitz.h"
 
+#include "simd-imp.h"
+
 #include <string.h>
 #include <stdarg.h>
 
@@ -113,12 +115,60 @@ static inline int iswhite(int a)
 	return 0;
 }
 
-fz_buffer *
-fz_new_buffer_from_base64(fz_context *ctx, const char *data, size_t size)
+#ifdef FZ_SIMD
+/*
+	Decode 16 base64 characters into 12 bytes. Returns 0, having
+	written nothing, if any of them is padding, white space or not
+	in the alphabet; the scalar loop deals with those.
+*/
+static int
+decode_base64_block(unsigned char *d, const char *s)
+{
+	fz_u8x16 c = fz_u8x16_load((const unsigned char *)s);
+	fz_u8x16 upper = fz_u8x16_and(fz_u8x16_le(fz_u8x16_splat('A'), c), fz_u8x16_le(c, fz_u8x16_splat('Z')));
+	fz_u8x16 lower = fz_u8x16_and(fz_u8x16_le(fz_u8x16_splat('a'), c), fz_u8x16_le(c, fz_u8x16_splat('z')));
+	fz_u8x16 digit = fz_u8x16_and(fz_u8x16_le(fz_u8x16_splat('0'), c), fz_u8x16_le(c, fz_u8x16_splat('9')));
+	fz_u8x16 plus = fz_u8x16_eq(c, fz_u8x16_splat('+'));
+	fz_u8x16 slash = fz_u8x16_eq(c, fz_u8x16_splat('/'));
+	fz_u8x16 v, w;
+	unsigned char lanes[16];
+	int i;
+
+	if (!fz_u8x16_all(fz_u8x16_or(fz_u8x16_or(fz_u8x16_or(upper, lower), digit), fz_u8x16_or(plus, slash))))
+		return 0;
+
+	/* Bytes wrap, so subtracting 'a'-26 is adding 256-71. */
+	v = fz_u8x16_sub(c, fz_u8x16_splat('A'));
+	v = fz_u8x16_select(lower, fz_u8x16_sub(c, fz_u8x16_splat('a' - 26)), v);
+	v = fz_u8x16_select(digit, fz_u8x16_add(c, fz_u8x16_splat(52 - '0')), v);
+	v = fz_u8x16_select(plus, fz_u8x16_splat(62), v);
+	v = fz_u8x16_select(slash, fz_u8x16_splat(63), v);
+
+	/* Each 32-bit lane holds four sextets, first in the low byte.
+	 * Gather them into the low 24 bits, first sextet highest. */
+	w = fz_u8x16_shl32(fz_u8x16_and(v, fz_u8x16_splat32(0x3f)), 18);
+	w = fz_u8x16_or(w, fz_u8x16_shl32(fz_u8x16_and(v, fz_u8x16_splat32(0x3f00)), 4));
+	w = fz_u8x16_or(w, fz_u8x16_shr32(fz_u8x16_and(v, fz_u8x16_splat32(0x3f0000)), 10));
+	w = fz_u8x16_or(w, fz_u8x16_shr32(v, 24));
+	fz_u8x16_store(lanes, w);
+
+	for (i = 0; i < 4; i++)
+	{
+		d[0] = lanes[4*i+2];
+		d[1] = lanes[4*i+1];
+		d[2] = lanes[4*i+0];
+		d += 3;
+	}
+	return 1;
+}
+#endif
+
+size_t
+fz_decode_base64(fz_context *ctx, unsigned char *out, const char *data, size_t size)
 {
-	fz_buffer *out = fz_new_buffer(ctx, size > 0 ? size : strlen(data));
-	const char *end = data + (size > 0 ? size : strlen(data));
+	const char *end = data + size;
 	const char *s = data;
+	unsigned char *d = out;
 	uint32_t buf = 0;
 	int bits = 0;
 
@@ -135,58 +185,81 @@ fz_new_buffer_from_base64(fz_context *ctx, const char *data, size_t size)
 	while (s < end && end[-1] == '=')
 		end--;
 
-	fz_try(ctx)
+	while (s < end)
 	{
-		while (s < end)
-		{
-			int c = *s++;
-
-			if (c >= 'A' && c <= 'Z')
-				c = c - 'A';
-			else if (c >= 'a' && c <= 'z')
-				c = c - 'a' + 26;
-			else if (c >= '0' && c <= '9')
-				c = c - '0' + 52;
-			else if (c == '+')
-				c = 62;
-			else if (c == '/')
-				c = 63;
-			else if (iswhite(c))
-				continue;
-			else
-			{
-				fz_warn(ctx, "invalid character in base64");
-				break;
-			}
-
-			buf <<= 6;
-			buf |= c & 0x3f;
-			bits += 6;
+		int c;
 
-			if (bits == 24)
+#ifdef FZ_SIMD
+		/* Take whole blocks while we are between groups. Each is
+		 * read in full before any of it is written, so decoding
+		 * in place is safe. */
+		if (bits == 0)
+		{
+			while (end - s >= 16 && decode_base64_block(d, s))
 			{
-				fz_append_byte(ctx, out, buf >> 16);
-				fz_append_byte(ctx, out, buf >> 8);
-				fz_append_byte(ctx, out, buf >> 0);
-				bits = 0;
+				s += 16;
+				d += 12;
 			}
+			if (s == end)
+				break;
 		}
+#endif
 
-		if (bits == 18)
+		c = *s++;
+
+		if (c >= 'A' && c <= 'Z')
+			c = c - 'A';
+		else if (c >= 'a' && c <= 'z')
+			c = c - 'a' + 26;
+		else if (c >= '0' && c <= '9')
+			c = c - '0' + 52;
+		else if (c == '+')
+			c = 62;
+		else if (c == '/')
+			c = 63;
+		else if (iswhite(c))
+			continue;
+		else
 		{
-			fz_append_byte(ctx, out, buf >> 10);
-			fz_append_byte(ctx, out, buf >> 2);
+			fz_warn(ctx, "invalid character in base64");
+			break;
 		}
-		else if (bits == 12)
+
+		buf <<= 6;
+		buf |= c & 0x3f;
+		bits += 6;
+
+		if (bits == 24)
 		{
-			fz_append_byte(ctx, out, buf >> 4);
+			*d++ = buf >> 16;
+			*d++ = buf >> 8;
+			*d++ = buf >> 0;
+			bits = 0;
 		}
 	}
-	fz_catch(ctx)
+
+	if (bits == 18)
 	{
-		fz_drop_buffer(ctx, out);
-		fz_rethrow(ctx);
+		*d++ = buf >> 10;
+		*d++ = buf >> 2;
+	}
+	else if (bits == 12)
+	{
+		*d++ = buf >> 4;
 	}
+
+	return d - out;
+}
+
+fz_buffer *
+fz_new_buffer_from_base64(fz_context *ctx, const char *data, size_t size)
+{
+	fz_buffer *out;
+
+	if (size == 0)
+		size = strlen(data);
+	out = fz_new_buffer(ctx, size / 4 * 3 + 3);
+	out->len = fz_decode_base64(ctx, out->data, data, size);
 	return out;
 }
 
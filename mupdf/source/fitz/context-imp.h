@@ -55,6 +55,7 @@ struct fz_tuning_context
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	int image_scale_threads;
 };
 
 void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *subarea);
@@ -62,6 +63,12 @@ int fz_default_image_scale(void *arg, int dst_w, int dst_h, int src_w, int src_h
 
 void fz_init_aa_context(fz_context *ctx);
 
+/*
+	Choose the vector span painters for this machine. They are shared
+	by all contexts; only the first call does anything.
+*/
+void fz_init_paint_simd(void);
+
 void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
@@ -126,6 +126,11 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_image_scale_threads(fz_context *ctx, int threads)
+{
+	ctx->tuning->image_scale_threads = threads > 1 ? threads : 1;
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
@@ -212,6 +217,7 @@ fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks,
 
 	fz_init_error_context(ctx);
 	fz_init_aa_context(ctx);
+	fz_init_paint_simd();
 	fz_init_random_context(ctx);
 
 	/* Now initialise sections that are shared */
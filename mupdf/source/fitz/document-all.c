@@ -23,6 +23,7 @@
 #include "mupdf/fitz.h"
 
 extern fz_document_handler pdf_document_handler;
+extern fz_document_handler caj_document_handler;
 extern fz_document_handler xps_document_handler;
 extern fz_document_handler svg_document_handler;
 extern fz_document_handler cbz_document_handler;
@@ -38,6 +39,9 @@ void fz_register_document_handlers(fz_context *ctx)
 #if FZ_ENABLE_PDF
 	fz_register_document_handler(ctx, &pdf_document_handler);
 #endif /* FZ_ENABLE_PDF */
+#if FZ_ENABLE_CAJ
+	fz_register_document_handler(ctx, &caj_document_handler);
+#endif /* FZ_ENABLE_CAJ */
 #if FZ_ENABLE_XPS
 	fz_register_document_handler(ctx, &xps_document_handler);
 #endif /* FZ_ENABLE_XPS */
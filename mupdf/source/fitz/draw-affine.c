@@ -3896,6 +3896,22 @@ fz_gridfit_matrix(int as_tiled, fz_matrix m)
 	return m;
 }
 
+/*
+	Paint a row with a vector painter, which does what it can of the
+	middle, and the C painter, which does the ends.
+*/
+static void
+paint_affine_simd(fz_affine_painter_t *simdfn, paintfn_t *paintfn, byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int dn, int sn, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	int x0, x1;
+
+	simdfn(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, &x0, &x1);
+	if (x0 > 0)
+		paintfn(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, x0, dn, sn, alpha, NULL, NULL, NULL, eop);
+	if (x1 < w)
+		paintfn(dp + x1 * (dn + da), da, sp, sw, sh, ss, sa, u + x1 * fa, v + x1 * fb, fa, fb, w - x1, dn, sn, alpha, NULL, NULL, NULL, eop);
+}
+
 /* Draw an image with an affine transform on destination */
 
 static void
@@ -3913,13 +3929,15 @@ fz_paint_image_imp(fz_context *ctx,
 {
 	byte *dp, *sp, *hp, *gp;
 	affint u, v, fa, fb, fc, fd;
-	int x, y, w, h;
+	int x, y, w, h, ox, oy;
 	affint sw, sh, sa, sn, hs, da, dn, gs;
 	ptrdiff_t ss;
 	fz_irect bbox;
 	int dolerp;
 	paintfn_t *paintfn;
+	fz_affine_painter_t *simdfn = NULL;
 	int is_rectilinear;
+	int g2rgb = 0;
 
 	if (alpha == 0)
 		return;
@@ -3944,6 +3962,8 @@ fz_paint_image_imp(fz_context *ctx,
 	}
 
 	bbox = fz_irect_from_rect(fz_transform_rect(fz_unit_rect, ctm));
+	ox = bbox.x0;
+	oy = bbox.y0;
 	bbox = fz_intersect_irect(bbox, *scissor);
 
 	x = bbox.x0;
@@ -3987,8 +4007,13 @@ fz_paint_image_imp(fz_context *ctx,
 	/* Calculate initial texture positions. Do a half step to start. */
 	/* Bug 693021: Keep calculation in float for as long as possible to
 	 * avoid overflow. */
-	u = (int)((ctm.a * x) + (ctm.c * y) + ctm.e + ((ctm.a + ctm.c) * .5f));
-	v = (int)((ctm.b * x) + (ctm.d * y) + ctm.f + ((ctm.b + ctm.d) * .5f));
+	/* Start from the corner of the whole image and step on to (x,y) in
+	 * fixed point, the same as the loops below step, so the samples
+	 * picked don't depend on how the scissor cuts the image. */
+	u = (int)((ctm.a * ox) + (ctm.c * oy) + ctm.e + ((ctm.a + ctm.c) * .5f));
+	v = (int)((ctm.b * ox) + (ctm.d * oy) + ctm.f + ((ctm.b + ctm.d) * .5f));
+	u += (x - ox) * fa + (y - oy) * fc;
+	v += (x - ox) * fb + (y - oy) * fd;
 
 	dp = dst->samples + (y - dst->y) * (size_t)dst->stride + (x - dst->x) * (size_t)dst->n;
 	da = dst->alpha;
@@ -4041,6 +4066,7 @@ fz_paint_image_imp(fz_context *ctx,
 #if FZ_PLOTTERS_RGB
 	if (dn == 3 && img->n == 1 + sa && !color && !fz_overprint_required(eop))
 	{
+		g2rgb = 1;
 		if (dolerp)
 			paintfn = fz_paint_affine_g2rgb_lerp(da, sa, fa, fb, dn, alpha);
 		else
@@ -4090,6 +4116,9 @@ fz_paint_image_imp(fz_context *ctx,
 	if (paintfn == NULL)
 		return;
 
+	if (!color && !shape && !group_alpha && !fz_overprint_required(eop) && (sn == dn || g2rgb))
+		simdfn = fz_get_affine_painter_simd(da, sa, dn, sn, dolerp, fa, fb);
+
 	if (dolerp)
 	{
 		u -= HALF;
@@ -4100,7 +4129,10 @@ fz_paint_image_imp(fz_context *ctx,
 
 	while (h--)
 	{
-		paintfn(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, color, hp, gp, eop);
+		if (simdfn)
+			paint_affine_simd(simdfn, paintfn, dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, eop);
+		else
+			paintfn(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, color, hp, gp, eop);
 		dp += dst->stride;
 		hp += hs;
 		gp += gs;
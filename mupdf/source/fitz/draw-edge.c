@@ -83,8 +83,6 @@ fz_drop_gel(fz_context *ctx, fz_rasterizer *rast)
 
 enum { INSIDE, OUTSIDE, LEAVE, ENTER };
 
-#define clip_lerp_y(v,m,x0,y0,x1,y1,t) clip_lerp_x(v,m,y0,x0,y1,x1,t)
-
 static int
 clip_lerp_x(int val, int m, int x0, int y0, int x1, int y1, int *out)
 {
@@ -110,6 +108,13 @@ clip_lerp_x(int val, int m, int x0, int y0, int x1, int y1, int *out)
 	}
 }
 
+/*
+	Insert an edge, cut down to the rows of the clip. The edge is not
+	moved to where it crosses the clip, as that would step it along a
+	slightly different line; it is set up whole and then stepped on to
+	the first row inside. So an edge lights the same pixels whatever
+	the clip, and a page drawn in bands matches one drawn whole.
+*/
 static void
 fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, int y1)
 {
@@ -119,6 +124,7 @@ fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, i
 	int winding;
 	int width;
 	int tmp;
+	int top, bot;
 
 	if (y0 == y1)
 		return;
@@ -131,13 +137,18 @@ fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, i
 	else
 		winding = 1;
 
+	top = fz_maxi(y0, ras->clip.y0);
+	bot = fz_mini(y1, ras->clip.y1);
+	if (top >= bot)
+		return;
+
 	if (x0 < gel->super.bbox.x0) gel->super.bbox.x0 = x0;
 	if (x0 > gel->super.bbox.x1) gel->super.bbox.x1 = x0;
 	if (x1 < gel->super.bbox.x0) gel->super.bbox.x0 = x1;
 	if (x1 > gel->super.bbox.x1) gel->super.bbox.x1 = x1;
 
-	if (y0 < gel->super.bbox.y0) gel->super.bbox.y0 = y0;
-	if (y1 > gel->super.bbox.y1) gel->super.bbox.y1 = y1;
+	if (top < gel->super.bbox.y0) gel->super.bbox.y0 = top;
+	if (bot > gel->super.bbox.y1) gel->super.bbox.y1 = bot;
 
 	if (gel->len + 1 == gel->cap) {
 		int new_cap = gel->cap * 2;
@@ -175,6 +186,20 @@ fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, i
 		edge->xmove = (width / dy) * edge->xdir;
 		edge->adj_up = width % dy;
 	}
+
+	/* Take the n steps advance_active would take to reach the top of
+	 * the clip all at once. Each step adds adj_up to the error term and
+	 * takes off adj_down whenever it goes positive, which keeps it in
+	 * (-adj_down, 0]. */
+	if (top > y0) {
+		int n = top - y0;
+		int64_t s = edge->e + (int64_t)n * edge->adj_up;
+		int64_t k = s > 0 ? (s + edge->adj_down - 1) / edge->adj_down : 0;
+		edge->x += n * edge->xmove + (int)k * edge->xdir;
+		edge->e = (int)(s - k * edge->adj_down);
+		edge->y = top;
+	}
+	edge->h = bot - edge->y;
 }
 
 static void
@@ -199,15 +224,10 @@ fz_insert_gel(fz_context *ctx, fz_rasterizer *ras, float fx0, float fy0, float f
 	x1 = (int)fz_clamp(fx1, BBOX_MIN * hscale, BBOX_MAX * hscale);
 	y1 = (int)fz_clamp(fy1, BBOX_MIN * vscale, BBOX_MAX * vscale);
 
-	d = clip_lerp_y(ras->clip.y0, 0, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return;
-	if (d == LEAVE) { y1 = ras->clip.y0; x1 = v; }
-	if (d == ENTER) { y0 = ras->clip.y0; x0 = v; }
-
-	d = clip_lerp_y(ras->clip.y1, 1, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return;
-	if (d == LEAVE) { y1 = ras->clip.y1; x1 = v; }
-	if (d == ENTER) { y0 = ras->clip.y1; x0 = v; }
+	/* Edges wholly above or below the clip are dropped here; the rest
+	 * are cut to the clip rows by fz_insert_gel_raw. */
+	if ((y0 < ras->clip.y0 && y1 < ras->clip.y0) || (y0 > ras->clip.y1 && y1 > ras->clip.y1))
+		return;
 
 	d = clip_lerp_x(ras->clip.x0, 0, x0, y0, x1, y1, &v);
 	if (d == OUTSIDE) {
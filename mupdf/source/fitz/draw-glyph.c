@@ -21,9 +21,11 @@
 // CA 94945, U.S.A., +1(415)492-9861, for further information.
 
 #include "mupdf/fitz.h"
+#include "context-imp.h"
 #include "draw-imp.h"
 #include "glyph-imp.h"
 #include "pixmap-imp.h"
+#include "thread-imp.h"
 
 #include <string.h>
 #include <math.h>
@@ -31,7 +33,36 @@
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
-#define GLYPH_HASH_LEN 509
+/*
+	The cache is split into shards by the hash of the key, each with
+	its own hash table, LRU list and lock, so that threads rendering
+	text at once seldom wait for each other. The size limit is for the
+	whole cache, so a shard that gets more than its share of the
+	glyphs in use can have more of the room (see evict_shard).
+
+	The shard locks are fz_mutexes of our own, not the app's locks.
+	That is safe with whatever locks the app supplies because:
+
+	- Nothing outside this file can reach a shard, so the app's locks
+	  never needed to cover them; FZ_LOCK_GLYPHCACHE still guards the
+	  reference count and the cache's total size.
+	- At most one shard lock is held at a time, and no code takes one
+	  while it holds any FZ_LOCK_*. Inside a shard lock we only take
+	  FZ_LOCK_ALLOC and FZ_LOCK_FREETYPE (to allocate, and to drop
+	  glyphs and fonts), and FZ_LOCK_GLYPHCACHE around the total, so
+	  locks are always taken shard first and can't deadlock with the
+	  app's.
+	- Glyphs are rendered with no shard lock held, so a Type 3 glyph
+	  that draws text can come back into the cache.
+
+	A context is only ever shared with clones of itself running on
+	other threads, which need locks that work between real threads
+	anyway. When we can't have mutexes (a build without threads), or
+	the context has no locking and so can't be cloned, there is a
+	single shard behind FZ_LOCK_GLYPHCACHE instead.
+*/
+#define GLYPH_SHARDS 8
+#define GLYPH_HASH_LEN 127
 
 typedef struct
 {
@@ -54,17 +85,25 @@ typedef struct fz_glyph_cache_entry
 	fz_glyph *val;
 } fz_glyph_cache_entry;
 
-struct fz_glyph_cache
+typedef struct
 {
-	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
+	size_t hits, misses;
+	size_t num_evictions, evicted;
 	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	fz_mutex *mutex;
+} fz_glyph_cache_shard;
+
+struct fz_glyph_cache
+{
+	int refs;
+	int sharded;
+	int nshards;
+	size_t total;
+	size_t max;
+	fz_glyph_cache_shard shard[GLYPH_SHARDS];
 };
 
 static size_t
@@ -79,78 +118,193 @@ void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
 
+	/* Without locks, this context can never be cloned, so only one
+	 * thread will ever use the cache. */
+	if (ctx->locks.lock != fz_locks_default.lock)
+	{
+		cache->sharded = 1;
+		for (i = 0; i < GLYPH_SHARDS; i++)
+		{
+			cache->shard[i].mutex = fz_new_mutex();
+			if (!cache->shard[i].mutex)
+			{
+				while (i-- > 0)
+					fz_drop_mutex(cache->shard[i].mutex);
+				cache->sharded = 0;
+				break;
+			}
+		}
+	}
+	cache->nshards = cache->sharded ? GLYPH_SHARDS : 1;
+	cache->max = MAX_CACHE_SIZE;
+
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+lock_shard(fz_context *ctx, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
+	if (ctx->glyph_cache->sharded)
+		fz_lock_mutex(shard->mutex);
+	else
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+static void
+unlock_shard(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	if (ctx->glyph_cache->sharded)
+		fz_unlock_mutex(shard->mutex);
+	else
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+/*
+	Add to and take from the size of the whole cache, and return the
+	new size. With one shard its lock covers this already; otherwise
+	FZ_LOCK_GLYPHCACHE is held just for the sum.
+*/
+static size_t
+change_total(fz_context *ctx, fz_glyph_cache *cache, size_t add, size_t sub)
+{
+	size_t total;
+
+	if (cache->sharded)
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->total = cache->total + add - sub;
+	total = cache->total;
+	if (cache->sharded)
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	return total;
+}
+
+static void
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
+{
+	size_t size = fz_glyph_size(ctx, entry->val);
 
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= size;
+	change_total(ctx, cache, 0, size);
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard's lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+do_purge(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
 	for (i = 0; i < GLYPH_HASH_LEN; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		while (shard->entry[i])
+			drop_glyph_cache_entry(ctx, cache, shard, shard->entry[i]);
 	}
+}
+
+/*
+	Evict from the tail of a shard, whose lock is held, while the whole
+	cache is over its limit and this shard has more than its share of
+	it. Any shard over its share will do, as the cache can only be over
+	the limit if some shard is. 'keep' is never evicted. Returns
+	non-zero if the cache is still over the limit.
+*/
+static int
+evict_shard(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *keep)
+{
+	size_t share = cache->max / cache->nshards;
+
+	while (change_total(ctx, cache, 0, 0) > cache->max)
+	{
+		if (!shard->lru_tail || shard->lru_tail == keep || shard->total <= share)
+			return 1;
+		shard->num_evictions++;
+		shard->evicted += fz_glyph_size(ctx, shard->lru_tail->val);
+		drop_glyph_cache_entry(ctx, cache, shard, shard->lru_tail);
+	}
+	return 0;
+}
+
+/* Evict from the shards other than 'full', taking their locks one at a
+ * time, until the cache is back under its limit. */
+static void
+evict_others(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_cache_shard *full)
+{
+	int i, over = 1;
 
-	cache->total = 0;
+	for (i = 0; i < cache->nshards && over; i++)
+	{
+		fz_glyph_cache_shard *shard = &cache->shard[i];
+		if (shard == full)
+			continue;
+		lock_shard(ctx, shard);
+		over = evict_shard(ctx, cache, shard, NULL);
+		unlock_shard(ctx, shard);
+	}
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i;
+
+	for (i = 0; i < cache->nshards; i++)
+	{
+		lock_shard(ctx, &cache->shard[i]);
+		do_purge(ctx, cache, &cache->shard[i]);
+		unlock_shard(ctx, &cache->shard[i]);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	fz_glyph_cache *cache;
+	int i;
+
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	cache = ctx->glyph_cache;
+	cache->refs--;
+	if (cache->refs > 0)
+		cache = NULL;
+	ctx->glyph_cache = NULL;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+
+	/* Nobody else can see the cache once the last reference goes. */
+	if (cache)
 	{
-		do_purge(ctx);
-		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
+		for (i = 0; i < cache->nshards; i++)
+		{
+			do_purge(ctx, cache, &cache->shard[i]);
+			if (cache->sharded)
+				fz_drop_mutex(cache->shard[i].mutex);
+		}
+		fz_free(ctx, cache);
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
 fz_glyph_cache *
@@ -256,7 +410,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -266,31 +420,50 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = shard->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	shard->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
+/* The shard's lock is always held when this function is called. */
+static fz_glyph *
+find_glyph(fz_context *ctx, fz_glyph_cache_shard *shard, const fz_glyph_key *key, unsigned hash)
+{
+	fz_glyph_cache_entry *entry = shard->entry[hash];
+	while (entry)
+	{
+		if (memcmp(&entry->key, key, sizeof(*key)) == 0)
+		{
+			move_to_front(shard, entry);
+			return fz_keep_glyph(ctx, entry->val);
+		}
+		entry = entry->bucket_next;
+	}
+	return NULL;
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *shard;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
 	float size;
-	fz_glyph *val;
-	int do_cache, locked, caching;
+	fz_glyph *val, *found;
+	int do_cache, locked, caching, over;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
 	fz_var(locked);
 	fz_var(caching);
+	fz_var(over);
 	fz_var(val);
 
 	memset(&key, 0, sizeof key);
@@ -322,47 +495,42 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
-	while (entry)
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	shard = &cache->shard[hash % cache->nshards];
+	hash = (hash / cache->nshards) % GLYPH_HASH_LEN;
+	lock_shard(ctx, shard);
+	val = find_glyph(ctx, shard, &key, hash);
+	if (val)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		shard->hits++;
+		unlock_shard(ctx, shard);
+		return val;
 	}
+	shard->misses++;
+	unlock_shard(ctx, shard);
 
-	locked = 1;
+	locked = 0;
 	caching = 0;
-	val = NULL;
+	over = 0;
 
 	fz_try(ctx)
 	{
+		/* We don't hold the shard's lock while rendering, so
+		 * that other threads can use it meanwhile. The danger
+		 * here is that some other thread will come along, and
+		 * want the same glyph too. If it does, we may both end
+		 * up rendering pixmaps. We cope with this later on, by
+		 * ensuring that only one gets inserted into the cache.
+		 * If we insert ours to find one already there, we
+		 * abandon ours, and use the one there already.
+		 */
 		if (is_ft_font)
 		{
 			val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
 		}
 		else if (fz_font_t3_procs(ctx, font))
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
 		}
 		else
 		{
@@ -375,60 +543,46 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!is_ft_font)
+				lock_shard(ctx, shard);
+				locked = 1;
+
+				/* Someone else might have rendered it in
+				 * the meantime. */
+				found = find_glyph(ctx, shard, &key, hash);
+				if (found)
 				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
+					fz_drop_glyph(ctx, val);
+					val = found;
+					break;
 				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = shard->entry[hash];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				shard->entry[hash] = entry;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
-				entry->lru_next = cache->lru_head;
+				entry->lru_next = shard->lru_head;
 				if (entry->lru_next)
 					entry->lru_next->lru_prev = entry;
 				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
+					shard->lru_tail = entry;
+				shard->lru_head = entry;
 
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				shard->total += fz_glyph_size(ctx, val);
+				change_total(ctx, cache, fz_glyph_size(ctx, val), 0);
+				over = evict_shard(ctx, cache, shard, entry);
 			}
 		}
-unlock_and_return_val:
-		{
-		}
 	}
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			unlock_shard(ctx, shard);
 	}
 	fz_catch(ctx)
 	{
@@ -438,6 +592,10 @@ unlock_and_return_val:
 			fz_rethrow(ctx);
 	}
 
+	/* Our shard didn't have enough to give back; the rest must. */
+	if (over)
+		evict_others(ctx, cache, shard);
+
 	return val;
 }
 
@@ -481,8 +639,24 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	size_t total = 0, largest = 0, hits = 0, misses = 0, evicted = 0, num_evictions = 0;
+	int i;
+
+	for (i = 0; i < cache->nshards; i++)
+	{
+		fz_glyph_cache_shard *shard = &cache->shard[i];
+		lock_shard(ctx, shard);
+		total += shard->total;
+		largest = fz_maxz(largest, shard->total);
+		hits += shard->hits;
+		misses += shard->misses;
+		num_evictions += shard->num_evictions;
+		evicted += shard->evicted;
+		unlock_shard(ctx, shard);
+	}
+
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", total);
+	fz_write_printf(ctx, out, "Glyph Cache Shards: %d (largest %zu bytes)\n", cache->nshards, largest);
+	fz_write_printf(ctx, out, "Glyph Cache Lookups: %zu (%zu hits, %zu misses)\n", hits + misses, hits, misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %zu (%zu bytes)\n", num_evictions, evicted);
 }
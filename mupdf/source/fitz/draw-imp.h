@@ -452,11 +452,42 @@ typedef void (fz_solid_color_painter_t)(unsigned char * FZ_RESTRICT dp, int n, i
 
 typedef void (fz_span_painter_t)(unsigned char * FZ_RESTRICT dp, int da, const unsigned char * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop);
 typedef void (fz_span_color_painter_t)(unsigned char * FZ_RESTRICT dp, const unsigned char * FZ_RESTRICT mp, int n, int w, const unsigned char * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop);
+typedef void (fz_span_mask_painter_t)(unsigned char * FZ_RESTRICT dp, const unsigned char * FZ_RESTRICT sp, const unsigned char * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop);
 
 fz_solid_color_painter_t *fz_get_solid_color_painter(int n, const unsigned char * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop);
 fz_span_painter_t *fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop);
 fz_span_color_painter_t *fz_get_span_color_painter(int n, int da, const unsigned char * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop);
 
+/*
+	The vector span painters chosen by fz_init_paint_simd, for the
+	cases they cover (no overprint, 1, 3 or 4 components); NULL
+	otherwise, or when there are none for this machine.
+*/
+fz_span_painter_t *fz_get_span_painter_simd(int da, int sa, int n, int alpha);
+fz_span_color_painter_t *fz_get_span_color_painter_simd(int n, int da);
+fz_span_mask_painter_t *fz_get_span_mask_painter_simd(int a, int n);
+
+/*
+	A vector image painter paints the middle of a row of an image, in
+	the fixed point of draw-affine.c, and gives the pixels it did as
+	*x0 up to *x1; the rest are left for the C painters. There are
+	painters for gray onto gray, and gray or rgb onto rgb, with no
+	shape, group alpha or overprint: interpolated, for images upright
+	or turned through 90 degrees (fa or fb is 0), and nearest, for
+	upright ones being copied or scaled up.
+*/
+typedef void (fz_affine_painter_t)(unsigned char * FZ_RESTRICT dp, int da, const unsigned char * FZ_RESTRICT sp, int64_t sw, int64_t sh, ptrdiff_t ss, int sa, int64_t u, int64_t v, int64_t fa, int64_t fb, int w, int dn, int sn, int alpha, int *x0, int *x1);
+
+fz_affine_painter_t *fz_get_affine_painter_simd(int da, int sa, int dn, int sn, int lerp, int64_t fa, int64_t fb);
+
+/*
+	Turn the vector painters and row scalers off, or back on, for
+	every context, so that tests can check them against the C ones.
+	Not to be called while anything is drawing.
+*/
+void fz_enable_paint_simd(int enable);
+int fz_paint_simd_enabled(void);
+
 void fz_paint_image(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, const fz_irect * FZ_RESTRICT scissor, fz_pixmap * FZ_RESTRICT shape, fz_pixmap * FZ_RESTRICT group_alpha, fz_pixmap * FZ_RESTRICT img, fz_matrix ctm, int alpha, int lerp_allowed, const fz_overprint * FZ_RESTRICT eop);
 void fz_paint_image_with_color(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, const fz_irect * FZ_RESTRICT scissor, fz_pixmap * FZ_RESTRICT shape, fz_pixmap * FZ_RESTRICT group_alpha, fz_pixmap * FZ_RESTRICT img, fz_matrix ctm, const unsigned char * FZ_RESTRICT colorbv, int lerp_allowed, const fz_overprint * FZ_RESTRICT eop);
 
@@ -0,0 +1,687 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "mupdf/fitz.h"
+
+#include "context-imp.h"
+#include "draw-imp.h"
+#include "simd-imp.h"
+#include "thread-imp.h"
+
+#include <string.h>
+
+/*
+	Vector versions of the commonest span painters: 1, 3 and 4
+	components, with or without destination alpha, for a color
+	through a mask, a source through a mask, and a source with alpha
+	over the destination.
+
+	Also of the image painters in draw-affine.c, for gray and rgb
+	images (with or without alpha) drawn onto gray or rgb: upright or
+	turned through 90 degrees when interpolated, upright when not.
+	These do the middles of rows, where no sample needs clamping to
+	the image's edges, and leave the rest to the C painters.
+
+	The instruction set is chosen when the first context is made. These
+	are for x86 only, and need byte shuffles, so SSE4.1 at least (and
+	AVX2, for the 16-bit arithmetic in one register on long spans),
+	which we find out about at run time. Elsewhere the C painters are
+	used.
+*/
+
+#if defined(FZ_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define PAINT_SIMD_X86
+#endif
+
+typedef unsigned char byte;
+
+#ifdef PAINT_SIMD_X86
+
+/*
+	For each of the 16 bytes worked on in a step: the pixel it belongs
+	to (for the mask), and the bytes of the source it comes from and
+	whose alpha applies to it. Bytes past the last whole pixel have
+	0x80, which all our shuffles turn into 0. A color has no source,
+	so its src gives the component instead.
+*/
+typedef struct
+{
+	int pixels;
+	byte pix[16];
+	byte src[16];
+	byte alpha[16];
+} span_layout;
+
+static span_layout color_layouts[5][2];
+static span_layout mask_layouts[5][2];
+static span_layout over_layouts[5][2];
+
+static void
+init_layout(span_layout *layout, int dn, int sn, int sa)
+{
+	int j;
+
+	layout->pixels = 16 / (dn > sn ? dn : sn);
+	for (j = 0; j < 16; j++)
+	{
+		int p = j / dn;
+		if (p < layout->pixels)
+		{
+			layout->pix[j] = p;
+			layout->src[j] = p * sn + j % dn;
+			layout->alpha[j] = p * sn + sa;
+		}
+		else
+			layout->pix[j] = layout->src[j] = layout->alpha[j] = 0x80;
+	}
+}
+
+static void
+init_layouts(void)
+{
+	int n, a;
+
+	for (n = 1; n <= 4; n++)
+	{
+		if (n == 2)
+			continue;
+		for (a = 0; a <= 1; a++)
+		{
+			init_layout(&color_layouts[n][a], n + a, 0, 0);
+			init_layout(&mask_layouts[n][a], n + a, n + a, n);
+			init_layout(&over_layouts[n][a], n + a, n + 1, n);
+		}
+	}
+}
+
+/*
+	The C versions, for short spans and the pixels left over at the
+	end of long ones. These do just what the painters in draw-paint.c
+	do; each is expanded for the component counts we handle so that
+	the compiler can unroll it.
+*/
+
+static fz_forceinline void
+template_span_with_color_tail(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n1, int da, int w, const byte * FZ_RESTRICT color, int sa)
+{
+	int k;
+
+	do
+	{
+		int a = *mp++;
+		a = FZ_EXPAND(a);
+		if (sa != 256)
+			a = FZ_COMBINE(a, sa);
+		if (a == 256)
+		{
+			for (k = 0; k < n1; k++)
+				dp[k] = color[k];
+			if (da)
+				dp[n1] = 255;
+		}
+		else if (a != 0)
+		{
+			for (k = 0; k < n1; k++)
+				dp[k] = FZ_BLEND(color[k], dp[k], a);
+			if (da)
+				dp[n1] = FZ_BLEND(255, dp[n1], a);
+		}
+		dp += n1 + da;
+	}
+	while (--w);
+}
+
+static void
+span_with_color_tail(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n1, int da, int w, const byte * FZ_RESTRICT color, int sa)
+{
+	switch (n1 * 2 + da)
+	{
+	case 2: template_span_with_color_tail(dp, mp, 1, 0, w, color, sa); break;
+	case 3: template_span_with_color_tail(dp, mp, 1, 1, w, color, sa); break;
+	case 6: template_span_with_color_tail(dp, mp, 3, 0, w, color, sa); break;
+	case 7: template_span_with_color_tail(dp, mp, 3, 1, w, color, sa); break;
+	case 8: template_span_with_color_tail(dp, mp, 4, 0, w, color, sa); break;
+	case 9: template_span_with_color_tail(dp, mp, 4, 1, w, color, sa); break;
+	}
+}
+
+static fz_forceinline void
+template_span_with_mask_tail(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int n, int a, int w)
+{
+	int k;
+
+	do
+	{
+		int ma = *mp++;
+		ma = FZ_EXPAND(ma);
+		if (ma != 0 && !(a && sp[n] == 0))
+		{
+			if (ma == 256)
+				for (k = 0; k < n + a; k++)
+					dp[k] = sp[k];
+			else
+				for (k = 0; k < n + a; k++)
+					dp[k] = FZ_BLEND(sp[k], dp[k], ma);
+		}
+		dp += n + a;
+		sp += n + a;
+	}
+	while (--w);
+}
+
+static void
+span_with_mask_tail(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int n, int a, int w)
+{
+	switch (n * 2 + a)
+	{
+	case 2: template_span_with_mask_tail(dp, sp, mp, 1, 0, w); break;
+	case 3: template_span_with_mask_tail(dp, sp, mp, 1, 1, w); break;
+	case 6: template_span_with_mask_tail(dp, sp, mp, 3, 0, w); break;
+	case 7: template_span_with_mask_tail(dp, sp, mp, 3, 1, w); break;
+	case 8: template_span_with_mask_tail(dp, sp, mp, 4, 0, w); break;
+	case 9: template_span_with_mask_tail(dp, sp, mp, 4, 1, w); break;
+	}
+}
+
+static fz_forceinline void
+template_span_sa_tail(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int n, int w)
+{
+	int k;
+
+	do
+	{
+		int t = FZ_EXPAND(sp[n]);
+		if (t == 256)
+		{
+			for (k = 0; k < n + da; k++)
+				dp[k] = sp[k];
+		}
+		else if (t != 0)
+		{
+			t = 256 - t;
+			for (k = 0; k < n + da; k++)
+				dp[k] = sp[k] + FZ_COMBINE(dp[k], t);
+		}
+		dp += n + da;
+		sp += n + 1;
+	}
+	while (--w);
+}
+
+static void
+span_sa_tail(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int n, int w)
+{
+	switch (n * 2 + da)
+	{
+	case 2: template_span_sa_tail(dp, 0, sp, 1, w); break;
+	case 3: template_span_sa_tail(dp, 1, sp, 1, w); break;
+	case 6: template_span_sa_tail(dp, 0, sp, 3, w); break;
+	case 7: template_span_sa_tail(dp, 1, sp, 3, w); break;
+	case 8: template_span_sa_tail(dp, 0, sp, 4, w); break;
+	case 9: template_span_sa_tail(dp, 1, sp, 4, w); break;
+	}
+}
+
+/* The fixed point the image painters work in; as in draw-affine.c. */
+typedef int64_t affint;
+
+#define PREC 14
+#define ONE (((affint)1)<<PREC)
+#define MASK (ONE-1)
+#define HALF (((affint)1)<<(PREC-1))
+
+/*
+	For each of the 16 destination bytes worked on in a step of an
+	image painter: the pixel it belongs to, and the source component
+	that goes into it (the same component, or the gray for rgb from
+	gray, or the alpha). Where the image has no alpha, the alpha is
+	set with opaque instead. Inside marks the bytes that are painted.
+
+	Scale turns pixel offsets into byte offsets in the source, and
+	packed gives the source bytes in a buffer of gathered samples.
+	Fractions are 16 bits to a pixel; frac_lo and frac_hi pick them
+	out for the first and last 8 destination bytes.
+*/
+typedef struct
+{
+	int pixels;
+	byte pix[16];
+	byte comp[16];
+	byte alpha[16];
+	byte opaque[16];
+	byte inside[16];
+	byte scale[16];
+	byte packed[16];
+	byte packed_alpha[16];
+	byte frac_lo[16];
+	byte frac_hi[16];
+} affine_layout;
+
+/* Indexed by [dn == 3][da][sn == 3][sa]. */
+static affine_layout affine_layouts[2][2][2][2];
+
+static int
+affine_frac_index(const affine_layout *layout, int dn1, int j)
+{
+	int p = j / dn1;
+	return p < layout->pixels ? p : 0x80;
+}
+
+static void
+init_affine_layout(affine_layout *layout, int dn, int da, int sn, int sa)
+{
+	int dn1 = dn + da;
+	int sn1 = sn + sa;
+	int j;
+
+	layout->pixels = 16 / (dn1 > sn1 ? dn1 : sn1);
+	for (j = 0; j < 16; j++)
+	{
+		int p = j / dn1;
+		int k = j % dn1;
+		int lo = affine_frac_index(layout, dn1, j >> 1);
+		int hi = affine_frac_index(layout, dn1, 8 + (j >> 1));
+
+		layout->scale[j] = j * sn1;
+		layout->frac_lo[j] = lo == 0x80 ? 0x80 : lo * 2 + (j & 1);
+		layout->frac_hi[j] = hi == 0x80 ? 0x80 : hi * 2 + (j & 1);
+		if (p < layout->pixels)
+		{
+			int comp = k < dn ? (sn == dn ? k : 0) : sa ? sn : 0x80;
+			layout->pix[j] = p;
+			layout->comp[j] = comp;
+			layout->alpha[j] = sa ? sn : 0x80;
+			layout->opaque[j] = k < dn || sa ? 0 : 0xff;
+			layout->inside[j] = 0xff;
+			layout->packed[j] = comp == 0x80 ? 0x80 : p * sn1 + comp;
+			layout->packed_alpha[j] = sa ? p * sn1 + sn : 0x80;
+		}
+		else
+		{
+			layout->pix[j] = layout->comp[j] = layout->alpha[j] = 0x80;
+			layout->packed[j] = layout->packed_alpha[j] = 0x80;
+			layout->opaque[j] = layout->inside[j] = 0;
+		}
+	}
+}
+
+static void
+init_affine_layouts(void)
+{
+	int da, sa;
+
+	for (da = 0; da <= 1; da++)
+	{
+		for (sa = 0; sa <= 1; sa++)
+		{
+			init_affine_layout(&affine_layouts[0][da][0][sa], 1, da, 1, sa);
+			init_affine_layout(&affine_layouts[1][da][0][sa], 3, da, 1, sa);
+			init_affine_layout(&affine_layouts[1][da][1][sa], 3, da, 3, sa);
+		}
+	}
+}
+
+/*
+	Find the run of x in [0, w) for which 0 <= u + x * f < lim, as
+	*x0 up to *x1.
+*/
+static void
+affine_run(affint u, affint f, affint lim, int w, int *x0, int *x1)
+{
+	affint a, b;
+
+	if (f == 0)
+	{
+		a = 0;
+		b = u >= 0 && u < lim ? w : 0;
+	}
+	else if (f > 0)
+	{
+		a = u >= 0 ? 0 : (f - u - 1) / f;
+		b = u >= lim ? 0 : (lim - u + f - 1) / f;
+	}
+	else
+	{
+		a = u < lim ? 0 : (u - lim) / -f + 1;
+		b = u < 0 ? 0 : u / -f + 1;
+	}
+	if (a > w)
+		a = w;
+	if (b > w)
+		b = w;
+	if (b < a)
+		b = a;
+	*x0 = (int)a;
+	*x1 = (int)b;
+}
+
+static fz_forceinline void
+copy_sample(byte * FZ_RESTRICT d, const byte * FZ_RESTRICT s, int n)
+{
+	d[0] = s[0];
+	if (n > 1)
+		d[1] = s[1];
+	if (n > 2)
+		d[2] = s[2];
+	if (n > 3)
+		d[3] = s[3];
+}
+
+#endif
+
+#ifdef PAINT_SIMD_X86
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+/* 16 bytes, as used by both of the x86 versions. */
+
+static TARGET_SSE41 fz_forceinline __m128i load_x86(const byte *p) { return _mm_loadu_si128((const __m128i *)p); }
+static TARGET_SSE41 fz_forceinline void store_x86(byte *p, __m128i a) { _mm_storeu_si128((__m128i *)p, a); }
+static TARGET_SSE41 fz_forceinline __m128i shuffle_x86(__m128i a, __m128i idx) { return _mm_shuffle_epi8(a, idx); }
+static TARGET_SSE41 fz_forceinline int is_zero_x86(__m128i a) { return _mm_testz_si128(a, a); }
+static TARGET_SSE41 fz_forceinline __m128i eq0_x86(__m128i a) { return _mm_cmpeq_epi8(a, _mm_setzero_si128()); }
+static TARGET_SSE41 fz_forceinline __m128i andnot_x86(__m128i mask, __m128i a) { return _mm_andnot_si128(mask, a); }
+static TARGET_SSE41 fz_forceinline __m128i select_x86(__m128i mask, __m128i a, __m128i b) { return _mm_blendv_epi8(b, a, mask); }
+
+/* SSE4.1: 16 lanes of 16 bits in two registers. */
+
+typedef struct { __m128i lo, hi; } w16_sse41;
+
+#define load_sse41 load_x86
+#define store_sse41 store_x86
+#define shuffle_sse41 shuffle_x86
+#define is_zero_sse41 is_zero_x86
+#define eq0_sse41 eq0_x86
+#define andnot_sse41 andnot_x86
+#define select_sse41 select_x86
+
+static TARGET_SSE41 fz_forceinline w16_sse41 widen_sse41(__m128i a)
+{
+	w16_sse41 r = { _mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(_mm_srli_si128(a, 8)) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline __m128i narrow_sse41(w16_sse41 a) { return _mm_packus_epi16(a.lo, a.hi); }
+static TARGET_SSE41 fz_forceinline w16_sse41 splat_sse41(int v)
+{
+	w16_sse41 r = { _mm_set1_epi16((short)v), _mm_set1_epi16((short)v) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 add_sse41(w16_sse41 a, w16_sse41 b)
+{
+	w16_sse41 r = { _mm_add_epi16(a.lo, b.lo), _mm_add_epi16(a.hi, b.hi) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 sub_sse41(w16_sse41 a, w16_sse41 b)
+{
+	w16_sse41 r = { _mm_sub_epi16(a.lo, b.lo), _mm_sub_epi16(a.hi, b.hi) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 mul_sse41(w16_sse41 a, w16_sse41 b)
+{
+	w16_sse41 r = { _mm_mullo_epi16(a.lo, b.lo), _mm_mullo_epi16(a.hi, b.hi) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 and_sse41(w16_sse41 a, w16_sse41 b)
+{
+	w16_sse41 r = { _mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 shr7_sse41(w16_sse41 a)
+{
+	w16_sse41 r = { _mm_srli_epi16(a.lo, 7), _mm_srli_epi16(a.hi, 7) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 shr8_sse41(w16_sse41 a)
+{
+	w16_sse41 r = { _mm_srli_epi16(a.lo, 8), _mm_srli_epi16(a.hi, 8) };
+	return r;
+}
+
+#define SIMD_OP(x) x##_sse41
+#define SIMD_V8 __m128i
+#define SIMD_W16 w16_sse41
+#define SIMD_TARGET TARGET_SSE41
+#include "paint-span-simd.h"
+
+static TARGET_SSE41 fz_forceinline w16_sse41 join_sse41(__m128i lo, __m128i hi)
+{
+	w16_sse41 r = { lo, hi };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline w16_sse41 mulfrac_sse41(w16_sse41 a, w16_sse41 f)
+{
+	w16_sse41 r = { _mm_mulhi_epi16(_mm_slli_epi16(a.lo, 16 - PREC), f.lo), _mm_mulhi_epi16(_mm_slli_epi16(a.hi, 16 - PREC), f.hi) };
+	return r;
+}
+static TARGET_SSE41 fz_forceinline __m128i positions_sse41(int frac, const int32_t *steps, __m128i *lo, __m128i *hi)
+{
+	__m128i f = _mm_set1_epi32(frac);
+	__m128i m = _mm_set1_epi32((int)MASK);
+	__m128i x0 = _mm_add_epi32(f, _mm_loadu_si128((const __m128i *)steps));
+	__m128i x1 = _mm_add_epi32(f, _mm_loadu_si128((const __m128i *)(steps + 4)));
+	__m128i x2 = _mm_add_epi32(f, _mm_loadu_si128((const __m128i *)(steps + 8)));
+	__m128i x3 = _mm_add_epi32(f, _mm_loadu_si128((const __m128i *)(steps + 12)));
+	*lo = _mm_packs_epi32(_mm_and_si128(x0, m), _mm_and_si128(x1, m));
+	*hi = _mm_packs_epi32(_mm_and_si128(x2, m), _mm_and_si128(x3, m));
+	return _mm_packus_epi16(
+		_mm_packs_epi32(_mm_srai_epi32(x0, PREC), _mm_srai_epi32(x1, PREC)),
+		_mm_packs_epi32(_mm_srai_epi32(x2, PREC), _mm_srai_epi32(x3, PREC)));
+}
+
+#define SIMD_OP(x) x##_sse41
+#define SIMD_V8 __m128i
+#define SIMD_W16 w16_sse41
+#define SIMD_TARGET TARGET_SSE41
+#include "paint-affine-simd.h"
+
+/* AVX2: 16 lanes of 16 bits in one register. */
+
+#define load_avx2 load_x86
+#define store_avx2 store_x86
+#define shuffle_avx2 shuffle_x86
+#define is_zero_avx2 is_zero_x86
+#define eq0_avx2 eq0_x86
+#define andnot_avx2 andnot_x86
+#define select_avx2 select_x86
+
+static TARGET_AVX2 fz_forceinline __m256i widen_avx2(__m128i a) { return _mm256_cvtepu8_epi16(a); }
+static TARGET_AVX2 fz_forceinline __m128i narrow_avx2(__m256i a) { return _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)); }
+static TARGET_AVX2 fz_forceinline __m256i splat_avx2(int v) { return _mm256_set1_epi16((short)v); }
+static TARGET_AVX2 fz_forceinline __m256i add_avx2(__m256i a, __m256i b) { return _mm256_add_epi16(a, b); }
+static TARGET_AVX2 fz_forceinline __m256i sub_avx2(__m256i a, __m256i b) { return _mm256_sub_epi16(a, b); }
+static TARGET_AVX2 fz_forceinline __m256i mul_avx2(__m256i a, __m256i b) { return _mm256_mullo_epi16(a, b); }
+static TARGET_AVX2 fz_forceinline __m256i and_avx2(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+static TARGET_AVX2 fz_forceinline __m256i shr7_avx2(__m256i a) { return _mm256_srli_epi16(a, 7); }
+static TARGET_AVX2 fz_forceinline __m256i shr8_avx2(__m256i a) { return _mm256_srli_epi16(a, 8); }
+
+#define SIMD_OP(x) x##_avx2
+#define SIMD_V8 __m128i
+#define SIMD_W16 __m256i
+#define SIMD_TARGET TARGET_AVX2
+#include "paint-span-simd.h"
+
+/*
+	The 256-bit multiplies only pay for themselves over long spans;
+	on shorter ones they were measured to be slower than SSE4.1 (by
+	as much as 4 times, for 4 byte pixels), so those go there.
+*/
+#define AVX2_MIN_SPAN 512
+
+static void
+paint_span_with_color_x86(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	if (w >= AVX2_MIN_SPAN)
+		paint_span_with_color_avx2(dp, mp, n, w, color, da, eop);
+	else
+		paint_span_with_color_sse41(dp, mp, n, w, color, da, eop);
+}
+
+static void
+paint_span_with_mask_x86(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	if (w >= AVX2_MIN_SPAN)
+		paint_span_with_mask_avx2(dp, sp, mp, w, n, a, eop);
+	else
+		paint_span_with_mask_sse41(dp, sp, mp, w, n, a, eop);
+}
+
+static void
+paint_span_sa_x86(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	if (w >= AVX2_MIN_SPAN)
+		paint_span_sa_avx2(dp, da, sp, sa, n, w, alpha, eop);
+	else
+		paint_span_sa_sse41(dp, da, sp, sa, n, w, alpha, eop);
+}
+
+static int
+cpu_level(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	int level = 0;
+	__cpuid(info, 0);
+	if (info[0] >= 1)
+	{
+		__cpuid(info, 1);
+		if (info[2] & (1<<19))
+			level = 1;
+		/* AVX2 also needs the OS to save the ymm registers. */
+		if (level && (info[2] & (1<<27)) && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1<<5))
+				level = 2;
+		}
+	}
+	return level;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return 2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return 1;
+	return 0;
+#endif
+}
+
+#endif /* PAINT_SIMD_X86 */
+
+static struct
+{
+	fz_span_color_painter_t *color;
+	fz_span_mask_painter_t *mask;
+	fz_span_painter_t *sa;
+	fz_affine_painter_t *affine_near;
+	fz_affine_painter_t *affine_lerp;
+} simd_painters;
+
+static void
+init_paint_simd(void)
+{
+#ifdef PAINT_SIMD_X86
+	init_layouts();
+	init_affine_layouts();
+#endif
+
+#if defined(PAINT_SIMD_X86)
+	switch (cpu_level())
+	{
+	case 2:
+		simd_painters.color = paint_span_with_color_x86;
+		simd_painters.mask = paint_span_with_mask_x86;
+		simd_painters.sa = paint_span_sa_x86;
+		simd_painters.affine_near = paint_affine_near_sse41;
+		simd_painters.affine_lerp = paint_affine_lerp_sse41;
+		break;
+	case 1:
+		simd_painters.color = paint_span_with_color_sse41;
+		simd_painters.mask = paint_span_with_mask_sse41;
+		simd_painters.sa = paint_span_sa_sse41;
+		simd_painters.affine_near = paint_affine_near_sse41;
+		simd_painters.affine_lerp = paint_affine_lerp_sse41;
+		break;
+	}
+#endif
+}
+
+void fz_init_paint_simd(void)
+{
+	/* Contexts can be made on several threads at once. */
+	static fz_once once = FZ_ONCE_INIT;
+
+	fz_call_once(&once, init_paint_simd);
+}
+
+static int simd_enabled = 1;
+
+void fz_enable_paint_simd(int enable)
+{
+	simd_enabled = enable;
+}
+
+int fz_paint_simd_enabled(void)
+{
+	return simd_enabled;
+}
+
+static int
+simd_components(int n)
+{
+	return simd_enabled && (n == 1 || n == 3 || n == 4);
+}
+
+fz_span_color_painter_t *
+fz_get_span_color_painter_simd(int n, int da)
+{
+	return simd_components(n - da) ? simd_painters.color : NULL;
+}
+
+fz_span_mask_painter_t *
+fz_get_span_mask_painter_simd(int a, int n)
+{
+	return simd_components(n) ? simd_painters.mask : NULL;
+}
+
+fz_span_painter_t *
+fz_get_span_painter_simd(int da, int sa, int n, int alpha)
+{
+	return sa && alpha == 255 && simd_components(n) ? simd_painters.sa : NULL;
+}
+
+fz_affine_painter_t *
+fz_get_affine_painter_simd(int da, int sa, int dn, int sn, int lerp, int64_t fa, int64_t fb)
+{
+	if (!simd_enabled || (fa == 0) == (fb == 0) || (!lerp && fb != 0))
+		return NULL;
+	if (!(dn == 1 && sn == 1) && !(dn == 3 && (sn == 1 || sn == 3)))
+		return NULL;
+	return lerp ? simd_painters.affine_lerp : simd_painters.affine_near;
+}
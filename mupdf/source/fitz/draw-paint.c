@@ -1115,6 +1115,7 @@ paint_span_with_color_N_da_op_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTR
 fz_span_color_painter_t *
 fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop)
 {
+	fz_span_color_painter_t *fn;
 	byte alpha = color[n-da];
 	if (alpha == 0)
 		return NULL;
@@ -1127,6 +1128,9 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 			return da ? paint_span_with_color_N_da_op_alpha : paint_span_with_color_N_op_alpha;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+	fn = fz_get_span_color_painter_simd(n, da);
+	if (fn)
+		return fn;
 	switch(n-da)
 	{
 	case 0:
@@ -1431,11 +1435,13 @@ paint_span_with_mask_N(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const
 }
 #endif /* FZ_PLOTTERS_N */
 
-typedef void (fz_span_mask_painter_t)(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop);
-
 static fz_span_mask_painter_t *
 fz_get_span_mask_painter(int a, int n)
 {
+	fz_span_mask_painter_t *fn = fz_get_span_mask_painter_simd(a, n);
+	if (fn)
+		return fn;
+
 	switch(n)
 	{
 		case 0:
@@ -2121,6 +2127,8 @@ paint_span_N_general_alpha_op(byte * FZ_RESTRICT dp, int da, const byte * FZ_RES
 fz_span_painter_t *
 fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop)
 {
+	fz_span_painter_t *fn;
+
 #if FZ_ENABLE_SPOT_RENDERING
 	if (fz_overprint_required(eop))
 	{
@@ -2132,6 +2140,9 @@ fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RE
 			return NULL;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+	fn = fz_get_span_painter_simd(da, sa, n, alpha);
+	if (fn)
+		return fn;
 	switch (n)
 	{
 	case 0:
@@ -0,0 +1,221 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "mupdf/fitz.h"
+#include "thread-imp.h"
+
+/*
+	Draw a display list on several threads at once, by splitting the
+	destination into bands of whole rows. There are a few bands for
+	each thread, so that a thread that gets the easy ones can help
+	out with the rest; they are handed out in order from a shared
+	counter.
+
+	Each band is drawn through a pixmap that shares its samples with
+	the destination, so there is nothing to join up afterwards. All
+	of them, and the contexts for the workers, are made on the
+	calling thread before any workers start.
+*/
+
+/* Don't make bands of fewer rows than this. */
+#define MIN_BAND_HEIGHT 32
+/* How many bands to aim for per thread. */
+#define BANDS_PER_THREAD 4
+
+typedef struct
+{
+	fz_display_list *list;
+	fz_matrix ctm;
+	int len;
+	fz_pixmap **band;
+	int next;
+	int failed;
+	int locked;
+	fz_mutex *mutex;
+} render_batch;
+
+typedef struct
+{
+	fz_context *ctx;
+	render_batch *batch;
+	int errcode;
+	char message[256];
+} render_worker;
+
+static fz_pixmap *
+next_band(render_batch *batch)
+{
+	fz_pixmap *band = NULL;
+
+	if (batch->locked)
+		fz_lock_mutex(batch->mutex);
+	if (!batch->failed && batch->next < batch->len)
+		band = batch->band[batch->next++];
+	if (batch->locked)
+		fz_unlock_mutex(batch->mutex);
+	return band;
+}
+
+static void
+draw_band(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *pix)
+{
+	fz_device *dev = fz_new_draw_device(ctx, fz_identity, pix);
+	fz_try(ctx)
+	{
+		fz_run_display_list(ctx, list, dev, ctm, fz_rect_from_irect(fz_pixmap_bbox(ctx, pix)), NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Draw bands until there are none left, or one fails. Never throws. */
+static void
+render_worker_fn(void *arg)
+{
+	render_worker *worker = arg;
+	render_batch *batch = worker->batch;
+	fz_context *ctx = worker->ctx;
+	fz_pixmap *band;
+
+	while ((band = next_band(batch)) != NULL)
+	{
+		fz_try(ctx)
+			draw_band(ctx, batch->list, batch->ctm, band);
+		fz_catch(ctx)
+		{
+			worker->errcode = fz_caught(ctx);
+			fz_strlcpy(worker->message, fz_caught_message(ctx), sizeof worker->message);
+			if (batch->locked)
+				fz_lock_mutex(batch->mutex);
+			batch->failed = 1;
+			if (batch->locked)
+				fz_unlock_mutex(batch->mutex);
+			break;
+		}
+	}
+}
+
+void
+fz_render_display_list_parallel(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_pixmap *pixmap, int nthreads)
+{
+	render_batch batch = { 0 };
+	render_worker *worker = NULL;
+	fz_thread **thread = NULL;
+	int i, band_h, nclones = 0, nworkers = 1, nstarted = 0;
+
+	if (nthreads > pixmap->h / MIN_BAND_HEIGHT)
+		nthreads = pixmap->h / MIN_BAND_HEIGHT;
+	if (nthreads <= 1)
+	{
+		draw_band(ctx, list, ctm, pixmap);
+		return;
+	}
+
+	fz_var(batch);
+	fz_var(worker);
+	fz_var(thread);
+	fz_var(nclones);
+	fz_var(nworkers);
+
+	batch.list = list;
+	batch.ctm = ctm;
+	band_h = fz_maxi(MIN_BAND_HEIGHT, (pixmap->h + nthreads * BANDS_PER_THREAD - 1) / (nthreads * BANDS_PER_THREAD));
+
+	fz_try(ctx)
+	{
+		/* The calling thread is worker 0, with its own context. */
+		worker = fz_calloc(ctx, nthreads, sizeof *worker);
+		worker[0].ctx = ctx;
+		for (i = 1; i < nthreads; i++)
+		{
+			worker[i].ctx = fz_clone_context(ctx);
+			if (!worker[i].ctx)
+				break;
+			nclones++;
+		}
+
+		if (nclones > 0 && (batch.mutex = fz_new_mutex()) != NULL)
+		{
+			fz_irect bbox = fz_pixmap_bbox(ctx, pixmap);
+			int y;
+
+			batch.locked = 1;
+			nworkers = 1 + nclones;
+			batch.band = fz_malloc_array(ctx, (pixmap->h + band_h - 1) / band_h, fz_pixmap *);
+			for (y = bbox.y0; y < bbox.y1; y += band_h)
+			{
+				fz_irect r = bbox;
+				r.y0 = y;
+				r.y1 = fz_mini(y + band_h, bbox.y1);
+				batch.band[batch.len] = fz_new_pixmap_from_pixmap(ctx, pixmap, &r);
+				batch.len++;
+			}
+			thread = fz_malloc_array(ctx, nworkers - 1, fz_thread *);
+		}
+		else
+		{
+			/* No locks to share the context with, or no threads. */
+			batch.band = fz_malloc_struct(ctx, fz_pixmap *);
+			batch.band[0] = fz_keep_pixmap(ctx, pixmap);
+			batch.len = 1;
+		}
+
+		for (i = 0; i < nworkers; i++)
+			worker[i].batch = &batch;
+		while (nstarted < nworkers - 1 && (thread[nstarted] = fz_new_thread(render_worker_fn, &worker[nstarted + 1])) != NULL)
+			nstarted++;
+		render_worker_fn(&worker[0]);
+		for (i = 0; i < nstarted; i++)
+			fz_join_thread(thread[i]);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, thread);
+		for (i = 0; i < batch.len; i++)
+			fz_drop_pixmap(ctx, batch.band[i]);
+		fz_free(ctx, batch.band);
+		fz_drop_mutex(batch.mutex);
+		for (i = 1; i <= nclones; i++)
+			fz_drop_context(worker[i].ctx);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, worker);
+		fz_rethrow(ctx);
+	}
+
+	for (i = 0; i < nworkers; i++)
+		if (worker[i].errcode)
+			break;
+	if (i < nworkers)
+	{
+		int errcode = worker[i].errcode;
+		char message[256];
+		fz_strlcpy(message, worker[i].message, sizeof message);
+		fz_free(ctx, worker);
+		fz_throw(ctx, errcode, "%s", message);
+	}
+	fz_free(ctx, worker);
+}
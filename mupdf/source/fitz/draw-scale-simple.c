@@ -34,8 +34,11 @@ intermediate results rather than ints.
 
 #include "mupdf/fitz.h"
 
+#include "context-imp.h"
 #include "draw-imp.h"
 #include "pixmap-imp.h"
+#include "simd-imp.h"
+#include "thread-imp.h"
 
 #include <math.h>
 #include <string.h>
@@ -1279,6 +1282,306 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #endif
 
+#ifdef FZ_SIMD
+
+/*
+	Vector versions of the row scalers. Products of source bytes and
+	weights are summed in 32-bit lanes, a pair of them at a time, so
+	the results are identical to those of the versions above. That
+	needs every weight to fit in 16 bits, which in practice they
+	always do; weights_fit_16 checks before we use them.
+*/
+
+static int
+weights_fit_16(const fz_weights *weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	int i, len;
+
+	for (i = weights->count; i > 0; i--)
+	{
+		contrib++; /* Skip min */
+		len = *contrib++;
+		while (len-- > 0)
+		{
+			int c = *contrib++;
+			if (c < -32768 || c > 32767)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* Two weights, in the 16-bit halves of each 32-bit lane. */
+static fz_forceinline fz_u8x16
+weight_pair(int a, int b)
+{
+	return fz_u8x16_splat32(((uint32_t)b << 16) | (uint16_t)a);
+}
+
+static void
+scale_row_to_temp1_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	fz_u8x16 zero = fz_u8x16_splat(0);
+	int len, i, step = 1;
+	const unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		int val = 128;
+		min = &src[*contrib++];
+		len = *contrib++;
+		if (len >= 8)
+		{
+			/* 8 source pixels at a time. */
+			fz_u8x16 acc = zero;
+			do
+			{
+				fz_u8x16 s = fz_u8x16_zip_lo(fz_u8x16_load64(min), zero);
+				fz_u8x16 c = fz_u8x16_narrow32(fz_u8x16_load((const unsigned char *)contrib), fz_u8x16_load((const unsigned char *)(contrib + 4)));
+				acc = fz_u8x16_add32(acc, fz_u8x16_madd16(s, c));
+				min += 8;
+				contrib += 8;
+				len -= 8;
+			}
+			while (len >= 8);
+			val += fz_u8x16_sum32(acc);
+		}
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+/*
+	A pixel in the low bytes of each 32-bit lane. Copying 3 bytes into
+	an int would go through memory and stall the load after it, so a
+	pixel of 3 is built up in a register; or, when next is set, read
+	with the byte before it (from the previous pixel) and shifted
+	down.
+*/
+static fz_forceinline fz_u8x16
+load_pixel(const unsigned char *p, int n, int next)
+{
+	uint32_t v = 0;
+	if (n == 3 && next)
+	{
+		memcpy(&v, p - 1, 4);
+		v >>= 8;
+	}
+	else if (n == 3)
+		v = p[0] | (p[1] << 8) | (p[2] << 16);
+	else
+		memcpy(&v, p, n);
+	return fz_u8x16_splat32(v);
+}
+
+/*
+	Each component of a destination pixel in a 32-bit lane, from two
+	source pixels at a time: their components are zipped together so
+	that each lane sums one component of both.
+*/
+static fz_forceinline void
+template_scale_row_to_temp_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int n)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	fz_u8x16 zero = fz_u8x16_splat(0);
+	fz_u8x16 k128 = fz_u8x16_splat32(128);
+	fz_u8x16 k255 = fz_u8x16_splat32(255);
+	fz_u8x16 px[4];
+	unsigned char out[16];
+	int len, i, j, k, step = n;
+	const unsigned char *min;
+
+	if (weights->flip)
+	{
+		dst += (weights->count-1)*n;
+		step = -n;
+	}
+	for (i=weights->count; i > 0; i -= k)
+	{
+		/* 4 destination pixels are packed into bytes together. */
+		k = i < 4 ? i : 4;
+		for (j = 0; j < k; j++)
+		{
+			fz_u8x16 acc = k128;
+			min = &src[n * *contrib++];
+			len = *contrib++;
+			if (n == 4)
+			{
+				/* 4 source pixels from one load: the first and
+				 * third, and the second and fourth, are zipped. */
+				for (; len >= 4; len -= 4)
+				{
+					fz_u8x16 s = fz_u8x16_load(min);
+					fz_u8x16 lo = fz_u8x16_zip_lo(s, zero);
+					fz_u8x16 hi = fz_u8x16_zip_hi(s, zero);
+					acc = fz_u8x16_add32(acc, fz_u8x16_madd16(fz_u8x16_zip16_lo(lo, hi), weight_pair(contrib[0], contrib[2])));
+					acc = fz_u8x16_add32(acc, fz_u8x16_madd16(fz_u8x16_zip16_hi(lo, hi), weight_pair(contrib[1], contrib[3])));
+					min += 16;
+					contrib += 4;
+				}
+			}
+			for (; len >= 2; len -= 2)
+			{
+				fz_u8x16 s = fz_u8x16_zip_lo(load_pixel(min, n, 0), load_pixel(min + n, n, 1));
+				s = fz_u8x16_zip_lo(s, zero);
+				acc = fz_u8x16_add32(acc, fz_u8x16_madd16(s, weight_pair(contrib[0], contrib[1])));
+				min += 2*n;
+				contrib += 2;
+			}
+			if (len)
+			{
+				fz_u8x16 s = fz_u8x16_zip_lo(fz_u8x16_zip_lo(load_pixel(min, n, 0), zero), zero);
+				acc = fz_u8x16_add32(acc, fz_u8x16_madd16(s, weight_pair(*contrib++, 0)));
+			}
+			px[j] = fz_u8x16_and(fz_u8x16_shr32(acc, 8), k255);
+		}
+		for (; j < 4; j++)
+			px[j] = zero;
+		fz_u8x16_store(out, fz_u8x16_pack32(px[0], px[1], px[2], px[3]));
+		for (j = 0; j < k; j++)
+		{
+			memcpy(dst, &out[4*j], n);
+			dst += step;
+		}
+	}
+}
+
+static void
+scale_row_to_temp2_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	assert(weights->n == 2);
+	template_scale_row_to_temp_simd(dst, src, weights, 2);
+}
+
+static void
+scale_row_to_temp3_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	assert(weights->n == 3);
+	template_scale_row_to_temp_simd(dst, src, weights, 3);
+}
+
+static void
+scale_row_to_temp4_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	assert(weights->n == 4);
+	template_scale_row_to_temp_simd(dst, src, weights, 4);
+}
+
+/* 16 bytes of a destination row, from len temp rows width apart. */
+static fz_forceinline fz_u8x16
+scale_block_from_temp(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	fz_u8x16 zero = fz_u8x16_splat(0);
+	fz_u8x16 k255 = fz_u8x16_splat32(255);
+	fz_u8x16 a0, a1, a2, a3;
+
+	a0 = a1 = a2 = a3 = fz_u8x16_splat32(128);
+	for (; len > 0; len -= 2)
+	{
+		fz_u8x16 r0 = fz_u8x16_load(src);
+		fz_u8x16 r1, w, lo, hi;
+		if (len >= 2)
+		{
+			r1 = fz_u8x16_load(src + width);
+			w = weight_pair(contrib[0], contrib[1]);
+		}
+		else
+		{
+			r1 = zero;
+			w = weight_pair(contrib[0], 0);
+		}
+		lo = fz_u8x16_zip_lo(r0, r1);
+		hi = fz_u8x16_zip_hi(r0, r1);
+		a0 = fz_u8x16_add32(a0, fz_u8x16_madd16(fz_u8x16_zip_lo(lo, zero), w));
+		a1 = fz_u8x16_add32(a1, fz_u8x16_madd16(fz_u8x16_zip_hi(lo, zero), w));
+		a2 = fz_u8x16_add32(a2, fz_u8x16_madd16(fz_u8x16_zip_lo(hi, zero), w));
+		a3 = fz_u8x16_add32(a3, fz_u8x16_madd16(fz_u8x16_zip_hi(hi, zero), w));
+		src += 2*width;
+		contrib += 2;
+	}
+	a0 = fz_u8x16_and(fz_u8x16_shr32(a0, 8), k255);
+	a1 = fz_u8x16_and(fz_u8x16_shr32(a1, 8), k255);
+	a2 = fz_u8x16_and(fz_u8x16_shr32(a2, 8), k255);
+	a3 = fz_u8x16_and(fz_u8x16_shr32(a3, 8), k255);
+	return fz_u8x16_pack32(a0, a1, a2, a3);
+}
+
+static fz_forceinline unsigned char
+scale_byte_from_temp(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	int val = 128;
+
+	while (len-- > 0)
+	{
+		val += *src * *contrib++;
+		src += width;
+	}
+	return (unsigned char)(val>>8);
+}
+
+static void
+scale_row_from_temp_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+		fz_u8x16_store(&dst[x], scale_block_from_temp(&src[x], contrib, len, width));
+	for (; x < width; x++)
+		dst[x] = scale_byte_from_temp(&src[x], contrib, len, width);
+}
+
+static void
+scale_row_from_temp_alpha_simd(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	unsigned char out[16];
+	int len, x, j, c = 0;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		fz_u8x16_store(out, scale_block_from_temp(&src[x], contrib, len, width));
+		for (j = 0; j < 16; j++)
+		{
+			*dst++ = out[j];
+			if (++c == n)
+			{
+				*dst++ = 255;
+				c = 0;
+			}
+		}
+	}
+	for (; x < width; x++)
+	{
+		*dst++ = scale_byte_from_temp(&src[x], contrib, len, width);
+		if (++c == n)
+		{
+			*dst++ = 255;
+			c = 0;
+		}
+	}
+}
+
+#endif /* FZ_SIMD */
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int n, int forcealpha, int w, int h, int stride)
@@ -1545,6 +1848,68 @@ adjust_alpha_edges(fz_pixmap * FZ_RESTRICT pix, const fz_weights * FZ_RESTRICT r
 	}
 }
 
+typedef void (row_scale_in_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
+typedef void (row_scale_out_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+
+/*
+	A band of destination rows, with its own temporary buffer. Bands
+	share the source, the weights and the destination, but only read
+	the first two and write their own rows of the last, so several
+	can be scaled at once without locking. Nothing in here allocates
+	or throws.
+*/
+typedef struct
+{
+	const fz_pixmap *src;
+	fz_pixmap *dst;
+	const fz_weights *rows;
+	const fz_weights *cols;
+	row_scale_in_fn *scale_in;
+	row_scale_out_fn *scale_out;
+	unsigned char *temp;
+	int temp_span, temp_rows;
+	int flip_y;
+	int row0, row1;
+} scale_band;
+
+/* Don't bother with threads for scales that read less than this. */
+#define SCALE_BAND_MIN_WORK (1<<20)
+/* Nor make bands of fewer destination rows than this. */
+#define SCALE_BAND_MIN_ROWS 8
+
+static void
+scale_band_rows(void *arg)
+{
+	scale_band *band = arg;
+	const fz_pixmap *src = band->src;
+	const fz_weights *contrib_rows = band->rows;
+	int max_row, row;
+
+	/* Start by filling the temporary buffer with the first rows the
+	 * band needs. */
+	max_row = contrib_rows->index[contrib_rows->index[band->row0]];
+	for (row = band->row0; row < band->row1; row++)
+	{
+		/*
+		Which source rows do we need to have scaled into the
+		temporary buffer in order to be able to do the final
+		scale?
+		*/
+		int row_index = contrib_rows->index[row];
+		int row_min = contrib_rows->index[row_index++];
+		int row_len = contrib_rows->index[row_index];
+		while (max_row < row_min+row_len)
+		{
+			/* Scale another row */
+			assert(max_row < src->h);
+			(*band->scale_in)(&band->temp[band->temp_span*(max_row % band->temp_rows)], &src->samples[(band->flip_y ? (src->h-1-max_row): max_row)*src->stride], band->cols);
+			max_row++;
+		}
+
+		(*band->scale_out)(&band->dst->samples[row*band->dst->stride], band->temp, contrib_rows, band->cols->count, src->n, row);
+	}
+}
+
 fz_pixmap *
 fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip)
 {
@@ -1559,13 +1924,14 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	fz_weights *contrib_cols = NULL;
 	fz_pixmap *output = NULL;
 	unsigned char *temp = NULL;
-	int max_row, temp_span, temp_rows, row;
+	int temp_span, temp_rows;
 	int dst_w_int, dst_h_int, dst_x_int, dst_y_int;
 	int flip_x, flip_y, forcealpha;
 	fz_rect patch;
 
 	fz_var(contrib_cols);
 	fz_var(contrib_rows);
+	fz_var(temp);
 
 	/* Avoid extreme scales where overflows become problematic. */
 	if (w > (1<<24) || h > (1<<24) || w < -(1<<24) || h < -(1<<24))
@@ -1773,19 +2139,41 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	else
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
-		void (*row_scale_in)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
-		void (*row_scale_out)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+		row_scale_in_fn *row_scale_in;
+		row_scale_out_fn *row_scale_out;
+		scale_band *band = NULL;
+		fz_thread **thread = NULL;
+		int i, nbands, nthreads;
+		size_t temp_size;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
 		if (temp_span <= 0 || temp_rows > INT_MAX / temp_span)
 			goto cleanup;
+		temp_size = (size_t)temp_span*temp_rows;
+
+		/* Split large scales into bands of rows for worker threads,
+		 * when we've been asked to. */
+		nbands = 1;
+		if (ctx->tuning->image_scale_threads > 1 && (int64_t)src->w * src->h * src->n >= SCALE_BAND_MIN_WORK)
+		{
+			nbands = fz_mini(ctx->tuning->image_scale_threads, contrib_rows->count / SCALE_BAND_MIN_ROWS);
+			if (nbands < 1 || temp_size > SIZE_MAX / nbands)
+				nbands = 1;
+		}
+
+		fz_var(band);
 		fz_try(ctx)
 		{
-			temp = fz_calloc(ctx, (size_t)temp_span*temp_rows, sizeof(unsigned char));
+			temp = fz_calloc(ctx, temp_size * nbands, sizeof(unsigned char));
+			band = fz_malloc_array(ctx, nbands, scale_band);
+			if (nbands > 1)
+				thread = fz_malloc_array(ctx, nbands - 1, fz_thread *);
 		}
 		fz_catch(ctx)
 		{
+			fz_free(ctx, temp);
+			fz_free(ctx, band);
 			fz_drop_pixmap(ctx, output);
 			if (!cache_x)
 				fz_free(ctx, contrib_cols);
@@ -1812,27 +2200,57 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			break;
 		}
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
-		max_row = contrib_rows->index[contrib_rows->index[0]];
-		for (row = 0; row < contrib_rows->count; row++)
+#ifdef FZ_SIMD
+		if (src->n <= 4 && fz_paint_simd_enabled() && weights_fit_16(contrib_cols))
 		{
-			/*
-			Which source rows do we need to have scaled into the
-			temporary buffer in order to be able to do the final
-			scale?
-			*/
-			int row_index = contrib_rows->index[row];
-			int row_min = contrib_rows->index[row_index++];
-			int row_len = contrib_rows->index[row_index];
-			while (max_row < row_min+row_len)
+			switch (src->n)
 			{
-				/* Scale another row */
-				assert(max_row < src->h);
-				(*row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->stride], contrib_cols);
-				max_row++;
+			case 1:
+				row_scale_in = scale_row_to_temp1_simd;
+				break;
+			case 2:
+				row_scale_in = scale_row_to_temp2_simd;
+				break;
+			case 3:
+				row_scale_in = scale_row_to_temp3_simd;
+				break;
+			case 4:
+				row_scale_in = scale_row_to_temp4_simd;
+				break;
 			}
+		}
+		if (fz_paint_simd_enabled() && weights_fit_16(contrib_rows))
+			row_scale_out = forcealpha ? scale_row_from_temp_alpha_simd : scale_row_from_temp_simd;
+#endif
 
-			(*row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, contrib_cols->count, src->n, row);
+		for (i = 0; i < nbands; i++)
+		{
+			band[i].src = src;
+			band[i].dst = output;
+			band[i].rows = contrib_rows;
+			band[i].cols = contrib_cols;
+			band[i].scale_in = row_scale_in;
+			band[i].scale_out = row_scale_out;
+			band[i].temp = temp + temp_size * i;
+			band[i].temp_span = temp_span;
+			band[i].temp_rows = temp_rows;
+			band[i].flip_y = flip_y;
+			band[i].row0 = (int)((int64_t)contrib_rows->count * i / nbands);
+			band[i].row1 = (int)((int64_t)contrib_rows->count * (i + 1) / nbands);
 		}
+
+		/* Any bands we can't get a thread for are done here. */
+		nthreads = 0;
+		while (nthreads < nbands - 1 && (thread[nthreads] = fz_new_thread(scale_band_rows, &band[nthreads + 1])) != NULL)
+			nthreads++;
+		scale_band_rows(&band[0]);
+		for (i = nthreads + 1; i < nbands; i++)
+			scale_band_rows(&band[i]);
+		for (i = 0; i < nthreads; i++)
+			fz_join_thread(thread[i]);
+
+		fz_free(ctx, thread);
+		fz_free(ctx, band);
 		fz_free(ctx, temp);
 
 		if (forcealpha)
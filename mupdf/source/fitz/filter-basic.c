@@ -49,11 +49,18 @@ next_null(fz_context *ctx, fz_stream *stm, size_t max)
 		return EOF;
 	if (n > state->remain)
 		n = state->remain;
-	if (n > sizeof(state->buffer))
-		n = sizeof(state->buffer);
-
-	memcpy(state->buffer, state->chain->rp, n);
-	stm->rp = state->buffer;
+	if (fz_stream_is_memory(ctx, state->chain))
+	{
+		/* The data stays put, so hand it out where it is. */
+		stm->rp = state->chain->rp;
+	}
+	else
+	{
+		if (n > sizeof(state->buffer))
+			n = sizeof(state->buffer);
+		memcpy(state->buffer, state->chain->rp, n);
+		stm->rp = state->buffer;
+	}
 	stm->wp = stm->rp + n;
 	state->chain->rp += n;
 	state->remain -= n;
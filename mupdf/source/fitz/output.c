@@ -27,7 +27,10 @@
 
 #include "mupdf/fitz.h"
 
+#include "simd-imp.h"
+
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -339,6 +342,100 @@ fz_new_output_with_buffer(fz_context *ctx, fz_buffer *buf)
 	return out;
 }
 
+typedef struct
+{
+	fz_output_write_fn *emit;
+	void *arg;
+	unsigned char *chunk;
+	size_t len, cap;
+	int64_t pos;
+} chunk_output;
+
+static void
+chunk_write(fz_context *ctx, void *opaque, const void *data_, size_t n)
+{
+	chunk_output *state = opaque;
+	const unsigned char *data = data_;
+
+	state->pos += n;
+	while (n > 0)
+	{
+		/* Whole chunks are passed straight through; this is the usual
+		 * case, since the fz_output buffer is one chunk long. */
+		if (state->len == 0 && n >= state->cap)
+		{
+			state->emit(ctx, state->arg, data, state->cap);
+			data += state->cap;
+			n -= state->cap;
+		}
+		else
+		{
+			size_t k = fz_minz(n, state->cap - state->len);
+			memcpy(state->chunk + state->len, data, k);
+			state->len += k;
+			data += k;
+			n -= k;
+			if (state->len == state->cap)
+			{
+				state->emit(ctx, state->arg, state->chunk, state->len);
+				state->len = 0;
+			}
+		}
+	}
+}
+
+static int64_t
+chunk_tell(fz_context *ctx, void *opaque)
+{
+	chunk_output *state = opaque;
+	return state->pos;
+}
+
+static void
+chunk_close(fz_context *ctx, void *opaque)
+{
+	chunk_output *state = opaque;
+	if (state->len > 0)
+	{
+		state->emit(ctx, state->arg, state->chunk, state->len);
+		state->len = 0;
+	}
+}
+
+static void
+chunk_drop(fz_context *ctx, void *opaque)
+{
+	chunk_output *state = opaque;
+	fz_free(ctx, state->chunk);
+	fz_free(ctx, state);
+}
+
+fz_output *
+fz_new_output_with_chunks(fz_context *ctx, size_t chunk_size, fz_output_write_fn *emit, void *arg)
+{
+	chunk_output *state;
+	fz_output *out;
+
+	if (chunk_size == 0 || chunk_size > INT_MAX)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid output chunk size");
+
+	state = fz_malloc_struct(ctx, chunk_output);
+	fz_try(ctx)
+		state->chunk = Memento_label(fz_malloc(ctx, chunk_size), "output_chunk");
+	fz_catch(ctx)
+	{
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
+	}
+	state->emit = emit;
+	state->arg = arg;
+	state->cap = chunk_size;
+
+	out = fz_new_output(ctx, (int)chunk_size, state, chunk_write, chunk_close, chunk_drop);
+	out->tell = chunk_tell;
+	return out;
+}
+
 void
 fz_close_output(fz_context *ctx, fz_output *out)
 {
@@ -601,39 +698,120 @@ fz_write_rune(fz_context *ctx, fz_output *out, int rune)
 	fz_write_data(ctx, out, data, fz_runetochar(data, rune));
 }
 
-void
-fz_write_base64(fz_context *ctx, fz_output *out, const unsigned char *data, size_t size, int newline)
+static const char base64_set[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef FZ_SIMD
+/* Encode 12 bytes as 16 base64 characters. */
+static void
+encode_base64_block(char *out, const unsigned char *data)
+{
+	unsigned char lanes[16];
+	fz_u8x16 v, w, off;
+	int i;
+
+	/* One group of three bytes to each 32-bit lane, first byte
+	 * highest, and split into sextets with the first in the low
+	 * byte so that they come out in order. */
+	for (i = 0; i < 4; i++)
+	{
+		lanes[4*i+0] = data[3*i+2];
+		lanes[4*i+1] = data[3*i+1];
+		lanes[4*i+2] = data[3*i+0];
+		lanes[4*i+3] = 0;
+	}
+	v = fz_u8x16_load(lanes);
+	w = fz_u8x16_shr32(v, 18);
+	w = fz_u8x16_or(w, fz_u8x16_and(fz_u8x16_shr32(v, 4), fz_u8x16_splat32(0x3f00)));
+	w = fz_u8x16_or(w, fz_u8x16_and(fz_u8x16_shl32(v, 10), fz_u8x16_splat32(0x3f0000)));
+	w = fz_u8x16_or(w, fz_u8x16_and(fz_u8x16_shl32(v, 24), fz_u8x16_splat32(0x3f000000)));
+
+	/* Map each range of sextets onto its part of the alphabet by
+	 * adding an offset; bytes wrap, so negative offsets work. */
+	off = fz_u8x16_splat('A');
+	off = fz_u8x16_select(fz_u8x16_le(fz_u8x16_splat(26), w), fz_u8x16_splat('a' - 26), off);
+	off = fz_u8x16_select(fz_u8x16_le(fz_u8x16_splat(52), w), fz_u8x16_splat((unsigned char)('0' - 52)), off);
+	off = fz_u8x16_select(fz_u8x16_eq(w, fz_u8x16_splat(62)), fz_u8x16_splat((unsigned char)('+' - 62)), off);
+	off = fz_u8x16_select(fz_u8x16_eq(w, fz_u8x16_splat(63)), fz_u8x16_splat((unsigned char)('/' - 63)), off);
+	fz_u8x16_store((unsigned char *)out, fz_u8x16_add(w, off));
+}
+#endif
+
+/* Encode size bytes, padding the last group. Returns the length. */
+static size_t
+encode_base64(char *out, const unsigned char *data, size_t size)
 {
-	static const char set[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	size_t i;
-	for (i = 0; i + 3 <= size; i += 3)
+	char *p = out;
+	size_t i = 0;
+
+#ifdef FZ_SIMD
+	for (; i + 12 <= size; i += 12, p += 16)
+		encode_base64_block(p, data + i);
+#endif
+	for (; i + 3 <= size; i += 3)
 	{
 		int c = data[i];
 		int d = data[i+1];
 		int e = data[i+2];
-		if (newline && (i & 15) == 0)
-			fz_write_byte(ctx, out, '\n');
-		fz_write_byte(ctx, out, set[c>>2]);
-		fz_write_byte(ctx, out, set[((c&3)<<4)|(d>>4)]);
-		fz_write_byte(ctx, out, set[((d&15)<<2)|(e>>6)]);
-		fz_write_byte(ctx, out, set[e&63]);
+		*p++ = base64_set[c>>2];
+		*p++ = base64_set[((c&3)<<4)|(d>>4)];
+		*p++ = base64_set[((d&15)<<2)|(e>>6)];
+		*p++ = base64_set[e&63];
 	}
 	if (size - i == 2)
 	{
 		int c = data[i];
 		int d = data[i+1];
-		fz_write_byte(ctx, out, set[c>>2]);
-		fz_write_byte(ctx, out, set[((c&3)<<4)|(d>>4)]);
-		fz_write_byte(ctx, out, set[((d&15)<<2)]);
-		fz_write_byte(ctx, out, '=');
+		*p++ = base64_set[c>>2];
+		*p++ = base64_set[((c&3)<<4)|(d>>4)];
+		*p++ = base64_set[((d&15)<<2)];
+		*p++ = '=';
 	}
 	else if (size - i == 1)
 	{
 		int c = data[i];
-		fz_write_byte(ctx, out, set[c>>2]);
-		fz_write_byte(ctx, out, set[((c&3)<<4)]);
-		fz_write_byte(ctx, out, '=');
-		fz_write_byte(ctx, out, '=');
+		*p++ = base64_set[c>>2];
+		*p++ = base64_set[((c&3)<<4)];
+		*p++ = '=';
+		*p++ = '=';
+	}
+	return p - out;
+}
+
+/*
+	Lines hold 48 bytes (64 characters), and with newline set each
+	line that has a whole group in it starts with a newline. The
+	data is encoded a batch of lines at a time into a buffer on the
+	stack, and passed on in one go.
+*/
+#define BASE64_LINE 48
+#define BASE64_BATCH (BASE64_LINE * 16)
+
+static size_t
+encode_base64_batch(char *out, const unsigned char *data, size_t size, int newline)
+{
+	char *p = out;
+	size_t i, n;
+
+	for (i = 0; i < size; i += n)
+	{
+		n = fz_minz(size - i, BASE64_LINE);
+		if (newline && n >= 3)
+			*p++ = '\n';
+		p += encode_base64(p, data + i, n);
+	}
+	return p - out;
+}
+
+void
+fz_write_base64(fz_context *ctx, fz_output *out, const unsigned char *data, size_t size, int newline)
+{
+	char buf[BASE64_BATCH / 3 * 4 + BASE64_BATCH / BASE64_LINE];
+	size_t i, n;
+
+	for (i = 0; i < size; i += n)
+	{
+		n = fz_minz(size - i, BASE64_BATCH);
+		fz_write_data(ctx, out, buf, encode_base64_batch(buf, data + i, n, newline));
 	}
 }
 
@@ -648,36 +826,13 @@ fz_write_base64_buffer(fz_context *ctx, fz_output *out, fz_buffer *buf, int newl
 void
 fz_append_base64(fz_context *ctx, fz_buffer *out, const unsigned char *data, size_t size, int newline)
 {
-	static const char set[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	size_t i;
-	for (i = 0; i + 3 <= size; i += 3)
-	{
-		int c = data[i];
-		int d = data[i+1];
-		int e = data[i+2];
-		if (newline && (i & 15) == 0)
-			fz_append_byte(ctx, out, '\n');
-		fz_append_byte(ctx, out, set[c>>2]);
-		fz_append_byte(ctx, out, set[((c&3)<<4)|(d>>4)]);
-		fz_append_byte(ctx, out, set[((d&15)<<2)|(e>>6)]);
-		fz_append_byte(ctx, out, set[e&63]);
-	}
-	if (size - i == 2)
-	{
-		int c = data[i];
-		int d = data[i+1];
-		fz_append_byte(ctx, out, set[c>>2]);
-		fz_append_byte(ctx, out, set[((c&3)<<4)|(d>>4)]);
-		fz_append_byte(ctx, out, set[((d&15)<<2)]);
-		fz_append_byte(ctx, out, '=');
-	}
-	else if (size - i == 1)
+	char buf[BASE64_BATCH / 3 * 4 + BASE64_BATCH / BASE64_LINE];
+	size_t i, n;
+
+	for (i = 0; i < size; i += n)
 	{
-		int c = data[i];
-		fz_append_byte(ctx, out, set[c>>2]);
-		fz_append_byte(ctx, out, set[((c&3)<<4)]);
-		fz_append_byte(ctx, out, '=');
-		fz_append_byte(ctx, out, '=');
+		n = fz_minz(size - i, BASE64_BATCH);
+		fz_append_data(ctx, out, buf, encode_base64_batch(buf, data + i, n, newline));
 	}
 }
 
@@ -0,0 +1,290 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+	This file is #included by draw-paint-simd.c once for each
+	instruction set, after paint-span-simd.h, to produce its image
+	painters. It uses the same helpers, and also:
+
+	positions(frac, steps, &lo, &hi) adds frac to the 16 32-bit steps,
+	and gives the whole parts as bytes and the fractions as 16-bit
+	lanes (the first 8 in lo, the rest in hi).
+
+	join(lo, hi) gives the 16-bit lanes held in two byte vectors, and
+	mulfrac(a, f) gives (a * f) >> PREC for signed a and fraction f.
+
+	Each step paints one 16 byte vector of destination. The samples
+	for it are shuffled out of a single 16 bytes of the source row
+	where they fit, as they do when an upright image is being scaled
+	up or copied. Otherwise they are gathered one by one into buffers
+	first, which only pays for interpolated images.
+*/
+
+static SIMD_TARGET fz_forceinline SIMD_W16
+SIMD_OP(lerp)(SIMD_W16 a, SIMD_W16 b, SIMD_W16 f)
+{
+	return SIMD_OP(add)(a, SIMD_OP(mulfrac)(SIMD_OP(sub)(b, a), f));
+}
+
+static SIMD_TARGET fz_forceinline SIMD_W16
+SIMD_OP(bilerp)(SIMD_V8 a, SIMD_V8 b, SIMD_V8 c, SIMD_V8 d, SIMD_W16 uf, SIMD_W16 vf)
+{
+	SIMD_W16 ab = SIMD_OP(lerp)(SIMD_OP(widen)(a), SIMD_OP(widen)(b), uf);
+	SIMD_W16 cd = SIMD_OP(lerp)(SIMD_OP(widen)(c), SIMD_OP(widen)(d), uf);
+	return SIMD_OP(lerp)(ab, cd, vf);
+}
+
+/* fz_mul255, exactly. */
+static SIMD_TARGET fz_forceinline SIMD_W16
+SIMD_OP(mul255)(SIMD_W16 a, SIMD_W16 b, SIMD_W16 k128)
+{
+	SIMD_W16 x = SIMD_OP(add)(SIMD_OP(mul)(a, b), k128);
+	return SIMD_OP(shr8)(SIMD_OP(add)(x, SIMD_OP(shr8)(x)));
+}
+
+static SIMD_TARGET fz_forceinline void
+SIMD_OP(template_paint_affine)(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int dn, int sn, int alpha, int lerp, int *px0, int *px1)
+{
+	const affine_layout *layout = &affine_layouts[dn == 3][da][sn == 3][sa];
+	int pixels = layout->pixels;
+	int dn1 = dn + da;
+	int sn1 = sn + sa;
+	int dstep = pixels * dn1;
+	int single;
+	int32_t steps[16];
+	byte buf[4][16];
+	int16_t frac[16];
+	affint iw, ih;
+	int x, x0, x1, vx0, vx1, more;
+	SIMD_V8 pix, comp, salpha, opaque, inside, sn1v, dv;
+	SIMD_W16 k128, k255, kalpha;
+
+	*px0 = *px1 = 0;
+
+	/* Find where every sample is inside the image. */
+	if (lerp)
+	{
+		iw = (sw - HALF) >> PREC;
+		ih = (sh - HALF) >> PREC;
+		affine_run(u, fa, (iw - 1) << PREC, w, &x0, &x1);
+		affine_run(v, fb, (ih - 1) << PREC, w, &vx0, &vx1);
+	}
+	else
+	{
+		iw = sw;
+		ih = sh;
+		affine_run(u, fa, iw << PREC, w, &x0, &x1);
+		affine_run(v, fb, ih << PREC, w, &vx0, &vx1);
+	}
+	if (vx0 > x0)
+		x0 = vx0;
+	if (vx1 < x1)
+		x1 = vx1;
+	if (x0 + pixels > x1 || (w - x0) * dn1 < 16)
+		return;
+
+	/* Gathering nearest samples is no quicker than the C painters. */
+	single = fb == 0 && fa > 0 && (((MASK + (pixels - 1) * fa) >> PREC) + lerp + 1) * sn1 <= 16;
+	if (!single && !lerp)
+		return;
+	if (single)
+		for (x = 0; x < 16; x++)
+			steps[x] = (int32_t)(x * fa);
+
+	pix = SIMD_OP(load)(layout->pix);
+	comp = SIMD_OP(load)(layout->comp);
+	salpha = SIMD_OP(load)(layout->alpha);
+	opaque = SIMD_OP(load)(layout->opaque);
+	inside = SIMD_OP(load)(layout->inside);
+	sn1v = fz_u8x16_splat(sn1);
+	k128 = SIMD_OP(splat)(128);
+	k255 = SIMD_OP(splat)(255);
+	kalpha = SIMD_OP(splat)(alpha);
+
+	u += x0 * fa;
+	v += x0 * fb;
+	dp += x0 * dn1;
+	dv = SIMD_OP(load)(dp);
+	x = x0;
+	do
+	{
+		SIMD_V8 s, a, b, c, d, frlo, frhi, out, next;
+		SIMD_V8 sa0, sa1, sa2, sa3;
+		SIMD_W16 ya = k255;
+		affint ui = u >> PREC;
+
+		sa0 = sa1 = sa2 = sa3 = inside;
+		if (single && ui * sn1 + 16 <= iw * sn1)
+		{
+			const byte *row = sp + (v >> PREC) * ss + ui * sn1;
+			SIMD_V8 offs = SIMD_OP(positions)((int)(u & MASK), steps, &frlo, &frhi);
+			SIMD_V8 base, idx;
+			offs = SIMD_OP(shuffle)(SIMD_OP(load)(layout->scale), offs);
+			base = SIMD_OP(shuffle)(offs, pix);
+			idx = fz_u8x16_add(base, comp);
+			a = SIMD_OP(load)(row);
+			if (lerp)
+			{
+				c = SIMD_OP(load)(row + ss);
+				if (sa)
+				{
+					SIMD_V8 aidx = fz_u8x16_add(base, salpha);
+					SIMD_V8 bidx = fz_u8x16_add(aidx, sn1v);
+					sa0 = SIMD_OP(shuffle)(a, aidx);
+					sa1 = SIMD_OP(shuffle)(a, bidx);
+					sa2 = SIMD_OP(shuffle)(c, aidx);
+					sa3 = SIMD_OP(shuffle)(c, bidx);
+				}
+				b = SIMD_OP(shuffle)(a, fz_u8x16_add(idx, sn1v));
+				d = SIMD_OP(shuffle)(c, fz_u8x16_add(idx, sn1v));
+				a = SIMD_OP(shuffle)(a, idx);
+				c = SIMD_OP(shuffle)(c, idx);
+			}
+			else
+			{
+				if (sa)
+					sa0 = SIMD_OP(shuffle)(a, fz_u8x16_add(base, salpha));
+				a = SIMD_OP(shuffle)(a, idx);
+			}
+		}
+		else
+		{
+			affint uk = u, vk = v;
+			int k;
+			for (k = 0; k < pixels; k++)
+			{
+				const byte *p = sp + (vk >> PREC) * ss + (uk >> PREC) * sn1;
+				copy_sample(buf[0] + k * sn1, p, sn1);
+				if (lerp)
+				{
+					copy_sample(buf[1] + k * sn1, p + sn1, sn1);
+					copy_sample(buf[2] + k * sn1, p + ss, sn1);
+					copy_sample(buf[3] + k * sn1, p + ss + sn1, sn1);
+					frac[k] = (int16_t)((fb == 0 ? uk : vk) & MASK);
+				}
+				uk += fa;
+				vk += fb;
+			}
+			a = SIMD_OP(load)(buf[0]);
+			if (sa)
+				sa0 = SIMD_OP(shuffle)(a, SIMD_OP(load)(layout->packed_alpha));
+			a = SIMD_OP(shuffle)(a, SIMD_OP(load)(layout->packed));
+			if (lerp)
+			{
+				b = SIMD_OP(load)(buf[1]);
+				c = SIMD_OP(load)(buf[2]);
+				d = SIMD_OP(load)(buf[3]);
+				frlo = SIMD_OP(load)((const byte *)frac);
+				frhi = SIMD_OP(load)((const byte *)(frac + 8));
+				if (sa)
+				{
+					SIMD_V8 aidx = SIMD_OP(load)(layout->packed_alpha);
+					sa1 = SIMD_OP(shuffle)(b, aidx);
+					sa2 = SIMD_OP(shuffle)(c, aidx);
+					sa3 = SIMD_OP(shuffle)(d, aidx);
+				}
+				b = SIMD_OP(shuffle)(b, SIMD_OP(load)(layout->packed));
+				c = SIMD_OP(shuffle)(c, SIMD_OP(load)(layout->packed));
+				d = SIMD_OP(shuffle)(d, SIMD_OP(load)(layout->packed));
+			}
+		}
+
+		if (lerp)
+		{
+			SIMD_W16 f, uf, vf;
+			if (pixels == 16)
+				f = SIMD_OP(join)(frlo, frhi);
+			else
+				f = SIMD_OP(join)(SIMD_OP(shuffle)(frlo, SIMD_OP(load)(layout->frac_lo)), SIMD_OP(shuffle)(frlo, SIMD_OP(load)(layout->frac_hi)));
+			if (fb == 0)
+			{
+				uf = f;
+				vf = SIMD_OP(splat)((int)(v & MASK));
+			}
+			else
+			{
+				uf = SIMD_OP(splat)((int)(u & MASK));
+				vf = f;
+			}
+			s = SIMD_OP(narrow)(SIMD_OP(bilerp)(a, b, c, d, uf, vf));
+			if (sa)
+				ya = SIMD_OP(bilerp)(sa0, sa1, sa2, sa3, uf, vf);
+		}
+		else
+		{
+			s = a;
+			if (sa)
+				ya = SIMD_OP(widen)(sa0);
+		}
+		s = fz_u8x16_or(s, opaque);
+
+		if (!sa && alpha == 255)
+		{
+			/* Opaque: just copy. */
+			out = SIMD_OP(select)(inside, s, dv);
+		}
+		else
+		{
+			/* x.alpha + d.(255 - ya.alpha) for pixels with any alpha */
+			SIMD_W16 ea = sa ? (alpha == 255 ? ya : SIMD_OP(mul255)(ya, kalpha, k128)) : kalpha;
+			SIMD_W16 r = SIMD_OP(widen)(s);
+			if (alpha != 255)
+				r = SIMD_OP(mul255)(r, kalpha, k128);
+			r = SIMD_OP(add)(r, SIMD_OP(mul255)(SIMD_OP(widen)(dv), SIMD_OP(sub)(k255, ea), k128));
+			/* Stored as bytes, as the C painters do. */
+			r = SIMD_OP(and)(r, k255);
+			out = SIMD_OP(select)(SIMD_OP(andnot)(SIMD_OP(eq0)(SIMD_OP(narrow)(ea)), inside), SIMD_OP(narrow)(r), dv);
+		}
+
+		x += pixels;
+		u += pixels * fa;
+		v += pixels * fb;
+		more = x + pixels <= x1 && (w - x) * dn1 >= 16;
+		next = dv;
+		if (more)
+			next = SIMD_OP(load)(dp + dstep);
+		SIMD_OP(store)(dp, out);
+		dv = next;
+		dp += dstep;
+	}
+	while (more);
+
+	*px0 = x0;
+	*px1 = x;
+}
+
+static SIMD_TARGET void
+SIMD_OP(paint_affine_near)(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int dn, int sn, int alpha, int *x0, int *x1)
+{
+	SIMD_OP(template_paint_affine)(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, 0, x0, x1);
+}
+
+static SIMD_TARGET void
+SIMD_OP(paint_affine_lerp)(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int dn, int sn, int alpha, int *x0, int *x1)
+{
+	SIMD_OP(template_paint_affine)(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, dn, sn, alpha, 1, x0, x1);
+}
+
+#undef SIMD_OP
+#undef SIMD_V8
+#undef SIMD_W16
+#undef SIMD_TARGET
@@ -0,0 +1,209 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+	This file is #included by draw-paint-simd.c once for each
+	instruction set, to produce its span painters.
+
+	SIMD_OP(x) names the helpers (and, with it, the painters) for the
+	instruction set, SIMD_V8 and SIMD_W16 are its types for 16 bytes
+	and for 16 16-bit lanes, and SIMD_TARGET is whatever the compiler
+	needs to be allowed to use it.
+
+	The painters work 16 destination bytes at a time, holding as many
+	whole pixels as fit; the bytes past the last pixel are given a
+	weight of 0, so are written back unchanged. Every step loads 16
+	bytes from each of its inputs, so the loops stop while at least
+	16 pixels remain and the rest (and short spans) are done in C.
+
+	The arithmetic is the same as the C painters', so the results are
+	identical to theirs. Blends are done as s.a + d.(256-a), which is
+	the same as FZ_BLEND and fits in 16 bits.
+*/
+
+static SIMD_TARGET fz_forceinline SIMD_W16
+SIMD_OP(expand)(SIMD_V8 a)
+{
+	SIMD_W16 w = SIMD_OP(widen)(a);
+	return SIMD_OP(add)(w, SIMD_OP(shr7)(w));
+}
+
+static SIMD_TARGET fz_forceinline SIMD_W16
+SIMD_OP(blend)(SIMD_W16 s, SIMD_W16 d, SIMD_W16 a, SIMD_W16 k256)
+{
+	return SIMD_OP(shr8)(SIMD_OP(add)(SIMD_OP(mul)(s, a), SIMD_OP(mul)(d, SIMD_OP(sub)(k256, a))));
+}
+
+/*
+	Where a step is less than 16 bytes, the next one's load overlaps
+	this one's store, and would have to wait for it; so each step
+	loads the destination for the next before storing. The bytes they
+	share are written back unchanged, so this gives the same result.
+*/
+
+/* Blend a non-premultiplied color in mask over destination */
+static SIMD_TARGET void
+SIMD_OP(paint_span_with_color)(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int n1 = n - da;
+	int sa = FZ_EXPAND(color[n1]);
+
+	if (w >= 16)
+	{
+		const span_layout *layout = &color_layouts[n1][da];
+		int pixels = layout->pixels;
+		int step = pixels * n;
+		byte pixel[16] = { 0 };
+		SIMD_V8 pix, dv;
+		SIMD_W16 s, k256, wsa;
+
+		memcpy(pixel, color, n1);
+		if (da)
+			pixel[n1] = 255;
+		pix = SIMD_OP(load)(layout->pix);
+		s = SIMD_OP(widen)(SIMD_OP(shuffle)(SIMD_OP(load)(pixel), SIMD_OP(load)(layout->src)));
+		k256 = SIMD_OP(splat)(256);
+		wsa = SIMD_OP(splat)(sa);
+
+		dv = SIMD_OP(load)(dp);
+		do
+		{
+			SIMD_V8 m = SIMD_OP(shuffle)(SIMD_OP(load)(mp), pix);
+			SIMD_V8 next = dv;
+			int changed = !SIMD_OP(is_zero)(m);
+			if (changed)
+			{
+				SIMD_W16 a = SIMD_OP(expand)(m);
+				if (sa != 256)
+					a = SIMD_OP(shr8)(SIMD_OP(mul)(a, wsa));
+				dv = SIMD_OP(narrow)(SIMD_OP(blend)(s, SIMD_OP(widen)(dv), a, k256));
+			}
+			w -= pixels;
+			if (w >= 16)
+				next = SIMD_OP(load)(dp + step);
+			if (changed)
+				SIMD_OP(store)(dp, dv);
+			dv = next;
+			dp += step;
+			mp += pixels;
+		}
+		while (w >= 16);
+	}
+
+	if (w > 0)
+		span_with_color_tail(dp, mp, n1, da, w, color, sa);
+}
+
+/* Blend source in mask over destination */
+static SIMD_TARGET void
+SIMD_OP(paint_span_with_mask)(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop)
+{
+	if (w >= 16)
+	{
+		const span_layout *layout = &mask_layouts[n][a];
+		int pixels = layout->pixels;
+		int step = pixels * (n + a);
+		SIMD_V8 pix = SIMD_OP(load)(layout->pix);
+		SIMD_V8 alpha = SIMD_OP(load)(layout->alpha);
+		SIMD_W16 k256 = SIMD_OP(splat)(256);
+		SIMD_V8 dv = SIMD_OP(load)(dp);
+
+		do
+		{
+			SIMD_V8 sv = SIMD_OP(load)(sp);
+			SIMD_V8 m = SIMD_OP(shuffle)(SIMD_OP(load)(mp), pix);
+			SIMD_V8 next = dv;
+			int changed;
+			/* Pixels with no source alpha are left alone. */
+			if (a)
+				m = SIMD_OP(andnot)(SIMD_OP(eq0)(SIMD_OP(shuffle)(sv, alpha)), m);
+			changed = !SIMD_OP(is_zero)(m);
+			if (changed)
+				dv = SIMD_OP(narrow)(SIMD_OP(blend)(SIMD_OP(widen)(sv), SIMD_OP(widen)(dv), SIMD_OP(expand)(m), k256));
+			w -= pixels;
+			if (w >= 16)
+				next = SIMD_OP(load)(dp + step);
+			if (changed)
+				SIMD_OP(store)(dp, dv);
+			dv = next;
+			dp += step;
+			sp += step;
+			mp += pixels;
+		}
+		while (w >= 16);
+	}
+
+	if (w > 0)
+		span_with_mask_tail(dp, sp, mp, n, a, w);
+}
+
+/* Blend source with alpha over destination */
+static SIMD_TARGET void
+SIMD_OP(paint_span_sa)(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	if (w >= 16)
+	{
+		const span_layout *layout = &over_layouts[n][da];
+		int pixels = layout->pixels;
+		int dstep = pixels * (n + da);
+		int sstep = pixels * (n + 1);
+		SIMD_V8 src = SIMD_OP(load)(layout->src);
+		SIMD_V8 salpha = SIMD_OP(load)(layout->alpha);
+		SIMD_W16 k256 = SIMD_OP(splat)(256);
+		SIMD_W16 k255 = SIMD_OP(splat)(255);
+		SIMD_V8 dv = SIMD_OP(load)(dp);
+
+		do
+		{
+			SIMD_V8 sv = SIMD_OP(load)(sp);
+			SIMD_V8 sab = SIMD_OP(shuffle)(sv, salpha);
+			SIMD_V8 next = dv;
+			int changed = !SIMD_OP(is_zero)(sab);
+			if (changed)
+			{
+				SIMD_W16 t = SIMD_OP(sub)(k256, SIMD_OP(expand)(sab));
+				SIMD_W16 r = SIMD_OP(shr8)(SIMD_OP(mul)(SIMD_OP(widen)(dv), t));
+				r = SIMD_OP(add)(SIMD_OP(widen)(SIMD_OP(shuffle)(sv, src)), r);
+				/* Stored as bytes, as the C painters do. */
+				r = SIMD_OP(and)(r, k255);
+				dv = SIMD_OP(select)(SIMD_OP(eq0)(sab), dv, SIMD_OP(narrow)(r));
+			}
+			w -= pixels;
+			if (w >= 16)
+				next = SIMD_OP(load)(dp + dstep);
+			if (changed)
+				SIMD_OP(store)(dp, dv);
+			dv = next;
+			dp += dstep;
+			sp += sstep;
+		}
+		while (w >= 16);
+	}
+
+	if (w > 0)
+		span_sa_tail(dp, da, sp, n, w);
+}
+
+#undef SIMD_OP
+#undef SIMD_V8
+#undef SIMD_W16
+#undef SIMD_TARGET
@@ -0,0 +1,222 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#ifndef FITZ_SIMD_IMP_H
+#define FITZ_SIMD_IMP_H
+
+/*
+	A thin layer over the 128-bit vector instructions of the target.
+	For now that is SSE2 on x86 only; FZ_SIMD is defined when it is
+	available. Other instruction sets can be added here once they can
+	be built and put through the same tests.
+
+	Code with a vector path keeps its scalar path, and uses it both
+	when FZ_SIMD is not defined and for the ragged ends of its data.
+	Define FZ_DISABLE_SIMD (make simd=no) to build with the scalar
+	paths only.
+
+	Byte lanes are unsigned. Comparisons give a mask with all bits of
+	a lane set where the comparison holds.
+*/
+
+#ifndef FZ_DISABLE_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FZ_SIMD_SSE2
+#endif
+#endif
+
+#ifdef FZ_SIMD_SSE2
+#define FZ_SIMD
+
+#include <emmintrin.h>
+typedef __m128i fz_u8x16;
+
+static inline fz_u8x16 fz_u8x16_load(const unsigned char *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void fz_u8x16_store(unsigned char *p, fz_u8x16 a)
+{
+	_mm_storeu_si128((__m128i *)p, a);
+}
+
+static inline fz_u8x16 fz_u8x16_splat(unsigned char c)
+{
+	return _mm_set1_epi8((char)c);
+}
+
+static inline fz_u8x16 fz_u8x16_or(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_or_si128(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_and(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_and_si128(a, b);
+}
+
+/* Wrapping byte arithmetic. */
+static inline fz_u8x16 fz_u8x16_add(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_add_epi8(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_sub(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_sub_epi8(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_eq(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_cmpeq_epi8(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_le(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_cmpeq_epi8(_mm_min_epu8(a, b), a);
+}
+
+/* Lanes of a where mask is set, of b elsewhere. */
+static inline fz_u8x16 fz_u8x16_select(fz_u8x16 mask, fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+	The same register seen as four 32-bit lanes, in memory order.
+	Callers that build lane values from bytes assume a little-endian
+	target, as x86 is.
+*/
+static inline fz_u8x16 fz_u8x16_splat32(uint32_t v)
+{
+	return _mm_set1_epi32((int)v);
+}
+
+static inline fz_u8x16 fz_u8x16_shl32(fz_u8x16 a, int n)
+{
+	return _mm_slli_epi32(a, n);
+}
+
+static inline fz_u8x16 fz_u8x16_shr32(fz_u8x16 a, int n)
+{
+	return _mm_srli_epi32(a, n);
+}
+
+/* 8 bytes from p in the low lanes, zeros in the high ones. */
+static inline fz_u8x16 fz_u8x16_load64(const unsigned char *p)
+{
+	return _mm_loadl_epi64((const __m128i *)p);
+}
+
+/* The low (or high) 8 lanes of a and b, interleaved: a0 b0 a1 b1... */
+static inline fz_u8x16 fz_u8x16_zip_lo(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_unpacklo_epi8(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_zip_hi(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_unpackhi_epi8(a, b);
+}
+
+/* The same, for the low (or high) 4 16-bit lanes. */
+static inline fz_u8x16 fz_u8x16_zip16_lo(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_unpacklo_epi16(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_zip16_hi(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_unpackhi_epi16(a, b);
+}
+
+/*
+	Multiply the signed 16-bit lanes of a and b, and add each pair of
+	products into a 32-bit lane. Zipping bytes with zeros gives the
+	16-bit lanes to feed this with.
+*/
+static inline fz_u8x16 fz_u8x16_madd16(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_madd_epi16(a, b);
+}
+
+static inline fz_u8x16 fz_u8x16_add32(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_add_epi32(a, b);
+}
+
+/* The sum of the 32-bit lanes of a. */
+static inline int fz_u8x16_sum32(fz_u8x16 a)
+{
+	a = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0x4e));
+	a = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0xb1));
+	return _mm_cvtsi128_si32(a);
+}
+
+/* The 32-bit lanes of a and b as 16-bit lanes, which they must fit. */
+static inline fz_u8x16 fz_u8x16_narrow32(fz_u8x16 a, fz_u8x16 b)
+{
+	return _mm_packs_epi32(a, b);
+}
+
+/* The 32-bit lanes of a, b, c and d, which must be 0 to 255, as bytes. */
+static inline fz_u8x16 fz_u8x16_pack32(fz_u8x16 a, fz_u8x16 b, fz_u8x16 c, fz_u8x16 d)
+{
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+/* Index of the first lane set in mask, or 16 if none is. */
+static inline int fz_u8x16_first(fz_u8x16 mask)
+{
+	unsigned int bits = (unsigned int)_mm_movemask_epi8(mask);
+	int i = 0;
+	if (!bits)
+		return 16;
+#if defined(__GNUC__) || defined(__clang__)
+	i = __builtin_ctz(bits);
+#else
+	while (!(bits & 1))
+		bits >>= 1, i++;
+#endif
+	return i;
+}
+
+/* Whether every lane of mask is set. */
+static inline int fz_u8x16_all(fz_u8x16 mask)
+{
+	return _mm_movemask_epi8(mask) == 0xffff;
+}
+
+/*
+	Combine pairs of lanes holding 4-bit values, high nibble first,
+	into 8 bytes at out.
+*/
+static inline void fz_u8x16_pack_nibbles(unsigned char *out, fz_u8x16 a)
+{
+	__m128i w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, _mm_set1_epi16(0xff)), 4), _mm_srli_epi16(a, 8));
+	_mm_storel_epi64((__m128i *)out, _mm_packus_epi16(w, w));
+}
+
+#endif
+
+#endif
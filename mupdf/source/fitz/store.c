@@ -59,6 +59,9 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* Number of times memory has been short; see fz_store_scavenge_count. */
+	int scavenges;
 };
 
 void
@@ -822,6 +825,7 @@ scavenge(fz_context *ctx, size_t tofree)
 		return 0;
 
 	store->scavenging = 1;
+	store->scavenges++;
 
 	do
 	{
@@ -972,6 +976,20 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 	return 0;
 }
 
+int fz_store_scavenge_count(fz_context *ctx)
+{
+	int count;
+
+	if (ctx->store == NULL)
+		return 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	count = ctx->store->scavenges;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return count;
+}
+
 int
 fz_shrink_store(fz_context *ctx, unsigned int percent)
 {
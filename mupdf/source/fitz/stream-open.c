@@ -31,6 +31,12 @@
 #include <errno.h>
 #include <stdio.h>
 
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 int
 fz_file_exists(fz_context *ctx, const char *path)
 {
@@ -174,6 +180,117 @@ fz_stream *fz_open_file_ptr_no_close(fz_context *ctx, FILE *file)
 	return stm;
 }
 
+#ifdef USE_MMAP
+
+/* Memory mapped file stream */
+
+/*
+	A regular file is mapped whole and served as a single window, the
+	same way as a memory stream: seeking only moves rp, and reads never
+	make a system call or copy.
+*/
+
+typedef struct
+{
+	unsigned char *data;
+	size_t len;
+	dev_t dev;
+	ino_t ino;
+} fz_mapped_file;
+
+static int next_buffer(fz_context *ctx, fz_stream *stm, size_t max);
+
+static void seek_mapped(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	fz_mapped_file *state = stm->state;
+
+	/* Convert to absolute pos */
+	if (whence == 1)
+		offset += stm->rp - state->data;
+	else if (whence == 2)
+		offset += (int64_t)state->len;
+
+	if (offset < 0)
+		offset = 0;
+	if ((uint64_t)offset > state->len)
+		offset = (int64_t)state->len;
+	stm->rp = state->data + offset;
+}
+
+static void drop_mapped(fz_context *ctx, void *state_)
+{
+	fz_mapped_file *state = state_;
+	if (munmap(state->data, state->len) < 0)
+		fz_warn(ctx, "unmap error: %s", strerror(errno));
+	fz_free(ctx, state);
+}
+
+/* Returns NULL, leaving file open, if it cannot be mapped. */
+static fz_stream *
+fz_open_mapped_file(fz_context *ctx, FILE *file)
+{
+	fz_mapped_file *state = NULL;
+	fz_stream *stm;
+	struct stat st;
+	void *data;
+	size_t len;
+
+	if (fstat(fileno(file), &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	if (st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX)
+		return NULL;
+	len = (size_t)st.st_size;
+
+	data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	/* The mapping outlives the descriptor. */
+	fclose(file);
+
+	fz_try(ctx)
+		state = fz_malloc_struct(ctx, fz_mapped_file);
+	fz_catch(ctx)
+	{
+		munmap(data, len);
+		fz_rethrow(ctx);
+	}
+	state->data = data;
+	state->len = len;
+	state->dev = st.st_dev;
+	state->ino = st.st_ino;
+
+	stm = fz_new_stream(ctx, state, next_buffer, drop_mapped);
+	stm->seek = seek_mapped;
+
+	stm->rp = state->data;
+	stm->wp = state->data + len;
+
+	stm->pos = (int64_t)len;
+
+	return stm;
+}
+
+#endif
+
+int
+fz_stream_maps_file(fz_context *ctx, fz_stream *stm, const char *filename)
+{
+#ifdef USE_MMAP
+	fz_mapped_file *state;
+	struct stat st;
+
+	if (!stm || stm->seek != seek_mapped)
+		return 0;
+	state = stm->state;
+	if (stat(filename, &st) < 0)
+		return 0;
+	return st.st_dev == state->dev && st.st_ino == state->ino;
+#else
+	return 0;
+#endif
+}
+
 fz_stream *
 fz_open_file(fz_context *ctx, const char *name)
 {
@@ -188,6 +305,23 @@ fz_open_file(fz_context *ctx, const char *name)
 	return fz_open_file_ptr(ctx, file);
 }
 
+fz_stream *
+fz_open_file_mapped(fz_context *ctx, const char *name)
+{
+#ifdef USE_MMAP
+	fz_stream *stm;
+	FILE *file = fopen(name, "rb");
+	if (file == NULL)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open %s: %s", name, strerror(errno));
+	stm = fz_open_mapped_file(ctx, file);
+	if (stm)
+		return stm;
+	return fz_open_file_ptr(ctx, file);
+#else
+	return fz_open_file(ctx, name);
+#endif
+}
+
 #ifdef _WIN32
 fz_stream *
 fz_open_file_w(fz_context *ctx, const wchar_t *name)
@@ -206,6 +340,12 @@ static int next_buffer(fz_context *ctx, fz_stream *stm, size_t max)
 	return EOF;
 }
 
+int
+fz_stream_is_memory(fz_context *ctx, fz_stream *stm)
+{
+	return stm->next == next_buffer;
+}
+
 static void seek_buffer(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
 {
 	int64_t pos = stm->pos - (stm->wp - stm->rp);
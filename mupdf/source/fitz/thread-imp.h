@@ -0,0 +1,94 @@
+// Copyright (C) 2026 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#ifndef FITZ_THREAD_IMP_H
+#define FITZ_THREAD_IMP_H
+
+/*
+	Threads for the few places inside the library that split work
+	up between threads of their own.
+
+	thread.c is built with Windows threads on Windows, with pthreads
+	when HAVE_PTHREAD is defined, and otherwise with no threads at
+	all. In the last case every constructor returns NULL, and callers
+	must do the work on the calling thread instead.
+
+	Objects are allocated with the system allocator, as the mutexes
+	for a context's locks have to exist before the context does.
+	Constructors never throw; they return NULL on any failure.
+*/
+
+typedef struct fz_thread fz_thread;
+typedef struct fz_mutex fz_mutex;
+typedef struct fz_semaphore fz_semaphore;
+
+typedef void (fz_thread_fn)(void *arg);
+
+/*
+	Non-zero if this build can start threads.
+*/
+int fz_threads_available(void);
+
+/*
+	Start a thread running fn(arg). Returns NULL if no thread
+	could be started.
+*/
+fz_thread *fz_new_thread(fz_thread_fn *fn, void *arg);
+
+/*
+	Wait for a thread to finish and free it. NULL is ignored.
+*/
+void fz_join_thread(fz_thread *thread);
+
+/*
+	Mutexes. Not recursive.
+*/
+fz_mutex *fz_new_mutex(void);
+void fz_drop_mutex(fz_mutex *mutex);
+void fz_lock_mutex(fz_mutex *mutex);
+void fz_unlock_mutex(fz_mutex *mutex);
+
+/*
+	Semaphores are created with a value of 0. Triggering one
+	increments the value, waiting decrements it, blocking while
+	it would go negative.
+*/
+fz_semaphore *fz_new_semaphore(void);
+void fz_drop_semaphore(fz_semaphore *sem);
+void fz_trigger_semaphore(fz_semaphore *sem);
+void fz_wait_semaphore(fz_semaphore *sem);
+
+/*
+	Call fn the first time fz_call_once is called with a given once,
+	however many threads get there together, and nothing after that.
+	No caller returns before fn has. A once must be static and start
+	out as FZ_ONCE_INIT. Every call takes a lock, so this is for
+	setting things up, not for inner loops.
+*/
+typedef int fz_once;
+typedef void (fz_once_fn)(void);
+
+#define FZ_ONCE_INIT 0
+
+void fz_call_once(fz_once *once, fz_once_fn *fn);
+
+#endif
@@ -0,0 +1,374 @@
+// Copyright (C) 2026 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "thread-imp.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+struct fz_thread
+{
+	HANDLE handle;
+	fz_thread_fn *fn;
+	void *arg;
+};
+
+struct fz_mutex
+{
+	CRITICAL_SECTION cs;
+};
+
+struct fz_semaphore
+{
+	HANDLE handle;
+};
+
+int fz_threads_available(void)
+{
+	return 1;
+}
+
+static DWORD WINAPI thread_starter(LPVOID arg)
+{
+	fz_thread *thread = arg;
+	thread->fn(thread->arg);
+	return 0;
+}
+
+fz_thread *fz_new_thread(fz_thread_fn *fn, void *arg)
+{
+	fz_thread *thread = malloc(sizeof *thread);
+	if (!thread)
+		return NULL;
+	thread->fn = fn;
+	thread->arg = arg;
+	thread->handle = CreateThread(NULL, 0, thread_starter, thread, 0, NULL);
+	if (thread->handle == NULL)
+	{
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+void fz_join_thread(fz_thread *thread)
+{
+	if (!thread)
+		return;
+	(void)WaitForSingleObject(thread->handle, INFINITE);
+	(void)CloseHandle(thread->handle);
+	free(thread);
+}
+
+fz_mutex *fz_new_mutex(void)
+{
+	fz_mutex *mutex = malloc(sizeof *mutex);
+	if (mutex)
+		InitializeCriticalSection(&mutex->cs);
+	return mutex;
+}
+
+void fz_drop_mutex(fz_mutex *mutex)
+{
+	if (!mutex)
+		return;
+	DeleteCriticalSection(&mutex->cs);
+	free(mutex);
+}
+
+void fz_lock_mutex(fz_mutex *mutex)
+{
+	EnterCriticalSection(&mutex->cs);
+}
+
+void fz_unlock_mutex(fz_mutex *mutex)
+{
+	LeaveCriticalSection(&mutex->cs);
+}
+
+fz_semaphore *fz_new_semaphore(void)
+{
+	fz_semaphore *sem = malloc(sizeof *sem);
+	if (!sem)
+		return NULL;
+	sem->handle = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+	if (sem->handle == NULL)
+	{
+		free(sem);
+		return NULL;
+	}
+	return sem;
+}
+
+void fz_drop_semaphore(fz_semaphore *sem)
+{
+	if (!sem)
+		return;
+	(void)CloseHandle(sem->handle);
+	free(sem);
+}
+
+void fz_trigger_semaphore(fz_semaphore *sem)
+{
+	(void)ReleaseSemaphore(sem->handle, 1, NULL);
+}
+
+void fz_wait_semaphore(fz_semaphore *sem)
+{
+	(void)WaitForSingleObject(sem->handle, INFINITE);
+}
+
+static SRWLOCK once_lock = SRWLOCK_INIT;
+
+void fz_call_once(fz_once *once, fz_once_fn *fn)
+{
+	AcquireSRWLockExclusive(&once_lock);
+	if (!*once)
+	{
+		fn();
+		*once = 1;
+	}
+	ReleaseSRWLockExclusive(&once_lock);
+}
+
+#elif defined(HAVE_PTHREAD)
+
+#include <pthread.h>
+
+struct fz_thread
+{
+	pthread_t thread;
+	fz_thread_fn *fn;
+	void *arg;
+};
+
+struct fz_mutex
+{
+	pthread_mutex_t mutex;
+};
+
+/* Not every pthreads has unnamed semaphores (macOS and iOS don't), so
+ * build them from a mutex and a condition variable. */
+struct fz_semaphore
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+};
+
+int fz_threads_available(void)
+{
+	return 1;
+}
+
+static void *thread_starter(void *arg)
+{
+	fz_thread *thread = arg;
+	thread->fn(thread->arg);
+	return NULL;
+}
+
+fz_thread *fz_new_thread(fz_thread_fn *fn, void *arg)
+{
+	fz_thread *thread = malloc(sizeof *thread);
+	if (!thread)
+		return NULL;
+	thread->fn = fn;
+	thread->arg = arg;
+	if (pthread_create(&thread->thread, NULL, thread_starter, thread))
+	{
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+void fz_join_thread(fz_thread *thread)
+{
+	if (!thread)
+		return;
+	(void)pthread_join(thread->thread, NULL);
+	free(thread);
+}
+
+fz_mutex *fz_new_mutex(void)
+{
+	fz_mutex *mutex = malloc(sizeof *mutex);
+	if (!mutex)
+		return NULL;
+	if (pthread_mutex_init(&mutex->mutex, NULL))
+	{
+		free(mutex);
+		return NULL;
+	}
+	return mutex;
+}
+
+void fz_drop_mutex(fz_mutex *mutex)
+{
+	if (!mutex)
+		return;
+	(void)pthread_mutex_destroy(&mutex->mutex);
+	free(mutex);
+}
+
+void fz_lock_mutex(fz_mutex *mutex)
+{
+	(void)pthread_mutex_lock(&mutex->mutex);
+}
+
+void fz_unlock_mutex(fz_mutex *mutex)
+{
+	(void)pthread_mutex_unlock(&mutex->mutex);
+}
+
+fz_semaphore *fz_new_semaphore(void)
+{
+	fz_semaphore *sem = malloc(sizeof *sem);
+	if (!sem)
+		return NULL;
+	sem->count = 0;
+	if (pthread_mutex_init(&sem->mutex, NULL))
+	{
+		free(sem);
+		return NULL;
+	}
+	if (pthread_cond_init(&sem->cond, NULL))
+	{
+		(void)pthread_mutex_destroy(&sem->mutex);
+		free(sem);
+		return NULL;
+	}
+	return sem;
+}
+
+void fz_drop_semaphore(fz_semaphore *sem)
+{
+	if (!sem)
+		return;
+	(void)pthread_cond_destroy(&sem->cond);
+	(void)pthread_mutex_destroy(&sem->mutex);
+	free(sem);
+}
+
+void fz_trigger_semaphore(fz_semaphore *sem)
+{
+	/* Signal on every trigger, not just when the count leaves 0, or
+	 * with two waiters the second of two quick triggers would wake
+	 * nobody. */
+	(void)pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	(void)pthread_cond_signal(&sem->cond);
+	(void)pthread_mutex_unlock(&sem->mutex);
+}
+
+void fz_wait_semaphore(fz_semaphore *sem)
+{
+	(void)pthread_mutex_lock(&sem->mutex);
+	while (sem->count == 0)
+		(void)pthread_cond_wait(&sem->cond, &sem->mutex);
+	--sem->count;
+	(void)pthread_mutex_unlock(&sem->mutex);
+}
+
+static pthread_mutex_t once_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void fz_call_once(fz_once *once, fz_once_fn *fn)
+{
+	(void)pthread_mutex_lock(&once_mutex);
+	if (!*once)
+	{
+		fn();
+		*once = 1;
+	}
+	(void)pthread_mutex_unlock(&once_mutex);
+}
+
+#else
+
+/* No threads. Nothing can be created, so nothing else is ever called. */
+
+int fz_threads_available(void)
+{
+	return 0;
+}
+
+fz_thread *fz_new_thread(fz_thread_fn *fn, void *arg)
+{
+	return NULL;
+}
+
+void fz_join_thread(fz_thread *thread)
+{
+}
+
+fz_mutex *fz_new_mutex(void)
+{
+	return NULL;
+}
+
+void fz_drop_mutex(fz_mutex *mutex)
+{
+}
+
+void fz_lock_mutex(fz_mutex *mutex)
+{
+	abort();
+}
+
+void fz_unlock_mutex(fz_mutex *mutex)
+{
+	abort();
+}
+
+fz_semaphore *fz_new_semaphore(void)
+{
+	return NULL;
+}
+
+void fz_drop_semaphore(fz_semaphore *sem)
+{
+}
+
+void fz_trigger_semaphore(fz_semaphore *sem)
+{
+	abort();
+}
+
+void fz_wait_semaphore(fz_semaphore *sem)
+{
+	abort();
+}
+
+void fz_call_once(fz_once *once, fz_once_fn *fn)
+{
+	if (!*once)
+	{
+		fn();
+		*once = 1;
+	}
+}
+
+#endif
@@ -0,0 +1,581 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+	CAJ container support.
+
+	A CAJ file is a small binary header followed by the body of a PDF
+	document. The body has no version marker, no cross reference table,
+	no catalog and usually no root for its page tree, so we open it
+	in place as a sub-range of the container (no copy is made), let the
+	normal repair logic rebuild the xref, and then synthesise whatever
+	is missing from the page tree. The table of contents stored in the
+	header is turned into a document outline.
+*/
+
+#define CAJ_PAGE_COUNT_OFFSET 0x10
+#define CAJ_BODY_POINTER_OFFSET 0x14
+#define CAJ_TOC_OFFSET 0x110
+#define CAJ_TOC_ENTRY_SIZE 0x134
+#define CAJ_TOC_TITLE_SIZE 256
+#define CAJ_TOC_PAGE_OFFSET (CAJ_TOC_TITLE_SIZE + 24)
+#define CAJ_TOC_PAGE_SIZE 12
+#define CAJ_TOC_LEVEL_OFFSET (CAJ_TOC_PAGE_OFFSET + CAJ_TOC_PAGE_SIZE + 12)
+
+typedef struct
+{
+	int num;
+	int parent;
+	int64_t ofs;
+} caj_kid;
+
+/*
+	A seekable window onto the PDF body within the container. Repair
+	seeks all over the file it is given, which a null filter can't do.
+	When the container is held in memory, the body is read in place.
+*/
+typedef struct
+{
+	fz_stream *chain;
+	int64_t start;
+	int64_t length;
+	int64_t offset;
+	unsigned char buffer[4096];
+} caj_body;
+
+static int
+next_caj_body(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	caj_body *state = stm->state;
+	size_t n;
+
+	if (state->offset >= state->length)
+		return EOF;
+
+	fz_seek(ctx, state->chain, state->start + state->offset, SEEK_SET);
+	n = fz_available(ctx, state->chain, max);
+	if (n == 0)
+		return EOF;
+	if ((int64_t)n > state->length - state->offset)
+		n = (size_t)(state->length - state->offset);
+	if (fz_stream_is_memory(ctx, state->chain))
+	{
+		stm->rp = state->chain->rp;
+	}
+	else
+	{
+		if (n > sizeof(state->buffer))
+			n = sizeof(state->buffer);
+		memcpy(state->buffer, state->chain->rp, n);
+		stm->rp = state->buffer;
+	}
+	stm->wp = stm->rp + n;
+	state->chain->rp += n;
+	state->offset += n;
+	stm->pos = state->offset;
+	return *stm->rp++;
+}
+
+static void
+seek_caj_body(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	caj_body *state = stm->state;
+
+	if (whence == SEEK_CUR)
+		offset += stm->pos - (stm->wp - stm->rp);
+	else if (whence == SEEK_END)
+		offset += state->length;
+
+	if (offset < 0)
+		offset = 0;
+	if (offset > state->length)
+		offset = state->length;
+
+	state->offset = offset;
+	stm->pos = state->offset;
+	stm->rp = stm->wp = state->buffer;
+}
+
+static void
+close_caj_body(fz_context *ctx, void *state_)
+{
+	caj_body *state = state_;
+	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state);
+}
+
+static fz_stream *
+caj_open_body(fz_context *ctx, fz_stream *chain, int64_t start, int64_t length)
+{
+	caj_body *state = fz_malloc_struct(ctx, caj_body);
+	fz_stream *stm;
+
+	state->chain = fz_keep_stream(ctx, chain);
+	state->start = start;
+	state->length = length;
+	stm = fz_new_stream(ctx, state, next_caj_body, close_caj_body);
+	stm->seek = seek_caj_body;
+	return stm;
+}
+
+static int64_t
+caj_find_body_end(fz_context *ctx, fz_stream *file, int64_t start)
+{
+	unsigned char buf[4096 + 5];
+	int64_t end, pos;
+	size_t n, i;
+
+	fz_seek(ctx, file, 0, SEEK_END);
+	end = fz_tell(ctx, file);
+
+	/* The body ends with the last 'endobj' in the file. Scan backwards,
+	 * overlapping each window by 5 bytes so we can't miss a keyword
+	 * straddling a window boundary. */
+	pos = end;
+	while (pos > start)
+	{
+		int64_t chunk = fz_mini64(4096, pos - start);
+		pos -= chunk;
+		fz_seek(ctx, file, pos, SEEK_SET);
+		n = fz_read(ctx, file, buf, (size_t)fz_mini64(chunk + 5, end - pos));
+		for (i = n; i >= 6; i--)
+			if (!memcmp(buf + i - 6, "endobj", 6))
+				return pos + (int64_t)i;
+	}
+
+	fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find end of pdf body in caj file");
+}
+
+static int
+caj_cmp_kid(const void *a_, const void *b_)
+{
+	const caj_kid *a = a_;
+	const caj_kid *b = b_;
+	if (a->parent != b->parent)
+		return a->parent < b->parent ? -1 : 1;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs ? -1 : 1;
+	return a->num - b->num;
+}
+
+static int
+caj_node_exists(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_xref_entry *entry;
+	pdf_obj *obj = NULL;
+	int exists;
+
+	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
+		return 0;
+	entry = pdf_get_xref_entry_no_null(ctx, doc, num);
+	if (entry->type != 'n' && entry->type != 'o')
+		return 0;
+
+	fz_try(ctx)
+		obj = pdf_load_object(ctx, doc, num);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		return 0;
+	}
+	exists = pdf_is_dict(ctx, obj);
+	pdf_drop_obj(ctx, obj);
+	return exists;
+}
+
+static int
+caj_node_count(fz_context *ctx, pdf_obj *node)
+{
+	if (pdf_dict_get(ctx, node, PDF_NAME(Type)) == PDF_NAME(Pages))
+		return pdf_dict_get_int(ctx, node, PDF_NAME(Count));
+	return 1;
+}
+
+/* Create a new /Pages node over kids[0..n-1] and point their /Parent at it. */
+static pdf_obj *
+caj_new_pages_node(fz_context *ctx, pdf_document *doc, int n, pdf_obj **kids)
+{
+	pdf_obj *node = pdf_add_new_dict(ctx, doc, 3);
+	pdf_obj *array;
+	int i, count = 0;
+
+	fz_try(ctx)
+	{
+		pdf_dict_put(ctx, node, PDF_NAME(Type), PDF_NAME(Pages));
+		array = pdf_dict_put_array(ctx, node, PDF_NAME(Kids), n);
+		for (i = 0; i < n; i++)
+		{
+			pdf_array_push(ctx, array, kids[i]);
+			pdf_dict_put(ctx, kids[i], PDF_NAME(Parent), node);
+			count += caj_node_count(ctx, kids[i]);
+		}
+		pdf_dict_put_int(ctx, node, PDF_NAME(Count), count);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, node);
+		fz_rethrow(ctx);
+	}
+	return node;
+}
+
+/*
+	Every object that names a /Parent is a page tree node. Any parent
+	that isn't present in the body is recreated from the set of objects
+	that point at it, in file order. If more than one such parent is
+	missing, a new root is created above them.
+*/
+static pdf_obj *
+caj_repair_page_tree(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *root = NULL;
+	pdf_obj **tops = NULL;
+	pdf_obj **nodes = NULL;
+	caj_kid *kids = NULL;
+	int64_t *tops_ofs = NULL;
+	int i, j, k, len, nkids = 0, ntops = 0, root_num = 0;
+
+	fz_var(root);
+	fz_var(tops);
+	fz_var(nodes);
+	fz_var(kids);
+	fz_var(tops_ofs);
+	fz_var(ntops);
+
+	len = pdf_xref_len(ctx, doc);
+
+	fz_try(ctx)
+	{
+		kids = fz_malloc_array(ctx, len, caj_kid);
+
+		for (i = 1; i < len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry_no_null(ctx, doc, i);
+			pdf_obj *obj = NULL;
+			pdf_obj *parent;
+
+			if (entry->type != 'n' && entry->type != 'o')
+				continue;
+
+			fz_try(ctx)
+				obj = pdf_load_object(ctx, doc, i);
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				fz_warn(ctx, "ignoring broken object (%d 0 R)", i);
+				continue;
+			}
+
+			parent = pdf_dict_get(ctx, obj, PDF_NAME(Parent));
+			if (pdf_is_indirect(ctx, parent))
+			{
+				kids[nkids].num = i;
+				kids[nkids].parent = pdf_to_num(ctx, parent);
+				kids[nkids].ofs = entry->ofs;
+				nkids++;
+			}
+			else if (root_num == 0 && pdf_dict_get(ctx, obj, PDF_NAME(Type)) == PDF_NAME(Pages))
+			{
+				root_num = i;
+			}
+			pdf_drop_obj(ctx, obj);
+		}
+
+		qsort(kids, nkids, sizeof *kids, caj_cmp_kid);
+
+		tops = fz_malloc_array(ctx, nkids, pdf_obj *);
+		tops_ofs = fz_malloc_array(ctx, nkids, int64_t);
+		nodes = fz_malloc_array(ctx, nkids, pdf_obj *);
+
+		for (i = 0; i < nkids; i = j)
+		{
+			int64_t first_ofs = kids[i].ofs;
+
+			for (j = i; j < nkids && kids[j].parent == kids[i].parent; j++)
+				first_ofs = fz_mini64(first_ofs, kids[j].ofs);
+
+			if (caj_node_exists(ctx, doc, kids[i].parent))
+				continue;
+
+			for (k = i; k < j; k++)
+				nodes[k - i] = pdf_new_indirect(ctx, doc, kids[k].num, 0);
+			fz_try(ctx)
+				tops[ntops] = caj_new_pages_node(ctx, doc, j - i, nodes);
+			fz_always(ctx)
+				for (k = i; k < j; k++)
+					pdf_drop_obj(ctx, nodes[k - i]);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+			tops_ofs[ntops++] = first_ofs;
+		}
+
+		if (ntops == 0)
+		{
+			if (root_num == 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page tree in caj file");
+			root = pdf_new_indirect(ctx, doc, root_num, 0);
+		}
+		else if (ntops == 1)
+		{
+			root = pdf_keep_obj(ctx, tops[0]);
+		}
+		else
+		{
+			/* Order the orphaned subtrees by where their pages appear in the file. */
+			for (i = 1; i < ntops; i++)
+			{
+				pdf_obj *t = tops[i];
+				int64_t o = tops_ofs[i];
+				for (j = i; j > 0 && tops_ofs[j - 1] > o; j--)
+				{
+					tops[j] = tops[j - 1];
+					tops_ofs[j] = tops_ofs[j - 1];
+				}
+				tops[j] = t;
+				tops_ofs[j] = o;
+			}
+			root = caj_new_pages_node(ctx, doc, ntops, tops);
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < ntops; i++)
+			pdf_drop_obj(ctx, tops[i]);
+		fz_free(ctx, tops);
+		fz_free(ctx, tops_ofs);
+		fz_free(ctx, nodes);
+		fz_free(ctx, kids);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, root);
+		fz_rethrow(ctx);
+	}
+
+	return root;
+}
+
+static void
+caj_add_catalog(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *pages = NULL;
+	pdf_obj *catalog;
+
+	if (pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Pages"))
+		return;
+
+	pages = caj_repair_page_tree(ctx, doc);
+	fz_try(ctx)
+	{
+		catalog = pdf_add_new_dict(ctx, doc, 2);
+		pdf_dict_put(ctx, catalog, PDF_NAME(Type), PDF_NAME(Catalog));
+		pdf_dict_put(ctx, catalog, PDF_NAME(Pages), pages);
+		/* Fetch the trailer late; creating objects may have started
+		 * a new xref section with its own copy of it. */
+		pdf_dict_put_drop(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root), catalog);
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, pages);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+caj_decode_title(fz_context *ctx, fz_buffer *out, pdf_cmap *gbk, pdf_cmap *ucs, unsigned char *s, unsigned char *e)
+{
+	int ucsbuf[8];
+	unsigned int cpt;
+	int i, n;
+
+	while (s < e && *s)
+	{
+		if (*s < 0x80)
+		{
+			fz_append_rune(ctx, out, *s++);
+			continue;
+		}
+		s += pdf_decode_cmap(gbk, s, e, &cpt);
+		n = pdf_lookup_cmap_full(ucs, pdf_lookup_cmap(gbk, cpt), ucsbuf);
+		if (n <= 0)
+			fz_append_rune(ctx, out, FZ_REPLACEMENT_CHARACTER);
+		for (i = 0; i < n; i++)
+			fz_append_rune(ctx, out, ucsbuf[i]);
+	}
+}
+
+static void
+caj_load_outline(fz_context *ctx, pdf_document *doc, fz_stream *file, int64_t limit)
+{
+	unsigned char entry[CAJ_TOC_ENTRY_SIZE];
+	char page_str[CAJ_TOC_PAGE_SIZE + 1];
+	pdf_cmap *gbk = NULL;
+	pdf_cmap *ucs = NULL;
+	fz_buffer *titles = NULL;
+	pdf_outline_entry *items = NULL;
+	size_t *title_ofs = NULL;
+	int i, n, count;
+
+	fz_seek(ctx, file, CAJ_TOC_OFFSET, SEEK_SET);
+	count = fz_read_int32_le(ctx, file);
+	if (count <= 0)
+		return;
+	if (CAJ_TOC_OFFSET + 4 + (int64_t)count * CAJ_TOC_ENTRY_SIZE > limit)
+	{
+		fz_warn(ctx, "truncating caj table of contents");
+		count = (int)((limit - CAJ_TOC_OFFSET - 4) / CAJ_TOC_ENTRY_SIZE);
+		if (count <= 0)
+			return;
+	}
+
+	fz_var(gbk);
+	fz_var(ucs);
+	fz_var(titles);
+	fz_var(items);
+	fz_var(title_ofs);
+
+	fz_try(ctx)
+	{
+		gbk = pdf_load_system_cmap(ctx, "GBK2K-H");
+		ucs = pdf_load_system_cmap(ctx, "Adobe-GB1-UCS2");
+		titles = fz_new_buffer(ctx, count * 32);
+		items = fz_malloc_array(ctx, count, pdf_outline_entry);
+		title_ofs = fz_malloc_array(ctx, count, size_t);
+
+		for (n = 0; n < count; n++)
+		{
+			if (fz_read(ctx, file, entry, sizeof entry) < sizeof entry)
+				break;
+
+			/* Titles are packed into one buffer, which may move as it
+			 * grows, so remember offsets until we are done. */
+			title_ofs[n] = titles->len;
+			caj_decode_title(ctx, titles, gbk, ucs, entry, entry + CAJ_TOC_TITLE_SIZE);
+			fz_append_byte(ctx, titles, 0);
+
+			memcpy(page_str, entry + CAJ_TOC_PAGE_OFFSET, CAJ_TOC_PAGE_SIZE);
+			page_str[CAJ_TOC_PAGE_SIZE] = 0;
+			items[n].page = fz_atoi(page_str) - 1;
+			items[n].level = entry[CAJ_TOC_LEVEL_OFFSET] |
+				(entry[CAJ_TOC_LEVEL_OFFSET+1] << 8) |
+				(entry[CAJ_TOC_LEVEL_OFFSET+2] << 16) |
+				(entry[CAJ_TOC_LEVEL_OFFSET+3] << 24);
+			items[n].is_open = 0;
+		}
+
+		for (i = 0; i < n; i++)
+			items[i].title = (const char *)titles->data + title_ofs[i];
+
+		pdf_set_outline_tree(ctx, doc, n, items);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, title_ofs);
+		fz_free(ctx, items);
+		fz_drop_buffer(ctx, titles);
+		pdf_drop_cmap(ctx, ucs);
+		pdf_drop_cmap(ctx, gbk);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot load caj table of contents");
+	}
+}
+
+pdf_document *
+pdf_open_caj_accelerated_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel)
+{
+	unsigned char magic[4];
+	pdf_document *doc = NULL;
+	fz_stream *body = NULL;
+	int64_t body_ptr, body_start, body_end;
+	int page_count;
+
+	fz_var(doc);
+	fz_var(body);
+
+	fz_seek(ctx, file, 0, SEEK_SET);
+	if (fz_read(ctx, file, magic, 4) < 4 || memcmp(magic, "CAJ", 3) != 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not a caj file");
+
+	fz_seek(ctx, file, CAJ_PAGE_COUNT_OFFSET, SEEK_SET);
+	page_count = fz_read_int32_le(ctx, file);
+	body_ptr = fz_read_uint32_le(ctx, file);
+	fz_seek(ctx, file, body_ptr, SEEK_SET);
+	body_start = fz_read_uint32_le(ctx, file);
+	body_end = caj_find_body_end(ctx, file, body_start);
+
+	fz_try(ctx)
+	{
+		body = caj_open_body(ctx, file, body_start, body_end - body_start);
+		doc = pdf_open_accelerated_document_with_stream(ctx, body, accel);
+		caj_add_catalog(ctx, doc);
+		if (pdf_count_pages(ctx, doc) != page_count)
+			fz_warn(ctx, "caj header claims %d pages, found %d", page_count, pdf_count_pages(ctx, doc));
+		caj_load_outline(ctx, doc, file, fz_mini64(body_ptr, body_start));
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, body);
+	fz_catch(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+
+	return doc;
+}
+
+pdf_document *
+pdf_open_caj_document_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_caj_accelerated_document_with_stream(ctx, file, NULL);
+}
+
+static const char *caj_extensions[] =
+{
+	"caj",
+	NULL
+};
+
+static const char *caj_mimetypes[] =
+{
+	"application/caj",
+	"application/x-caj",
+	NULL
+};
+
+fz_document_handler caj_document_handler =
+{
+	NULL,
+	NULL,
+	(fz_document_open_with_stream_fn*)pdf_open_caj_document_with_stream,
+	caj_extensions,
+	caj_mimetypes,
+	NULL,
+	(fz_document_open_accel_with_stream_fn*)pdf_open_caj_accelerated_document_with_stream
+};
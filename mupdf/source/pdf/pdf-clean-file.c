@@ -22,8 +22,10 @@
 
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "../fitz/thread-imp.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 typedef struct
@@ -413,56 +415,81 @@ static void retainpages(fz_context *ctx, globals *glo, int argc, char **argv)
 	pdf_drop_obj(ctx, root);
 }
 
-static void pdf_add_outline(fz_context *ctx, fz_outline_iterator* iter, char* outline) 
+/*
+	Parse "level page title" lines (pages counted from 1) and set
+	them as the document outline in one go.
+*/
+static void pdf_add_outline(fz_context *ctx, pdf_document *doc, const char *outline)
 {
-	int prev_level = 1;
-	int offset = 0;
-	int len = strlen(outline);
-	int cnt = 0;
-	while (1) {
-		int current_level;
-		int page;
-		char title[1024]={0};
-		char uri[20] = {0};
-		int current_read;	
-		sscanf(&outline[offset], "%d %d %[^\n]%n", &current_level, &page, &title,&current_read);
-		sprintf(uri,"#page=%d",page);	
-		fz_outline_item item = {title, uri, 0};
-		
-		printf("title:%s uri:%s\n",item.title,item.uri);
-		if (prev_level == current_level) {
-			iter->insert(ctx,iter,&item);
-		}
-		if (prev_level < current_level) {
-			iter->prev(ctx,iter);
-			iter->down(ctx,iter);
-			iter->insert(ctx,iter,&item);
-		}
-		if (prev_level > current_level) {
-			iter->up(ctx,iter);
-			iter->next(ctx,iter);
-			iter->insert(ctx,iter,&item);
-		}
-		
-		prev_level = current_level;
-		offset+=current_read+1;
-		if (offset == len) {
-			break;
+	pdf_outline_entry *entries = NULL;
+	char *text = NULL;
+	char *p, *end, *eol;
+	int n = 0, cap = 0;
+	int level, page;
+
+	fz_var(entries);
+	fz_var(text);
+
+	fz_try(ctx)
+	{
+		text = fz_strdup(ctx, outline);
+		for (p = text; *p; p = eol)
+		{
+			eol = strchr(p, '\n');
+			if (eol)
+				*eol++ = 0;
+			else
+				eol = p + strlen(p);
+
+			level = strtol(p, &end, 10);
+			if (end == p)
+				continue;
+			page = strtol(end, &p, 10);
+			while (*p == ' ' || *p == '\t')
+				p++;
+
+			if (n == cap)
+			{
+				cap = cap ? cap * 2 : 64;
+				entries = fz_realloc_array(ctx, entries, cap, pdf_outline_entry);
+			}
+			entries[n].level = level;
+			entries[n].page = page - 1;
+			entries[n].title = p;
+			entries[n].is_open = 0;
+			n++;
 		}
+
+		pdf_set_outline_tree(ctx, doc, n, entries);
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, entries);
+		fz_free(ctx, text);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
-int pdf_clean_file(fz_context *ctx, char *infile, int size,char *outline,char **out_buffer, char *password, pdf_write_options *opts, int argc, char *argv[])
+void pdf_clean_file_to_output(fz_context *ctx, char *infile, int size, char *outline, fz_output *out, char *password, pdf_write_options *opts, int argc, char *argv[])
 {
 	globals glo = { 0 };
+	fz_stream *stream = NULL;
 
 	glo.ctx = ctx;
-	int out_size=0;
-	fz_stream* stream;
+
+	fz_var(stream);
+
 	fz_try(ctx)
 	{	
-		stream=fz_open_memory(ctx,infile,size);
-		glo.doc=pdf_open_document_with_stream(ctx,stream);
+		stream=fz_open_memory(ctx,(unsigned char *)infile,size);
+		if (size >= 3 && !memcmp(infile, "CAJ", 3))
+			glo.doc=pdf_open_caj_document_with_stream(ctx,stream);
+		else
+			glo.doc=pdf_open_document_with_stream(ctx,stream);
+		/* The document is only read and written out once, so nothing
+		 * outlives it and its objects can all come from one arena. */
+		pdf_enable_object_arena(ctx, glo.doc);
 		if (pdf_needs_password(ctx, glo.doc))
 			if (!pdf_authenticate_password(ctx, glo.doc, password))
 				fz_throw(glo.ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", infile);
@@ -471,22 +498,12 @@ int pdf_clean_file(fz_context *ctx, char *infile, int size,char *outline,char **
 		if (argc)
 			retainpages(ctx, &glo, argc, argv);
 
-		fz_buffer* buffer = fz_new_buffer(ctx, 1);
-		fz_output* out=fz_new_output_with_buffer(ctx,buffer);
-		
-		fz_outline_iterator* iter = glo.doc->super.outline_iterator(ctx, glo.doc);
-		pdf_add_outline(ctx, iter, outline);
-		fz_drop_outline_iterator(ctx, iter);
+		/* CAJ containers carry their own table of contents */
+		if (outline && *outline)
+			pdf_add_outline(ctx, glo.doc, outline);
 
-		pdf_write_document(ctx, glo.doc, out,opts);
+		pdf_write_document(ctx, glo.doc, out, opts);
 		fz_close_output(ctx, out);
-		fz_drop_output(ctx, out);
-		
-		char *ptr;
-		out_size=fz_buffer_storage(ctx,buffer,&ptr);
-		*out_buffer=malloc(out_size);
-		memcpy(*out_buffer,ptr,out_size);
-		fz_drop_buffer(ctx,buffer);
 	}
 	fz_always(ctx)
 	{
@@ -497,47 +514,394 @@ int pdf_clean_file(fz_context *ctx, char *infile, int size,char *outline,char **
 	{
 		fz_rethrow(ctx);
 	}
+}
+
+int pdf_clean_file(fz_context *ctx, char *infile, int size,char *outline,char **out_buffer, char *password, pdf_write_options *opts, int argc, char *argv[])
+{
+	fz_buffer *buffer = NULL;
+	fz_output *out = NULL;
+	int out_size = 0;
+
+	fz_var(buffer);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		buffer = fz_new_buffer(ctx, 1);
+		out = fz_new_output_with_buffer(ctx, buffer);
+		pdf_clean_file_to_output(ctx, infile, size, outline, out, password, opts, argc, argv);
+
+		/* Hand the buffer storage over to the caller instead of copying it */
+		out_size = fz_buffer_extract(ctx, buffer, (unsigned char **)out_buffer);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buffer);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 	return out_size;
 }
 
-char* internal_mupdf_clean(char* input,int size,char* outline,int *length) {
-	char *password = "";
-	pdf_write_options opts = pdf_default_write_options;
-	int errors = 0;
+/*
+	Compacting drops duplicate and unused objects and packs the rest
+	into object streams. The output is smaller but no longer matches
+	what earlier builds wrote byte for byte, so only sessions that ask
+	for it get it.
+*/
+static void mupdf_clean_options(pdf_write_options *opts, int compact)
+{
+	*opts = pdf_default_write_options;
+	opts->dont_regenerate_id = 1;
+	if (compact)
+	{
+		opts->do_garbage = 3;
+		opts->do_objstms = 1;
+	}
+}
+
+/*
+	Clean input into a buffer held by the result, which also keeps a
+	reference to the context that allocated it so that the buffer can
+	be dropped through that context later. If owns_ctx is set, the
+	context is dropped along with the result.
+*/
+static mupdf_clean_result *clean_with_context(fz_context *ctx, int owns_ctx, int compact, char *input, int size, char *outline)
+{
+	pdf_write_options opts;
+	mupdf_clean_result *result;
+	fz_output *out = NULL;
+
+	result = malloc(sizeof(*result));
+	if (!result)
+	{
+		if (owns_ctx)
+			fz_drop_context(ctx);
+		return NULL;
+	}
+	result->data = NULL;
+	result->length = 0;
+	result->ctx = ctx;
+	result->owns_ctx = owns_ctx;
+	result->buffer = NULL;
+
+	mupdf_clean_options(&opts, compact);
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		result->buffer = fz_new_buffer(ctx, 1);
+		out = fz_new_output_with_buffer(ctx, result->buffer);
+		pdf_clean_file_to_output(ctx, input, size, outline, out, "", &opts, 0, NULL);
+		result->data = (char *)result->buffer->data;
+		result->length = (int)result->buffer->len;
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, result->buffer);
+		result->buffer = NULL;
+		result->data = NULL;
+		result->length = 0;
+	}
+
+	/* A one-shot context has nothing more to render, so only the
+	 * output need stay alive until the result is freed. */
+	if (owns_ctx)
+		fz_empty_store(ctx);
+
+	return result;
+}
+
+void internal_mupdf_clean_result_free(mupdf_clean_result *result)
+{
+	if (!result)
+		return;
+	fz_drop_buffer(result->ctx, result->buffer);
+	if (result->owns_ctx)
+		fz_drop_context(result->ctx);
+	free(result);
+}
+
+static void emit_chunk(fz_context *ctx, void *arg, const void *data, size_t n)
+{
+	mupdf_clean_chunk_fn **fn = arg;
+	(*fn)((const char *)data, (int)n);
+}
+
+static int clean_stream_with_context(fz_context *ctx, int compact, char *input, int size, char *outline, int chunk_size, mupdf_clean_chunk_fn *fn)
+{
+	pdf_write_options opts;
+	fz_output *out = NULL;
+	int length = -1;
+
+	mupdf_clean_options(&opts, compact);
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_chunks(ctx, chunk_size > 0 ? chunk_size : 1 << 20, emit_chunk, &fn);
+		pdf_clean_file_to_output(ctx, input, size, outline, out, "", &opts, 0, NULL);
+		length = (int)fz_tell_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		length = -1;
+
+	return length;
+}
+
+mupdf_clean_result *internal_mupdf_clean_run(char *input, int size, char *outline)
+{
 	fz_context *ctx;
-	char *buffer;
 
-	opts.dont_regenerate_id = 1;
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return NULL;
+	return clean_with_context(ctx, 1, 0, input, size, outline);
+}
+
+/*
+	The original entry point hands back a bare pointer for the caller
+	to free(), so give it a copy from malloc rather than storage that
+	belongs to a context.
+*/
+char* internal_mupdf_clean(char* input,int size,char* outline,int *length) {
+	mupdf_clean_result *result;
+	char *buffer = NULL;
+
+	result = internal_mupdf_clean_run(input, size, outline);
+	if (result && result->data)
+	{
+		buffer = malloc(result->length > 0 ? result->length : 1);
+		if (buffer)
+		{
+			memcpy(buffer, result->data, result->length);
+			if (length != NULL)
+				*length = result->length;
+		}
+	}
+	internal_mupdf_clean_result_free(result);
+	return buffer;
+}
+
+int internal_mupdf_clean_stream(char *input, int size, char *outline, int chunk_size, mupdf_clean_chunk_fn *fn)
+{
+	fz_context *ctx;
+	int length;
 
 	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
 	if (!ctx)
+		return -1;
+	length = clean_stream_with_context(ctx, 0, input, size, outline, chunk_size, fn);
+	fz_drop_context(ctx);
+	return length;
+}
+
+/*
+ * Sessions keep one context, and with it the store, font, colorspace
+ * and glyph caches, alive across many documents. Clones share those
+ * caches with their parent, so the context needs real locks. Builds
+ * without threads (such as wasm) have none, and get a session with no
+ * locks instead, which cannot be cloned.
+ */
+
+struct mupdf_clean_session
+{
+	fz_context *ctx;
+	mupdf_clean_session *parent;
+	fz_mutex *mutexes[FZ_LOCK_MAX];
+	int compact;
+};
+
+static void session_lock(void *user, int lock)
+{
+	mupdf_clean_session *session = user;
+	fz_lock_mutex(session->mutexes[lock]);
+}
+
+static void session_unlock(void *user, int lock)
+{
+	mupdf_clean_session *session = user;
+	fz_unlock_mutex(session->mutexes[lock]);
+}
+
+mupdf_clean_session *internal_mupdf_clean_session_new(int store_mb)
+{
+	mupdf_clean_session *session;
+	fz_locks_context locks;
+	int i;
+
+	session = calloc(1, sizeof(*session));
+	if (!session)
+		return NULL;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		if ((session->mutexes[i] = fz_new_mutex()) == NULL)
+			break;
+
+	if (i == FZ_LOCK_MAX)
 	{
-		fprintf(stderr, "cannot initialise context\n");
-		exit(1);
+		locks.user = session;
+		locks.lock = session_lock;
+		locks.unlock = session_unlock;
+		session->ctx = fz_new_context(NULL, &locks, store_mb > 0 ? (size_t)store_mb << 20 : FZ_STORE_DEFAULT);
 	}
-	fz_try(ctx)
+	else
 	{
-		int output_size=pdf_clean_file(ctx, input,size, outline, &buffer, password, &opts, 0, NULL);
-		if (length!=NULL) {
-			*length = output_size;
+		while (i-- > 0)
+		{
+			fz_drop_mutex(session->mutexes[i]);
+			session->mutexes[i] = NULL;
 		}
+		session->ctx = fz_new_context(NULL, NULL, store_mb > 0 ? (size_t)store_mb << 20 : FZ_STORE_DEFAULT);
 	}
-	fz_catch(ctx)
+	if (!session->ctx)
 	{
-		errors++;
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			fz_drop_mutex(session->mutexes[i]);
+		free(session);
+		return NULL;
 	}
-	fz_drop_context(ctx);
-	return buffer;
+	return session;
 }
 
+mupdf_clean_session *internal_mupdf_clean_session_clone(mupdf_clean_session *parent)
+{
+	mupdf_clean_session *session;
+	int compact;
+
+	if (!parent)
+		return NULL;
+	compact = parent->compact;
+	/* Clones all share the locks of the session that created them. */
+	while (parent->parent)
+		parent = parent->parent;
+
+	session = calloc(1, sizeof(*session));
+	if (!session)
+		return NULL;
+	session->parent = parent;
+	session->compact = compact;
+	session->ctx = fz_clone_context(parent->ctx);
+	if (!session->ctx)
+	{
+		free(session);
+		return NULL;
+	}
+	return session;
+}
+
+void internal_mupdf_clean_session_free(mupdf_clean_session *session)
+{
+	int i;
+
+	if (!session)
+		return;
+	fz_drop_context(session->ctx);
+	if (!session->parent)
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			fz_drop_mutex(session->mutexes[i]);
+	free(session);
+}
+
+/*
+ * Base64 input is decoded where it lies, into the start of the same
+ * memory, so a large file never needs a second copy.
+ */
+static int clean_stream_base64_with_context(fz_context *ctx, int compact, char *input, int size, char *outline, int chunk_size, mupdf_clean_chunk_fn *fn)
+{
+	int length;
+
+	if (!input || size < 0)
+		return -1;
+	length = (int)fz_decode_base64(ctx, (unsigned char *)input, input, size);
+	return clean_stream_with_context(ctx, compact, input, length, outline, chunk_size, fn);
+}
+
+#ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
 EMSCRIPTEN_KEEPALIVE int mupdf_clean_length(char *input,int size,char *outline) {
-	int length=0;
-	char *buffer = internal_mupdf_clean(input, size, outline, &length);
-	free(buffer);
+	mupdf_clean_result *result = internal_mupdf_clean_run(input, size, outline);
+	int length = result ? result->length : 0;
+	internal_mupdf_clean_result_free(result);
 	return length;
 }
 
 EMSCRIPTEN_KEEPALIVE char* mupdf_clean(char *input,int size,char *outline) {
 	return internal_mupdf_clean(input, size, outline, NULL);
-}
\ No newline at end of file
+}
+
+EMSCRIPTEN_KEEPALIVE int mupdf_clean_stream(char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn) {
+	return internal_mupdf_clean_stream(input, size, outline, chunk_size, fn);
+}
+
+EMSCRIPTEN_KEEPALIVE mupdf_clean_session* mupdf_clean_session_new(int store_mb) {
+	return internal_mupdf_clean_session_new(store_mb);
+}
+
+EMSCRIPTEN_KEEPALIVE mupdf_clean_session* mupdf_clean_session_clone(mupdf_clean_session *session) {
+	return internal_mupdf_clean_session_clone(session);
+}
+
+EMSCRIPTEN_KEEPALIVE void mupdf_clean_session_free(mupdf_clean_session *session) {
+	internal_mupdf_clean_session_free(session);
+}
+
+EMSCRIPTEN_KEEPALIVE void mupdf_clean_session_set_compact(mupdf_clean_session *session,int compact) {
+	if (session)
+		session->compact = compact;
+}
+
+EMSCRIPTEN_KEEPALIVE mupdf_clean_result* mupdf_clean_session_run(mupdf_clean_session *session,char *input,int size,char *outline) {
+	if (!session)
+		return NULL;
+	return clean_with_context(session->ctx, 0, session->compact, input, size, outline);
+}
+
+EMSCRIPTEN_KEEPALIVE int mupdf_clean_session_stream(mupdf_clean_session *session,char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn) {
+	if (!session)
+		return -1;
+	return clean_stream_with_context(session->ctx, session->compact, input, size, outline, chunk_size, fn);
+}
+
+EMSCRIPTEN_KEEPALIVE int mupdf_clean_session_stream_base64(mupdf_clean_session *session,char *input,int size,char *outline,int chunk_size,mupdf_clean_chunk_fn *fn) {
+	if (!session)
+		return -1;
+	return clean_stream_base64_with_context(session->ctx, session->compact, input, size, outline, chunk_size, fn);
+}
+
+EMSCRIPTEN_KEEPALIVE char* mupdf_clean_alloc(int size) {
+	return size > 0 ? malloc(size) : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE void mupdf_clean_free(char *data) {
+	free(data);
+}
+
+EMSCRIPTEN_KEEPALIVE mupdf_clean_result* mupdf_clean_run(char *input,int size,char *outline) {
+	return internal_mupdf_clean_run(input, size, outline);
+}
+
+EMSCRIPTEN_KEEPALIVE char* mupdf_clean_result_data(mupdf_clean_result *result) {
+	return result ? result->data : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE int mupdf_clean_result_length(mupdf_clean_result *result) {
+	return result ? result->length : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE void mupdf_clean_result_free(mupdf_clean_result *result) {
+	internal_mupdf_clean_result_free(result);
+}
@@ -64,16 +64,33 @@ pdf_drop_graft_map(fz_context *ctx, pdf_graft_map *map)
 	}
 }
 
+/* Primitive objects are not bound to a document, so can be re-used as is,
+ * unless they live in the source document's object arena. */
+static pdf_obj *
+graft_primitive(fz_context *ctx, pdf_obj *obj)
+{
+	if (!pdf_obj_in_arena(ctx, obj))
+		return pdf_keep_obj(ctx, obj);
+	if (pdf_is_int(ctx, obj))
+		return pdf_new_int(ctx, pdf_to_int64(ctx, obj));
+	if (pdf_is_real(ctx, obj))
+		return pdf_new_real(ctx, pdf_to_real(ctx, obj));
+	if (pdf_is_name(ctx, obj))
+		return pdf_new_name(ctx, pdf_to_name(ctx, obj));
+	if (pdf_is_string(ctx, obj))
+		return pdf_new_string(ctx, pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+	return pdf_keep_obj(ctx, obj);
+}
+
 pdf_obj *
 pdf_graft_object(fz_context *ctx, pdf_document *dst, pdf_obj *obj)
 {
 	pdf_document *src;
 	pdf_graft_map *map;
 
-	/* Primitive objects are not bound to a document, so can be re-used as is. */
 	src = pdf_get_bound_document(ctx, obj);
 	if (src == NULL)
-		return pdf_keep_obj(ctx, obj);
+		return graft_primitive(ctx, obj);
 
 	map = pdf_new_graft_map(ctx, dst);
 
@@ -99,10 +116,9 @@ pdf_graft_mapped_object(fz_context *ctx, pdf_graft_map *map, pdf_obj *obj)
 	pdf_document *src;
 	int new_num, src_num, len, i;
 
-	/* Primitive objects are not bound to a document, so can be re-used as is. */
 	src = pdf_get_bound_document(ctx, obj);
 	if (!src)
-		return pdf_keep_obj(ctx, obj);
+		return graft_primitive(ctx, obj);
 
 	if (map->src && src != map->src)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "grafted objects must all belong to the same source document");
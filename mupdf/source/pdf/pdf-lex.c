@@ -23,6 +23,8 @@
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
 
+#include "../fitz/simd-imp.h"
+
 #include <string.h>
 
 #define IS_NUMBER \
@@ -78,6 +80,16 @@ static inline int iswhite(int ch)
 		ch == '\040';
 }
 
+static inline int isdelim(int ch)
+{
+	return
+		ch == '(' || ch == ')' ||
+		ch == '<' || ch == '>' ||
+		ch == '[' || ch == ']' ||
+		ch == '{' || ch == '}' ||
+		ch == '/' || ch == '%';
+}
+
 static inline int fz_isprint(int ch)
 {
 	return ch >= ' ' && ch <= '~';
@@ -91,10 +103,131 @@ static inline int unhex(int ch)
 	return 0;
 }
 
+/*
+	Fast paths that scan the stream's current rp..wp window directly,
+	16 bytes at a time where the vector unit allows. They only ever
+	finish a token that ends inside the window; anything that runs up
+	to its edge, or needs the rarer rules (# escapes in names, repeated
+	signs in numbers, ...) is left to the byte at a time code below,
+	which refills the window as it goes.
+*/
+#ifndef DUMP_LEXER_STREAM
+#define LEX_FAST_PATHS
+#endif
+
+#ifdef LEX_FAST_PATHS
+
+static const unsigned char *
+skip_white(const unsigned char *p, const unsigned char *e)
+{
+#ifdef FZ_SIMD
+	const fz_u8x16 space = fz_u8x16_splat(' ');
+	const fz_u8x16 nul = fz_u8x16_splat(0);
+	const fz_u8x16 tab = fz_u8x16_splat('\t');
+	const fz_u8x16 lf = fz_u8x16_splat('\n');
+	const fz_u8x16 ff = fz_u8x16_splat('\f');
+	const fz_u8x16 cr = fz_u8x16_splat('\r');
+	while (e - p >= 16)
+	{
+		fz_u8x16 v = fz_u8x16_load(p);
+		fz_u8x16 w = fz_u8x16_or(
+			fz_u8x16_or(fz_u8x16_eq(v, space), fz_u8x16_eq(v, nul)),
+			fz_u8x16_or(
+				fz_u8x16_or(fz_u8x16_eq(v, tab), fz_u8x16_eq(v, lf)),
+				fz_u8x16_or(fz_u8x16_eq(v, ff), fz_u8x16_eq(v, cr))));
+		int i = fz_u8x16_first(fz_u8x16_eq(w, nul));
+		if (i < 16)
+			return p + i;
+		p += 16;
+	}
+#endif
+	while (p < e && iswhite(*p))
+		p++;
+	return p;
+}
+
+static const unsigned char *
+find_eol(const unsigned char *p, const unsigned char *e)
+{
+#ifdef FZ_SIMD
+	const fz_u8x16 lf = fz_u8x16_splat('\n');
+	const fz_u8x16 cr = fz_u8x16_splat('\r');
+	while (e - p >= 16)
+	{
+		fz_u8x16 v = fz_u8x16_load(p);
+		int i = fz_u8x16_first(fz_u8x16_or(fz_u8x16_eq(v, lf), fz_u8x16_eq(v, cr)));
+		if (i < 16)
+			return p + i;
+		p += 16;
+	}
+#endif
+	while (p < e && *p != '\n' && *p != '\r')
+		p++;
+	return p;
+}
+
+/* Find the first whitespace, delimiter or '#' (the end of a simple
+ * name or keyword). */
+static const unsigned char *
+find_name_end(const unsigned char *p, const unsigned char *e)
+{
+#ifdef FZ_SIMD
+	/* Any byte up to ' ' is a candidate; the few control characters
+	 * that are not whitespace are weeded out by the scalar check. */
+	const fz_u8x16 space = fz_u8x16_splat(' ');
+	const fz_u8x16 paren0 = fz_u8x16_splat('(');
+	const fz_u8x16 paren1 = fz_u8x16_splat(')');
+	const fz_u8x16 angle0 = fz_u8x16_splat('<');
+	const fz_u8x16 angle1 = fz_u8x16_splat('>');
+	const fz_u8x16 square0 = fz_u8x16_splat('[');
+	const fz_u8x16 square1 = fz_u8x16_splat(']');
+	const fz_u8x16 brace0 = fz_u8x16_splat('{');
+	const fz_u8x16 brace1 = fz_u8x16_splat('}');
+	const fz_u8x16 slash = fz_u8x16_splat('/');
+	const fz_u8x16 percent = fz_u8x16_splat('%');
+	const fz_u8x16 hash = fz_u8x16_splat('#');
+	while (e - p >= 16)
+	{
+		fz_u8x16 v = fz_u8x16_load(p);
+		fz_u8x16 m = fz_u8x16_or(
+			fz_u8x16_or(
+				fz_u8x16_or(fz_u8x16_le(v, space), fz_u8x16_eq(v, hash)),
+				fz_u8x16_or(fz_u8x16_eq(v, slash), fz_u8x16_eq(v, percent))),
+			fz_u8x16_or(
+				fz_u8x16_or(
+					fz_u8x16_or(fz_u8x16_eq(v, paren0), fz_u8x16_eq(v, paren1)),
+					fz_u8x16_or(fz_u8x16_eq(v, angle0), fz_u8x16_eq(v, angle1))),
+				fz_u8x16_or(
+					fz_u8x16_or(fz_u8x16_eq(v, square0), fz_u8x16_eq(v, square1)),
+					fz_u8x16_or(fz_u8x16_eq(v, brace0), fz_u8x16_eq(v, brace1)))));
+		int i = fz_u8x16_first(m);
+		if (i == 16)
+		{
+			p += 16;
+			continue;
+		}
+		p += i;
+		if (iswhite(*p) || isdelim(*p) || *p == '#')
+			return p;
+		p++;
+	}
+#endif
+	while (p < e && !iswhite(*p) && !isdelim(*p) && *p != '#')
+		p++;
+	return p;
+}
+
+#endif
+
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
 	int c;
+#ifdef LEX_FAST_PATHS
+	f->rp = (unsigned char *)skip_white(f->rp, f->wp);
+	if (f->rp < f->wp)
+		return;
+#endif
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -106,6 +239,15 @@ static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
 	int c;
+#ifdef LEX_FAST_PATHS
+	const unsigned char *p = find_eol(f->rp, f->wp);
+	if (p < f->wp)
+	{
+		f->rp = (unsigned char *)p + 1;
+		return;
+	}
+	f->rp = f->wp;
+#endif
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -184,6 +326,31 @@ static int fast_atoi(char *s)
 	return neg ? -i : i;
 }
 
+static int
+number_token(pdf_lexbuf *buf, char *isreal, int neg, int isbad)
+{
+	if (isbad)
+		return PDF_TOK_KEYWORD;
+	if (isreal)
+	{
+		/* We'd like to use the fastest possible atof
+		 * routine, but we'd rather match acrobats
+		 * handling of broken numbers. As such, we
+		 * spot common broken cases and call an
+		 * acrobat compatible routine where required. */
+		if (neg > 1 || isreal - buf->scratch >= 10)
+			buf->f = acrobat_compatible_atof(buf->scratch);
+		else
+			buf->f = fz_atof(buf->scratch);
+		return PDF_TOK_REAL;
+	}
+	else
+	{
+		buf->i = fast_atoi(buf->scratch);
+		return PDF_TOK_INT;
+	}
+}
+
 static int
 lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -193,6 +360,36 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 	int neg = (c == '-');
 	int isbad = 0;
 
+#ifdef LEX_FAST_PATHS
+	{
+		/* Digits with at most one '.', ended by whitespace or a
+		 * delimiter within the window. */
+		const unsigned char *p = f->rp;
+		const unsigned char *dot = NULL;
+		size_t n;
+		while (p < f->wp)
+		{
+			if (*p >= '0' && *p <= '9')
+				p++;
+			else if (*p == '.' && !isreal && !dot)
+				dot = p++;
+			else
+				break;
+		}
+		n = p - f->rp;
+		if (p < f->wp && (iswhite(*p) || isdelim(*p)) && n + 2 <= buf->size)
+		{
+			*s = c;
+			memcpy(s + 1, f->rp, n);
+			s[n + 1] = '\0';
+			if (dot)
+				isreal = s + 1 + (dot - f->rp);
+			f->rp = (unsigned char *)p;
+			return number_token(buf, isreal, neg, 0);
+		}
+	}
+#endif
+
 	*s++ = c;
 
 	c = lex_byte(ctx, f);
@@ -242,26 +439,7 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 
 end:
 	*s = '\0';
-	if (isbad)
-		return PDF_TOK_KEYWORD;
-	if (isreal)
-	{
-		/* We'd like to use the fastest possible atof
-		 * routine, but we'd rather match acrobats
-		 * handling of broken numbers. As such, we
-		 * spot common broken cases and call an
-		 * acrobat compatible routine where required. */
-		if (neg > 1 || isreal - buf->scratch >= 10)
-			buf->f = acrobat_compatible_atof(buf->scratch);
-		else
-			buf->f = fz_atof(buf->scratch);
-		return PDF_TOK_REAL;
-	}
-	else
-	{
-		buf->i = fast_atoi(buf->scratch);
-		return PDF_TOK_INT;
-	}
+	return number_token(buf, isreal, neg, isbad);
 }
 
 static void
@@ -269,8 +447,25 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 {
 	char *s = lb->scratch;
 	char *e = s + fz_minz(127, lb->size);
+	int held = EOF;
 	int c;
 
+#ifdef LEX_FAST_PATHS
+	{
+		/* A name without # escapes, ending within the window. */
+		const unsigned char *p = find_name_end(f->rp, f->wp);
+		size_t n = p - f->rp;
+		if (p < f->wp && *p != '#' && n < (size_t)(e - s))
+		{
+			memcpy(s, f->rp, n);
+			s[n] = '\0';
+			lb->len = n;
+			f->rp = (unsigned char *)p;
+			return;
+		}
+	}
+#endif
+
 	while (1)
 	{
 		if (s == e)
@@ -289,7 +484,13 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 				s = NULL;
 			}
 		}
-		c = lex_byte(ctx, f);
+		if (held != EOF)
+		{
+			c = held;
+			held = EOF;
+		}
+		else
+			c = lex_byte(ctx, f);
 		switch (c)
 		{
 		case IS_WHITE:
@@ -301,6 +502,7 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 		case '#':
 		{
 			int hex[2];
+			int first = EOF;
 			int i;
 			for (i = 0; i < 2; i++)
 			{
@@ -322,12 +524,17 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 				case EOF:
 					goto illegal;
 				}
+				if (i == 0)
+					first = c;
 			}
 			if (s) *s++ = (hex[0] << 4) + hex[1];
 			break;
 illegal:
+			/* Keep the first digit of a broken escape as part of the
+			 * name. The peek for the second may have refilled the
+			 * stream, so the digit can't be unread; hold on to it. */
 			if (i == 1)
-				fz_unread_byte(ctx, f);
+				held = first;
 			if (s) *s++ = '#';
 			continue;
 		}
@@ -457,6 +664,32 @@ lex_hex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+#if defined(LEX_FAST_PATHS) && defined(FZ_SIMD)
+		/* Decode runs of 16 hex digits 8 bytes at a time. */
+		if (!x)
+		{
+			const fz_u8x16 zero = fz_u8x16_splat('0');
+			const fz_u8x16 nine = fz_u8x16_splat(9);
+			const fz_u8x16 lower = fz_u8x16_splat(0x20);
+			const fz_u8x16 a_ = fz_u8x16_splat('a');
+			const fz_u8x16 five = fz_u8x16_splat(5);
+			const fz_u8x16 ten = fz_u8x16_splat(10);
+			while (f->wp - f->rp >= 16 && e - s >= 8)
+			{
+				fz_u8x16 v = fz_u8x16_load(f->rp);
+				fz_u8x16 d = fz_u8x16_sub(v, zero);
+				fz_u8x16 l = fz_u8x16_sub(fz_u8x16_or(v, lower), a_);
+				fz_u8x16 dig = fz_u8x16_le(d, nine);
+				if (!fz_u8x16_all(fz_u8x16_or(dig, fz_u8x16_le(l, five))))
+					break;
+				fz_u8x16_pack_nibbles((unsigned char *)s, fz_u8x16_select(dig, d, fz_u8x16_add(l, ten)));
+				s += 8;
+				f->rp += 16;
+			}
+			if (s == e)
+				continue;
+		}
+#endif
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
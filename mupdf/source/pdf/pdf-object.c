@@ -57,7 +57,9 @@ enum
 	PDF_FLAGS_SORTED = 2,
 	PDF_FLAGS_DIRTY = 4,
 	PDF_FLAGS_MEMO_BASE = 8,
-	PDF_FLAGS_MEMO_BASE_BOOL = 16
+	PDF_FLAGS_MEMO_BASE_BOOL = 16,
+	PDF_FLAGS_ARENA = 64, /* object lives in its document's object arena */
+	PDF_FLAGS_ARENA_ITEMS = 128 /* ... as do its array or dict items */
 };
 
 struct pdf_obj
@@ -98,6 +100,7 @@ typedef struct
 	int parent_num;
 	int len;
 	int cap;
+	int last_used; /* object cache epoch, see pdf_trim_object_cache */
 	pdf_obj **items;
 } pdf_obj_array;
 
@@ -108,6 +111,7 @@ typedef struct
 	int parent_num;
 	int len;
 	int cap;
+	int last_used; /* object cache epoch, see pdf_trim_object_cache */
 	struct keyval *items;
 } pdf_obj_dict;
 
@@ -167,32 +171,97 @@ struct pdf_journal
 #define ARRAY(obj) ((pdf_obj_array *)(obj))
 #define REF(obj) ((pdf_obj_ref *)(obj))
 
-pdf_obj *
-pdf_new_int(fz_context *ctx, int64_t i)
+/*
+	Integers that fit in the pointer payload are not allocated at all,
+	but encoded in the pointer itself, much like null, booleans and the
+	constant names. Allocated objects are always at least 2-byte aligned,
+	so an odd value at or above PDF_LIMIT is an immediate integer. The
+	payload is biased so that it never lands below PDF_LIMIT.
+*/
+#define IMM_INT_MAX ((int64_t)(UINTPTR_MAX >> 3))
+#define IMM_INT_MIN (-IMM_INT_MAX)
+#define IMM_INT_FITS(i) ((i) >= IMM_INT_MIN && (i) <= IMM_INT_MAX)
+#define IMM_INT_ENCODE(i) \
+	((pdf_obj *)(((((uintptr_t)((i) - IMM_INT_MIN)) + PDF_ENUM_LIMIT) << 1) | 1))
+#define IMM_INT_DECODE(obj) \
+	((int64_t)((((uintptr_t)(obj)) >> 1) - PDF_ENUM_LIMIT) + IMM_INT_MIN)
+
+#define OBJ_IS_IMM_INT(obj) (obj >= PDF_LIMIT && ((uintptr_t)(obj) & 1))
+#define OBJ_IS_BOXED(obj) (obj >= PDF_LIMIT && !((uintptr_t)(obj) & 1))
+
+/*
+	While a document is loading objects from its file into its object
+	arena (see pdf_enable_object_arena) they are carved out of the
+	arena rather than allocated one by one. Such objects are never
+	freed individually; the arena goes with the document. Once the
+	arena has reached PDF_OBJECT_ARENA_MAX bytes, objects go on the
+	heap as usual.
+*/
+static fz_pool *
+object_arena(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc || doc->obj_arena_loading <= 0)
+		return NULL;
+	if (fz_pool_size(ctx, doc->obj_arena) >= PDF_OBJECT_ARENA_MAX)
+		return NULL;
+	return doc->obj_arena;
+}
+
+static void *
+obj_alloc(fz_context *ctx, fz_pool *arena, size_t size)
+{
+	/* Round up to keep the int64_t in pdf_obj_num aligned. */
+	if (arena)
+		return fz_pool_alloc(ctx, arena, (size + 7) & ~(size_t)7);
+	return fz_malloc(ctx, size);
+}
+
+static pdf_obj *
+new_int(fz_context *ctx, fz_pool *arena, int64_t i)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(int)");
+	obj = Memento_label(obj_alloc(ctx, arena, sizeof(pdf_obj_num)), "pdf_obj(int)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA : 0;
 	obj->u.i = i;
 	return &obj->super;
 }
 
 pdf_obj *
-pdf_new_real(fz_context *ctx, float f)
+pdf_new_int(fz_context *ctx, int64_t i)
+{
+	if (IMM_INT_FITS(i))
+		return IMM_INT_ENCODE(i);
+	return new_int(ctx, NULL, i);
+}
+
+pdf_obj *
+pdf_new_boxed_int(fz_context *ctx, int64_t i)
+{
+	return new_int(ctx, NULL, i);
+}
+
+static pdf_obj *
+new_real(fz_context *ctx, fz_pool *arena, float f)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(real)");
+	obj = Memento_label(obj_alloc(ctx, arena, sizeof(pdf_obj_num)), "pdf_obj(real)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_REAL;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA : 0;
 	obj->u.f = f;
 	return &obj->super;
 }
 
 pdf_obj *
-pdf_new_string(fz_context *ctx, const char *str, size_t len)
+pdf_new_real(fz_context *ctx, float f)
+{
+	return new_real(ctx, NULL, f);
+}
+
+static pdf_obj *
+new_string(fz_context *ctx, fz_pool *arena, const char *str, size_t len)
 {
 	pdf_obj_string *obj;
 	unsigned int l = (unsigned int)len;
@@ -200,10 +269,10 @@ pdf_new_string(fz_context *ctx, const char *str, size_t len)
 	if ((size_t)l != len)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Overflow in pdf string");
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_string, buf) + len + 1), "pdf_obj(string)");
+	obj = Memento_label(obj_alloc(ctx, arena, offsetof(pdf_obj_string, buf) + len + 1), "pdf_obj(string)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_STRING;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA : 0;
 	obj->text = NULL;
 	obj->len = l;
 	memcpy(obj->buf, str, len);
@@ -212,9 +281,15 @@ pdf_new_string(fz_context *ctx, const char *str, size_t len)
 }
 
 pdf_obj *
-pdf_new_name(fz_context *ctx, const char *str)
+pdf_new_string(fz_context *ctx, const char *str, size_t len)
+{
+	return new_string(ctx, NULL, str, len);
+}
+
+/* Index of str in the standard name table, or 0 if it is not there. */
+static int
+find_standard_name(const char *str)
 {
-	pdf_obj_name *obj;
 	int l = 3; /* skip dummy slots */
 	int r = nelem(PDF_NAME_LIST) - 1;
 	while (l <= r)
@@ -226,9 +301,20 @@ pdf_new_name(fz_context *ctx, const char *str)
 		else if (c > 0)
 			l = m + 1;
 		else
-			return (pdf_obj*)(intptr_t)m;
+			return m;
 	}
+	return 0;
+}
 
+/*
+	Names are always allocated on the heap, never in an object arena.
+	They can be store keys, but carry no document, so a name in an
+	arena could not be tied to the document that owns its memory.
+*/
+static pdf_obj *
+alloc_name(fz_context *ctx, const char *str)
+{
+	pdf_obj_name *obj;
 	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_name, n) + strlen(str) + 1), "pdf_obj(name)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_NAME;
@@ -237,9 +323,130 @@ pdf_new_name(fz_context *ctx, const char *str)
 	return &obj->super;
 }
 
+static pdf_obj *
+new_name(fz_context *ctx, const char *str)
+{
+	int i = find_standard_name(str);
+	if (i)
+		return (pdf_obj*)(intptr_t)i;
+	return alloc_name(ctx, str);
+}
+
+pdf_obj *
+pdf_new_name(fz_context *ctx, const char *str)
+{
+	return new_name(ctx, str);
+}
+
+pdf_obj *
+pdf_new_parsed_int(fz_context *ctx, pdf_document *doc, int64_t i)
+{
+	if (IMM_INT_FITS(i))
+		return IMM_INT_ENCODE(i);
+	return new_int(ctx, object_arena(ctx, doc), i);
+}
+
+pdf_obj *
+pdf_new_parsed_real(fz_context *ctx, pdf_document *doc, float f)
+{
+	return new_real(ctx, object_arena(ctx, doc), f);
+}
+
+pdf_obj *
+pdf_new_parsed_string(fz_context *ctx, pdf_document *doc, const char *str, size_t len)
+{
+	return new_string(ctx, object_arena(ctx, doc), str, len);
+}
+
+/*
+	The names a document uses beyond the standard table are interned
+	in an open addressed hash table held by the document. The table
+	owns one reference to each name, and they are allocated on the
+	heap rather than in the object arena, so handing them out is only
+	a matter of reference counting. A name that is already shared by
+	so many objects that its 16-bit count could overflow is no longer
+	handed out; its users get a private copy instead.
+*/
+#define PDF_NAME_SHARE_MAX 32000
+
+static uint32_t
+name_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static void
+grow_name_table(fz_context *ctx, pdf_document *doc)
+{
+	int cap = doc->names_cap ? doc->names_cap * 2 : 256;
+	pdf_obj **names = fz_calloc(ctx, cap, sizeof(*names));
+	int i, j;
+
+	for (i = 0; i < doc->names_cap; i++)
+	{
+		if (!doc->names[i])
+			continue;
+		j = name_hash(NAME(doc->names[i])->n) & (cap - 1);
+		while (names[j])
+			j = (j + 1) & (cap - 1);
+		names[j] = doc->names[i];
+	}
+
+	fz_free(ctx, doc->names);
+	doc->names = names;
+	doc->names_cap = cap;
+}
+
+static pdf_obj *
+intern_name(fz_context *ctx, pdf_document *doc, const char *str)
+{
+	pdf_obj *obj;
+	int i = find_standard_name(str);
+	if (i)
+		return (pdf_obj*)(intptr_t)i;
+
+	if (doc->names_count * 2 >= doc->names_cap)
+		grow_name_table(ctx, doc);
+
+	i = name_hash(str) & (doc->names_cap - 1);
+	while ((obj = doc->names[i]) != NULL)
+	{
+		if (!strcmp(NAME(obj)->n, str))
+		{
+			if (obj->refs < PDF_NAME_SHARE_MAX)
+				return pdf_keep_obj(ctx, obj);
+			return alloc_name(ctx, str);
+		}
+		i = (i + 1) & (doc->names_cap - 1);
+	}
+
+	obj = alloc_name(ctx, str);
+	doc->names[i] = pdf_keep_obj(ctx, obj);
+	doc->names_count++;
+	return obj;
+}
+
+pdf_obj *
+pdf_new_parsed_name(fz_context *ctx, pdf_document *doc, const char *str)
+{
+	if (doc)
+		return intern_name(ctx, doc, str);
+	return new_name(ctx, str);
+}
+
+int
+pdf_obj_in_arena(fz_context *ctx, pdf_obj *obj)
+{
+	return OBJ_IS_BOXED(obj) && (obj->flags & PDF_FLAGS_ARENA);
+}
+
 pdf_obj *
 pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
+	fz_pool *arena;
 	pdf_obj_ref *obj;
 	if (num < 0 || num > PDF_MAX_OBJECT_NUMBER)
 	{
@@ -251,10 +458,11 @@ pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 		fz_warn(ctx, "invalid generation number (%d)", gen);
 		return PDF_NULL;
 	}
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
+	arena = object_arena(ctx, doc);
+	obj = Memento_label(obj_alloc(ctx, arena, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INDIRECT;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA : 0;
 	obj->doc = doc;
 	obj->num = num;
 	obj->gen = gen;
@@ -263,21 +471,30 @@ pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 
 #define OBJ_IS_NULL(obj) (obj == PDF_NULL)
 #define OBJ_IS_BOOL(obj) (obj == PDF_TRUE || obj == PDF_FALSE)
-#define OBJ_IS_NAME(obj) ((obj > PDF_FALSE && obj < PDF_LIMIT) || (obj >= PDF_LIMIT && obj->kind == PDF_NAME))
+#define OBJ_IS_NAME(obj) ((obj > PDF_FALSE && obj < PDF_LIMIT) || (OBJ_IS_BOXED(obj) && obj->kind == PDF_NAME))
 #define OBJ_IS_INT(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_INT)
+	(OBJ_IS_IMM_INT(obj) || (OBJ_IS_BOXED(obj) && obj->kind == PDF_INT))
 #define OBJ_IS_REAL(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_REAL)
+	(OBJ_IS_BOXED(obj) && obj->kind == PDF_REAL)
 #define OBJ_IS_NUMBER(obj) \
-	(obj >= PDF_LIMIT && (obj->kind == PDF_REAL || obj->kind == PDF_INT))
+	(OBJ_IS_IMM_INT(obj) || (OBJ_IS_BOXED(obj) && (obj->kind == PDF_REAL || obj->kind == PDF_INT)))
 #define OBJ_IS_STRING(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_STRING)
+	(OBJ_IS_BOXED(obj) && obj->kind == PDF_STRING)
 #define OBJ_IS_ARRAY(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_ARRAY)
+	(OBJ_IS_BOXED(obj) && obj->kind == PDF_ARRAY)
 #define OBJ_IS_DICT(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_DICT)
+	(OBJ_IS_BOXED(obj) && obj->kind == PDF_DICT)
 #define OBJ_IS_INDIRECT(obj) \
-	(obj >= PDF_LIMIT && obj->kind == PDF_INDIRECT)
+	(OBJ_IS_BOXED(obj) && obj->kind == PDF_INDIRECT)
+
+/* The value of an int, immediate or allocated. */
+static inline int64_t
+int_value(pdf_obj *obj)
+{
+	if (OBJ_IS_IMM_INT(obj))
+		return IMM_INT_DECODE(obj);
+	return NUM(obj)->u.i;
+}
 
 #define RESOLVE(obj) \
 	if (OBJ_IS_INDIRECT(obj)) \
@@ -352,6 +569,8 @@ int pdf_to_bool(fz_context *ctx, pdf_obj *obj)
 int pdf_to_int(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
+	if (OBJ_IS_IMM_INT(obj))
+		return (int)IMM_INT_DECODE(obj);
 	if (obj < PDF_LIMIT)
 		return 0;
 	if (obj->kind == PDF_INT)
@@ -364,6 +583,8 @@ int pdf_to_int(fz_context *ctx, pdf_obj *obj)
 int64_t pdf_to_int64(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
+	if (OBJ_IS_IMM_INT(obj))
+		return IMM_INT_DECODE(obj);
 	if (obj < PDF_LIMIT)
 		return 0;
 	if (obj->kind == PDF_INT)
@@ -376,6 +597,8 @@ int64_t pdf_to_int64(fz_context *ctx, pdf_obj *obj)
 float pdf_to_real(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
+	if (OBJ_IS_IMM_INT(obj))
+		return IMM_INT_DECODE(obj);
 	if (obj < PDF_LIMIT)
 		return 0;
 	if (obj->kind == PDF_REAL)
@@ -390,7 +613,7 @@ const char *pdf_to_name(fz_context *ctx, pdf_obj *obj)
 	RESOLVE(obj);
 	if (obj < PDF_LIMIT)
 		return PDF_NAME_LIST[((intptr_t)obj)];
-	if (obj->kind == PDF_NAME)
+	if (OBJ_IS_BOXED(obj) && obj->kind == PDF_NAME)
 		return NAME(obj)->n;
 	return "";
 }
@@ -439,7 +662,7 @@ const char *pdf_to_text_string(fz_context *ctx, pdf_obj *obj)
 
 void pdf_set_int(fz_context *ctx, pdf_obj *obj, int64_t i)
 {
-	if (OBJ_IS_INT(obj))
+	if (OBJ_IS_BOXED(obj) && obj->kind == PDF_INT)
 		NUM(obj)->u.i = i;
 }
 
@@ -483,7 +706,7 @@ pdf_document *pdf_get_indirect_document(fz_context *ctx, pdf_obj *obj)
 */
 pdf_document *pdf_get_bound_document(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return NULL;
 	if (obj->kind == PDF_INDIRECT)
 		return REF(obj)->doc;
@@ -523,6 +746,14 @@ do_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b, int check_streams)
 	if (a <= PDF_FALSE || b <= PDF_FALSE)
 		return 1;
 
+	/* a or b is an immediate int */
+	if (OBJ_IS_IMM_INT(a) || OBJ_IS_IMM_INT(b))
+	{
+		if (!OBJ_IS_INT(a) || !OBJ_IS_INT(b))
+			return 1;
+		return int_value(a) < int_value(b) ? -1 : int_value(a) > int_value(b);
+	}
+
 	/* a is a constant name */
 	if (a < PDF_LIMIT)
 	{
@@ -548,7 +779,7 @@ do_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b, int check_streams)
 	switch (a->kind)
 	{
 	case PDF_INT:
-		return NUM(a)->u.i - NUM(b)->u.i;
+		return NUM(a)->u.i < NUM(b)->u.i ? -1 : NUM(a)->u.i > NUM(b)->u.i;
 
 	case PDF_REAL:
 		if (NUM(a)->u.f < NUM(b)->u.f)
@@ -703,6 +934,124 @@ pdf_objcmp_deep(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 	return do_objcmp(ctx, a, b, 1);
 }
 
+/*
+	Structural hashes, consistent with do_objcmp: any two objects
+	that compare equal hash to the same value. Dictionary entries
+	are combined with an order independent sum, since unsorted
+	dictionaries compare equal regardless of key order.
+*/
+
+static uint32_t
+hash_bytes(uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *s = data;
+	while (len--)
+		h = (h ^ *s++) * 16777619;
+	return h;
+}
+
+static uint32_t
+hash_mix(uint32_t h, uint32_t v)
+{
+	return hash_bytes(h, &v, sizeof v);
+}
+
+static uint32_t
+do_objhash(fz_context *ctx, pdf_obj *obj, int check_streams)
+{
+	uint32_t h;
+	int i;
+
+	/* null, true, or false */
+	if (obj <= PDF_FALSE)
+		return (uint32_t)(intptr_t)obj;
+
+	/* constant names hash like the equivalent allocated name */
+	if (obj < PDF_LIMIT)
+	{
+		const char *n = PDF_NAME_LIST[(intptr_t)obj];
+		return hash_bytes(2166136261u ^ PDF_NAME, n, strlen(n));
+	}
+
+	/* immediate ints hash like the equivalent allocated int */
+	if (OBJ_IS_IMM_INT(obj))
+	{
+		int64_t i = IMM_INT_DECODE(obj);
+		return hash_bytes(2166136261u ^ PDF_INT, &i, sizeof i);
+	}
+
+	h = 2166136261u ^ obj->kind;
+	switch (obj->kind)
+	{
+	case PDF_INT:
+		return hash_bytes(h, &NUM(obj)->u.i, sizeof NUM(obj)->u.i);
+
+	case PDF_REAL:
+	{
+		/* -0 and 0 compare equal */
+		float f = NUM(obj)->u.f == 0 ? 0 : NUM(obj)->u.f;
+		return hash_bytes(h, &f, sizeof f);
+	}
+
+	case PDF_STRING:
+		return hash_bytes(h, STRING(obj)->buf, STRING(obj)->len);
+
+	case PDF_NAME:
+		return hash_bytes(h, NAME(obj)->n, strlen(NAME(obj)->n));
+
+	case PDF_INDIRECT:
+		h = hash_mix(h, REF(obj)->num);
+		return hash_mix(h, REF(obj)->gen);
+
+	case PDF_ARRAY:
+		h = hash_mix(h, ARRAY(obj)->len);
+		for (i = 0; i < ARRAY(obj)->len; i++)
+			h = hash_mix(h, do_objhash(ctx, ARRAY(obj)->items[i], 0));
+		return h;
+
+	case PDF_DICT:
+	{
+		uint32_t sum = 0;
+		pdf_document *doc = DICT(obj)->doc;
+		int num = pdf_obj_parent_num(ctx, obj);
+		pdf_xref_entry *entry;
+
+		for (i = 0; i < DICT(obj)->len; i++)
+			sum += hash_mix(do_objhash(ctx, DICT(obj)->items[i].k, 0), do_objhash(ctx, DICT(obj)->items[i].v, 0));
+		h = hash_mix(hash_mix(h, DICT(obj)->len), sum);
+
+		if (!check_streams)
+			return h;
+
+		/* Fold in the raw stream contents, so streams with
+		 * different data end up in different buckets. */
+		entry = pdf_get_xref_entry_no_change(ctx, doc, num);
+		if (entry != NULL && entry->obj == obj && pdf_obj_num_is_stream(ctx, doc, num))
+		{
+			fz_buffer *buf = pdf_load_raw_stream_number(ctx, doc, num);
+			unsigned char *data;
+			size_t len = fz_buffer_storage(ctx, buf, &data);
+			h = hash_bytes(h, data, len);
+			fz_drop_buffer(ctx, buf);
+		}
+		return h;
+	}
+	}
+	return h;
+}
+
+uint32_t
+pdf_objhash(fz_context *ctx, pdf_obj *obj)
+{
+	return do_objhash(ctx, obj, 0);
+}
+
+uint32_t
+pdf_objhash_deep(fz_context *ctx, pdf_obj *obj)
+{
+	return do_objhash(ctx, obj, 1);
+}
+
 int pdf_name_eq(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 {
 	RESOLVE(a);
@@ -711,6 +1060,8 @@ int pdf_name_eq(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 		return 0;
 	if (a < PDF_LIMIT || b < PDF_LIMIT)
 		return (a == b);
+	if (!OBJ_IS_BOXED(a) || !OBJ_IS_BOXED(b))
+		return 0;
 	if (a->kind == PDF_NAME && b->kind == PDF_NAME)
 		return !strcmp(NAME(a)->n, NAME(b)->n);
 	return 0;
@@ -725,6 +1076,8 @@ pdf_objkindstr(pdf_obj *obj)
 		return "boolean";
 	if (obj < PDF_LIMIT)
 		return "name";
+	if (OBJ_IS_IMM_INT(obj))
+		return "integer";
 	switch (obj->kind)
 	{
 	case PDF_INT: return "integer";
@@ -741,26 +1094,32 @@ pdf_objkindstr(pdf_obj *obj)
 pdf_obj *
 pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 {
+	fz_pool *arena = object_arena(ctx, doc);
 	pdf_obj_array *obj;
 	int i;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_array)), "pdf_obj(array)");
+	obj = Memento_label(obj_alloc(ctx, arena, sizeof(pdf_obj_array)), "pdf_obj(array)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_ARRAY;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA | PDF_FLAGS_ARENA_ITEMS : 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
+	obj->last_used = 0;
 
 	obj->len = 0;
 	obj->cap = initialcap > 1 ? initialcap : 6;
 
 	fz_try(ctx)
 	{
-		obj->items = Memento_label(fz_malloc_array(ctx, obj->cap, pdf_obj*), "pdf_array_items");
+		if (arena)
+			obj->items = obj_alloc(ctx, arena, obj->cap * sizeof(pdf_obj*));
+		else
+			obj->items = Memento_label(fz_malloc_array(ctx, obj->cap, pdf_obj*), "pdf_array_items");
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		if (!arena)
+			fz_free(ctx, obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->cap; i++)
@@ -775,7 +1134,24 @@ pdf_array_grow(fz_context *ctx, pdf_obj_array *obj)
 	int i;
 	int new_cap = (obj->cap * 3) / 2;
 
-	obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
+	if (obj->super.flags & PDF_FLAGS_ARENA_ITEMS)
+	{
+		/* Arena storage cannot be reallocated. Copy the items into
+		 * a new block; once loading is over, onto the heap. */
+		fz_pool *arena = object_arena(ctx, obj->doc);
+		pdf_obj **items;
+		if (arena)
+			items = obj_alloc(ctx, arena, new_cap * sizeof(pdf_obj*));
+		else
+		{
+			items = Memento_label(fz_malloc_array(ctx, new_cap, pdf_obj*), "pdf_array_items");
+			obj->super.flags &= ~PDF_FLAGS_ARENA_ITEMS;
+		}
+		memcpy(items, obj->items, obj->len * sizeof(pdf_obj*));
+		obj->items = items;
+	}
+	else
+		obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
 	obj->cap = new_cap;
 
 	for (i = obj->len ; i < obj->cap; i++)
@@ -1481,7 +1857,7 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 		obj should be a dict or an array. We don't care about
 		any other types, as they aren't 'containers'.
 	*/
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 
 	switch (obj->kind)
@@ -1800,14 +2176,14 @@ static int keyvalcmp(const void *ap, const void *bp)
 	 * do, then they match. */
 	if (a->k < PDF_LIMIT)
 		an = PDF_NAME_LIST[(intptr_t)a->k];
-	else if (a->k >= PDF_LIMIT && a->k->kind == PDF_NAME)
+	else if (OBJ_IS_BOXED(a->k) && a->k->kind == PDF_NAME)
 		an = NAME(a->k)->n;
 	else
 		return 0;
 
 	if (b->k < PDF_LIMIT)
 		bn = PDF_NAME_LIST[(intptr_t)b->k];
-	else if (b->k >= PDF_LIMIT && b->k->kind == PDF_NAME)
+	else if (OBJ_IS_BOXED(b->k) && b->k->kind == PDF_NAME)
 		bn = NAME(b->k)->n;
 	else
 		return 0;
@@ -1818,26 +2194,32 @@ static int keyvalcmp(const void *ap, const void *bp)
 pdf_obj *
 pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 {
+	fz_pool *arena = object_arena(ctx, doc);
 	pdf_obj_dict *obj;
 	int i;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
+	obj = Memento_label(obj_alloc(ctx, arena, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_DICT;
-	obj->super.flags = 0;
+	obj->super.flags = arena ? PDF_FLAGS_ARENA | PDF_FLAGS_ARENA_ITEMS : 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
+	obj->last_used = 0;
 
 	obj->len = 0;
 	obj->cap = initialcap > 1 ? initialcap : 10;
 
 	fz_try(ctx)
 	{
-		DICT(obj)->items = Memento_label(fz_malloc_array(ctx, DICT(obj)->cap, struct keyval), "dict_items");
+		if (arena)
+			DICT(obj)->items = obj_alloc(ctx, arena, DICT(obj)->cap * sizeof(struct keyval));
+		else
+			DICT(obj)->items = Memento_label(fz_malloc_array(ctx, DICT(obj)->cap, struct keyval), "dict_items");
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		if (!arena)
+			fz_free(ctx, obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < DICT(obj)->cap; i++)
@@ -1855,7 +2237,23 @@ pdf_dict_grow(fz_context *ctx, pdf_obj *obj)
 	int i;
 	int new_cap = (DICT(obj)->cap * 3) / 2;
 
-	DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
+	if (obj->flags & PDF_FLAGS_ARENA_ITEMS)
+	{
+		/* As for arrays, arena items move on growth. */
+		fz_pool *arena = object_arena(ctx, DICT(obj)->doc);
+		struct keyval *items;
+		if (arena)
+			items = obj_alloc(ctx, arena, new_cap * sizeof(struct keyval));
+		else
+		{
+			items = Memento_label(fz_malloc_array(ctx, new_cap, struct keyval), "dict_items");
+			obj->flags &= ~PDF_FLAGS_ARENA_ITEMS;
+		}
+		memcpy(items, DICT(obj)->items, DICT(obj)->len * sizeof(struct keyval));
+		DICT(obj)->items = items;
+	}
+	else
+		DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
 	DICT(obj)->cap = new_cap;
 
 	for (i = DICT(obj)->len; i < DICT(obj)->cap; i++)
@@ -1977,6 +2375,55 @@ pdf_dict_finds(fz_context *ctx, pdf_obj *obj, const char *key)
 	}
 }
 
+/* As pdf_dict_finds, for a key that is an allocated name. Keys parsed
+ * from the same document are interned, so a hit is usually settled by
+ * comparing pointers alone. */
+static int
+pdf_dict_find_name(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
+{
+	int len = DICT(obj)->len;
+	if ((obj->flags & PDF_FLAGS_SORTED) && len > 0)
+	{
+		int l = 0;
+		int r = len - 1;
+
+		if (DICT(obj)->items[r].k != key && strcmp(pdf_to_name(ctx, DICT(obj)->items[r].k), NAME(key)->n) < 0)
+		{
+			return -1 - (r+1);
+		}
+
+		while (l <= r)
+		{
+			int m = (l + r) >> 1;
+			pdf_obj *k = DICT(obj)->items[m].k;
+			int c = (k == key ? 0 : -strcmp(pdf_to_name(ctx, k), NAME(key)->n));
+			if (c < 0)
+				r = m - 1;
+			else if (c > 0)
+				l = m + 1;
+			else
+				return m;
+		}
+		return -1 - l;
+	}
+
+	else
+	{
+		int i;
+		for (i = 0; i < len; i++)
+		{
+			pdf_obj *k = DICT(obj)->items[i].k;
+			if (k == key)
+				return i;
+			/* Allocated names are never standard ones. */
+			if (k >= PDF_LIMIT && !strcmp(NAME(k)->n, NAME(key)->n))
+				return i;
+		}
+
+		return -1 - len;
+	}
+}
+
 static int
 pdf_dict_find(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 {
@@ -2111,7 +2558,7 @@ pdf_dict_get(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 	if (key < PDF_LIMIT)
 		i = pdf_dict_find(ctx, obj, key);
 	else
-		i = pdf_dict_finds(ctx, obj, pdf_to_name(ctx, key));
+		i = pdf_dict_find_name(ctx, obj, key);
 	if (i >= 0)
 		return DICT(obj)->items[i].v;
 	return NULL;
@@ -2158,7 +2605,7 @@ pdf_dict_get_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val, pdf_
 	if (key < PDF_LIMIT)
 		i = pdf_dict_find(ctx, obj, key);
 	else
-		i = pdf_dict_finds(ctx, obj, pdf_to_name(ctx, key));
+		i = pdf_dict_find_name(ctx, obj, key);
 
 	prepare_object_for_alteration(ctx, obj, val);
 
@@ -2461,7 +2908,7 @@ pdf_sort_dict(fz_context *ctx, pdf_obj *obj)
 pdf_obj *
 pdf_deep_copy_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 	{
 		return obj;
 	}
@@ -2520,7 +2967,7 @@ int
 pdf_obj_marked(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	return !!(obj->flags & PDF_FLAGS_MARKED);
 }
@@ -2530,7 +2977,7 @@ pdf_mark_obj(fz_context *ctx, pdf_obj *obj)
 {
 	int marked;
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	marked = !!(obj->flags & PDF_FLAGS_MARKED);
 	obj->flags |= PDF_FLAGS_MARKED;
@@ -2541,7 +2988,7 @@ void
 pdf_unmark_obj(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags &= ~PDF_FLAGS_MARKED;
 }
@@ -2671,7 +3118,7 @@ pdf_mark_list_free(fz_context *ctx, pdf_mark_list *marks)
 void
 pdf_set_obj_memo(fz_context *ctx, pdf_obj *obj, int bit, int memo)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	bit <<= 1;
 	obj->flags |= PDF_FLAGS_MEMO_BASE << bit;
@@ -2684,7 +3131,7 @@ pdf_set_obj_memo(fz_context *ctx, pdf_obj *obj, int bit, int memo)
 int
 pdf_obj_memo(fz_context *ctx, pdf_obj *obj, int bit, int *memo)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	bit <<= 1;
 	if (!(obj->flags & (PDF_FLAGS_MEMO_BASE<<bit)))
@@ -2697,7 +3144,7 @@ pdf_obj_memo(fz_context *ctx, pdf_obj *obj, int bit, int *memo)
 int pdf_obj_is_dirty(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	return !!(obj->flags & PDF_FLAGS_DIRTY);
 }
@@ -2705,7 +3152,7 @@ int pdf_obj_is_dirty(fz_context *ctx, pdf_obj *obj)
 void pdf_dirty_obj(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags |= PDF_FLAGS_DIRTY;
 }
@@ -2713,7 +3160,7 @@ void pdf_dirty_obj(fz_context *ctx, pdf_obj *obj)
 void pdf_clean_obj(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags &= ~PDF_FLAGS_DIRTY;
 }
@@ -2726,8 +3173,10 @@ pdf_drop_array(fz_context *ctx, pdf_obj *obj)
 	for (i = 0; i < DICT(obj)->len; i++)
 		pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!(obj->flags & PDF_FLAGS_ARENA_ITEMS))
+		fz_free(ctx, DICT(obj)->items);
+	if (!(obj->flags & PDF_FLAGS_ARENA))
+		fz_free(ctx, obj);
 }
 
 static void
@@ -2740,14 +3189,16 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 		pdf_drop_obj(ctx, DICT(obj)->items[i].v);
 	}
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	if (!(obj->flags & PDF_FLAGS_ARENA_ITEMS))
+		fz_free(ctx, DICT(obj)->items);
+	if (!(obj->flags & PDF_FLAGS_ARENA))
+		fz_free(ctx, obj);
 }
 
 pdf_obj *
 pdf_keep_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_LIMIT)
+	if (OBJ_IS_BOXED(obj))
 		return fz_keep_imp16(ctx, obj, &obj->refs);
 	return obj;
 }
@@ -2755,7 +3206,7 @@ pdf_keep_obj(fz_context *ctx, pdf_obj *obj)
 void
 pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		if (fz_drop_imp16(ctx, obj, &obj->refs))
 		{
@@ -2766,9 +3217,10 @@ pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 			else if (obj->kind == PDF_STRING)
 			{
 				fz_free(ctx, STRING(obj)->text);
-				fz_free(ctx, obj);
+				if (!(obj->flags & PDF_FLAGS_ARENA))
+					fz_free(ctx, obj);
 			}
-			else
+			else if (!(obj->flags & PDF_FLAGS_ARENA))
 				fz_free(ctx, obj);
 		}
 	}
@@ -2785,7 +3237,7 @@ pdf_set_obj_parent(fz_context *ctx, pdf_obj *obj, int num)
 {
 	int n, i;
 
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 
 	switch (obj->kind)
@@ -2805,9 +3257,30 @@ pdf_set_obj_parent(fz_context *ctx, pdf_obj *obj, int num)
 	}
 }
 
+void pdf_set_obj_last_used(fz_context *ctx, pdf_obj *obj, int epoch)
+{
+	if (!OBJ_IS_BOXED(obj))
+		return;
+	if (obj->kind == PDF_DICT)
+		DICT(obj)->last_used = epoch;
+	else if (obj->kind == PDF_ARRAY)
+		ARRAY(obj)->last_used = epoch;
+}
+
+int pdf_obj_last_used(fz_context *ctx, pdf_obj *obj)
+{
+	if (!OBJ_IS_BOXED(obj))
+		return -1;
+	if (obj->kind == PDF_DICT)
+		return DICT(obj)->last_used;
+	if (obj->kind == PDF_ARRAY)
+		return ARRAY(obj)->last_used;
+	return -1;
+}
+
 int pdf_obj_parent_num(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 
 	switch (obj->kind)
@@ -3282,7 +3755,7 @@ void pdf_debug_ref(fz_context *ctx, pdf_obj *obj)
 
 int pdf_obj_refs(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	return obj->refs;
 }
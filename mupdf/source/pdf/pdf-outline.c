@@ -566,6 +566,150 @@ fz_outline_iterator *pdf_new_outline_iterator(fz_context *ctx, pdf_document *doc
 	return &iter->super;
 }
 
+void
+pdf_set_outline_tree(fz_context *ctx, pdf_document *doc, int n, const pdf_outline_entry *entries)
+{
+	pdf_obj **pages = NULL;
+	pdf_obj **nodes = NULL;
+	int *parent = NULL;
+	int *count = NULL;
+	int *last = NULL;
+	pdf_obj *outlines = NULL;
+	pdf_obj *root, *up, *dest;
+	int i, p, sp, top, page_count, bad_pages = 0;
+
+	fz_var(pages);
+	fz_var(nodes);
+	fz_var(parent);
+	fz_var(count);
+	fz_var(last);
+	fz_var(outlines);
+
+	if (n < 0)
+		n = 0;
+
+	pdf_begin_operation(ctx, doc, "Set outline");
+
+	fz_try(ctx)
+	{
+		root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root));
+		if (n == 0)
+		{
+			pdf_dict_del(ctx, root, PDF_NAME(Outlines));
+			break;
+		}
+
+		pages = fz_calloc(ctx, n, sizeof *pages);
+		nodes = fz_calloc(ctx, n, sizeof *nodes);
+		parent = fz_malloc_array(ctx, n, int);
+		count = fz_calloc(ctx, n, sizeof *count);
+		last = fz_malloc_array(ctx, n + 1, int);
+
+		/* Resolve all destinations before we touch the document: any
+		 * structural change drops the cached page map, so looking
+		 * pages up as we go would rebuild it for every entry. */
+		page_count = pdf_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+		{
+			if (entries[i].page < 0)
+				continue;
+			if (entries[i].page >= page_count)
+				bad_pages++;
+			else
+				pages[i] = pdf_keep_obj(ctx, pdf_lookup_page_obj(ctx, doc, entries[i].page));
+		}
+		if (bad_pages)
+			fz_warn(ctx, "dropping %d outline destinations beyond the last page", bad_pages);
+
+		/* Find the parent of each entry, using 'last' as the stack
+		 * of currently open ancestors. */
+		for (sp = 0, i = 0; i < n; i++)
+		{
+			while (sp > 0 && entries[last[sp-1]].level >= entries[i].level)
+				sp--;
+			parent[i] = sp > 0 ? last[sp-1] : -1;
+			last[sp++] = i;
+		}
+
+		/* Count the descendants each item shows when opened: its
+		 * children, and what its open children show in turn. Parents
+		 * always precede their children. */
+		for (top = 0, i = n - 1; i >= 0; i--)
+		{
+			int shown = 1 + (entries[i].is_open ? count[i] : 0);
+			if (parent[i] >= 0)
+				count[parent[i]] += shown;
+			else
+				top += shown;
+		}
+
+		outlines = pdf_add_new_dict(ctx, doc, 4);
+		pdf_dict_put(ctx, outlines, PDF_NAME(Type), PDF_NAME(Outlines));
+		pdf_dict_put_int(ctx, outlines, PDF_NAME(Count), top);
+		for (i = 0; i < n; i++)
+			nodes[i] = pdf_add_new_dict(ctx, doc, 6);
+
+		/* Link each entry after the last child seen so far of its
+		 * parent; slot n stands for the outline root. */
+		for (i = 0; i <= n; i++)
+			last[i] = -1;
+		for (i = 0; i < n; i++)
+		{
+			p = parent[i] < 0 ? n : parent[i];
+			up = p == n ? outlines : nodes[p];
+
+			pdf_dict_put_text_string(ctx, nodes[i], PDF_NAME(Title), entries[i].title ? entries[i].title : "");
+			pdf_dict_put(ctx, nodes[i], PDF_NAME(Parent), up);
+			if (last[p] < 0)
+				pdf_dict_put(ctx, up, PDF_NAME(First), nodes[i]);
+			else
+			{
+				pdf_dict_put(ctx, nodes[i], PDF_NAME(Prev), nodes[last[p]]);
+				pdf_dict_put(ctx, nodes[last[p]], PDF_NAME(Next), nodes[i]);
+			}
+			last[p] = i;
+
+			/* Closed items carry a negative Count. */
+			if (count[i] > 0)
+				pdf_dict_put_int(ctx, nodes[i], PDF_NAME(Count), entries[i].is_open ? count[i] : -count[i]);
+
+			if (pages[i])
+			{
+				dest = pdf_dict_put_array(ctx, nodes[i], PDF_NAME(Dest), 5);
+				pdf_array_push(ctx, dest, pages[i]);
+				pdf_array_push(ctx, dest, PDF_NAME(XYZ));
+				pdf_array_push(ctx, dest, PDF_NULL);
+				pdf_array_push(ctx, dest, PDF_NULL);
+				pdf_array_push(ctx, dest, PDF_NULL);
+			}
+		}
+		for (p = 0; p <= n; p++)
+			if (last[p] >= 0)
+				pdf_dict_put(ctx, p == n ? outlines : nodes[p], PDF_NAME(Last), nodes[last[p]]);
+
+		pdf_dict_put(ctx, root, PDF_NAME(Outlines), outlines);
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (pages)
+				pdf_drop_obj(ctx, pages[i]);
+			if (nodes)
+				pdf_drop_obj(ctx, nodes[i]);
+		}
+		fz_free(ctx, pages);
+		fz_free(ctx, nodes);
+		fz_free(ctx, parent);
+		fz_free(ctx, count);
+		fz_free(ctx, last);
+		pdf_drop_obj(ctx, outlines);
+		pdf_end_operation(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 fz_link_dest
 pdf_resolve_link_dest(fz_context *ctx, pdf_document *doc, const char *uri)
 {
@@ -64,7 +64,13 @@ pdf_load_page_tree_imp(fz_context *ctx, pdf_document *doc, pdf_obj *node, int id
 			fz_throw(ctx, FZ_ERROR_GENERIC, "too many kids in page tree");
 		doc->rev_page_map[idx].page = idx;
 		doc->rev_page_map[idx].object = pdf_to_num(ctx, node);
-		doc->fwd_page_map[idx] = pdf_keep_obj(ctx, node);
+		/* Lazy lookups may have filled this in already. If they
+		 * disagree with the walk (a bad /Count), the walk wins. */
+		if (pdf_to_num(ctx, doc->fwd_page_map[idx]) != pdf_to_num(ctx, node) || !doc->fwd_page_map[idx])
+		{
+			pdf_drop_obj(ctx, doc->fwd_page_map[idx]);
+			doc->fwd_page_map[idx] = pdf_keep_obj(ctx, node);
+		}
 		++idx;
 	}
 	else
@@ -100,22 +106,48 @@ pdf_drop_page_tree_internal(fz_context *ctx, pdf_document *doc)
 	fz_free(ctx, doc->fwd_page_map);
 	doc->fwd_page_map = NULL;
 	doc->map_page_count = 0;
+	pdf_drop_obj(ctx, doc->page_tree_hint);
+	doc->page_tree_hint = NULL;
 }
 
+/*
+	The forward map is allocated up front, but only filled in as
+	pages are looked up.
+*/
+static void
+pdf_load_fwd_page_map(fz_context *ctx, pdf_document *doc)
+{
+	if (doc->fwd_page_map != NULL)
+		return;
+
+	fz_try(ctx)
+	{
+		doc->map_page_count = pdf_count_pages(ctx, doc);
+		doc->fwd_page_map = Memento_label(fz_calloc(ctx, doc->map_page_count, sizeof(pdf_obj *)), "pdf_fwd_page_map");
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_page_tree_internal(ctx, doc);
+		fz_rethrow(ctx);
+	}
+}
+
+/*
+	The reverse map needs every page, so this walks the whole tree.
+*/
 static void
 pdf_load_page_tree_internal(fz_context *ctx, pdf_document *doc)
 {
 	/* Check we're not already loaded. */
-	if (doc->fwd_page_map != NULL)
+	if (doc->rev_page_map != NULL)
 		return;
 
 	/* At this point we're trusting that only 1 thread should be doing
 	 * stuff that hits the document at a time. */
 	fz_try(ctx)
 	{
-		doc->map_page_count = pdf_count_pages(ctx, doc);
+		pdf_load_fwd_page_map(ctx, doc);
 		doc->rev_page_map = Memento_label(fz_calloc(ctx, doc->map_page_count, sizeof(pdf_rev_page_map)), "pdf_rev_page_map");
-		doc->fwd_page_map = Memento_label(fz_calloc(ctx, doc->map_page_count, sizeof(pdf_obj *)), "pdf_fwd_page_map");
 		pdf_load_page_tree_imp(ctx, doc, pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Pages"), 0, NULL);
 		qsort(doc->rev_page_map, doc->map_page_count, sizeof *doc->rev_page_map, cmp_rev_page_map);
 	}
@@ -227,13 +259,165 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 	return hit;
 }
 
+/*
+	Check that a page tree node's /Count agrees with its kids. Nodes
+	whose Kids array is as long as their /Count look fine without
+	loading anything. Big nodes are too costly to check one kid at a
+	time; return 0 for those, and the caller walks the whole tree.
+*/
+#define PAGE_TREE_CHECK_MAX 64
+
+static int
+pdf_check_page_tree_count(fz_context *ctx, pdf_obj *kids, int len, int count)
+{
+	int i, total = 0;
+
+	if (len == count)
+		return 1;
+	if (len > PAGE_TREE_CHECK_MAX)
+		return 0;
+
+	for (i = 0; i < len; i++)
+	{
+		pdf_obj *kid = pdf_array_get(ctx, kids, i);
+		pdf_obj *type = pdf_dict_get(ctx, kid, PDF_NAME(Type));
+		if (type ? pdf_name_eq(ctx, type, PDF_NAME(Pages)) : pdf_dict_get(ctx, kid, PDF_NAME(Kids)) && !pdf_dict_get(ctx, kid, PDF_NAME(MediaBox)))
+			total += fz_maxi(0, pdf_dict_get_int(ctx, kid, PDF_NAME(Count)));
+		else
+			total++;
+	}
+
+	if (total != count)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "page tree count mismatch");
+	return 1;
+}
+
+/*
+	Find a page by walking down the /Count values of the page tree,
+	filling in the forward map for every page passed on the way.
+
+	Sequential lookups are common, so we carry on from where the
+	last lookup ended when the page is further along in the same
+	node, rather than starting from the root each time.
+
+	Returns NULL if the way down passes a node that cannot be checked.
+*/
+static pdf_obj *
+pdf_lookup_page_lazy(fz_context *ctx, pdf_document *doc, int needle)
+{
+	pdf_mark_list mark_list;
+	pdf_obj *node, *kids;
+	pdf_obj *hit = NULL;
+	int base, count, page, i, len;
+	int unchecked = 0;
+
+	if (doc->page_tree_hint && needle >= doc->page_tree_hint_page && needle < doc->page_tree_hint_base + doc->page_tree_hint_count)
+	{
+		node = doc->page_tree_hint;
+		base = doc->page_tree_hint_base;
+		count = doc->page_tree_hint_count;
+		i = doc->page_tree_hint_kid;
+		page = doc->page_tree_hint_page;
+	}
+	else
+	{
+		node = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Pages");
+		if (!node)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page tree");
+		base = 0;
+		count = doc->map_page_count;
+		i = 0;
+		page = 0;
+	}
+
+	pdf_mark_list_init(ctx, &mark_list);
+
+	fz_try(ctx)
+	{
+		do
+		{
+			kids = pdf_dict_get(ctx, node, PDF_NAME(Kids));
+			len = pdf_array_len(ctx, kids);
+
+			if (len == 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "malformed page tree");
+
+			if (pdf_mark_list_push(ctx, &mark_list, node))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in page tree");
+
+			if (i == 0 && !pdf_check_page_tree_count(ctx, kids, len, count))
+			{
+				unchecked = 1;
+				break;
+			}
+
+			for (; i < len; i++)
+			{
+				pdf_obj *kid = pdf_array_get(ctx, kids, i);
+				pdf_obj *type = pdf_dict_get(ctx, kid, PDF_NAME(Type));
+				if (type ? pdf_name_eq(ctx, type, PDF_NAME(Pages)) : pdf_dict_get(ctx, kid, PDF_NAME(Kids)) && !pdf_dict_get(ctx, kid, PDF_NAME(MediaBox)))
+				{
+					int n = fz_maxi(0, pdf_dict_get_int(ctx, kid, PDF_NAME(Count)));
+					if (needle < page + n)
+					{
+						node = kid;
+						base = page;
+						count = n;
+						i = 0;
+						break;
+					}
+					page += n;
+				}
+				else
+				{
+					if (type ? !pdf_name_eq(ctx, type, PDF_NAME(Page)) : !pdf_dict_get(ctx, kid, PDF_NAME(MediaBox)))
+						fz_warn(ctx, "non-page object in page tree (%s)", pdf_to_name(ctx, type));
+					if (page < doc->map_page_count && doc->fwd_page_map[page] == NULL)
+						doc->fwd_page_map[page] = pdf_keep_obj(ctx, kid);
+					if (page == needle)
+					{
+						hit = kid;
+						break;
+					}
+					page++;
+				}
+			}
+		}
+		while (hit == NULL && i < len);
+
+		if (hit)
+		{
+			pdf_drop_obj(ctx, doc->page_tree_hint);
+			doc->page_tree_hint = pdf_keep_obj(ctx, node);
+			doc->page_tree_hint_base = base;
+			doc->page_tree_hint_count = count;
+			doc->page_tree_hint_kid = i;
+			doc->page_tree_hint_page = page;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_mark_list_free(ctx, &mark_list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	if (!hit && !unchecked)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle+1);
+	return hit;
+}
+
 pdf_obj *
 pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle)
 {
+	pdf_obj *hit = NULL;
+
 	if (doc->fwd_page_map == NULL && !doc->page_tree_broken)
 	{
 		fz_try(ctx)
-			pdf_load_page_tree_internal(ctx, doc);
+			pdf_load_fwd_page_map(ctx, doc);
 		fz_catch(ctx)
 		{
 			doc->page_tree_broken = 1;
@@ -247,6 +431,31 @@ pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find page %d in page tree", needle+1);
 		if (doc->fwd_page_map[needle] != NULL)
 			return doc->fwd_page_map[needle];
+
+		fz_try(ctx)
+		{
+			hit = pdf_lookup_page_lazy(ctx, doc, needle);
+			if (!hit)
+				pdf_load_page_tree_internal(ctx, doc);
+		}
+		fz_catch(ctx)
+		{
+			/* The /Count values may be wrong; the full walk
+			 * ignores them, so give that a go. */
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			fz_warn(ctx, "Lazy page lookup failed. Loading whole page tree");
+			fz_try(ctx)
+				pdf_load_page_tree_internal(ctx, doc);
+			fz_catch(ctx)
+			{
+				doc->page_tree_broken = 1;
+				fz_warn(ctx, "Page tree load failed. Falling back to slow lookup");
+			}
+		}
+		if (hit)
+			return hit;
+		if (doc->fwd_page_map && needle < doc->map_page_count && doc->fwd_page_map[needle] != NULL)
+			return doc->fwd_page_map[needle];
 	}
 
 	return pdf_lookup_page_loc(ctx, doc, needle, NULL, NULL);
@@ -1115,6 +1324,8 @@ pdf_load_page_imp(fz_context *ctx, fz_document *doc_, int chapter, int number)
 	pdf_annot *annot;
 	pdf_obj *pageobj, *obj;
 
+	pdf_trim_object_cache(ctx, doc);
+
 	if (doc->file_reading_linearly)
 	{
 		pageobj = pdf_progressive_advance(ctx, doc, number);
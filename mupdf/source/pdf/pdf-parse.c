@@ -562,15 +562,15 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 			if (tok != PDF_TOK_INT && tok != PDF_TOK_R)
 			{
 				if (n > 0)
-					pdf_array_push_int(ctx, ary, a);
+					pdf_array_push_drop(ctx, ary, pdf_new_parsed_int(ctx, doc, a));
 				if (n > 1)
-					pdf_array_push_int(ctx, ary, b);
+					pdf_array_push_drop(ctx, ary, pdf_new_parsed_int(ctx, doc, b));
 				n = 0;
 			}
 
 			if (tok == PDF_TOK_INT && n == 2)
 			{
-				pdf_array_push_int(ctx, ary, a);
+				pdf_array_push_drop(ctx, ary, pdf_new_parsed_int(ctx, doc, a));
 				a = b;
 				n --;
 			}
@@ -610,13 +610,13 @@ pdf_parse_array(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf
 				break;
 
 			case PDF_TOK_NAME:
-				pdf_array_push_name(ctx, ary, buf->scratch);
+				pdf_array_push_drop(ctx, ary, pdf_new_parsed_name(ctx, doc, buf->scratch));
 				break;
 			case PDF_TOK_REAL:
-				pdf_array_push_real(ctx, ary, buf->f);
+				pdf_array_push_drop(ctx, ary, pdf_new_parsed_real(ctx, doc, buf->f));
 				break;
 			case PDF_TOK_STRING:
-				pdf_array_push_string(ctx, ary, buf->scratch, buf->len);
+				pdf_array_push_drop(ctx, ary, pdf_new_parsed_string(ctx, doc, buf->scratch, buf->len));
 				break;
 			case PDF_TOK_TRUE:
 				pdf_array_push_bool(ctx, ary, 1);
@@ -674,7 +674,7 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 			if (tok != PDF_TOK_NAME)
 				fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid key in dict");
 
-			key = pdf_new_name(ctx, buf->scratch);
+			key = pdf_new_parsed_name(ctx, doc, buf->scratch);
 
 			tok = pdf_lex(ctx, file, buf);
 
@@ -688,9 +688,9 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 				val = pdf_parse_dict(ctx, doc, file, buf);
 				break;
 
-			case PDF_TOK_NAME: val = pdf_new_name(ctx, buf->scratch); break;
-			case PDF_TOK_REAL: val = pdf_new_real(ctx, buf->f); break;
-			case PDF_TOK_STRING: val = pdf_new_string(ctx, buf->scratch, buf->len); break;
+			case PDF_TOK_NAME: val = pdf_new_parsed_name(ctx, doc, buf->scratch); break;
+			case PDF_TOK_REAL: val = pdf_new_parsed_real(ctx, doc, buf->f); break;
+			case PDF_TOK_STRING: val = pdf_new_parsed_string(ctx, doc, buf->scratch, buf->len); break;
 			case PDF_TOK_TRUE: val = PDF_TRUE; break;
 			case PDF_TOK_FALSE: val = PDF_FALSE; break;
 			case PDF_TOK_NULL: val = PDF_NULL; break;
@@ -702,7 +702,7 @@ pdf_parse_dict(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbuf *
 				if (tok == PDF_TOK_CLOSE_DICT || tok == PDF_TOK_NAME ||
 					(tok == PDF_TOK_KEYWORD && !strcmp(buf->scratch, "ID")))
 				{
-					val = pdf_new_int(ctx, a);
+					val = pdf_new_parsed_int(ctx, doc, a);
 					pdf_dict_put(ctx, dict, key, val);
 					pdf_drop_obj(ctx, val);
 					val = NULL;
@@ -759,13 +759,13 @@ pdf_parse_stm_obj(fz_context *ctx, pdf_document *doc, fz_stream *file, pdf_lexbu
 		return pdf_parse_array(ctx, doc, file, buf);
 	case PDF_TOK_OPEN_DICT:
 		return pdf_parse_dict(ctx, doc, file, buf);
-	case PDF_TOK_NAME: return pdf_new_name(ctx, buf->scratch);
-	case PDF_TOK_REAL: return pdf_new_real(ctx, buf->f);
-	case PDF_TOK_STRING: return pdf_new_string(ctx, buf->scratch, buf->len);
+	case PDF_TOK_NAME: return pdf_new_parsed_name(ctx, doc, buf->scratch);
+	case PDF_TOK_REAL: return pdf_new_parsed_real(ctx, doc, buf->f);
+	case PDF_TOK_STRING: return pdf_new_parsed_string(ctx, doc, buf->scratch, buf->len);
 	case PDF_TOK_TRUE: return PDF_TRUE;
 	case PDF_TOK_FALSE: return PDF_FALSE;
 	case PDF_TOK_NULL: return PDF_NULL;
-	case PDF_TOK_INT: return pdf_new_int(ctx, buf->i);
+	case PDF_TOK_INT: return pdf_new_parsed_int(ctx, doc, buf->i);
 	default: fz_throw(ctx, FZ_ERROR_SYNTAX, "unknown token in object stream");
 	}
 }
@@ -838,9 +838,9 @@ pdf_parse_ind_obj_or_newobj(fz_context *ctx, pdf_document *doc, fz_stream *file,
 		obj = pdf_parse_dict(ctx, doc, file, buf);
 		break;
 
-	case PDF_TOK_NAME: obj = pdf_new_name(ctx, buf->scratch); break;
-	case PDF_TOK_REAL: obj = pdf_new_real(ctx, buf->f); break;
-	case PDF_TOK_STRING: obj = pdf_new_string(ctx, buf->scratch, buf->len); break;
+	case PDF_TOK_NAME: obj = pdf_new_parsed_name(ctx, doc, buf->scratch); break;
+	case PDF_TOK_REAL: obj = pdf_new_parsed_real(ctx, doc, buf->f); break;
+	case PDF_TOK_STRING: obj = pdf_new_parsed_string(ctx, doc, buf->scratch, buf->len); break;
 	case PDF_TOK_TRUE: obj = PDF_TRUE; break;
 	case PDF_TOK_FALSE: obj = PDF_FALSE; break;
 	case PDF_TOK_NULL: obj = PDF_NULL; break;
@@ -851,7 +851,7 @@ pdf_parse_ind_obj_or_newobj(fz_context *ctx, pdf_document *doc, fz_stream *file,
 
 		if (tok == PDF_TOK_STREAM || tok == PDF_TOK_ENDOBJ)
 		{
-			obj = pdf_new_int(ctx, a);
+			obj = pdf_new_parsed_int(ctx, doc, a);
 			read_next_token = 0;
 			break;
 		}
@@ -49,6 +49,56 @@ static void add_root(fz_context *ctx, pdf_obj *obj, pdf_obj ***roots, int *num_r
 	(*roots)[(*num_roots)++] = pdf_keep_obj(ctx, obj);
 }
 
+/*
+	Advance file to just past the next "endstream" keyword (or to EOF).
+
+	Stream data is usually binary and may be hundreds of megabytes, so
+	rather than pushing it through the lexer a byte at a time we search
+	the buffered window directly with memchr, carrying any partial match
+	over from one window to the next.
+
+	A mismatch part way through falls back along the usual KMP failure
+	table, so "endstr" directly followed by "endstream" is still found
+	from the second 'e'.
+*/
+static void
+skip_to_endstream(fz_context *ctx, fz_stream *file)
+{
+	static const char endstream[] = "endstream";
+	/* Length of the longest proper prefix of endstream[0..k) that is
+	 * also a suffix of it. Only "endstre" has one: the final 'e'. */
+	static const unsigned char fail[9] = { 0, 0, 0, 0, 0, 0, 0, 1, 0 };
+	size_t k = 0;
+	unsigned char *p, *e;
+
+	while (fz_available(ctx, file, 1) > 0)
+	{
+		p = file->rp;
+		e = file->wp;
+		while (p < e)
+		{
+			if (k == 0)
+			{
+				p = memchr(p, 'e', e - p);
+				if (p == NULL)
+				{
+					p = e;
+					break;
+				}
+			}
+			while (k > 0 && *p != endstream[k])
+				k = fail[k];
+			if (*p == endstream[k] && ++k == 9)
+			{
+				file->rp = p + 1;
+				return;
+			}
+			p++;
+		}
+		file->rp = e;
+	}
+}
+
 int
 pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int64_t *tmpofs, pdf_obj **root)
 {
@@ -195,16 +245,7 @@ pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, int64_t *stm
 			fz_seek(ctx, file, *stmofsp, 0);
 		}
 
-		(void)fz_read(ctx, file, (unsigned char *) buf->scratch, 9);
-
-		while (memcmp(buf->scratch, "endstream", 9) != 0)
-		{
-			c = fz_read_byte(ctx, file);
-			if (c == EOF)
-				break;
-			memmove(&buf->scratch[0], &buf->scratch[1], 8);
-			buf->scratch[8] = c;
-		}
+		skip_to_endstream(ctx, file);
 
 		if (stmlenp)
 			*stmlenp = fz_tell(ctx, file) - *stmofsp - 9;
@@ -761,3 +802,378 @@ pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid reference to non-object-stream: %d (%d 0 R)", (int)entry->ofs, i);
 	}
 }
+
+/*
+	Repair accelerator.
+
+	Repairing a file means lexing everything in it but the stream data,
+	which is seeked over when its Length is right and searched for
+	"endstream" when it isn't. Once that has been done, the resulting
+	xref table and trailer can be saved so that the next open of the
+	same file rebuilds them from the saved data instead.
+
+	The saved data is ignored unless the file still has the same length,
+	the same generation stamp (its modification time, when opened by
+	name) and the same MD5 over the bytes the repair lexed. That is every
+	byte but the data of the streams in the table, so the cost of the
+	check follows the number of objects rather than the size of the file;
+	hashing the stream data too would cost more than the repair's own
+	memchr search of it. Object streams are parsed by the repair, so
+	their data is hashed, as is any stream data too short to be worth a
+	seek.
+
+	An edit inside stream data that keeps the length is caught only by
+	the stamp, so a file opened from a stream, which has none, is
+	trusted not to have moved the end of a stream that way.
+*/
+
+#define MAGIC_ACCELERATOR 0xacce1e7a
+#define MAGIC_ACCEL_PDF   0x20464450
+#define ACCEL_VERSION     0x00010003
+
+/* Stream data shorter than this is cheaper to hash than to seek over. */
+#define ACCEL_MIN_SKIP 4096
+
+struct accel_entry
+{
+	char type;
+	unsigned short gen;
+	int num;
+	int64_t ofs;
+	int64_t stm_ofs;
+	int stm_len;
+	int data_len;
+};
+
+struct accel_range
+{
+	int64_t start, end;
+};
+
+static int
+cmp_accel_range(const void *a_, const void *b_)
+{
+	const struct accel_range *a = a_;
+	const struct accel_range *b = b_;
+	return (a->start > b->start) - (a->start < b->start);
+}
+
+static void
+hash_range(fz_context *ctx, fz_md5 *md5, fz_stream *file, int64_t ofs, int64_t len)
+{
+	size_t avail;
+
+	/* Straight from the stream's own buffer. */
+	fz_seek(ctx, file, ofs, SEEK_SET);
+	while (len > 0 && (avail = fz_available(ctx, file, (size_t)fz_mini64(len, 1 << 16))) > 0)
+	{
+		avail = (size_t)fz_mini64(avail, len);
+		fz_md5_update(md5, file->rp, avail);
+		file->rp += avail;
+		len -= avail;
+	}
+}
+
+static void
+hash_file(fz_context *ctx, pdf_document *doc, struct accel_entry *list, int len, int64_t *file_len, unsigned char digest[16])
+{
+	fz_stream *file = doc->file;
+	struct accel_range *skip;
+	fz_md5 md5;
+	int64_t n, pos;
+	int i, nskip = 0;
+
+	fz_seek(ctx, file, 0, SEEK_END);
+	n = fz_tell(ctx, file);
+
+	fz_md5_init(&md5);
+	fz_md5_update_int64(&md5, n);
+
+	skip = fz_malloc_array(ctx, len, struct accel_range);
+	fz_try(ctx)
+	{
+		for (i = 0; i < len; i++)
+		{
+			if (list[i].type != 'n' || list[i].data_len < ACCEL_MIN_SKIP)
+				continue;
+			if (list[i].stm_ofs <= 0 || list[i].stm_ofs >= n)
+				continue;
+			skip[nskip].start = list[i].stm_ofs;
+			skip[nskip].end = fz_mini64(list[i].stm_ofs + list[i].data_len, n);
+			nskip++;
+		}
+		qsort(skip, nskip, sizeof *skip, cmp_accel_range);
+
+		pos = 0;
+		for (i = 0; i < nskip; i++)
+		{
+			if (skip[i].start > pos)
+				hash_range(ctx, &md5, file, pos, skip[i].start - pos);
+			pos = fz_maxi64(pos, skip[i].end);
+		}
+		hash_range(ctx, &md5, file, pos, n - pos);
+	}
+	fz_always(ctx)
+		fz_free(ctx, skip);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	fz_md5_final(&md5, digest);
+
+	*file_len = n;
+}
+
+/*
+	The length of the data of stream 'num', if it is followed by
+	"endstream" as the repair checked, or -1.
+*/
+static int
+accel_data_len(fz_context *ctx, pdf_document *doc, int num, int64_t stm_ofs)
+{
+	pdf_obj *dict = pdf_load_object(ctx, doc, num);
+	int len = -1;
+
+	fz_try(ctx)
+	{
+		len = pdf_dict_get_int(ctx, dict, PDF_NAME(Length));
+		if (len > 0)
+		{
+			fz_seek(ctx, doc->file, stm_ofs + len, SEEK_SET);
+			if (pdf_lex(ctx, doc->file, &doc->lexbuf.base) != PDF_TOK_ENDSTREAM)
+				len = -1;
+		}
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, dict);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		len = -1;
+	}
+	return len;
+}
+
+static void
+write_int64_le(fz_context *ctx, fz_output *out, int64_t x)
+{
+	fz_write_uint32_le(ctx, out, (unsigned int)((uint64_t)x & 0xffffffff));
+	fz_write_uint32_le(ctx, out, (unsigned int)((uint64_t)x >> 32));
+}
+
+void
+pdf_write_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_output *out)
+{
+	unsigned char digest[16];
+	struct accel_entry *list = NULL;
+	fz_buffer *buf = NULL;
+	fz_output *bout = NULL;
+	pdf_xref *xref;
+	pdf_xref_subsec *sub;
+	int64_t file_len;
+	int i, xref_len;
+
+	fz_var(list);
+	fz_var(buf);
+	fz_var(bout);
+
+	fz_try(ctx)
+	{
+		if (!doc->repair_attempted || doc->repair_in_progress || doc->num_xref_sections == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "No accelerator data to write");
+
+		/* Only the repaired section describes the file; any edits
+		 * made since live in incremental sections above it. */
+		xref = &doc->xref_sections[doc->num_xref_sections - 1];
+		sub = xref->subsec;
+		xref_len = xref->num_objects;
+		if (sub == NULL || sub->next != NULL || sub->start != 0 || sub->len < xref_len || xref->trailer == NULL)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "No accelerator data to write");
+
+		list = fz_malloc_array(ctx, xref_len, struct accel_entry);
+		for (i = 0; i < xref_len; i++)
+		{
+			pdf_xref_entry *entry = &sub->table[i];
+
+			list[i].type = entry->type;
+			list[i].gen = entry->gen;
+			list[i].num = entry->num;
+			list[i].ofs = entry->ofs;
+			list[i].stm_ofs = entry->stm_ofs;
+			list[i].stm_len = -1;
+			list[i].data_len = -1;
+
+			/* Repair replaces the Length of each stream it finds in
+			 * an unencrypted file; those have to be replayed on load. */
+			if (entry->type == 'n' && entry->stm_ofs && !doc->crypt)
+			{
+				pdf_obj *length = pdf_dict_get(ctx, entry->obj, PDF_NAME(Length));
+				if (pdf_is_int(ctx, length) && !pdf_is_indirect(ctx, length))
+					list[i].stm_len = pdf_to_int(ctx, length);
+			}
+		}
+
+		for (i = 0; i < xref_len; i++)
+			if (list[i].type == 'n' && list[i].stm_ofs)
+				list[i].data_len = accel_data_len(ctx, doc, i, list[i].stm_ofs);
+		for (i = 0; i < xref_len; i++)
+			if (list[i].type == 'o' && list[i].ofs > 0 && list[i].ofs < xref_len)
+				list[list[i].ofs].data_len = -1;
+
+		hash_file(ctx, doc, list, xref_len, &file_len, digest);
+
+		fz_write_int32_le(ctx, out, MAGIC_ACCELERATOR);
+		fz_write_int32_le(ctx, out, MAGIC_ACCEL_PDF);
+		fz_write_int32_le(ctx, out, ACCEL_VERSION);
+		write_int64_le(ctx, out, file_len);
+		write_int64_le(ctx, out, doc->file_stamp);
+		fz_write_data(ctx, out, digest, 16);
+		fz_write_int32_le(ctx, out, doc->version);
+		fz_write_int32_le(ctx, out, xref_len);
+
+		for (i = 0; i < xref_len; i++)
+		{
+			fz_write_byte(ctx, out, list[i].type);
+			fz_write_uint16_le(ctx, out, list[i].gen);
+			fz_write_int32_le(ctx, out, list[i].num);
+			write_int64_le(ctx, out, list[i].ofs);
+			write_int64_le(ctx, out, list[i].stm_ofs);
+			fz_write_int32_le(ctx, out, list[i].stm_len);
+			fz_write_int32_le(ctx, out, list[i].data_len);
+		}
+
+		buf = fz_new_buffer(ctx, 256);
+		bout = fz_new_output_with_buffer(ctx, buf);
+		pdf_print_obj(ctx, bout, xref->trailer, 1, 0);
+		fz_close_output(ctx, bout);
+		fz_write_int32_le(ctx, out, (int)buf->len);
+		fz_write_data(ctx, out, buf->data, buf->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, bout);
+		fz_drop_buffer(ctx, buf);
+		fz_free(ctx, list);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int
+pdf_load_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	unsigned char digest[16], saved[16];
+	struct accel_entry *list = NULL;
+	unsigned char *data = NULL;
+	fz_stream *stm = NULL;
+	pdf_obj *trailer = NULL;
+	int64_t file_len, saved_len, saved_stamp;
+	int i, n, version, xref_len;
+	int indexed = 0;
+
+	fz_var(list);
+	fz_var(data);
+	fz_var(stm);
+	fz_var(trailer);
+	fz_var(indexed);
+
+	if ((int32_t)fz_read_uint32_le(ctx, accel) != (int32_t)MAGIC_ACCELERATOR)
+		return 0;
+	if (fz_read_int32_le(ctx, accel) != MAGIC_ACCEL_PDF)
+		return 0;
+	if (fz_read_int32_le(ctx, accel) != ACCEL_VERSION)
+		return 0;
+	saved_len = fz_read_int64_le(ctx, accel);
+	saved_stamp = fz_read_int64_le(ctx, accel);
+	if (fz_read(ctx, accel, saved, 16) != 16)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+	version = fz_read_int32_le(ctx, accel);
+	xref_len = fz_read_int32_le(ctx, accel);
+	if (xref_len <= 0 || xref_len > PDF_MAX_OBJECT_NUMBER + 1)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+
+	fz_try(ctx)
+	{
+		list = fz_malloc_array(ctx, xref_len, struct accel_entry);
+		for (i = 0; i < xref_len; i++)
+		{
+			list[i].type = fz_read_byte(ctx, accel);
+			list[i].gen = fz_read_uint16_le(ctx, accel);
+			list[i].num = fz_read_int32_le(ctx, accel);
+			list[i].ofs = fz_read_int64_le(ctx, accel);
+			list[i].stm_ofs = fz_read_int64_le(ctx, accel);
+			list[i].stm_len = fz_read_int32_le(ctx, accel);
+			list[i].data_len = fz_read_int32_le(ctx, accel);
+			if (list[i].type != 0 && list[i].type != 'f' && list[i].type != 'n' && list[i].type != 'o')
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+		}
+
+		n = fz_read_int32_le(ctx, accel);
+		if (n <= 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+		data = fz_malloc(ctx, n);
+		if (fz_read(ctx, accel, data, n) != (size_t)n)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+
+		if (saved_stamp != doc->file_stamp)
+			break;
+		hash_file(ctx, doc, list, xref_len, &file_len, digest);
+		if (file_len != saved_len || memcmp(digest, saved, 16))
+			break;
+
+		doc->repair_attempted = 1;
+		doc->version = version;
+		doc->file_size = file_len;
+
+		pdf_ensure_solid_xref(ctx, doc, xref_len);
+		for (i = 0; i < xref_len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_populating_xref_entry(ctx, doc, i);
+			entry->type = list[i].type;
+			entry->gen = list[i].gen;
+			entry->num = list[i].num;
+			entry->ofs = list[i].ofs;
+			entry->stm_ofs = list[i].stm_ofs;
+		}
+
+		stm = fz_open_memory(ctx, data, n);
+		trailer = pdf_parse_stm_obj(ctx, doc, stm, &doc->lexbuf.base);
+		if (!pdf_is_dict(ctx, trailer))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt accelerator data");
+		pdf_set_populating_xref_trailer(ctx, doc, trailer);
+
+		/* Like the repair itself, patch the file's objects in place
+		 * rather than as edits. */
+		doc->repair_in_progress = 1;
+		for (i = 0; i < xref_len; i++)
+		{
+			pdf_obj *dict, *old_obj = NULL;
+
+			if (list[i].type != 'n' || list[i].stm_len < 0)
+				continue;
+			dict = pdf_load_object(ctx, doc, i);
+			fz_try(ctx)
+			{
+				pdf_dict_get_put_drop(ctx, dict, PDF_NAME(Length), pdf_new_int(ctx, list[i].stm_len), &old_obj);
+				if (old_obj)
+					orphan_object(ctx, doc, old_obj);
+			}
+			fz_always(ctx)
+				pdf_drop_obj(ctx, dict);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+
+		indexed = 1;
+	}
+	fz_always(ctx)
+	{
+		doc->repair_in_progress = 0;
+		pdf_drop_obj(ctx, trailer);
+		fz_drop_stream(ctx, stm);
+		fz_free(ctx, data);
+		fz_free(ctx, list);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return indexed;
+}
@@ -89,6 +89,8 @@ pdf_store_item(fz_context *ctx, pdf_obj *key, void *val, size_t itemsize)
 	void *existing;
 
 	assert(pdf_is_name(ctx, key) || pdf_is_array(ctx, key) || pdf_is_dict(ctx, key) || pdf_is_indirect(ctx, key));
+	/* pdf_empty_store finds a document's arena keys by their binding. */
+	assert(!pdf_obj_in_arena(ctx, key) || pdf_get_bound_document(ctx, key) != NULL);
 	existing = fz_store_item(ctx, key, val, itemsize, &pdf_obj_store_type);
 	if (existing)
 		fz_warn(ctx, "unexpectedly replacing entry in PDF store");
@@ -113,6 +115,10 @@ pdf_filter_store(fz_context *ctx, void *doc_, void *key)
 	pdf_obj *obj = (pdf_obj *)key;
 	pdf_document *key_doc = pdf_get_bound_document(ctx, obj);
 
+	/* Keys from an object arena are arrays, dicts or indirect
+	 * references, which are all bound to the document that owns
+	 * the arena (names never live in one), so they go with it and
+	 * with nothing else. */
 	return (doc == key_doc);
 }
 
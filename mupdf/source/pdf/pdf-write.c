@@ -22,11 +22,13 @@
 
 #include "mupdf/fitz.h"
 #include "pdf-annot-imp.h"
+#include "../fitz/thread-imp.h"
 
 #include <zlib.h>
 
 #include <assert.h>
 #include <limits.h>
+#include <math.h>
 #include <string.h>
 
 #include <stdio.h> /* for debug printing */
@@ -79,6 +81,68 @@ typedef struct {
 	page_objects *page[1];
 } page_objects_list;
 
+/*
+	Streams are decoded and compressed again for writing in batches
+	ahead of the objects themselves, by a pool of worker threads that
+	lasts for the whole save. The data for each stream is loaded just
+	once, on the writing thread, when the batch is collected; when
+	its object comes to be written, only the dictionary is left to
+	edit to match.
+*/
+enum
+{
+	STREAM_STORE,
+	STREAM_FLATE,
+	STREAM_CCITT
+};
+
+typedef struct
+{
+	int num;
+
+	/* What to do with the data, decided on the writing thread. */
+	fz_buffer *src;
+	int unhex;
+	int inflate;
+	int compress;
+	int skip_incompressible;
+	int bitmap, bitmap_w, bitmap_h;
+
+	/* The result, from whichever thread gets to the job. */
+	int kind;
+	fz_buffer *out;
+	int failed;
+} stream_job;
+
+typedef struct
+{
+	int len, cap;
+	size_t size;
+	stream_job *job;
+} stream_batch;
+
+typedef struct stream_pool stream_pool;
+
+typedef struct
+{
+	stream_pool *pool;
+	fz_context *ctx;
+	fz_semaphore *start;
+	fz_semaphore *done;
+	fz_thread *thread;
+} stream_worker;
+
+struct stream_pool
+{
+	fz_mutex *mutex;
+	int level;
+	int quit;
+	stream_batch *batch;
+	int next;
+	int nworkers;
+	stream_worker *worker;
+};
+
 typedef struct
 {
 	fz_output *out;
@@ -97,12 +161,19 @@ typedef struct
 	int dont_regenerate_id;
 	int do_snapshot;
 	int do_preserve_metadata;
+	int do_objstms;
+	int compress_threads;
+	int compression_level;
+	int do_skip_incompressible;
 
 	int list_len;
 	int *use_list;
 	int64_t *ofs_list;
 	int *gen_list;
 	int *renumber_map;
+	int *objstm_list;
+	int first_objstm;
+	int last_objstm;
 
 	/* The following extras are required for linearization */
 	int *rev_renumber_map;
@@ -132,6 +203,10 @@ typedef struct
 	pdf_crypt *crypt;
 	pdf_obj *crypt_obj;
 	pdf_obj *metadata;
+
+	/* Parallel stream compression */
+	stream_pool *pool; /* Non-NULL when streams are prepared in batches. */
+	stream_batch *batch; /* The streams prepared by the last batch. */
 } pdf_write_state;
 
 /*
@@ -174,6 +249,7 @@ expand_lists(fz_context *ctx, pdf_write_state *opts, int num)
 	opts->gen_list = fz_realloc_array(ctx, opts->gen_list, num, int);
 	opts->renumber_map = fz_realloc_array(ctx, opts->renumber_map, num, int);
 	opts->rev_renumber_map = fz_realloc_array(ctx, opts->rev_renumber_map, num, int);
+	opts->objstm_list = fz_realloc_array(ctx, opts->objstm_list, num, int);
 
 	for (i = opts->list_len; i < num; i++)
 	{
@@ -182,6 +258,7 @@ expand_lists(fz_context *ctx, pdf_write_state *opts, int num)
 		opts->gen_list[i] = 0;
 		opts->renumber_map[i] = i;
 		opts->rev_renumber_map[i] = i;
+		opts->objstm_list[i] = 0;
 	}
 	opts->list_len = num;
 }
@@ -705,49 +782,112 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pd
  * Scan for and remove duplicate objects (slow)
  */
 
+typedef struct
+{
+	uint32_t hash;
+	int num;
+} objhash_entry;
+
+static int
+cmp_objhash_entry(const void *a_, const void *b_)
+{
+	const objhash_entry *a = a_;
+	const objhash_entry *b = b_;
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->num - b->num;
+}
+
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
 {
 	int num, other;
 	int xref_len = pdf_xref_len(ctx, doc);
+	objhash_entry *list;
+	int i, j, k, n = 0;
 
 	expand_lists(ctx, opts, xref_len);
-	for (num = 1; num < xref_len; num++)
+
+	/* Bucket the objects by structural hash, so that we only need to
+	 * compare objects that stand a chance of being equal. Sorting
+	 * each bucket by object number preserves the order in which the
+	 * objects would be compared if we tried every pair. */
+	list = fz_malloc_array(ctx, xref_len, objhash_entry);
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		for (num = 1; num < xref_len && num < opts->list_len; num++)
 		{
-			pdf_obj *a, *b;
-			int newnum;
+			pdf_obj *a;
 
-			if (num == other || num >= opts->list_len || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
 
-			/* TODO: resolve indirect references to see if we can omit them */
+			/* Streams only ever match when their contents are
+			 * compared; leave them out rather than fill buckets
+			 * with objects that can never be merged. */
+			if (opts->do_garbage < 4 && pdf_obj_num_is_stream(ctx, doc, num))
+				continue;
 
 			a = pdf_get_xref_entry_no_null(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry_no_null(ctx, doc, other)->obj;
-			if (opts->do_garbage >= 4)
-			{
-				if (pdf_objcmp_deep(ctx, a, b))
-					continue;
-			}
-			else
+			list[n].hash = opts->do_garbage >= 4 ? pdf_objhash_deep(ctx, a) : pdf_objhash(ctx, a);
+			list[n].num = num;
+			n++;
+		}
+
+		qsort(list, n, sizeof *list, cmp_objhash_entry);
+
+		for (i = 0; i < n; i = j)
+		{
+			for (j = i + 1; j < n && list[j].hash == list[i].hash; j++)
+				;
+
+			for (k = i + 1; k < j; k++)
 			{
-				if (pdf_objcmp(ctx, a, b))
-					continue;
-			}
+				int l;
 
-			/* Keep the lowest numbered object */
-			newnum = fz_mini(num, other);
-			opts->renumber_map[num] = newnum;
-			opts->renumber_map[other] = newnum;
-			opts->rev_renumber_map[newnum] = num; /* Either will do */
-			opts->use_list[fz_maxi(num, other)] = 0;
+				num = list[k].num;
 
-			/* One duplicate was found, do not look for another */
-			break;
+				/* Only compare an object to objects preceding it */
+				for (l = i; l < k; l++)
+				{
+					pdf_obj *a, *b;
+					int newnum;
+
+					other = list[l].num;
+					if (!opts->use_list[other])
+						continue;
+
+					/* TODO: resolve indirect references to see if we can omit them */
+
+					a = pdf_get_xref_entry_no_null(ctx, doc, num)->obj;
+					b = pdf_get_xref_entry_no_null(ctx, doc, other)->obj;
+					if (opts->do_garbage >= 4)
+					{
+						if (pdf_objcmp_deep(ctx, a, b))
+							continue;
+					}
+					else
+					{
+						if (pdf_objcmp(ctx, a, b))
+							continue;
+					}
+
+					/* Keep the lowest numbered object */
+					newnum = fz_mini(num, other);
+					opts->renumber_map[num] = newnum;
+					opts->renumber_map[other] = newnum;
+					opts->rev_renumber_map[newnum] = num; /* Either will do */
+					opts->use_list[fz_maxi(num, other)] = 0;
+
+					/* One duplicate was found, do not look for another */
+					break;
+				}
+			}
 		}
 	}
+	fz_always(ctx)
+		fz_free(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 /*
@@ -1198,21 +1338,21 @@ add_linearization_objs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts
 		opts->rev_renumber_map[params_num] = params_num;
 		opts->gen_list[params_num] = 0;
 		pdf_dict_put_real(ctx, params_obj, PDF_NAME(Linearized), 1.0f);
-		opts->linear_l = pdf_new_int(ctx, INT_MIN);
+		opts->linear_l = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, params_obj, PDF_NAME(L), opts->linear_l);
-		opts->linear_h0 = pdf_new_int(ctx, INT_MIN);
+		opts->linear_h0 = pdf_new_boxed_int(ctx, INT_MIN);
 		o = pdf_new_array(ctx, doc, 2);
 		pdf_dict_put_drop(ctx, params_obj, PDF_NAME(H), o);
 		pdf_array_push(ctx, o, opts->linear_h0);
-		opts->linear_h1 = pdf_new_int(ctx, INT_MIN);
+		opts->linear_h1 = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_array_push(ctx, o, opts->linear_h1);
-		opts->linear_o = pdf_new_int(ctx, INT_MIN);
+		opts->linear_o = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, params_obj, PDF_NAME(O), opts->linear_o);
-		opts->linear_e = pdf_new_int(ctx, INT_MIN);
+		opts->linear_e = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, params_obj, PDF_NAME(E), opts->linear_e);
-		opts->linear_n = pdf_new_int(ctx, INT_MIN);
+		opts->linear_n = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, params_obj, PDF_NAME(N), opts->linear_n);
-		opts->linear_t = pdf_new_int(ctx, INT_MIN);
+		opts->linear_t = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, params_obj, PDF_NAME(T), opts->linear_t);
 
 		/* Primary hint stream */
@@ -1226,7 +1366,7 @@ add_linearization_objs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts
 		opts->rev_renumber_map[hint_num] = hint_num;
 		opts->gen_list[hint_num] = 0;
 		pdf_dict_put_int(ctx, hint_obj, PDF_NAME(P), 0);
-		opts->hints_s = pdf_new_int(ctx, INT_MIN);
+		opts->hints_s = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, hint_obj, PDF_NAME(S), opts->hints_s);
 		/* FIXME: Do we have thumbnails? Do a T entry */
 		/* FIXME: Do we have outlines? Do an O entry */
@@ -1237,7 +1377,7 @@ add_linearization_objs(fz_context *ctx, pdf_document *doc, pdf_write_state *opts
 		/* FIXME: Do we have logical structure hierarchy? Do a C entry */
 		/* FIXME: Do L, Page Label hint table */
 		pdf_dict_put(ctx, hint_obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
-		opts->hints_length = pdf_new_int(ctx, INT_MIN);
+		opts->hints_length = pdf_new_boxed_int(ctx, INT_MIN);
 		pdf_dict_put(ctx, hint_obj, PDF_NAME(Length), opts->hints_length);
 		xe = pdf_get_xref_entry_no_null(ctx, doc, hint_num);
 		xe->stm_ofs = 0;
@@ -1582,18 +1722,16 @@ static void preloadobjstms(fz_context *ctx, pdf_document *doc)
  * Save streams and objects to the output
  */
 
-static int is_bitmap_stream(fz_context *ctx, pdf_obj *obj, size_t len, int *w, int *h)
+/* Is this a 1 bit per pixel grey image (or image mask) of w by h? Its
+ * data can then be compressed as CCITT G4 if it is exactly that size. */
+static int is_bitmap_image(fz_context *ctx, pdf_obj *obj, int *w, int *h)
 {
 	pdf_obj *bpc;
 	pdf_obj *cs;
-	int stride;
 	if (pdf_dict_get(ctx, obj, PDF_NAME(Subtype)) != PDF_NAME(Image))
 		return 0;
 	*w = pdf_dict_get_int(ctx, obj, PDF_NAME(Width));
 	*h = pdf_dict_get_int(ctx, obj, PDF_NAME(Height));
-	stride = (*w + 7) >> 3;
-	if ((size_t)stride * (*h) != len)
-		return 0;
 	if (pdf_dict_get_bool(ctx, obj, PDF_NAME(ImageMask)))
 	{
 		return 1;
@@ -1702,7 +1840,7 @@ static void addhexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 		fz_rethrow(ctx);
 }
 
-static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
+static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n, int level)
 {
 	fz_buffer *buf;
 	uLongf csize;
@@ -1718,7 +1856,7 @@ static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
 	data = Memento_label(fz_malloc(ctx, cap), "pdf_write_deflate");
 	buf = fz_new_buffer_from_data(ctx, data, cap);
 	csize = (uLongf)cap;
-	t = compress(data, &csize, p, longN);
+	t = compress2(data, &csize, p, longN, level);
 	if (t != Z_OK)
 	{
 		fz_drop_buffer(ctx, buf);
@@ -1728,6 +1866,38 @@ static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
 	return buf;
 }
 
+/*
+	Guess whether data is already as dense as deflate could make it,
+	by estimating the byte entropy of a few samples spread through it.
+	Small streams are always worth a try.
+*/
+static int is_incompressible(const unsigned char *p, size_t n)
+{
+	enum { SAMPLES = 8, SAMPLE_SIZE = 4096 };
+	unsigned int hist[256] = { 0 };
+	size_t i, k, step, total = 0;
+	double e = 0;
+
+	if (n < SAMPLES * SAMPLE_SIZE)
+		return 0;
+
+	step = (n - SAMPLE_SIZE) / (SAMPLES - 1);
+	for (k = 0; k < SAMPLES; k++)
+	{
+		const unsigned char *s = p + k * step;
+		for (i = 0; i < SAMPLE_SIZE; i++)
+			hist[s[i]]++;
+		total += SAMPLE_SIZE;
+	}
+
+	for (i = 0; i < 256; i++)
+		if (hist[i])
+			e -= hist[i] * log2((double)hist[i] / total);
+
+	/* Bits per byte; uniformly random data comes out at about 7.95. */
+	return e / total > 7.9;
+}
+
 static int striphexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	pdf_obj *f, *dp;
@@ -1802,131 +1972,221 @@ static void write_data(fz_context *ctx, void *arg, const unsigned char *data, si
 	fz_write_data(ctx, (fz_output *)arg, data, len);
 }
 
-static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+static fz_buffer *inflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
 {
-	fz_buffer *tmp_unhex = NULL, *tmp_comp = NULL, *tmp_hex = NULL, *buf = NULL;
-	pdf_obj *obj = NULL;
-	pdf_obj *dp;
-	size_t len;
-	unsigned char *data;
-	int w, h;
-
-	fz_var(buf);
-	fz_var(tmp_comp);
-	fz_var(tmp_hex);
-	fz_var(obj);
-
+	fz_stream *mstm = NULL;
+	fz_stream *xstm = NULL;
+	fz_buffer *out = NULL;
+	fz_var(mstm);
+	fz_var(xstm);
 	fz_try(ctx)
 	{
-		buf = pdf_load_raw_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
+		mstm = fz_open_memory(ctx, p, n);
+		xstm = fz_open_flated(ctx, mstm, 15);
+		out = fz_read_all(ctx, xstm, n*2);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, xstm);
+		fz_drop_stream(ctx, mstm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return out;
+}
 
-		len = fz_buffer_storage(ctx, buf, &data);
+/*
+	Decide how a stream is to be written, and edit obj (a copy of
+	its dictionary) to match, except for the filter that depends on
+	what the data turns out to be. When expanding, the stream's
+	filters are removed; when copying, only an ASCIIHexDecode filter
+	is.
+*/
+static void plan_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, int expand, int do_deflate, stream_job *job)
+{
+	pdf_obj *f;
 
-		if (do_deflate && striphexfilter(ctx, doc, obj))
+	if (expand)
+	{
+		/* Plain flate data is simple enough to inflate anywhere;
+		 * anything else goes through the usual filter chain. */
+		f = pdf_dict_get(ctx, obj, PDF_NAME(Filter));
+		job->inflate = (f == PDF_NAME(FlateDecode) && !pdf_dict_get(ctx, obj, PDF_NAME(DecodeParms)));
+		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
+		pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
+		job->compress = do_deflate;
+	}
+	else
+	{
+		if (do_deflate)
 		{
-			tmp_unhex = unhexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_unhex, &data);
+			/* obj is a shallow copy, so copy the arrays that
+			 * striphexfilter edits before it gets to them. */
+			f = pdf_dict_get(ctx, obj, PDF_NAME(Filter));
+			if (pdf_is_array(ctx, f))
+				pdf_dict_put_drop(ctx, obj, PDF_NAME(Filter), pdf_copy_array(ctx, f));
+			f = pdf_dict_get(ctx, obj, PDF_NAME(DecodeParms));
+			if (pdf_is_array(ctx, f))
+				pdf_dict_put_drop(ctx, obj, PDF_NAME(DecodeParms), pdf_copy_array(ctx, f));
+			job->unhex = striphexfilter(ctx, doc, obj);
 		}
+		job->compress = do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter));
+	}
 
-		if (do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter)))
-		{
-			if (is_bitmap_stream(ctx, obj, len, &w, &h))
-			{
-				tmp_comp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
-				dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), w);
-			}
-			else
-			{
-				tmp_comp = deflatebuf(ctx, data, len);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
-			}
-			len = fz_buffer_storage(ctx, tmp_comp, &data);
-		}
+	if (job->compress)
+		job->bitmap = is_bitmap_image(ctx, obj, &job->bitmap_w, &job->bitmap_h);
+}
 
-		if (opts->do_ascii && isbinarystream(ctx, data, len))
-		{
-			tmp_hex = hexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_hex, &data);
-			addhexfilter(ctx, doc, obj);
-		}
+/* Load the data that prepare_stream starts from. */
+static void load_stream_source(fz_context *ctx, pdf_document *doc, int num, int expand, stream_job *job)
+{
+	if (expand && !job->inflate)
+		job->src = pdf_load_stream_number(ctx, doc, num);
+	else
+		job->src = pdf_load_raw_stream_number(ctx, doc, num);
+}
 
-		fz_write_printf(ctx, opts->out, "%d %d obj\n", num, gen);
+/*
+	Decode and compress the data of a stream as planned. This is all
+	that runs on the worker threads, so it only ever touches the job.
+*/
+static void prepare_stream(fz_context *ctx, stream_job *job, int level)
+{
+	fz_buffer *data = fz_keep_buffer(ctx, job->src);
+	fz_buffer *tmp;
+	int kind = STREAM_STORE;
 
-		if (unenc)
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		if (job->unhex)
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), len);
-			pdf_print_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			fz_write_data(ctx, opts->out, data, len);
+			tmp = unhexbuf(ctx, data->data, data->len);
+			fz_drop_buffer(ctx, data);
+			data = tmp;
 		}
-		else
+		if (job->inflate)
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
-			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
+			tmp = inflatebuf(ctx, data->data, data->len);
+			fz_drop_buffer(ctx, data);
+			data = tmp;
 		}
-
-		fz_write_string(ctx, opts->out, "\nendstream\nendobj\n\n");
+		if (job->compress)
+		{
+			if (job->bitmap && (size_t)((job->bitmap_w + 7) >> 3) * job->bitmap_h == data->len)
+			{
+				tmp = fz_compress_ccitt_fax_g4(ctx, data->data, job->bitmap_w, job->bitmap_h);
+				fz_drop_buffer(ctx, data);
+				data = tmp;
+				kind = STREAM_CCITT;
+			}
+			else if (!job->skip_incompressible || !is_incompressible(data->data, data->len))
+			{
+				tmp = deflatebuf(ctx, data->data, data->len, level);
+				fz_drop_buffer(ctx, data);
+				data = tmp;
+				kind = STREAM_FLATE;
+			}
+		}
+		job->kind = kind;
+		job->out = data;
+		data = NULL;
 	}
 	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, tmp_unhex);
-		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_comp);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
-	}
+		fz_drop_buffer(ctx, data);
 	fz_catch(ctx)
-	{
 		fz_rethrow(ctx);
+}
+
+/* The job for stream num in the last batch, if there is one. */
+static stream_job *find_prepared_stream(pdf_write_state *opts, int num)
+{
+	stream_batch *batch = opts->batch;
+	int l = 0, r, m;
+
+	if (!batch)
+		return NULL;
+	r = batch->len - 1;
+	while (l <= r)
+	{
+		m = (l + r) >> 1;
+		if (batch->job[m].num < num)
+			l = m + 1;
+		else if (batch->job[m].num > num)
+			r = m - 1;
+		else
+			return &batch->job[m];
 	}
+	return NULL;
 }
 
-static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+static void drop_stream_job(fz_context *ctx, stream_job *job)
 {
-	fz_buffer *buf = NULL, *tmp_comp = NULL, *tmp_hex = NULL;
+	fz_drop_buffer(ctx, job->src);
+	fz_drop_buffer(ctx, job->out);
+	job->src = NULL;
+	job->out = NULL;
+}
+
+static void writestream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int expand, int unenc)
+{
+	stream_job local = { 0 };
+	stream_job *job = NULL;
+	fz_buffer *tmp_hex = NULL;
 	pdf_obj *obj = NULL;
 	pdf_obj *dp;
 	size_t len;
 	unsigned char *data;
-	int w, h;
 
-	fz_var(buf);
-	fz_var(tmp_comp);
 	fz_var(tmp_hex);
 	fz_var(obj);
+	fz_var(job);
 
 	fz_try(ctx)
 	{
-		buf = pdf_load_stream_number(ctx, doc, num);
 		obj = pdf_copy_dict(ctx, obj_orig);
-		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
-		pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
+		plan_stream(ctx, doc, obj, expand, do_deflate, &local);
+		local.skip_incompressible = opts->do_skip_incompressible;
 
-		len = fz_buffer_storage(ctx, buf, &data);
-		if (do_deflate)
+		job = find_prepared_stream(opts, num);
+		if (job && job->failed)
 		{
-			if (is_bitmap_stream(ctx, obj, len, &w, &h))
-			{
-				tmp_comp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
-				dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), w);
-			}
+			/* Redo it here, so that the error is reported. Data
+			 * that failed to inflate goes through the usual filter
+			 * chain instead. */
+			if (job->inflate)
+				local.inflate = 0;
 			else
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+				local.unhex = job->unhex;
+				local.src = fz_keep_buffer(ctx, job->src);
 			}
-			len = fz_buffer_storage(ctx, tmp_comp, &data);
+			drop_stream_job(ctx, job);
+			job = NULL;
+		}
+		if (!job)
+		{
+			if (expand)
+				local.inflate = 0;
+			if (!local.src)
+				load_stream_source(ctx, doc, num, expand, &local);
+			prepare_stream(ctx, &local, opts->compression_level);
+			job = &local;
 		}
 
+		if (job->kind == STREAM_CCITT)
+		{
+			pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
+			dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
+			pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
+			pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), job->bitmap_w);
+		}
+		else if (job->kind == STREAM_FLATE)
+			pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+
+		len = fz_buffer_storage(ctx, job->out, &data);
+
 		if (opts->do_ascii && isbinarystream(ctx, data, len))
 		{
 			tmp_hex = hexbuf(ctx, data, len);
@@ -1945,7 +2205,7 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 		}
 		else
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, (int)len));
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
 			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
 			fz_write_string(ctx, opts->out, "\nstream\n");
 			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
@@ -1955,9 +2215,11 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 	}
 	fz_always(ctx)
 	{
+		/* A prepared stream is only ever written once. */
+		if (job)
+			drop_stream_job(ctx, job);
+		drop_stream_job(ctx, &local);
 		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_comp);
-		fz_drop_buffer(ctx, buf);
 		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
@@ -2006,6 +2268,22 @@ static int is_jpx_filter(fz_context *ctx, pdf_obj *o)
 	return 0;
 }
 
+/* Filters whose output deflate cannot usefully shrink any further. */
+static int is_entropy_coded_filter(fz_context *ctx, pdf_obj *o)
+{
+	if (o == PDF_NAME(DCTDecode) || o == PDF_NAME(DCT) || o == PDF_NAME(JBIG2Decode))
+		return 1;
+	if (pdf_is_array(ctx, o))
+	{
+		int i, len;
+		len = pdf_array_len(ctx, o);
+		for (i = 0; i < len; i++)
+			if (is_entropy_coded_filter(ctx, pdf_array_get(ctx, o, i)))
+				return 1;
+	}
+	return 0;
+}
+
 static int is_image_stream(fz_context *ctx, pdf_obj *obj)
 {
 	pdf_obj *o;
@@ -2056,6 +2334,32 @@ static int is_xml_metadata(fz_context *ctx, pdf_obj *obj)
 	return 0;
 }
 
+/* Object streams created by pack_objstms, as opposed to ones read from
+ * the input file (which are dropped, since we write their contents out
+ * as plain objects). */
+static int is_packed_objstm(pdf_write_state *opts, int num)
+{
+	return opts->first_objstm > 0 && num >= opts->first_objstm && num <= opts->last_objstm;
+}
+
+static void stream_filters(fz_context *ctx, pdf_write_state *opts, pdf_obj *obj, int *do_deflate, int *do_expand)
+{
+	*do_deflate = opts->do_compress;
+	*do_expand = opts->do_expand;
+	if (opts->do_compress_images && is_image_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (opts->do_compress_fonts && is_font_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (is_xml_metadata(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (is_jpx_stream(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	/* Decoding a JPEG or JBIG2 image only to deflate the raw samples
+	 * again makes it much bigger; copy the original payload instead. */
+	if (opts->do_skip_incompressible && *do_deflate && *do_expand && is_entropy_coded_filter(ctx, pdf_dict_get(ctx, obj, PDF_NAME(Filter))))
+		*do_expand = 0;
+}
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int gen, int skip_xrefs, int unenc)
 {
 	pdf_obj *obj = NULL;
@@ -2078,7 +2382,7 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		if (pdf_is_dict(ctx, obj))
 		{
 			pdf_obj *type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
-			if (type == PDF_NAME(ObjStm))
+			if (type == PDF_NAME(ObjStm) && !is_packed_objstm(opts, num))
 			{
 				if (opts->use_list)
 					opts->use_list[num] = 0;
@@ -2096,21 +2400,8 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		{
 			if (pdf_obj_num_is_stream(ctx, doc, num))
 			{
-				do_deflate = opts->do_compress;
-				do_expand = opts->do_expand;
-				if (opts->do_compress_images && is_image_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (opts->do_compress_fonts && is_font_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (is_xml_metadata(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-				if (is_jpx_stream(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-
-				if (do_expand && num != opts->hint_object_num)
-					expandstream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
-				else
-					copystream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
+				stream_filters(ctx, opts, obj, &do_deflate, &do_expand);
+				writestream(ctx, doc, opts, obj, num, gen, do_deflate, do_expand && num != opts->hint_object_num, unenc);
 			}
 			else
 			{
@@ -2254,6 +2545,17 @@ static void writexrefstreamsubsect(fz_context *ctx, pdf_document *doc, pdf_write
 	pdf_array_push_int(ctx, index, to - from);
 	for (num = from; num < to; num++)
 	{
+		if (opts->objstm_list[num])
+		{
+			/* Compressed object: containing stream and index. */
+			fz_append_byte(ctx, fzbuf, 2);
+			fz_append_byte(ctx, fzbuf, opts->objstm_list[num]>>24);
+			fz_append_byte(ctx, fzbuf, opts->objstm_list[num]>>16);
+			fz_append_byte(ctx, fzbuf, opts->objstm_list[num]>>8);
+			fz_append_byte(ctx, fzbuf, opts->objstm_list[num]);
+			fz_append_byte(ctx, fzbuf, opts->ofs_list[num]);
+			continue;
+		}
 		fz_append_byte(ctx, fzbuf, opts->use_list[num] ? 1 : 0);
 		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]>>24);
 		fz_append_byte(ctx, fzbuf, opts->ofs_list[num]>>16);
@@ -2307,6 +2609,19 @@ static void writexrefstream(fz_context *ctx, pdf_document *doc, pdf_write_state
 				if (obj)
 					pdf_dict_put(ctx, dict, PDF_NAME(Encrypt), obj);
 			}
+			else
+			{
+				if (opts->crypt_obj)
+				{
+					if (pdf_is_indirect(ctx, opts->crypt_obj))
+						pdf_dict_put_drop(ctx, dict, PDF_NAME(Encrypt), pdf_new_indirect(ctx, doc, opts->crypt_object_number, 0));
+					else
+						pdf_dict_put(ctx, dict, PDF_NAME(Encrypt), opts->crypt_obj);
+				}
+
+				if (opts->metadata)
+					pdf_dict_putp(ctx, dict, "Root/Metadata", opts->metadata);
+			}
 		}
 
 		pdf_dict_put_int(ctx, dict, PDF_NAME(Size), to);
@@ -2426,6 +2741,10 @@ dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num
 	if (opts->do_garbage && !opts->use_list[num])
 		return;
 
+	/* Already written inside an object stream. */
+	if (opts->objstm_list[num])
+		return;
+
 	if (entry->type == 'n' || entry->type == 'o')
 	{
 		if (pass > 0)
@@ -2441,6 +2760,400 @@ dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num
 		opts->use_list[num] = 0;
 }
 
+/* Add stream num to the batch, if it needs decoding or compressing.
+ * This mirrors the decisions made by dowriteobject and writeobject. */
+static void
+collectobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num)
+{
+	pdf_xref_entry *entry = pdf_get_xref_entry_no_null(ctx, doc, num);
+	stream_batch *batch = opts->batch;
+	stream_job *job;
+	pdf_obj *obj, *type, *copy = NULL;
+	int do_deflate, do_expand, expand;
+
+	if (opts->do_garbage && !opts->use_list[num])
+		return;
+	if (entry->type != 'n' && entry->type != 'o')
+		return;
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return;
+	if (!pdf_obj_num_is_stream(ctx, doc, num))
+		return;
+
+	fz_var(copy);
+
+	obj = pdf_load_object(ctx, doc, num);
+	fz_try(ctx)
+	{
+		type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
+		if (type == PDF_NAME(ObjStm) || type == PDF_NAME(XRef))
+			break;
+		stream_filters(ctx, opts, obj, &do_deflate, &do_expand);
+		expand = do_expand && num != opts->hint_object_num;
+		if (!do_deflate && !expand)
+			break;
+
+		if (batch->len == batch->cap)
+		{
+			int new_cap = batch->cap ? batch->cap * 2 : 32;
+			batch->job = fz_realloc_array(ctx, batch->job, new_cap, stream_job);
+			batch->cap = new_cap;
+		}
+		job = &batch->job[batch->len];
+		memset(job, 0, sizeof *job);
+		job->num = num;
+
+		copy = pdf_copy_dict(ctx, obj);
+		plan_stream(ctx, doc, copy, expand, do_deflate, job);
+		job->skip_incompressible = opts->do_skip_incompressible;
+		load_stream_source(ctx, doc, num, expand, job);
+		batch->size += job->src->len;
+		batch->len++;
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, copy);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static stream_job *
+next_stream_job(stream_pool *pool)
+{
+	stream_job *job = NULL;
+
+	fz_lock_mutex(pool->mutex);
+	if (pool->next < pool->batch->len)
+		job = &pool->batch->job[pool->next++];
+	fz_unlock_mutex(pool->mutex);
+	return job;
+}
+
+/* Work through the jobs in the current batch. Never throws: failed
+ * jobs are left for the writer to redo, and report. */
+static void
+run_stream_jobs(fz_context *ctx, stream_pool *pool)
+{
+	stream_job *job;
+
+	while ((job = next_stream_job(pool)) != NULL)
+	{
+		fz_try(ctx)
+			prepare_stream(ctx, job, pool->level);
+		fz_catch(ctx)
+			job->failed = 1;
+	}
+}
+
+static void
+stream_worker_fn(void *arg)
+{
+	stream_worker *worker = arg;
+
+	while (1)
+	{
+		fz_wait_semaphore(worker->start);
+		if (worker->pool->quit)
+			break;
+		run_stream_jobs(worker->ctx, worker->pool);
+		fz_trigger_semaphore(worker->done);
+	}
+}
+
+static void
+drop_stream_pool(fz_context *ctx, stream_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pool->quit = 1;
+	for (i = 0; i < pool->nworkers; i++)
+		fz_trigger_semaphore(pool->worker[i].start);
+	for (i = 0; i < pool->nworkers; i++)
+	{
+		fz_join_thread(pool->worker[i].thread);
+		fz_drop_semaphore(pool->worker[i].start);
+		fz_drop_semaphore(pool->worker[i].done);
+		fz_drop_context(pool->worker[i].ctx);
+	}
+	fz_free(ctx, pool->worker);
+	fz_drop_mutex(pool->mutex);
+	fz_free(ctx, pool);
+}
+
+/* Start up to n worker threads, each with its own clone of the context.
+ * Returns NULL if none could be started: without threads, or if the
+ * context has no locks and so cannot be cloned. */
+static stream_pool *
+new_stream_pool(fz_context *ctx, int n, int level)
+{
+	stream_pool *pool;
+	stream_worker *worker;
+	fz_mutex *mutex;
+	int i;
+
+	mutex = fz_new_mutex();
+	if (!mutex)
+		return NULL;
+
+	fz_try(ctx)
+	{
+		pool = fz_malloc_struct(ctx, stream_pool);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_mutex(mutex);
+		fz_rethrow(ctx);
+	}
+	pool->mutex = mutex;
+	pool->level = level;
+
+	fz_try(ctx)
+	{
+		pool->worker = fz_calloc(ctx, n, sizeof *pool->worker);
+		for (i = 0; i < n; i++)
+		{
+			worker = &pool->worker[pool->nworkers];
+			worker->pool = pool;
+			worker->ctx = fz_clone_context(ctx);
+			worker->start = fz_new_semaphore();
+			worker->done = fz_new_semaphore();
+			if (worker->ctx && worker->start && worker->done)
+				worker->thread = fz_new_thread(stream_worker_fn, worker);
+			if (!worker->thread)
+			{
+				fz_drop_semaphore(worker->start);
+				fz_drop_semaphore(worker->done);
+				fz_drop_context(worker->ctx);
+				memset(worker, 0, sizeof *worker);
+				break;
+			}
+			pool->nworkers++;
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_stream_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	if (pool->nworkers == 0)
+	{
+		drop_stream_pool(ctx, pool);
+		return NULL;
+	}
+	return pool;
+}
+
+static void
+drop_stream_batch(fz_context *ctx, stream_batch *batch)
+{
+	int i;
+
+	if (!batch)
+		return;
+	for (i = 0; i < batch->len; i++)
+		drop_stream_job(ctx, &batch->job[i]);
+	fz_free(ctx, batch->job);
+	fz_free(ctx, batch);
+}
+
+/* Collect the streams that need preparing from object from onwards (up
+ * to a memory budget), prepare them all in parallel, and return the
+ * object number at which the next batch should start. */
+static int
+prepare_streams(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int from, int to)
+{
+	stream_batch *batch = opts->batch;
+	stream_pool *pool = opts->pool;
+	size_t budget = (size_t)opts->compress_threads << 22;
+	int i, num;
+
+	/* Anything left over from the last batch was never written. */
+	for (i = 0; i < batch->len; i++)
+		drop_stream_job(ctx, &batch->job[i]);
+	batch->len = 0;
+	batch->size = 0;
+
+	for (num = from; num < to && batch->size < budget; num++)
+	{
+		/* Leave any errors for the writer to run into. */
+		fz_try(ctx)
+			collectobject(ctx, doc, opts, num);
+		fz_catch(ctx)
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+	}
+
+	pool->batch = batch;
+	pool->next = 0;
+	for (i = 0; i < pool->nworkers; i++)
+		fz_trigger_semaphore(pool->worker[i].start);
+	run_stream_jobs(ctx, pool);
+	for (i = 0; i < pool->nworkers; i++)
+		fz_wait_semaphore(pool->worker[i].done);
+
+	return num;
+}
+
+static void
+dowriteobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int from, int to, int pass)
+{
+	int num, next = from;
+
+	for (num = from; num < to; num++)
+	{
+		if (opts->pool && num == next)
+			next = prepare_streams(ctx, doc, opts, num, to);
+		dowriteobject(ctx, doc, opts, num, pass);
+	}
+}
+
+/* Objects per object stream; the xref stream has one byte for the index. */
+#define OBJSTM_MAX_OBJECTS 100
+
+static int
+can_pack_object(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num)
+{
+	pdf_xref_entry *entry = pdf_get_xref_entry_no_null(ctx, doc, num);
+
+	if (!opts->use_list[num])
+		return 0;
+	if (entry->type != 'n' && entry->type != 'o')
+		return 0;
+	/* Only generation 0 objects can live in object streams. */
+	if (entry->type == 'n' && entry->gen != 0 && opts->do_garbage < 2)
+		return 0;
+	if (num == opts->crypt_object_number)
+		return 0;
+	if (pdf_obj_num_is_stream(ctx, doc, num))
+		return 0;
+	/* The catalog is changed after the objects are written when we
+	 * preserve metadata. */
+	if (opts->metadata && num == pdf_to_num(ctx, pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root))))
+		return 0;
+	return 1;
+}
+
+static void
+write_objstm(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int *list, int n)
+{
+	fz_buffer *head = NULL;
+	fz_buffer *body = NULL;
+	fz_buffer *data = NULL;
+	fz_output *out = NULL;
+	pdf_obj *dict = NULL;
+	int i, num;
+
+	fz_var(head);
+	fz_var(body);
+	fz_var(data);
+	fz_var(out);
+	fz_var(dict);
+
+	fz_try(ctx)
+	{
+		head = fz_new_buffer(ctx, n * 12);
+		body = fz_new_buffer(ctx, n * 128);
+		out = fz_new_output_with_buffer(ctx, body);
+		for (i = 0; i < n; i++)
+		{
+			pdf_obj *obj = pdf_load_object(ctx, doc, list[i]);
+			fz_append_printf(ctx, head, "%d %ld ", list[i], (long)fz_tell_output(ctx, out));
+			fz_try(ctx)
+				pdf_print_obj(ctx, out, obj, opts->do_tight, opts->do_ascii);
+			fz_always(ctx)
+				pdf_drop_obj(ctx, obj);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+			fz_write_byte(ctx, out, '\n');
+		}
+		fz_close_output(ctx, out);
+
+		dict = pdf_new_dict(ctx, doc, 4);
+		pdf_dict_put(ctx, dict, PDF_NAME(Type), PDF_NAME(ObjStm));
+		pdf_dict_put_int(ctx, dict, PDF_NAME(N), n);
+		pdf_dict_put_int(ctx, dict, PDF_NAME(First), head->len);
+		pdf_dict_put(ctx, dict, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+
+		fz_append_buffer(ctx, head, body);
+		data = deflatebuf(ctx, head->data, head->len, opts->compression_level);
+
+		/* Record the new object at once, so that it is deleted
+		 * again even if we fail before it is filled in. */
+		num = pdf_create_object(ctx, doc);
+		if (!opts->first_objstm)
+			opts->first_objstm = num;
+		opts->last_objstm = num;
+		expand_lists(ctx, opts, num);
+		pdf_update_object(ctx, doc, num, dict);
+		pdf_update_stream(ctx, doc, dict, data, 1);
+
+		opts->use_list[num] = 1;
+		opts->gen_list[num] = 0;
+
+		/* Packed objects keep their index in place of an offset. */
+		for (i = 0; i < n; i++)
+		{
+			opts->objstm_list[list[i]] = num;
+			opts->ofs_list[list[i]] = i;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, head);
+		fz_drop_buffer(ctx, body);
+		fz_drop_buffer(ctx, data);
+		pdf_drop_obj(ctx, dict);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Gather the non-stream objects into new compressed object streams, which
+ * will be written in their place. Returns the new xref length: xref_len,
+ * which may have been truncated, extended to cover the object streams. */
+static int
+pack_objstms(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int xref_len)
+{
+	int list[OBJSTM_MAX_OBJECTS];
+	int num, n = 0;
+
+	for (num = 1; num < xref_len; num++)
+	{
+		if (!can_pack_object(ctx, doc, opts, num))
+			continue;
+		list[n++] = num;
+		if (n == OBJSTM_MAX_OBJECTS)
+		{
+			write_objstm(ctx, doc, opts, list, n);
+			n = 0;
+		}
+	}
+	if (n > 0)
+		write_objstm(ctx, doc, opts, list, n);
+
+	if (opts->last_objstm >= xref_len)
+		xref_len = opts->last_objstm + 1;
+	return xref_len;
+}
+
+/* The object streams only exist for the saved file, so take them out of
+ * the document again, whether or not the save succeeded. */
+static void
+unpack_objstms(fz_context *ctx, pdf_document *doc, pdf_write_state *opts)
+{
+	int num;
+
+	for (num = opts->first_objstm; num > 0 && num <= opts->last_objstm; num++)
+		pdf_delete_object(ctx, doc, num);
+	opts->first_objstm = opts->last_objstm = 0;
+}
+
 static void
 writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass)
 {
@@ -2450,10 +3163,22 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	if (!opts->do_incremental)
 	{
 		int version = pdf_version(ctx, doc);
+		/* Object streams need PDF 1.5. */
+		if (opts->first_objstm && version < 15)
+			version = 15;
 		fz_write_printf(ctx, opts->out, "%%PDF-%d.%d\n", version / 10, version % 10);
 		fz_write_string(ctx, opts->out, "%\xC2\xB5\xC2\xB6\n\n");
 	}
 
+	/* Prepare streams ahead of writing them when we have threads to
+	 * spare. The offsets of linearized files are too delicate for this. */
+	if (opts->compress_threads > 1 && !opts->do_linear && !opts->pool)
+	{
+		opts->pool = new_stream_pool(ctx, opts->compress_threads - 1, opts->compression_level);
+		if (opts->pool)
+			opts->batch = fz_malloc_struct(ctx, stream_batch);
+	}
+
 	dowriteobject(ctx, doc, opts, opts->start, pass);
 
 	if (opts->do_linear)
@@ -2466,8 +3191,7 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 		writexref(ctx, doc, opts, opts->start, pdf_xref_len(ctx, doc), 1, opts->main_xref_offset, 0);
 	}
 
-	for (num = opts->start+1; num < xref_len; num++)
-		dowriteobject(ctx, doc, opts, num, pass);
+	dowriteobjects(ctx, doc, opts, opts->start+1, xref_len, pass);
 	if (opts->do_linear && pass == 1)
 	{
 		int64_t offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
@@ -3051,6 +3775,14 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->do_encrypt = in_opts->do_encrypt;
 	opts->dont_regenerate_id = in_opts->dont_regenerate_id;
 	opts->do_preserve_metadata = in_opts->do_preserve_metadata;
+	opts->compress_threads = in_opts->compress_threads;
+	if (in_opts->compression_effort <= 0)
+		opts->compression_level = Z_DEFAULT_COMPRESSION;
+	else
+		opts->compression_level = 1 + (fz_mini(in_opts->compression_effort, 100) - 1) * 8 / 99;
+	opts->do_skip_incompressible = in_opts->do_skip_incompressible;
+	/* Object streams are only written for full, non-linearized saves. */
+	opts->do_objstms = in_opts->do_objstms && !in_opts->do_incremental && !in_opts->do_linear && !pdf_has_unsaved_sigs(ctx, doc);
 	opts->start = 0;
 	opts->main_xref_offset = INT_MIN;
 
@@ -3067,6 +3799,7 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->gen_list = NULL;
 	opts->renumber_map = NULL;
 	opts->rev_renumber_map = NULL;
+	opts->objstm_list = NULL;
 
 	expand_lists(ctx, opts, xref_len);
 }
@@ -3074,11 +3807,14 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 /* Free the resources held by the dynamic write options */
 static void finalise_write_state(fz_context *ctx, pdf_write_state *opts)
 {
+	drop_stream_pool(ctx, opts->pool);
+	drop_stream_batch(ctx, opts->batch);
 	fz_free(ctx, opts->use_list);
 	fz_free(ctx, opts->ofs_list);
 	fz_free(ctx, opts->gen_list);
 	fz_free(ctx, opts->renumber_map);
 	fz_free(ctx, opts->rev_renumber_map);
+	fz_free(ctx, opts->objstm_list);
 	pdf_drop_obj(ctx, opts->linear_l);
 	pdf_drop_obj(ctx, opts->linear_h0);
 	pdf_drop_obj(ctx, opts->linear_h1);
@@ -3139,6 +3875,9 @@ const char *fz_pdf_write_options_usage =
 	"\tcompress: compress all streams\n"
 	"\tcompress-fonts: compress embedded fonts\n"
 	"\tcompress-images: compress images\n"
+	"\tcompress-threads=NUMBER: compress streams using this many threads\n"
+	"\tcompression-effort=fast|default|max|NUMBER: trade speed for size when compressing (1-100)\n"
+	"\tskip-incompressible: store noise-like streams and keep JPEG/JBIG2 images encoded\n"
 	"\tascii: ASCII hex encode binary streams\n"
 	"\tpretty: pretty-print objects with indentation\n"
 	"\tlinearize: optimize for web browsers\n"
@@ -3146,6 +3885,7 @@ const char *fz_pdf_write_options_usage =
 	"\tsanitize: sanitize graphics commands in content streams\n"
 	"\tgarbage: garbage collect unused objects\n"
 	"\tincremental: write changes as incremental update\n"
+	"\tobjstms: pack objects into compressed object streams\n"
 	"\tcontinue-on-error: continue saving the document even if there is an error\n"
 	"\tor garbage=compact: ... and compact cross reference table\n"
 	"\tor garbage=deduplicate: ... and remove duplicate objects\n"
@@ -3172,6 +3912,21 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_compress_fonts = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "compress-images", &val))
 		opts->do_compress_images = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "compress-threads", &val))
+		opts->compress_threads = fz_atoi(val);
+	if (fz_has_option(ctx, args, "compression-effort", &val))
+	{
+		if (fz_option_eq(val, "fast"))
+			opts->compression_effort = 1;
+		else if (fz_option_eq(val, "max"))
+			opts->compression_effort = 100;
+		else if (fz_option_eq(val, "default"))
+			opts->compression_effort = 0;
+		else
+			opts->compression_effort = fz_atoi(val);
+	}
+	if (fz_has_option(ctx, args, "skip-incompressible", &val))
+		opts->do_skip_incompressible = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "ascii", &val))
 		opts->do_ascii = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "pretty", &val))
@@ -3184,6 +3939,8 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_sanitize = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "incremental", &val))
 		opts->do_incremental = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "objstms", &val))
+		opts->do_objstms = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "regenerate-id", &val))
 		opts->dont_regenerate_id = fz_option_eq(val, "no");
 	if (fz_has_option(ctx, args, "decrypt", &val))
@@ -3501,6 +4258,9 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 		/* Make sure any objects hidden in compressed streams have been loaded */
 		if (!opts->do_incremental)
 		{
+			/* Objects are about to be rewritten in place, and so
+			 * can no longer be evicted and loaded again. */
+			doc->obj_cache_max = 0;
 			pdf_ensure_solid_xref(ctx, doc, xref_len);
 			preloadobjstms(ctx, doc);
 		}
@@ -3593,6 +4353,9 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 		}
 		else
 		{
+			if (opts->do_objstms)
+				xref_len = pack_objstms(ctx, doc, opts, xref_len);
+
 			writeobjects(ctx, doc, opts, 0);
 
 #ifdef DEBUG_WRITING
@@ -3632,6 +4395,11 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 				padto(ctx, opts->out, opts->main_xref_offset);
 				writexref(ctx, doc, opts, 0, opts->start, 0, 0, opts->first_xref_offset);
 			}
+			else if (opts->do_objstms)
+			{
+				opts->first_xref_offset = fz_tell_output(ctx, opts->out);
+				writexrefstream(ctx, doc, opts, 0, xref_len, 1, 0, opts->first_xref_offset);
+			}
 			else
 			{
 				opts->first_xref_offset = fz_tell_output(ctx, opts->out);
@@ -3652,6 +4420,10 @@ do_pdf_save_document(fz_context *ctx, pdf_document *doc, pdf_write_state *opts,
 		page_objects_dump(opts);
 		objects_dump(ctx, doc, opts);
 #endif
+		fz_try(ctx)
+			unpack_objstms(ctx, doc, opts);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot remove object streams: %s", fz_caught_message(ctx));
 		finalise_write_state(ctx, opts);
 		if (opts->crypt != doc->crypt)
 			pdf_drop_crypt(ctx, opts->crypt);
@@ -3724,6 +4496,34 @@ void pdf_write_document(fz_context *ctx, pdf_document *doc, fz_output *out, cons
 	do_pdf_save_document(ctx, doc, &opts, in_opts);
 }
 
+/*
+	Saving over the file the document was mapped from shortens it
+	under the mapping (an incremental save truncates it to the length
+	of the original), and reading past the new end raises SIGBUS. Read
+	the whole file into memory before the output is opened instead.
+*/
+static void
+unmap_input_file(fz_context *ctx, pdf_document *doc, const char *filename)
+{
+	fz_buffer *buf;
+	fz_stream *stm = NULL;
+
+	if (!doc->file || !fz_stream_maps_file(ctx, doc->file, filename))
+		return;
+
+	fz_seek(ctx, doc->file, 0, SEEK_SET);
+	buf = fz_read_all(ctx, doc->file, 0);
+	fz_try(ctx)
+		stm = fz_open_buffer(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	fz_drop_stream(ctx, doc->file);
+	doc->file = stm;
+}
+
 void pdf_save_document(fz_context *ctx, pdf_document *doc, const char *filename, const pdf_write_options *in_opts)
 {
 	pdf_write_options opts_defaults = pdf_default_write_options;
@@ -3790,6 +4590,8 @@ void pdf_save_document(fz_context *ctx, pdf_document *doc, const char *filename,
 
 	prepare_for_save(ctx, doc, in_opts);
 
+	unmap_input_file(ctx, doc, filename);
+
 	if (in_opts->do_incremental)
 	{
 		opts.out = fz_new_output_with_path(ctx, filename, 1);
@@ -1699,54 +1699,104 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
  */
 
 static void
-pdf_init_document(fz_context *ctx, pdf_document *doc)
+pdf_output_accelerator(fz_context *ctx, fz_document *doc, fz_output *out)
 {
-	pdf_obj *encrypt, *id;
-	int repaired = 0;
-
 	fz_try(ctx)
 	{
-		/* Check to see if we should work in progressive mode */
-		if (doc->file->progressive)
-		{
-			doc->file_reading_linearly = 1;
-			fz_seek(ctx, doc->file, 0, SEEK_END);
-			doc->file_length = fz_tell(ctx, doc->file);
-			if (doc->file_length < 0)
-				doc->file_length = 0;
-			fz_seek(ctx, doc->file, 0, SEEK_SET);
-		}
+		pdf_write_repair_accelerator(ctx, (pdf_document *)doc, out);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
 
-		pdf_load_version(ctx, doc);
+static int
+pdf_init_from_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	int indexed = 0;
 
-		/* Try to load the linearized file if we are in progressive
-		 * mode. */
-		if (doc->file_reading_linearly)
-			pdf_load_linear(ctx, doc);
-		else
-			/* Even if we're not in progressive mode, check to see
-			 * if the file claims to be linearized. This is important
-			 * for checking signatures later on. */
-			pdf_check_linear(ctx, doc);
+	fz_var(indexed);
 
-		/* If we aren't in progressive mode (or the linear load failed
-		 * and has set us back to non-progressive mode), load normally.
-		 */
-		if (!doc->file_reading_linearly)
-			pdf_load_xref(ctx, doc);
-	}
+	fz_try(ctx)
+		indexed = pdf_load_repair_accelerator(ctx, doc, accel);
 	fz_catch(ctx)
 	{
-		pdf_drop_xref_sections(ctx, doc);
 		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-		doc->file_reading_linearly = 0;
-		fz_warn(ctx, "trying to repair broken xref");
-		repaired = 1;
+		fz_warn(ctx, "ignoring broken accelerator data");
+	}
+
+	if (!indexed)
+	{
+		/* Start over from scratch. */
+		pdf_drop_xref_sections(ctx, doc);
+		doc->repair_attempted = 0;
+		doc->version = 17;
+	}
+
+	return indexed;
+}
+
+static void
+pdf_init_document(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	pdf_obj *encrypt, *id;
+	int repaired = 0;
+	int indexed = 0;
+
+	/* A previous repair of this very file may have been saved. */
+	if (accel && !doc->file->progressive)
+		indexed = pdf_init_from_accelerator(ctx, doc, accel);
+
+	if (!indexed)
+	{
+		fz_try(ctx)
+		{
+			/* Check to see if we should work in progressive mode */
+			if (doc->file->progressive)
+			{
+				doc->file_reading_linearly = 1;
+				fz_seek(ctx, doc->file, 0, SEEK_END);
+				doc->file_length = fz_tell(ctx, doc->file);
+				if (doc->file_length < 0)
+					doc->file_length = 0;
+				fz_seek(ctx, doc->file, 0, SEEK_SET);
+			}
+
+			pdf_load_version(ctx, doc);
+
+			/* Try to load the linearized file if we are in progressive
+			 * mode. */
+			if (doc->file_reading_linearly)
+				pdf_load_linear(ctx, doc);
+			else
+				/* Even if we're not in progressive mode, check to see
+				 * if the file claims to be linearized. This is important
+				 * for checking signatures later on. */
+				pdf_check_linear(ctx, doc);
+
+			/* If we aren't in progressive mode (or the linear load failed
+			 * and has set us back to non-progressive mode), load normally.
+			 */
+			if (!doc->file_reading_linearly)
+				pdf_load_xref(ctx, doc);
+		}
+		fz_catch(ctx)
+		{
+			pdf_drop_xref_sections(ctx, doc);
+			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+			doc->file_reading_linearly = 0;
+			fz_warn(ctx, "trying to repair broken xref");
+			repaired = 1;
+		}
 	}
 
 	fz_try(ctx)
 	{
-		if (repaired)
+		if (indexed)
+			pdf_prime_xref_index(ctx, doc);
+		else if (repaired)
 		{
 			/* pdf_repair_xref may access xref_index, so reset it properly */
 			if (doc->xref_index)
@@ -1763,10 +1813,15 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Allow lazy clients to read encrypted files with a blank password */
 		(void)pdf_authenticate_password(ctx, doc, "");
 
+		/* The accelerator holds the xref as it was after the
+		 * trailer was repaired, so that need not be done again. */
 		if (repaired)
 		{
 			pdf_repair_trailer(ctx, doc);
 		}
+
+		if (repaired || indexed)
+			doc->super.output_accelerator = pdf_output_accelerator;
 	}
 	fz_catch(ctx)
 	{
@@ -1932,11 +1987,31 @@ pdf_drop_document_imp(fz_context *ctx, pdf_document *doc)
 
 	fz_free(ctx, doc->orphans);
 
+	for (i = 0; i < doc->names_cap; i++)
+		pdf_drop_obj(ctx, doc->names[i]);
+	fz_free(ctx, doc->names);
+
 	pdf_drop_page_tree_internal(ctx, doc);
 
 	fz_defer_reap_end(ctx);
 
 	pdf_invalidate_xfa(ctx, doc);
+
+	/* Last, as everything above may drop objects that live in it. */
+	fz_drop_pool(ctx, doc->obj_arena);
+}
+
+void
+pdf_enable_object_arena(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc->obj_arena)
+		doc->obj_arena = fz_new_pool(ctx);
+}
+
+void
+pdf_set_object_cache_size(fz_context *ctx, pdf_document *doc, int max)
+{
+	doc->obj_cache_max = fz_maxi(max, 0);
 }
 
 void
@@ -1955,29 +2030,53 @@ pdf_keep_document(fz_context *ctx, pdf_document *doc)
  * compressed object streams
  */
 
-static pdf_xref_entry *
-pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, int target)
+/*
+	An object stream is inflated once and its directory (the object
+	numbers and offsets in its header) parsed once. Both are kept in
+	the store, so that each later lookup of one of its objects only
+	needs to parse that object.
+*/
+typedef struct
 {
-	fz_stream *stm = NULL;
-	pdf_obj *objstm = NULL;
-	int *numbuf = NULL;
-	int64_t *ofsbuf = NULL;
-
-	pdf_obj *obj;
+	fz_storable storable;
+	int64_t ofs; /* where the stream object was in the file */
+	fz_buffer *data;
 	int64_t first;
 	int count;
-	int i;
+	int *nums; /* 0 for entries that are out of range */
+	int64_t *ofsbuf;
+} pdf_obj_stm_dir;
+
+static void
+pdf_drop_obj_stm_dir_imp(fz_context *ctx, fz_storable *dir_)
+{
+	pdf_obj_stm_dir *dir = (pdf_obj_stm_dir *)dir_;
+
+	fz_drop_buffer(ctx, dir->data);
+	fz_free(ctx, dir->nums);
+	fz_free(ctx, dir->ofsbuf);
+	fz_free(ctx, dir);
+}
+
+static void
+pdf_drop_obj_stm_dir(fz_context *ctx, pdf_obj_stm_dir *dir)
+{
+	fz_drop_storable(ctx, &dir->storable);
+}
+
+static pdf_obj_stm_dir *
+pdf_load_obj_stm_dir_imp(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf)
+{
+	fz_stream *stm = NULL;
+	pdf_obj *objstm = NULL;
+	pdf_obj_stm_dir *dir = NULL;
 	pdf_token tok;
-	pdf_xref_entry *ret_entry = NULL;
 	int xref_len;
-	int found;
-	fz_stream *sub = NULL;
+	int i;
 
-	fz_var(numbuf);
-	fz_var(ofsbuf);
 	fz_var(objstm);
 	fz_var(stm);
-	fz_var(sub);
+	fz_var(dir);
 
 	fz_try(ctx)
 	{
@@ -1996,98 +2095,182 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	{
 		(void)pdf_mark_obj(ctx, objstm);
 
-		count = pdf_dict_get_int(ctx, objstm, PDF_NAME(N));
-		first = pdf_dict_get_int(ctx, objstm, PDF_NAME(First));
+		dir = fz_malloc_struct(ctx, pdf_obj_stm_dir);
+		FZ_INIT_STORABLE(dir, 1, pdf_drop_obj_stm_dir_imp);
+		dir->ofs = pdf_get_xref_entry_no_null(ctx, doc, num)->ofs;
 
-		validate_object_number_range(ctx, first, count, "object stream");
+		dir->count = pdf_dict_get_int(ctx, objstm, PDF_NAME(N));
+		dir->first = pdf_dict_get_int(ctx, objstm, PDF_NAME(First));
 
-		numbuf = fz_calloc(ctx, count, sizeof(*numbuf));
-		ofsbuf = fz_calloc(ctx, count, sizeof(*ofsbuf));
+		validate_object_number_range(ctx, dir->first, dir->count, "object stream");
 
-		xref_len = pdf_xref_len(ctx, doc);
+		dir->nums = fz_calloc(ctx, dir->count, sizeof(*dir->nums));
+		dir->ofsbuf = fz_calloc(ctx, dir->count, sizeof(*dir->ofsbuf));
 
-		found = 0;
+		dir->data = pdf_load_stream_number(ctx, doc, num);
 
-		stm = pdf_open_stream_number(ctx, doc, num);
-		for (i = 0; i < count; i++)
+		xref_len = pdf_xref_len(ctx, doc);
+
+		stm = fz_open_buffer(ctx, dir->data);
+		for (i = 0; i < dir->count; i++)
 		{
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d 0 R)", num);
-			numbuf[found] = buf->i;
+			dir->nums[i] = buf->i;
 
 			tok = pdf_lex(ctx, stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d 0 R)", num);
-			ofsbuf[found] = buf->i;
+			dir->ofsbuf[i] = buf->i;
 
-			if (numbuf[found] <= 0 || numbuf[found] >= xref_len)
+			if (dir->nums[i] <= 0 || dir->nums[i] >= xref_len)
+			{
 				fz_warn(ctx, "object stream object out of range, skipping");
-			else
-				found++;
+				dir->nums[i] = 0;
+			}
 		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		pdf_unmark_obj(ctx, objstm);
+		pdf_drop_obj(ctx, objstm);
+	}
+	fz_catch(ctx)
+	{
+		if (dir)
+			pdf_drop_obj_stm_dir_imp(ctx, &dir->storable);
+		fz_rethrow(ctx);
+	}
+
+	return dir;
+}
 
-		for (i = 0; i < found; i++)
+static pdf_obj_stm_dir *
+pdf_load_obj_stm_dir(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf)
+{
+	pdf_xref_entry *x = pdf_get_xref_entry_no_null(ctx, doc, num);
+	pdf_obj_stm_dir *dir;
+	pdf_obj *key;
+	int cacheable;
+
+	/* Streams that have been replaced in memory are not worth keeping. */
+	cacheable = (x->type == 'n' && x->stm_buf == NULL);
+	if (!cacheable)
+		return pdf_load_obj_stm_dir_imp(ctx, doc, num, buf);
+
+	key = pdf_new_indirect(ctx, doc, num, 0);
+	fz_try(ctx)
+	{
+		dir = pdf_find_item(ctx, pdf_drop_obj_stm_dir_imp, key);
+		/* A repair may have given the number to another object. */
+		if (dir && dir->ofs != x->ofs)
+		{
+			pdf_remove_item(ctx, pdf_drop_obj_stm_dir_imp, key);
+			pdf_drop_obj_stm_dir(ctx, dir);
+			dir = NULL;
+		}
+		if (dir == NULL)
+		{
+			dir = pdf_load_obj_stm_dir_imp(ctx, doc, num, buf);
+			pdf_store_item(ctx, key, dir, sizeof(*dir) + dir->data->len + dir->count * (sizeof(int) + sizeof(int64_t)));
+		}
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, key);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return dir;
+}
+
+/* Called once for each object that is parsed into the xref. Only
+ * arrays and dicts can be evicted, so only they count towards the
+ * budget; see pdf_trim_object_cache. */
+static void
+count_cached_object(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
+{
+	if (pdf_obj_last_used(ctx, obj) >= 0)
+		doc->obj_cache_count++;
+}
+
+static pdf_xref_entry *
+pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, int target)
+{
+	pdf_obj_stm_dir *dir;
+	pdf_xref_entry *ret_entry = NULL;
+	fz_stream *sub = NULL;
+	pdf_obj *obj = NULL;
+	int64_t start, end;
+	int i, k;
+
+	fz_var(sub);
+	fz_var(obj);
+
+	dir = pdf_load_obj_stm_dir(ctx, doc, num, buf);
+
+	fz_try(ctx)
+	{
+		/* The first definition of an object wins. */
+		for (i = 0; i < dir->count; i++)
+			if (dir->nums[i] == target)
+				break;
+
+		if (i < dir->count)
 		{
 			pdf_xref_entry *entry;
-			uint64_t length;
-			int64_t offset;
 
-			offset = first + ofsbuf[i];
-			if (i+1 < found)
-				length = ofsbuf[i+1] - ofsbuf[i];
-			else
-				length = UINT64_MAX;
+			/* An object runs up to the start of the next valid
+			 * one, or to the end of the stream. */
+			for (k = i + 1; k < dir->count; k++)
+				if (dir->nums[k] != 0)
+					break;
+			start = dir->first + dir->ofsbuf[i];
+			end = (int64_t)dir->data->len;
+			if (k < dir->count && dir->ofsbuf[k] >= dir->ofsbuf[i])
+				end = fz_mini64(end, dir->first + dir->ofsbuf[k]);
+			if (start < 0 || start > end)
+				start = end;
 
-			sub = fz_open_null_filter(ctx, stm, length, offset);
+			sub = fz_open_memory(ctx, dir->data->data + start, end - start);
 
-			obj = pdf_parse_stm_obj(ctx, doc, sub, buf);
-			fz_drop_stream(ctx, sub);
-			sub = NULL;
+			doc->obj_arena_loading++;
+			fz_try(ctx)
+				obj = pdf_parse_stm_obj(ctx, doc, sub, buf);
+			fz_always(ctx)
+				doc->obj_arena_loading--;
+			fz_catch(ctx)
+				fz_rethrow(ctx);
 
-			entry = pdf_get_xref_entry_no_null(ctx, doc, numbuf[i]);
+			entry = pdf_get_xref_entry_no_null(ctx, doc, target);
 
-			pdf_set_obj_parent(ctx, obj, numbuf[i]);
+			pdf_set_obj_parent(ctx, obj, target);
 
 			/* We may have set entry->type to be 'O' from being 'o' to avoid nasty
 			 * recursions in pdf_cache_object. Accept the type being 'O' here. */
 			if ((entry->type == 'o' || entry->type == 'O') && entry->ofs == num)
 			{
 				/* If we already have an entry for this object,
-				 * we'd like to drop it and use the new one -
-				 * but this means that anyone currently holding
-				 * a pointer to the old one will be left with a
-				 * stale pointer. Instead, we drop the new one
-				 * and trust that the old one is correct. */
-				if (entry->obj)
-				{
-					if (pdf_objcmp(ctx, entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
-					pdf_drop_obj(ctx, obj);
-				}
-				else
+				 * keep it; anyone holding a pointer to it would
+				 * be left with a stale one. */
+				if (entry->obj == NULL)
 				{
 					entry->obj = obj;
+					obj = NULL;
+					count_cached_object(ctx, doc, entry->obj);
 					fz_drop_buffer(ctx, entry->stm_buf);
 					entry->stm_buf = NULL;
 				}
-				if (numbuf[i] == target)
-					ret_entry = entry;
-			}
-			else
-			{
-				pdf_drop_obj(ctx, obj);
+				ret_entry = entry;
 			}
 		}
 	}
 	fz_always(ctx)
 	{
-		fz_drop_stream(ctx, stm);
 		fz_drop_stream(ctx, sub);
-		fz_free(ctx, ofsbuf);
-		fz_free(ctx, numbuf);
-		pdf_unmark_obj(ctx, objstm);
-		pdf_drop_obj(ctx, objstm);
+		pdf_drop_obj(ctx, obj);
+		pdf_drop_obj_stm_dir(ctx, dir);
 	}
 	fz_catch(ctx)
 	{
@@ -2370,7 +2553,10 @@ object_updated:
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find object in xref (%d 0 R)", num);
 
 	if (x->obj != NULL)
+	{
+		pdf_set_obj_last_used(ctx, x->obj, doc->obj_cache_epoch);
 		return x;
+	}
 
 	if (x->type == 'f')
 	{
@@ -2380,11 +2566,14 @@ object_updated:
 	{
 		fz_seek(ctx, doc->file, x->ofs, SEEK_SET);
 
+		doc->obj_arena_loading++;
 		fz_try(ctx)
 		{
 			x->obj = pdf_parse_ind_obj(ctx, doc, doc->file,
 					&rnum, &rgen, &x->stm_ofs, &try_repair);
 		}
+		fz_always(ctx)
+			doc->obj_arena_loading--;
 		fz_catch(ctx)
 		{
 			if (!try_repair || fz_caught(ctx) == FZ_ERROR_TRYLATER)
@@ -2427,6 +2616,7 @@ perform_repair:
 
 		if (doc->crypt)
 			pdf_crypt_obj(ctx, doc->crypt, x->obj, x->num, x->gen);
+		count_cached_object(ctx, doc, x->obj);
 	}
 	else if (x->type == 'o')
 	{
@@ -2466,6 +2656,7 @@ perform_repair:
 	}
 
 	pdf_set_obj_parent(ctx, x->obj, num);
+	pdf_set_obj_last_used(ctx, x->obj, doc->obj_cache_epoch);
 	return x;
 }
 
@@ -2965,16 +3156,18 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 	/* Default to PDF-1.7 if the version header is missing and for new documents */
 	doc->version = 17;
 
+	doc->obj_cache_max = PDF_OBJECT_CACHE_DEFAULT;
+
 	return doc;
 }
 
 pdf_document *
-pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+pdf_open_accelerated_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel)
 {
 	pdf_document *doc = pdf_new_document(ctx, file);
 	fz_try(ctx)
 	{
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, accel);
 	}
 	fz_catch(ctx)
 	{
@@ -2988,29 +3181,47 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_accelerated_document_with_stream(ctx, file, NULL);
+}
+
 /* Uncomment the following to test progressive loading. */
 /* #define TEST_PROGRESSIVE_HACK */
 
 pdf_document *
-pdf_open_document(fz_context *ctx, const char *filename)
+pdf_open_accelerated_document(fz_context *ctx, const char *filename, const char *accel)
 {
 	fz_stream *file = NULL;
+	fz_stream *afile = NULL;
 	pdf_document *doc = NULL;
 
 	fz_var(file);
+	fz_var(afile);
 	fz_var(doc);
 
 	fz_try(ctx)
 	{
 		file = fz_open_file(ctx, filename);
+		if (accel)
+		{
+			/* A missing or unreadable sidecar just means a slow open. */
+			fz_try(ctx)
+				afile = fz_open_file(ctx, accel);
+			fz_catch(ctx)
+				fz_warn(ctx, "cannot open accelerator '%s'", accel);
+		}
 #ifdef TEST_PROGRESSIVE_HACK
 		file->progressive = 1;
 #endif
 		doc = pdf_new_document(ctx, file);
-		pdf_init_document(ctx, doc);
+		doc->file_stamp = fz_stat_mtime(filename);
+		pdf_init_document(ctx, doc, afile);
 	}
 	fz_always(ctx)
 	{
+		fz_drop_stream(ctx, afile);
 		fz_drop_stream(ctx, file);
 	}
 	fz_catch(ctx)
@@ -3035,6 +3246,12 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document(fz_context *ctx, const char *filename)
+{
+	return pdf_open_accelerated_document(ctx, filename, NULL);
+}
+
 static void
 pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum)
 {
@@ -3502,8 +3719,8 @@ fz_document_handler pdf_document_handler =
 	(fz_document_open_with_stream_fn*)pdf_open_document_with_stream,
 	pdf_extensions,
 	pdf_mimetypes,
-	NULL,
-	NULL
+	(fz_document_open_accel_fn*)pdf_open_accelerated_document,
+	(fz_document_open_accel_with_stream_fn*)pdf_open_accelerated_document_with_stream
 };
 
 void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
@@ -3588,6 +3805,106 @@ void pdf_clear_xref_to_mark(fz_context *ctx, pdf_document *doc)
 	}
 }
 
+/* Ages are counted in epochs, and lumped together from here on. */
+#define MAX_CACHE_AGE 32
+
+static int
+can_evict(fz_context *ctx, pdf_document *doc, pdf_xref_entry *entry)
+{
+	/* Only objects we can load again exactly as they were. */
+	if (entry->obj == NULL || entry->stm_buf != NULL)
+		return 0;
+	if (entry->type != 'n' && entry->type != 'o')
+		return 0;
+	if (pdf_obj_refs(ctx, entry->obj) != 1 || pdf_obj_is_dirty(ctx, entry->obj))
+		return 0;
+	/* Repair patches stream lengths in memory only. */
+	if (doc->repair_attempted && entry->stm_ofs != 0)
+		return 0;
+	return 1;
+}
+
+void
+pdf_trim_object_cache(fz_context *ctx, pdf_document *doc)
+{
+	int count[MAX_CACHE_AGE + 1] = { 0 };
+	int x, e, age, cutoff, scavenges, target, cached;
+
+	/* Anything looked up during this epoch or the last is safe. */
+	doc->obj_cache_epoch++;
+
+	if (doc->obj_cache_max == 0 || doc->obj_arena)
+		return;
+	if (doc->save_in_progress || doc->repair_in_progress || doc->file_reading_linearly)
+		return;
+
+	scavenges = fz_store_scavenge_count(ctx);
+	if (scavenges != doc->obj_cache_scavenges)
+	{
+		doc->obj_cache_scavenges = scavenges;
+		target = 0;
+	}
+	else if (doc->obj_cache_count > doc->obj_cache_max)
+		target = doc->obj_cache_max / 4 * 3;
+	else
+		return;
+
+	/* Count cached objects by age... */
+	cached = 0;
+	for (x = doc->num_incremental_sections; x < doc->num_xref_sections; x++)
+	{
+		pdf_xref_subsec *sub;
+		for (sub = doc->xref_sections[x].subsec; sub != NULL; sub = sub->next)
+		{
+			for (e = 0; e < sub->len; e++)
+			{
+				pdf_xref_entry *entry = &sub->table[e];
+				int used = pdf_obj_last_used(ctx, entry->obj);
+				if (used < 0)
+					continue;
+				cached++;
+				if (can_evict(ctx, doc, entry))
+					count[fz_mini(doc->obj_cache_epoch - used, MAX_CACHE_AGE)]++;
+			}
+		}
+	}
+
+	/* ...find the youngest age we need to drop to get down to the
+	 * target, never younger than two epochs... */
+	cutoff = MAX_CACHE_AGE + 1;
+	while (cutoff > 2 && cached > target)
+	{
+		cutoff--;
+		cached -= count[cutoff];
+	}
+
+	/* ...and drop everything at least that old. */
+	for (x = doc->num_incremental_sections; x < doc->num_xref_sections; x++)
+	{
+		pdf_xref_subsec *sub;
+		for (sub = doc->xref_sections[x].subsec; sub != NULL; sub = sub->next)
+		{
+			for (e = 0; e < sub->len; e++)
+			{
+				pdf_xref_entry *entry = &sub->table[e];
+				int used = pdf_obj_last_used(ctx, entry->obj);
+				if (used < 0)
+					continue;
+				age = fz_mini(doc->obj_cache_epoch - used, MAX_CACHE_AGE);
+				if (age >= cutoff && can_evict(ctx, doc, entry))
+				{
+					pdf_drop_obj(ctx, entry->obj);
+					entry->obj = NULL;
+				}
+			}
+		}
+	}
+
+	/* If too much is still in use, don't look again until another
+	 * quarter of the budget has been loaded. */
+	doc->obj_cache_count = fz_mini(cached, target);
+}
+
 int
 pdf_count_versions(fz_context *ctx, pdf_document *doc)
 {
@@ -0,0 +1,194 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * caj-test - Open the CAJ fixture through the document handler, from a
+ * file and from memory, and check its page tree and outline, and that
+ * a table of contents with no room before the body is skipped.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+static void
+check_outline(fz_context *ctx, fz_document *doc)
+{
+	fz_outline *outline = fz_load_outline(ctx, doc);
+	fz_outline *o;
+
+	fz_try(ctx)
+	{
+		/* Two chapters, the first with a section that has a subsection. */
+		o = outline;
+		CHECK(o != NULL);
+		if (!o)
+			break;
+		CHECK_STR(o->title, "\xe7\xac\xac\xe4\xb8\x80\xe7\xab\xa0 Intro");
+		CHECK_INT(o->page.page, 0);
+		CHECK(!o->is_open);
+		CHECK(o->down != NULL);
+		if (o->down)
+		{
+			CHECK_STR(o->down->title, "1.1 \xe8\x8a\x82");
+			CHECK_INT(o->down->page.page, 1);
+			CHECK(o->down->down && !strcmp(o->down->down->title, "deep"));
+			CHECK(o->down->next == NULL);
+		}
+		o = o->next;
+		CHECK(o != NULL);
+		if (!o)
+			break;
+		CHECK_STR(o->title, "\xe7\xac\xac\xe4\xba\x8c\xe7\xab\xa0");
+		CHECK_INT(o->page.page, 3);
+		CHECK(o->down && !strcmp(o->down->title, "2.1") && o->down->page.page == 4);
+		CHECK(o->next == NULL);
+	}
+	fz_always(ctx)
+		fz_drop_outline(ctx, outline);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+check_document(fz_context *ctx, fz_document *doc)
+{
+	pdf_document *pdf = pdf_specifics(ctx, doc);
+	fz_page *page;
+	fz_rect bounds;
+	int i;
+
+	CHECK(pdf != NULL);
+	CHECK_INT(fz_count_pages(ctx, doc), 5);
+
+	/* The two missing page tree nodes are rebuilt in file order. */
+	for (i = 0; i < 5; i++)
+	{
+		pdf_obj *obj = pdf_lookup_page_obj(ctx, pdf, i);
+		CHECK_INT(pdf_to_num(ctx, obj), i + 1);
+	}
+
+	page = fz_load_page(ctx, doc, 4);
+	bounds = fz_bound_page(ctx, page);
+	CHECK(bounds.x1 == 200 && bounds.y1 == 200);
+	fz_drop_page(ctx, page);
+
+	/* Items are closed, so only the two chapters are shown. */
+	CHECK_INT(pdf_dict_get_int(ctx, pdf_dict_getp(ctx, pdf_trailer(ctx, pdf), "Root/Outlines"), PDF_NAME(Count)), 2);
+	CHECK_INT(pdf_dict_get_int(ctx, pdf_dict_getp(ctx, pdf_trailer(ctx, pdf), "Root/Outlines/First"), PDF_NAME(Count)), -1);
+
+	check_outline(ctx, doc);
+}
+
+/*
+	Point the header at a copy of the body pointer placed in front of
+	the table of contents, so none of the table fits before the body.
+	The document must still open, with no outline.
+*/
+static void
+check_no_outline(fz_context *ctx, fz_buffer *buf)
+{
+	fz_buffer *copy = fz_clone_buffer(ctx, buf);
+	fz_stream *stm = NULL;
+	fz_document *doc = NULL;
+	fz_outline *outline = NULL;
+
+	fz_var(stm);
+	fz_var(doc);
+	fz_var(outline);
+
+	fz_try(ctx)
+	{
+		unsigned char *p = copy->data;
+		unsigned int body_ptr = p[0x14] | p[0x15] << 8 | p[0x16] << 16 | (unsigned int)p[0x17] << 24;
+		memcpy(p + 0x100, p + body_ptr, 4);
+		p[0x14] = 0x00;
+		p[0x15] = 0x01;
+		p[0x16] = 0;
+		p[0x17] = 0;
+
+		stm = fz_open_buffer(ctx, copy);
+		doc = fz_open_document_with_stream(ctx, "application/x-caj", stm);
+		CHECK_INT(fz_count_pages(ctx, doc), 5);
+		outline = fz_load_outline(ctx, doc);
+		CHECK(outline == NULL);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_outline(ctx, outline);
+		fz_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, copy);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = mu_test_file(argc > 1 ? argv[1] : NULL, "sample.caj");
+	fz_context *ctx;
+	fz_document *doc = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return 1;
+
+	fz_var(doc);
+	fz_var(buf);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+
+		/* The handler is picked by the file's extension. */
+		doc = fz_open_document(ctx, path);
+		check_document(ctx, doc);
+		fz_drop_document(ctx, doc);
+		doc = NULL;
+
+		/* The body is read in place from a memory stream too. */
+		buf = fz_read_file(ctx, path);
+		stm = fz_open_buffer(ctx, buf);
+		doc = fz_open_document_with_stream(ctx, "application/x-caj", stm);
+		check_document(ctx, doc);
+
+		check_no_outline(ctx, buf);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+	return mu_test_result("caj-test");
+}
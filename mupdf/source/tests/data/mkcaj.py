@@ -0,0 +1,43 @@
+# Generate the CAJ fixtures used by caj-test.c.
+#
+# sample.caj holds a five page PDF body whose pages point at two page
+# tree nodes that are not in the file, and a table of contents with
+# GB18030 titles on three levels.
+
+import struct
+
+def make_caj(path, npages=5):
+	content = b"0 0 1 rg 10 10 100 100 re f"
+	body = b""
+	for i in range(npages):
+		parent = 100 if i < 2 else 101
+		body += b"%d 0 obj\r<</Type /Page /Parent %d 0 R /MediaBox [0 0 200 200] /Contents %d 0 R>>\rendobj\r" % (i + 1, parent, 40 + i)
+		body += b"%d 0 obj\r<</Length %d>>stream\r\n%s\r\nendstream\rendobj\r" % (40 + i, len(content), content)
+
+	toc = [
+		(1, 1, "第一章 Intro".encode("gb18030")),
+		(2, 2, "1.1 节".encode("gb18030")),
+		(3, 3, b"deep"),
+		(1, 4, "第二章".encode("gb18030")),
+		(2, 5, b"2.1"),
+	]
+	tocb = struct.pack("<i", len(toc))
+	for level, page, title in toc:
+		e = bytearray(0x134)
+		e[0:len(title)] = title
+		p = str(page).encode()
+		e[280:280 + len(p)] = p
+		e[304:308] = struct.pack("<i", level)
+		tocb += bytes(e)
+
+	hdr = bytearray(0x110)
+	hdr[0:4] = b"CAJ\0"
+	body_ptr = 0x110 + len(tocb)
+	struct.pack_into("<i", hdr, 0x10, npages)
+	struct.pack_into("<I", hdr, 0x14, body_ptr)
+	data = bytes(hdr) + tocb + struct.pack("<I", body_ptr + 4 + 16) + b"\0" * 16 + body
+	# Trailing junk after the last endobj, as real files have.
+	data += b"\x01\x02junk\xff" * 10
+	open(path, "wb").write(data)
+
+make_caj("sample.caj")
@@ -0,0 +1,978 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * draw-test - Paint spans and images and scale pixmaps with the vector
+ * painters and scalers and again with the C ones, and check that both
+ * give the same pixels. Where the build has no vector paths both runs
+ * are of the C ones. Also check that scaling or drawing a display list
+ * in bands on several threads gives the same pixels as doing it on one,
+ * and that threads sharing the glyph cache get the same text and counts.
+ */
+
+#include "mupdf/fitz.h"
+#include "mu-test.h"
+
+#include "draw-imp.h"
+#include "pixmap-imp.h"
+#include "thread-imp.h"
+
+/* Banded drawing runs on clones, which need real locks. */
+static fz_mutex *mutexes[FZ_LOCK_MAX];
+
+static void lock(void *user, int i)
+{
+	fz_lock_mutex(mutexes[i]);
+}
+
+static void unlock(void *user, int i)
+{
+	fz_unlock_mutex(mutexes[i]);
+}
+
+static int
+noise(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0xff;
+}
+
+/* Mostly clear or solid, as masks and alphas are, with some between. */
+static int
+noise_alpha(unsigned int *seed)
+{
+	int r = noise(seed);
+	if (r < 64)
+		return 0;
+	if (r < 128)
+		return 255;
+	return noise(seed);
+}
+
+/* Premultiplied samples, with the alphas noise_alpha gives. */
+static void
+fill_pixmap(fz_pixmap *pix, unsigned int *seed)
+{
+	int n1 = pix->n - pix->alpha;
+	int x, y, k, a;
+	unsigned char *p;
+
+	for (y = 0; y < pix->h; y++)
+	{
+		p = pix->samples + y * (size_t)pix->stride;
+		for (x = 0; x < pix->w; x++)
+		{
+			a = pix->alpha ? noise_alpha(seed) : 255;
+			for (k = 0; k < n1; k++)
+				*p++ = fz_mul255(noise(seed), a);
+			if (pix->alpha)
+				*p++ = a;
+		}
+	}
+}
+
+static fz_colorspace *
+colorspace_for(fz_context *ctx, int n)
+{
+	if (n == 1)
+		return fz_device_gray(ctx);
+	if (n == 3)
+		return fz_device_rgb(ctx);
+	return fz_device_cmyk(ctx);
+}
+
+static int
+same_pixmap(fz_pixmap *a, fz_pixmap *b)
+{
+	int y;
+
+	if (!a || !b || a->w != b->w || a->h != b->h || a->n != b->n)
+		return 0;
+	for (y = 0; y < a->h; y++)
+		if (memcmp(a->samples + y * (size_t)a->stride, b->samples + y * (size_t)b->stride, a->w * (size_t)a->n))
+			return 0;
+	return 1;
+}
+
+/* Spans of every length up to a few steps of 16 bytes, and some longer. */
+static const int span_widths[] = {
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+	20, 21, 23, 31, 32, 33, 47, 48, 49, 63, 64, 65, 100, 257,
+};
+
+#define SPAN_ROWS 3
+
+static void
+check_spans(fz_context *ctx)
+{
+	static const int ns[] = { 1, 3, 4 };
+	fz_pixmap *dst[2] = { NULL, NULL };
+	fz_pixmap *src = NULL;
+	fz_pixmap *msk = NULL;
+	fz_span_color_painter_t *fn;
+	unsigned char color[FZ_MAX_COLORS + 1];
+	unsigned int seed = 1;
+	int i, j, k, da, n1, w, y, alpha, op;
+
+	fz_var(dst);
+	fz_var(src);
+	fz_var(msk);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(ns); i++)
+		for (da = 0; da <= 1; da++)
+		for (j = 0; j < (int)nelem(span_widths); j++)
+		for (op = 0; op < 4; op++)
+		{
+			n1 = ns[i];
+			w = span_widths[j];
+
+			/* Color through a mask, solid and not; a source
+			 * through a mask; a source with alpha over. */
+			alpha = op == 1 ? 255 : 160;
+			msk = fz_new_pixmap(ctx, NULL, w, SPAN_ROWS, NULL, 1);
+			fill_pixmap(msk, &seed);
+			src = fz_new_pixmap(ctx, colorspace_for(ctx, n1), w, SPAN_ROWS, NULL, op == 3 ? 1 : da);
+			fill_pixmap(src, &seed);
+			for (k = 0; k < n1; k++)
+				color[k] = noise(&seed);
+			color[n1] = alpha;
+
+			dst[0] = fz_new_pixmap(ctx, colorspace_for(ctx, n1), w, SPAN_ROWS, NULL, da);
+			fill_pixmap(dst[0], &seed);
+			dst[1] = fz_clone_pixmap(ctx, dst[0]);
+
+			for (k = 0; k < 2; k++)
+			{
+				fz_enable_paint_simd(k == 0);
+				if (op < 2)
+				{
+					fn = fz_get_span_color_painter(n1 + da, da, color, NULL);
+					for (y = 0; y < SPAN_ROWS; y++)
+						fn(dst[k]->samples + y * (size_t)dst[k]->stride, msk->samples + y * (size_t)msk->stride, n1 + da, w, color, da, NULL);
+				}
+				else if (op == 2)
+					fz_paint_pixmap_with_mask(dst[k], src, msk);
+				else
+					fz_paint_pixmap(dst[k], src, 255);
+			}
+			fz_enable_paint_simd(1);
+
+			if (!same_pixmap(dst[0], dst[1]))
+			{
+				fprintf(stderr, "span painter %d differs: n=%d da=%d w=%d\n", op, n1, da, w);
+				mu_test_failures++;
+			}
+
+			fz_drop_pixmap(ctx, dst[0]);
+			fz_drop_pixmap(ctx, dst[1]);
+			fz_drop_pixmap(ctx, src);
+			fz_drop_pixmap(ctx, msk);
+			dst[0] = dst[1] = src = msk = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_enable_paint_simd(1);
+		fz_drop_pixmap(ctx, dst[0]);
+		fz_drop_pixmap(ctx, dst[1]);
+		fz_drop_pixmap(ctx, src);
+		fz_drop_pixmap(ctx, msk);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "spans: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/*
+	Images drawn upright and turned through 90 degrees each way, scaled
+	up and down, and at whole and fractional offsets; each with and
+	without interpolation, and opaque and not.
+*/
+static void
+check_images(fz_context *ctx)
+{
+	static const int pairs[][2] = { { 1, 1 }, { 3, 1 }, { 3, 3 } };
+	static const fz_matrix ctms[] = {
+		{ 37, 0, 0, 29, 0, 0 },
+		{ 37, 0, 0, 29, 3.25f, 1.5f },
+		{ 91, 0, 0, 53, 2.6f, 4.1f },
+		{ 201, 0, 0, 17, 0.4f, 0.7f },
+		{ 23, 0, 0, 19, 5.5f, 3 },
+		{ 0, 61, 45, 0, 1.3f, 2.2f },
+		{ 0, -61, 45, 0, 1.3f, 64.2f },
+		{ 0, 83, -71, 0, 73.6f, 0.3f },
+	};
+	fz_pixmap *dst[2] = { NULL, NULL };
+	fz_pixmap *img = NULL;
+	fz_irect scissor = { 0, 0, 220, 100 };
+	unsigned int seed = 2;
+	int i, j, k, da, sa, lerp, alpha;
+
+	fz_var(dst);
+	fz_var(img);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(pairs); i++)
+		for (da = 0; da <= 1; da++)
+		for (sa = 0; sa <= 1; sa++)
+		for (j = 0; j < (int)nelem(ctms); j++)
+		for (lerp = 0; lerp <= 1; lerp++)
+		for (alpha = 255; alpha >= 128; alpha -= 127)
+		{
+			img = fz_new_pixmap(ctx, colorspace_for(ctx, pairs[i][1]), 37, 29, NULL, sa);
+			fill_pixmap(img, &seed);
+			dst[0] = fz_new_pixmap(ctx, colorspace_for(ctx, pairs[i][0]), 220, 100, NULL, da);
+			fill_pixmap(dst[0], &seed);
+			dst[1] = fz_clone_pixmap(ctx, dst[0]);
+
+			for (k = 0; k < 2; k++)
+			{
+				fz_enable_paint_simd(k == 0);
+				fz_paint_image(ctx, dst[k], &scissor, NULL, NULL, img, ctms[j], alpha, lerp, NULL);
+			}
+			fz_enable_paint_simd(1);
+
+			if (!same_pixmap(dst[0], dst[1]))
+			{
+				fprintf(stderr, "image painter differs: dn=%d da=%d sn=%d sa=%d ctm=%d lerp=%d alpha=%d\n",
+					pairs[i][0], da, pairs[i][1], sa, j, lerp, alpha);
+				mu_test_failures++;
+			}
+
+			fz_drop_pixmap(ctx, dst[0]);
+			fz_drop_pixmap(ctx, dst[1]);
+			fz_drop_pixmap(ctx, img);
+			dst[0] = dst[1] = img = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_enable_paint_simd(1);
+		fz_drop_pixmap(ctx, dst[0]);
+		fz_drop_pixmap(ctx, dst[1]);
+		fz_drop_pixmap(ctx, img);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "images: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/* Pixmaps of 1 to 4 components scaled up, down, and each way at once. */
+static void
+check_scale(fz_context *ctx)
+{
+	static const int ns[][2] = { { 1, 0 }, { 1, 1 }, { 3, 0 }, { 3, 1 }, { 4, 0 } };
+	static const float sizes[][2] = {
+		{ 100, 60 }, { 11, 7 }, { 200, 3 }, { 5, 90 }, { 36.5f, 22.25f },
+	};
+	fz_pixmap *src = NULL;
+	fz_pixmap *dst[2] = { NULL, NULL };
+	unsigned int seed = 3;
+	int i, j, k;
+
+	fz_var(src);
+	fz_var(dst);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(ns); i++)
+		{
+			src = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i][0]), 37, 23, NULL, ns[i][1]);
+			fill_pixmap(src, &seed);
+			for (j = 0; j < (int)nelem(sizes); j++)
+			{
+				for (k = 0; k < 2; k++)
+				{
+					fz_enable_paint_simd(k == 0);
+					dst[k] = fz_scale_pixmap(ctx, src, 0.5f, 0.25f, sizes[j][0], sizes[j][1], NULL);
+				}
+				fz_enable_paint_simd(1);
+
+				if (!same_pixmap(dst[0], dst[1]))
+				{
+					fprintf(stderr, "scaler differs: n=%d alpha=%d size=%d\n", ns[i][0], ns[i][1], j);
+					mu_test_failures++;
+				}
+
+				fz_drop_pixmap(ctx, dst[0]);
+				fz_drop_pixmap(ctx, dst[1]);
+				dst[0] = dst[1] = NULL;
+			}
+			fz_drop_pixmap(ctx, src);
+			src = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_enable_paint_simd(1);
+		fz_drop_pixmap(ctx, dst[0]);
+		fz_drop_pixmap(ctx, dst[1]);
+		fz_drop_pixmap(ctx, src);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "scale: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/*
+	Scales big enough to be split into bands of rows, done with 2 to 7
+	threads and compared with the same scale on one. The sizes split
+	into bands that don't divide evenly, that are near the smallest
+	the scaler will make, and that are flipped or clipped.
+*/
+static void
+check_scale_threads(fz_context *ctx)
+{
+	static const int ns[][2] = { { 1, 0 }, { 3, 1 }, { 4, 0 } };
+	static const int threads[] = { 2, 3, 5, 7 };
+	static const float sizes[][2] = {
+		{ 301, 101 }, { 97, 37 }, { 640, 17 }, { 53, 250 }, { 1200, 911 }, { 333.5f, -127.25f },
+	};
+	fz_irect clip = { 10, -60, 210, 60 };
+	fz_pixmap *src = NULL;
+	fz_pixmap *want = NULL;
+	fz_pixmap *got = NULL;
+	unsigned int seed = 11;
+	int i, j, k, c;
+
+	fz_var(src);
+	fz_var(want);
+	fz_var(got);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(ns); i++)
+		{
+			/* At least 1MB of samples, or the scaler won't use threads. */
+			src = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i][0]), 1031, 1100 / (ns[i][0] + ns[i][1]), NULL, ns[i][1]);
+			fill_pixmap(src, &seed);
+			for (j = 0; j < (int)nelem(sizes); j++)
+			{
+				for (c = 0; c < 2; c++)
+				{
+					fz_tune_image_scale_threads(ctx, 1);
+					want = fz_scale_pixmap(ctx, src, 0.5f, 0.25f, sizes[j][0], sizes[j][1], c ? &clip : NULL);
+					for (k = 0; k < (int)nelem(threads); k++)
+					{
+						fz_tune_image_scale_threads(ctx, threads[k]);
+						got = fz_scale_pixmap(ctx, src, 0.5f, 0.25f, sizes[j][0], sizes[j][1], c ? &clip : NULL);
+						if (!same_pixmap(want, got))
+						{
+							fprintf(stderr, "threaded scale differs: n=%d alpha=%d size=%d clip=%d threads=%d\n", ns[i][0], ns[i][1], j, c, threads[k]);
+							mu_test_failures++;
+						}
+						fz_drop_pixmap(ctx, got);
+						got = NULL;
+					}
+					fz_drop_pixmap(ctx, want);
+					want = NULL;
+				}
+			}
+			fz_drop_pixmap(ctx, src);
+			src = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_tune_image_scale_threads(ctx, 1);
+		fz_drop_pixmap(ctx, got);
+		fz_drop_pixmap(ctx, want);
+		fz_drop_pixmap(ctx, src);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "threaded scale: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/*
+	A display list with something in every band: filled and stroked
+	paths, text, an image, a clip and a transparency group. If
+	'unbalanced', a clip over the lower half is never popped, so that
+	closing the draw device throws for the bands it covers.
+*/
+static fz_display_list *
+make_list(fz_context *ctx, fz_rect area, int unbalanced)
+{
+	static const float red[3] = { 1, 0, 0 };
+	static const float blue[3] = { 0, 0.3f, 1 };
+	fz_display_list *list = fz_new_display_list(ctx, area);
+	fz_device *dev = NULL;
+	fz_path *path = NULL;
+	fz_stroke_state *stroke = NULL;
+	fz_font *font = NULL;
+	fz_text *text = NULL;
+	fz_pixmap *pix = NULL;
+	fz_image *image = NULL;
+	unsigned int seed = 5;
+	float y;
+
+	fz_var(dev);
+	fz_var(path);
+	fz_var(stroke);
+	fz_var(font);
+	fz_var(text);
+	fz_var(pix);
+	fz_var(image);
+
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+
+		path = fz_new_path(ctx);
+		fz_moveto(ctx, path, area.x0 + 3, area.y0 + 2);
+		fz_lineto(ctx, path, area.x1 - 5, (area.y0 + area.y1) / 2);
+		fz_lineto(ctx, path, area.x0 + 10, area.y1 - 1);
+		fz_closepath(ctx, path);
+		fz_fill_path(ctx, dev, path, 0, fz_identity, fz_device_rgb(ctx), red, 0.8f, fz_default_color_params);
+		stroke = fz_new_stroke_state(ctx);
+		stroke->linewidth = 2.5f;
+		fz_stroke_path(ctx, dev, path, stroke, fz_identity, fz_device_rgb(ctx), blue, 1, fz_default_color_params);
+
+		pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), 13, 17, NULL, 1);
+		fill_pixmap(pix, &seed);
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+		fz_fill_image(ctx, dev, image, fz_make_matrix(area.x1 - area.x0, 0, 0, (area.y1 - area.y0) / 2, area.x0, area.y0 + (area.y1 - area.y0) / 4), 0.7f, fz_default_color_params);
+
+		font = fz_new_base14_font(ctx, "Helvetica");
+		text = fz_new_text(ctx);
+		for (y = area.y0 + 9; y < area.y1; y += 11)
+			fz_show_string(ctx, text, font, fz_make_matrix(10, 0, 0, -10, area.x0 + 2, y), "The quick brown fox", 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+
+		fz_begin_group(ctx, dev, area, NULL, 0, 0, FZ_BLEND_MULTIPLY, 0.5f);
+		fz_fill_text(ctx, dev, text, fz_identity, fz_device_rgb(ctx), blue, 1, fz_default_color_params);
+		fz_end_group(ctx, dev);
+
+		if (unbalanced)
+		{
+			fz_drop_path(ctx, path);
+			path = fz_new_path(ctx);
+			fz_rectto(ctx, path, area.x0, (area.y0 + area.y1) / 2, area.x1, area.y1);
+			fz_clip_path(ctx, dev, path, 0, fz_identity, area);
+			fz_fill_path(ctx, dev, path, 0, fz_identity, fz_device_rgb(ctx), red, 0.5f, fz_default_color_params);
+		}
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_text(ctx, text);
+		fz_drop_font(ctx, font);
+		fz_drop_image(ctx, image);
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_stroke_state(ctx, stroke);
+		fz_drop_path(ctx, path);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+/* Draw list into a clear pixmap covering bbox, on one thread with a
+ * plain draw device if nthreads is 0. */
+static fz_pixmap *
+render_list(fz_context *ctx, fz_display_list *list, fz_irect bbox, int nthreads)
+{
+	fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, NULL, 1);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap(ctx, pix);
+		if (nthreads == 0)
+		{
+			dev = fz_new_draw_device(ctx, fz_identity, pix);
+			fz_run_display_list(ctx, list, dev, fz_identity, fz_rect_from_irect(bbox), NULL);
+			fz_close_device(ctx, dev);
+		}
+		else
+			fz_render_display_list_parallel(ctx, list, fz_identity, pix, nthreads);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+	return pix;
+}
+
+/*
+	Draw the same list serially and in bands on 2 to 7 threads, into
+	pixmaps tall enough for every band, too short for more than one
+	or two, and with a last band shorter than the rest. With ctx,
+	which has no locks, the drawing falls back to the calling thread.
+	An error in one band is thrown once every thread has stopped.
+*/
+static void
+check_parallel(fz_context *ctx, fz_context *lctx)
+{
+	static const int heights[] = { 20, 40, 63, 100, 457 };
+	fz_display_list *list = NULL;
+	fz_display_list *plain = NULL;
+	fz_pixmap *want = NULL;
+	fz_pixmap *got = NULL;
+	fz_irect bbox;
+	int i, n, threw;
+
+	fz_var(list);
+	fz_var(plain);
+	fz_var(want);
+	fz_var(got);
+
+	fz_try(lctx)
+	{
+		for (i = 0; i < (int)nelem(heights); i++)
+		{
+			bbox = fz_make_irect(-7, -13, 294, heights[i] - 13);
+			list = make_list(lctx, fz_rect_from_irect(bbox), 0);
+			want = render_list(lctx, list, bbox, 0);
+			for (n = 1; n <= 7; n++)
+			{
+				got = render_list(lctx, list, bbox, n);
+				if (!same_pixmap(want, got))
+				{
+					fprintf(stderr, "banded drawing differs: height %d, %d threads\n", heights[i], n);
+					mu_test_failures++;
+				}
+				fz_drop_pixmap(lctx, got);
+				got = NULL;
+			}
+			/* Fonts can't be shared with an unrelated context, so
+			 * ctx gets a list of its own. */
+			fz_try(ctx)
+			{
+				plain = make_list(ctx, fz_rect_from_irect(bbox), 0);
+				got = render_list(ctx, plain, bbox, 4);
+				if (!same_pixmap(want, got))
+				{
+					fprintf(stderr, "drawing without locks differs: height %d\n", heights[i]);
+					mu_test_failures++;
+				}
+			}
+			fz_always(ctx)
+			{
+				fz_drop_pixmap(ctx, got);
+				got = NULL;
+				fz_drop_display_list(ctx, plain);
+				plain = NULL;
+			}
+			fz_catch(ctx)
+			{
+				fprintf(stderr, "drawing without locks: %s\n", fz_caught_message(ctx));
+				mu_test_failures++;
+			}
+			fz_drop_pixmap(lctx, want);
+			want = NULL;
+			fz_drop_display_list(lctx, list);
+			list = NULL;
+		}
+
+		bbox = fz_make_irect(0, 0, 200, 457);
+		list = make_list(lctx, fz_rect_from_irect(bbox), 1);
+		for (n = 1; n <= 7; n++)
+		{
+			threw = 0;
+			fz_try(lctx)
+				got = render_list(lctx, list, bbox, n);
+			fz_catch(lctx)
+			{
+				threw = 1;
+				if (!strstr(fz_caught_message(lctx), "items left on stack"))
+				{
+					fprintf(stderr, "banded drawing threw '%s' with %d threads\n", fz_caught_message(lctx), n);
+					mu_test_failures++;
+				}
+			}
+			fz_drop_pixmap(lctx, got);
+			got = NULL;
+			if (!threw)
+			{
+				fprintf(stderr, "banded drawing did not throw with %d threads\n", n);
+				mu_test_failures++;
+			}
+		}
+	}
+	fz_always(lctx)
+	{
+		fz_drop_pixmap(lctx, got);
+		fz_drop_pixmap(lctx, want);
+		fz_drop_display_list(lctx, list);
+	}
+	fz_catch(lctx)
+	{
+		fprintf(stderr, "parallel: %s\n", fz_caught_message(lctx));
+		mu_test_failures++;
+	}
+}
+
+typedef struct
+{
+	size_t size, hits, misses, evictions;
+} glyph_stats;
+
+/* Read the glyph cache's counts back from its statistics dump. */
+static glyph_stats
+get_glyph_stats(fz_context *ctx)
+{
+	glyph_stats st = { 0 };
+	fz_buffer *buf = fz_new_buffer(ctx, 256);
+	fz_output *out = NULL;
+	const char *s;
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_buffer(ctx, buf);
+		fz_dump_glyph_cache_stats(ctx, out);
+		fz_write_byte(ctx, out, 0);
+		fz_close_output(ctx, out);
+		s = (const char *)buf->data;
+		if ((s = strstr(s, "Glyph Cache Size: ")) == NULL || sscanf(s, "Glyph Cache Size: %zu", &st.size) != 1)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "no glyph cache size");
+		if ((s = strstr(s, "Glyph Cache Lookups: ")) == NULL || sscanf(s, "Glyph Cache Lookups: %*u (%zu hits, %zu misses)", &st.hits, &st.misses) != 2)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "no glyph cache lookups");
+		if ((s = strstr(s, "Glyph Cache Evictions: ")) == NULL || sscanf(s, "Glyph Cache Evictions: %zu", &st.evictions) != 1)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "no glyph cache evictions");
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return st;
+}
+
+/* Lines of the same string at a few sizes and subpixel offsets. */
+static fz_text *
+make_text(fz_context *ctx, fz_font *font, const char *str, const float *sizes, int nsizes, float *height)
+{
+	fz_text *text = fz_new_text(ctx);
+	float y = 0;
+	int i;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < nsizes; i++)
+		{
+			y += sizes[i] * 1.25f;
+			fz_show_string(ctx, text, font, fz_make_matrix(sizes[i], 0, 0, -sizes[i], 2 + i * 0.3f, y + i * 0.4f), str, 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	*height = y + 2;
+	return text;
+}
+
+static fz_pixmap *
+draw_text(fz_context *ctx, fz_text *text, fz_irect bbox)
+{
+	static const float black[1] = { 0 };
+	fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), bbox, NULL, 0);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_fill_text(ctx, dev, text, fz_identity, fz_device_gray(ctx), black, 1, fz_default_color_params);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+	return pix;
+}
+
+#define GLYPH_THREADS 4
+
+typedef struct
+{
+	fz_context *ctx;
+	fz_text *text;
+	fz_irect bbox;
+	int rounds;
+	fz_pixmap *pix[4];
+	int failed;
+} glyph_worker;
+
+/* Draw the text several times, as fast as we can, to keep the other
+ * threads busy in the same shards. */
+static void
+glyph_worker_fn(void *arg)
+{
+	glyph_worker *w = arg;
+	int i;
+
+	for (i = 0; i < w->rounds; i++)
+	{
+		fz_try(w->ctx)
+			w->pix[i] = draw_text(w->ctx, w->text, w->bbox);
+		fz_catch(w->ctx)
+			w->failed = 1;
+	}
+}
+
+/*
+	Draw the same text on several threads at once, with clones sharing
+	one glyph cache, starting from an empty cache so the threads race
+	to render and insert the same glyphs. Every thread must get the
+	same pixels as one thread drawing alone, every lookup must be
+	counted, every glyph must miss at least once and at most once per
+	thread, and the cache must end up the same size as after drawing
+	alone, with no glyph inserted twice.
+*/
+static void
+check_glyph_threads(fz_context *ctx, fz_font *font)
+{
+	static const float sizes[] = { 7, 9, 11.5f, 12, 17, 23, 40 };
+	glyph_worker worker[GLYPH_THREADS] = { { 0 } };
+	fz_thread *thread[GLYPH_THREADS] = { 0 };
+	fz_text *text = NULL;
+	fz_pixmap *want = NULL;
+	glyph_stats s0, s1, s2, s3;
+	size_t lookups, distinct;
+	float height;
+	fz_irect bbox;
+	int i, k;
+
+	fz_var(text);
+	fz_var(want);
+
+	fz_try(ctx)
+	{
+		text = make_text(ctx, font, "The quick brown fox jumps over the lazy dog. 0123456789", sizes, nelem(sizes), &height);
+		bbox = fz_make_irect(0, 0, 1200, (int)height);
+
+		fz_purge_glyph_cache(ctx);
+		s0 = get_glyph_stats(ctx);
+		want = draw_text(ctx, text, bbox);
+		s1 = get_glyph_stats(ctx);
+		lookups = (s1.hits + s1.misses) - (s0.hits + s0.misses);
+		distinct = s1.misses - s0.misses;
+		CHECK(distinct > 100);
+		CHECK(s1.evictions == s0.evictions);
+
+		fz_purge_glyph_cache(ctx);
+		s2 = get_glyph_stats(ctx);
+		CHECK(s2.size == 0);
+		for (i = 0; i < GLYPH_THREADS; i++)
+		{
+			worker[i].ctx = fz_clone_context(ctx);
+			if (!worker[i].ctx)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context");
+			worker[i].text = text;
+			worker[i].bbox = bbox;
+			worker[i].rounds = nelem(worker[i].pix);
+		}
+		for (i = 0; i < GLYPH_THREADS; i++)
+			if ((thread[i] = fz_new_thread(glyph_worker_fn, &worker[i])) == NULL)
+				glyph_worker_fn(&worker[i]);
+		for (i = 0; i < GLYPH_THREADS; i++)
+			fz_join_thread(thread[i]);
+		s3 = get_glyph_stats(ctx);
+
+		for (i = 0; i < GLYPH_THREADS; i++)
+		{
+			CHECK(!worker[i].failed);
+			for (k = 0; k < worker[i].rounds; k++)
+				if (!same_pixmap(want, worker[i].pix[k]))
+				{
+					fprintf(stderr, "glyph cache: thread %d round %d drew different text\n", i, k);
+					mu_test_failures++;
+				}
+		}
+		CHECK(s3.hits + s3.misses - (s2.hits + s2.misses) == GLYPH_THREADS * nelem(worker[0].pix) * lookups);
+		CHECK(s3.misses - s2.misses >= distinct);
+		CHECK(s3.misses - s2.misses <= GLYPH_THREADS * distinct);
+		CHECK(s3.evictions == s2.evictions);
+		CHECK(s3.size == s1.size);
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < GLYPH_THREADS; i++)
+		{
+			for (k = 0; k < (int)nelem(worker[i].pix); k++)
+				fz_drop_pixmap(ctx, worker[i].pix[k]);
+			fz_drop_context(worker[i].ctx);
+		}
+		fz_drop_pixmap(ctx, want);
+		fz_drop_text(ctx, text);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "glyph cache threads: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/*
+	Glyphs from one font that fill most of the cache's 1MB, but not all
+	of it, must all stay there: the size limit is for the whole cache,
+	not for each shard, so drawing them again is all hits. Going over
+	the limit then evicts enough to get back under it.
+*/
+static void
+check_glyph_budget(fz_context *ctx, fz_font *font)
+{
+	static const float sizes[] = { 100, 110, 120, 130, 140, 150, 160, 170, 180, 190, 200 };
+	static const float more[] = { 210, 220, 230, 240, 250 };
+	fz_text *text = NULL;
+	fz_pixmap *pix = NULL;
+	glyph_stats s0, s1, s2, s3;
+	float height;
+
+	fz_var(text);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		text = make_text(ctx, font, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz", sizes, nelem(sizes), &height);
+
+		fz_purge_glyph_cache(ctx);
+		s0 = get_glyph_stats(ctx);
+		pix = draw_text(ctx, text, fz_make_irect(0, 0, 5000, (int)height));
+		fz_drop_pixmap(ctx, pix);
+		pix = NULL;
+		s1 = get_glyph_stats(ctx);
+		CHECK(s1.evictions == s0.evictions);
+
+		pix = draw_text(ctx, text, fz_make_irect(0, 0, 5000, (int)height));
+		s2 = get_glyph_stats(ctx);
+		CHECK(s2.misses == s1.misses);
+		CHECK(s2.evictions == s1.evictions);
+		CHECK(s2.size == s1.size);
+		fz_drop_pixmap(ctx, pix);
+		pix = NULL;
+		fz_drop_text(ctx, text);
+		text = NULL;
+
+		text = make_text(ctx, font, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz", more, nelem(more), &height);
+		pix = draw_text(ctx, text, fz_make_irect(0, 0, 7000, (int)height));
+		s3 = get_glyph_stats(ctx);
+		CHECK(s3.evictions > s2.evictions);
+		CHECK(s3.size <= 1024 * 1024);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_text(ctx, text);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "glyph cache budget: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+static void
+check_glyph_cache(fz_context *ctx)
+{
+	fz_font *font = NULL;
+
+	fz_var(font);
+
+	fz_try(ctx)
+	{
+		font = fz_new_base14_font(ctx, "Times-Roman");
+		check_glyph_threads(ctx, font);
+		check_glyph_budget(ctx, font);
+	}
+	fz_always(ctx)
+		fz_drop_font(ctx, font);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "glyph cache: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_locks_context locks = { NULL, lock, unlock };
+	fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	fz_context *lctx;
+	int i;
+
+	CHECK(ctx != NULL);
+	if (!ctx)
+		return mu_test_result("draw-test");
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		if ((mutexes[i] = fz_new_mutex()) == NULL)
+			break;
+	lctx = fz_new_context(NULL, i == FZ_LOCK_MAX ? &locks : NULL, FZ_STORE_DEFAULT);
+	CHECK(lctx != NULL);
+
+	/* One display list is broken on purpose. */
+	fz_set_warning_callback(ctx, NULL, NULL);
+	if (lctx)
+	{
+		fz_set_error_callback(lctx, NULL, NULL);
+		fz_set_warning_callback(lctx, NULL, NULL);
+	}
+
+	check_spans(ctx);
+	check_images(ctx);
+	check_scale(ctx);
+	check_scale_threads(ctx);
+	if (lctx)
+	{
+		check_parallel(ctx, lctx);
+		check_glyph_cache(lctx);
+	}
+
+	fz_drop_context(lctx);
+	fz_drop_context(ctx);
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		fz_drop_mutex(mutexes[i]);
+	return mu_test_result("draw-test");
+}
@@ -0,0 +1,256 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * lex-test - Lex the same input from one whole buffer and through
+ * streams that hand it out 1, 7 and 40 bytes at a time, and check
+ * the tokens and their values all match. The lexer's fast paths only
+ * run on tokens that end inside the stream's window, so the small
+ * windows drive it through the byte at a time code instead, and put
+ * a window edge at every offset of every token.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+/*
+	A stream that copies at most 'chunk' bytes at a time into a window
+	of its own, followed by junk, so reading past wp gives the wrong
+	answer rather than the next bytes of the input.
+*/
+#define MAX_CHUNK 64
+
+typedef struct
+{
+	const unsigned char *data;
+	size_t len;
+	size_t chunk;
+	size_t pos;
+	unsigned char window[MAX_CHUNK + 16];
+} chunked;
+
+static int
+next_chunked(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	chunked *state = stm->state;
+	size_t n = fz_minz(state->chunk, state->len - state->pos);
+	if (n == 0)
+		return EOF;
+	memcpy(state->window, state->data + state->pos, n);
+	memset(state->window + n, '0', sizeof state->window - n);
+	stm->rp = state->window;
+	stm->wp = stm->rp + n;
+	state->pos += n;
+	stm->pos = (int64_t)state->pos;
+	return *stm->rp++;
+}
+
+static void
+drop_chunked(fz_context *ctx, void *state)
+{
+	fz_free(ctx, state);
+}
+
+static fz_stream *
+open_chunked(fz_context *ctx, const unsigned char *data, size_t len, size_t chunk)
+{
+	chunked *state = fz_malloc_struct(ctx, chunked);
+	state->data = data;
+	state->len = len;
+	state->chunk = chunk;
+	return fz_new_stream(ctx, state, next_chunked, drop_chunked);
+}
+
+/* Lex stm to the end, writing each token and its value to out. */
+static void
+lex_all(fz_context *ctx, fz_stream *stm, fz_buffer *out)
+{
+	pdf_lexbuf lb;
+	pdf_token tok;
+
+	pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+	fz_try(ctx)
+	{
+		do
+		{
+			tok = pdf_lex(ctx, stm, &lb);
+			fz_append_printf(ctx, out, "%d", (int)tok);
+			if (tok == PDF_TOK_INT)
+				fz_append_printf(ctx, out, ":%d", (int)lb.i);
+			else if (tok == PDF_TOK_REAL)
+				fz_append_data(ctx, out, &lb.f, sizeof lb.f);
+			else if (tok == PDF_TOK_NAME || tok == PDF_TOK_STRING || tok == PDF_TOK_KEYWORD)
+			{
+				fz_append_printf(ctx, out, ":%d:", (int)lb.len);
+				fz_append_data(ctx, out, lb.scratch, lb.len);
+			}
+			fz_append_byte(ctx, out, '\n');
+		}
+		while (tok != PDF_TOK_EOF && tok != PDF_TOK_ERROR);
+	}
+	fz_always(ctx)
+		pdf_lexbuf_fin(ctx, &lb);
+	fz_catch(ctx)
+		fz_append_printf(ctx, out, "error: %s\n", fz_caught_message(ctx));
+}
+
+static fz_buffer *
+lex_input(fz_context *ctx, const unsigned char *data, size_t len, size_t chunk)
+{
+	fz_buffer *out = fz_new_buffer(ctx, 256);
+	fz_stream *stm = NULL;
+
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		if (chunk)
+			stm = open_chunked(ctx, data, len, chunk);
+		else
+			stm = fz_open_memory(ctx, data, len);
+		lex_all(ctx, stm, out);
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, out);
+		fz_rethrow(ctx);
+	}
+	return out;
+}
+
+static int
+check_input(fz_context *ctx, const char *name, const unsigned char *data, size_t len)
+{
+	static const size_t chunks[] = { 1, 7, 40 };
+	fz_buffer *whole = NULL;
+	fz_buffer *part = NULL;
+	int i, ok = 1;
+
+	fz_var(whole);
+	fz_var(part);
+
+	fz_try(ctx)
+	{
+		whole = lex_input(ctx, data, len, 0);
+		for (i = 0; i < (int)nelem(chunks); i++)
+		{
+			part = lex_input(ctx, data, len, chunks[i]);
+			if (part->len != whole->len || memcmp(part->data, whole->data, whole->len))
+			{
+				fprintf(stderr, "%s: tokens differ with %d byte chunks\n", name, (int)chunks[i]);
+				mu_test_failures++;
+				ok = 0;
+			}
+			fz_drop_buffer(ctx, part);
+			part = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, part);
+		fz_drop_buffer(ctx, whole);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", name, fz_caught_message(ctx));
+		mu_test_failures++;
+		ok = 0;
+	}
+	return ok;
+}
+
+/* Tokens that take each fast path, and each of the rules that send
+ * the lexer back to the byte at a time code, at lengths either side
+ * of the 16 byte vector width. */
+static const char *samples[] =
+{
+	"1 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] >>\nendobj\n",
+	"% a comment that runs past sixteen bytes\r% another\n%\n%%EOF",
+	"/A /AB /ABCDEFGHIJKLMNO /ABCDEFGHIJKLMNOP /ABCDEFGHIJKLMNOPQ /A#20B /#41#42 /a#2 /x#zz/y",
+	"/ThisNameIsLongerThanAHundredAndTwentySevenBytesxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx /Next",
+	"/N\001ame /N\177ame /\200\201\202\203\204\205\206\207\210\211\212\213\214\215\216\217\220 /Tail",
+	"0 1 -1 +1 12345678901 -2147483648 2147483647 3.5 -.5 .5 5. 1.2.3 --4 +-5 -+6 1e5 0000000000000000001 12345678901234567890.5",
+	"1.000000000001 -0.000000000001 123456789.123456789 4(x)5[6]7<8>9{10}11/12%13\n14",
+	"<> <0> <01> <0123456789abcdef> <0123456789ABCDEF0> <0123456789abcdefABCDEF0123456789abcdef> <01 23\n45\t67> <0g1> <fffffffffffffffffffffffffffffffff>",
+	"<4142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f60616263646566676869>",
+	"(plain) (nested (parens) here) (escapes \\n\\r\\t\\b\\f\\(\\)\\\\ \\101\\12\\1x) (line\\\ncontinued) (cr\r\nlf)",
+	"true false null R obj endobj stream endstream xref trailer startxref newobj keyword Tf Tj TJ ' \"",
+	"[ 1 2 [ 3 ] ] << /K << /L 1 >> >> { 1 2 add } ) > }",
+	"BT /F1 12 Tf 72 712 Td (Hello) Tj ET q 1 0 0 1 0 0 cm 0.5 0.25 0.125 rg 10 10 100 100 re f Q",
+};
+
+/* Whitespace, NUL included, running past the vector width. */
+static const char white[] = "   \t\r\n\f\000   \t\r\n\f   \t\r\n\f   \t\r\n\f   42";
+
+/* A fixed pseudo-random mix of the characters the lexer treats
+ * specially, so tokens straddle window edges in every way. */
+static void
+check_fuzz(fz_context *ctx)
+{
+	static const char alphabet[] = "0123456789.+-/#%()<>[]{}\\ \t\r\n\fabcdefABCDEFxyzRobjtrue";
+	unsigned char data[1024];
+	unsigned int seed = 12345;
+	char name[32];
+	int i, k, n;
+
+	for (k = 0; k < 200; k++)
+	{
+		n = 1 + k * 5;
+		for (i = 0; i < n; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			data[i] = alphabet[(seed >> 16) % (sizeof alphabet - 1)];
+		}
+		fz_snprintf(name, sizeof name, "fuzz %d", k);
+		if (!check_input(ctx, name, data, n))
+			break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	char name[32];
+	int i;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+		return 1;
+
+	/* Some of the input is broken on purpose. */
+	fz_set_warning_callback(ctx, NULL, NULL);
+	fz_set_error_callback(ctx, NULL, NULL);
+
+	for (i = 0; i < (int)nelem(samples); i++)
+	{
+		fz_snprintf(name, sizeof name, "sample %d", i);
+		check_input(ctx, name, (const unsigned char *)samples[i], strlen(samples[i]));
+	}
+	check_input(ctx, "white", (const unsigned char *)white, sizeof white - 1);
+	check_fuzz(ctx);
+
+	fz_drop_context(ctx);
+	return mu_test_result("lex-test");
+}
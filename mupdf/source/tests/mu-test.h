@@ -0,0 +1,84 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#ifndef MUPDF_TESTS_MU_TEST_H
+#define MUPDF_TESTS_MU_TEST_H
+
+/*
+	Shared scaffolding for the regression tests in this directory.
+
+	Each test is a small program run by 'make check'. It is passed the
+	directory holding the test data as its only argument, and exits
+	with a non-zero status if any check failed.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+static int mu_test_failures = 0;
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			mu_test_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_INT(a, b) \
+	do { \
+		long long a_ = (long long)(a), b_ = (long long)(b); \
+		if (a_ != b_) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+			mu_test_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_STR(a, b) \
+	do { \
+		const char *a_ = (a), *b_ = (b); \
+		if (!a_ || !b_ || strcmp(a_, b_)) { \
+			fprintf(stderr, "%s:%d: check failed: %s == \"%s\" (got \"%s\")\n", __FILE__, __LINE__, #a, b_ ? b_ : "(null)", a_ ? a_ : "(null)"); \
+			mu_test_failures++; \
+		} \
+	} while (0)
+
+/* Path of a file in the test data directory. */
+static inline const char *
+mu_test_file(const char *dir, const char *name)
+{
+	static char path[1024];
+	snprintf(path, sizeof path, "%s/%s", dir ? dir : "source/tests/data", name);
+	return path;
+}
+
+static inline int
+mu_test_result(const char *name)
+{
+	if (mu_test_failures)
+		fprintf(stderr, "%s: %d check(s) failed\n", name, mu_test_failures);
+	else
+		printf("%s: ok\n", name);
+	return mu_test_failures != 0;
+}
+
+#endif
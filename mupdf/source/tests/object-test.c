@@ -0,0 +1,711 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * object-test - Check the compact object representations: integers
+ * held in the pointer itself, and names interned per document; the
+ * accounting of the xref object cache, and what it drops when given a
+ * budget; and that store keys from an object arena stay with the
+ * document that owns it.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+#include <limits.h>
+
+static pdf_obj *
+parse(fz_context *ctx, pdf_document *doc, const char *str)
+{
+	fz_stream *stm = fz_open_memory(ctx, (const unsigned char *)str, strlen(str));
+	pdf_lexbuf lexbuf;
+	pdf_obj *obj = NULL;
+
+	pdf_lexbuf_init(ctx, &lexbuf, PDF_LEXBUF_SMALL);
+	fz_try(ctx)
+		obj = pdf_parse_stm_obj(ctx, doc, stm, &lexbuf);
+	fz_always(ctx)
+	{
+		pdf_lexbuf_fin(ctx, &lexbuf);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return obj;
+}
+
+static const int64_t int_values[] =
+{
+	0, 1, -1, 42, -42,
+	INT_MAX, INT_MIN, (int64_t)INT_MAX + 1, (int64_t)INT_MIN - 1,
+	(int64_t)1 << 40, -((int64_t)1 << 40),
+	INT64_MAX, INT64_MIN + 1,
+};
+
+/* Small integers are immediates, large ones boxed, and both must
+ * behave exactly like the allocated integers they replace. */
+static void
+check_ints(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj *a = NULL;
+	pdf_obj *b = NULL;
+	pdf_obj *arr = NULL;
+	char buf[64], text[64];
+	size_t len;
+	int i;
+
+	fz_var(a);
+	fz_var(b);
+	fz_var(arr);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < (int)nelem(int_values); i++)
+		{
+			int64_t v = int_values[i];
+
+			a = pdf_new_int(ctx, v);
+			b = pdf_new_boxed_int(ctx, v);
+
+			CHECK(pdf_is_int(ctx, a) && pdf_is_number(ctx, a));
+			CHECK(!pdf_is_real(ctx, a) && !pdf_is_name(ctx, a) && !pdf_is_indirect(ctx, a));
+			CHECK_INT(pdf_to_int64(ctx, a), v);
+			CHECK_INT(pdf_to_int64(ctx, b), v);
+			CHECK(pdf_to_real(ctx, a) == (float)v);
+			if (v >= INT_MIN && v <= INT_MAX)
+				CHECK_INT(pdf_to_int(ctx, a), v);
+
+			/* Immediate or not, equal values compare and hash alike. */
+			CHECK(pdf_objcmp(ctx, a, b) == 0);
+			CHECK(pdf_objhash(ctx, a) == pdf_objhash(ctx, b));
+
+			/* Keeping and dropping must balance either way. */
+			CHECK(pdf_keep_obj(ctx, a) == a);
+			pdf_drop_obj(ctx, a);
+
+			/* The printer, like the lexer, only deals in ints. */
+			if (v >= INT_MIN && v <= INT_MAX)
+			{
+				snprintf(text, sizeof text, "%d", (int)v);
+				CHECK_STR(pdf_sprint_obj(ctx, buf, sizeof buf, &len, a, 1, 0), text);
+			}
+
+			/* Only the boxed integer can be changed in place. */
+			pdf_set_int(ctx, b, v + 1);
+			CHECK_INT(pdf_to_int64(ctx, b), v + 1);
+			CHECK_INT(pdf_to_int64(ctx, a), v);
+			CHECK(pdf_objcmp(ctx, a, b) != 0);
+
+			pdf_drop_obj(ctx, a);
+			a = NULL;
+			pdf_drop_obj(ctx, b);
+			b = NULL;
+		}
+
+		/* Through the parser, and in and out of containers. */
+		arr = parse(ctx, doc, "[0 -7 2147483647 -2147483648 3.5 /W]");
+		CHECK_INT(pdf_array_len(ctx, arr), 6);
+		CHECK_INT(pdf_array_get_int(ctx, arr, 0), 0);
+		CHECK_INT(pdf_array_get_int(ctx, arr, 1), -7);
+		CHECK_INT(pdf_array_get_int(ctx, arr, 2), INT_MAX);
+		CHECK_INT(pdf_array_get_int(ctx, arr, 3), INT_MIN);
+		CHECK(pdf_is_real(ctx, pdf_array_get(ctx, arr, 4)));
+		CHECK(pdf_array_get(ctx, arr, 5) == PDF_NAME(W));
+		CHECK_STR(pdf_sprint_obj(ctx, buf, sizeof buf, &len, arr, 1, 0), "[0 -7 2147483647 -2147483648 3.5/W]");
+
+		pdf_array_put_drop(ctx, arr, 0, pdf_new_int(ctx, 12345));
+		CHECK_INT(pdf_array_get_int(ctx, arr, 0), 12345);
+		pdf_array_push_int(ctx, arr, (int64_t)1 << 40);
+		CHECK_INT(pdf_to_int64(ctx, pdf_array_get(ctx, arr, 6)), (int64_t)1 << 40);
+		pdf_array_push_int(ctx, arr, INT64_MAX);
+		CHECK_INT(pdf_to_int64(ctx, pdf_array_get(ctx, arr, 7)), INT64_MAX);
+		CHECK(pdf_array_contains(ctx, arr, pdf_array_get(ctx, arr, 1)));
+		CHECK(pdf_array_contains(ctx, arr, pdf_array_get(ctx, arr, 7)));
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, a);
+		pdf_drop_obj(ctx, b);
+		pdf_drop_obj(ctx, arr);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Names outside the standard table are shared within a document, and
+ * still match names made anywhere else by value. */
+static void
+check_names(fz_context *ctx, pdf_document *doc)
+{
+	pdf_document *other = NULL;
+	pdf_obj *a = NULL;
+	pdf_obj *b = NULL;
+	pdf_obj *c = NULL;
+	pdf_obj *dict = NULL;
+	pdf_obj *dict2 = NULL;
+	pdf_obj *arr = NULL;
+	int i;
+
+	fz_var(other);
+	fz_var(a);
+	fz_var(b);
+	fz_var(c);
+	fz_var(dict);
+	fz_var(dict2);
+	fz_var(arr);
+
+	fz_try(ctx)
+	{
+		other = pdf_create_document(ctx);
+
+		/* Standard names stay constants. */
+		a = pdf_new_parsed_name(ctx, doc, "Type");
+		CHECK(a == PDF_NAME(Type));
+		pdf_drop_obj(ctx, a);
+
+		a = pdf_new_parsed_name(ctx, doc, "F1");
+		b = pdf_new_parsed_name(ctx, doc, "F1");
+		c = pdf_new_name(ctx, "F1");
+		CHECK(a == b);
+		CHECK(a != c);
+		CHECK(pdf_name_eq(ctx, a, c));
+		CHECK(pdf_objcmp(ctx, a, c) == 0);
+		CHECK(pdf_objhash(ctx, a) == pdf_objhash(ctx, c));
+		CHECK_STR(pdf_to_name(ctx, a), "F1");
+		pdf_drop_obj(ctx, b);
+		b = pdf_new_parsed_name(ctx, other, "F1");
+		CHECK(b != a && pdf_name_eq(ctx, a, b));
+		pdf_drop_obj(ctx, b);
+		b = NULL;
+
+		/* The table keeps the name after its last user is gone. */
+		pdf_drop_obj(ctx, a);
+		a = pdf_new_parsed_name(ctx, doc, "F1");
+		b = pdf_new_parsed_name(ctx, doc, "F1");
+		CHECK(a == b);
+		pdf_drop_obj(ctx, b);
+		b = NULL;
+
+		/* Keys parsed from the file match by pointer, any others by value. */
+		dict = parse(ctx, doc, "<</R12 1/F1 2/Font<</F1 3/F2 4>>>>");
+		dict2 = pdf_dict_get(ctx, dict, PDF_NAME(Font));
+		CHECK(pdf_dict_get_key(ctx, dict, 1) == a);
+		CHECK(pdf_dict_get_key(ctx, dict2, 0) == a);
+		CHECK_INT(pdf_dict_get_int(ctx, dict, a), 2);
+		CHECK_INT(pdf_dict_get_int(ctx, dict, c), 2);
+		CHECK_INT(pdf_to_int(ctx, pdf_dict_gets(ctx, dict, "R12")), 1);
+		CHECK_INT(pdf_to_int(ctx, pdf_dict_gets(ctx, dict2, "F2")), 4);
+		b = pdf_new_parsed_name(ctx, other, "F2");
+		CHECK_INT(pdf_dict_get_int(ctx, dict2, b), 4);
+		pdf_drop_obj(ctx, b);
+		b = NULL;
+
+		/* Replacing and adding with names from elsewhere. */
+		pdf_dict_put_int(ctx, dict, c, 5);
+		CHECK_INT(pdf_dict_len(ctx, dict), 3);
+		CHECK_INT(pdf_dict_get_int(ctx, dict, a), 5);
+		pdf_dict_puts_drop(ctx, dict, "F3", pdf_new_int(ctx, 6));
+		b = pdf_new_parsed_name(ctx, doc, "F3");
+		CHECK_INT(pdf_dict_get_int(ctx, dict, b), 6);
+		pdf_drop_obj(ctx, b);
+		b = NULL;
+
+		/* Enough uses of one name to run past the point where it is
+		 * shared, so that later ones get copies of their own. */
+		arr = pdf_new_array(ctx, doc, 40000);
+		for (i = 0; i < 40000; i++)
+			pdf_array_push_drop(ctx, arr, pdf_new_parsed_name(ctx, doc, "Many"));
+		CHECK(pdf_array_get(ctx, arr, 0) == pdf_array_get(ctx, arr, 100));
+		CHECK(pdf_array_get(ctx, arr, 0) != pdf_array_get(ctx, arr, 39999));
+		for (i = 0; i < 40000; i++)
+			if (strcmp(pdf_array_get_name(ctx, arr, i), "Many"))
+				break;
+		CHECK_INT(i, 40000);
+		pdf_drop_obj(ctx, arr);
+		arr = NULL;
+
+		/* Once they are gone, the name is shared again. */
+		b = pdf_new_parsed_name(ctx, doc, "Many");
+		pdf_drop_obj(ctx, c);
+		c = pdf_new_parsed_name(ctx, doc, "Many");
+		CHECK(b == c);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, arr);
+		pdf_drop_obj(ctx, dict);
+		pdf_drop_obj(ctx, a);
+		pdf_drop_obj(ctx, b);
+		pdf_drop_obj(ctx, c);
+		pdf_drop_document(ctx, other);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Every array and dict parsed into the xref counts once towards the
+ * object cache budget, whether it came from an object stream or not,
+ * and nothing else counts. */
+static void
+check_object_cache(fz_context *ctx)
+{
+	pdf_document *doc = NULL;
+	pdf_obj *obj = NULL;
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	fz_stream *stm = NULL;
+	pdf_write_options opts;
+	char *preloaded = NULL;
+	int i, k, n, containers;
+
+	fz_var(doc);
+	fz_var(obj);
+	fz_var(preloaded);
+	fz_var(buf);
+	fz_var(out);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		for (i = 0; i < 30; i++)
+		{
+			if (i % 3 == 0)
+				obj = pdf_add_object_drop(ctx, doc, pdf_new_int(ctx, i));
+			else if (i % 3 == 1)
+				obj = pdf_add_new_dict(ctx, doc, 1);
+			else
+				obj = pdf_add_new_array(ctx, doc, 1);
+			pdf_drop_obj(ctx, obj);
+			obj = NULL;
+		}
+		buf = fz_new_buffer(ctx, 1024);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_parse_write_options(ctx, &opts, "objstms");
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+
+		stm = fz_open_buffer(ctx, buf);
+		doc = pdf_open_document_with_stream(ctx, stm);
+
+		/* Eviction is opt in. */
+		CHECK_INT(doc->obj_cache_max, 0);
+
+		/* Anything already in place (the xref stream) isn't counted. */
+		n = pdf_xref_len(ctx, doc);
+		preloaded = fz_calloc(ctx, n, 1);
+		for (i = 1; i < n; i++)
+			preloaded[i] = (pdf_get_xref_entry_no_null(ctx, doc, i)->obj != NULL);
+
+		for (k = 0; k < 2; k++)
+			for (i = 1; i < n; i++)
+				pdf_drop_obj(ctx, pdf_load_object(ctx, doc, i));
+
+		containers = 0;
+		for (i = 1; i < n; i++)
+		{
+			obj = pdf_get_xref_entry_no_null(ctx, doc, i)->obj;
+			if (!preloaded[i] && (pdf_is_dict(ctx, obj) || pdf_is_array(ctx, obj)))
+				containers++;
+		}
+		obj = NULL;
+		CHECK(containers >= 20);
+		CHECK_INT(doc->obj_cache_count, containers);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, preloaded);
+		pdf_drop_obj(ctx, obj);
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+#define CACHE_PAGES 60
+#define CACHE_BUDGET 16
+/* Page, resources, font dict, font and contents. */
+#define CACHE_PER_PAGE 5
+
+/* A document whose pages each have objects of their own. */
+static fz_buffer *
+make_paged_file(fz_context *ctx, const char *options)
+{
+	pdf_document *doc = NULL;
+	pdf_obj *res = NULL, *font = NULL, *page = NULL;
+	fz_buffer *contents = NULL;
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	pdf_write_options opts;
+	int i;
+
+	fz_var(doc);
+	fz_var(res);
+	fz_var(font);
+	fz_var(page);
+	fz_var(contents);
+	fz_var(buf);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		for (i = 0; i < CACHE_PAGES; i++)
+		{
+			font = pdf_add_new_dict(ctx, doc, 3);
+			pdf_dict_put(ctx, font, PDF_NAME(Type), PDF_NAME(Font));
+			pdf_dict_put_name(ctx, font, PDF_NAME(Subtype), "Type1");
+			pdf_dict_put_name(ctx, font, PDF_NAME(BaseFont), "Helvetica");
+			res = pdf_add_new_dict(ctx, doc, 1);
+			pdf_dict_puts_drop(ctx, pdf_dict_put_dict(ctx, res, PDF_NAME(Font), 1), "F1", font);
+			font = NULL;
+			contents = fz_new_buffer(ctx, 64);
+			fz_append_printf(ctx, contents, "BT /F1 12 Tf 72 720 Td (Page %d) Tj ET", i + 1);
+			page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 612, 792), 0, res, contents);
+			pdf_insert_page(ctx, doc, -1, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+			pdf_drop_obj(ctx, res);
+			res = NULL;
+			fz_drop_buffer(ctx, contents);
+			contents = NULL;
+		}
+		buf = fz_new_buffer(ctx, 1024);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_parse_write_options(ctx, &opts, options);
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, contents);
+		pdf_drop_obj(ctx, page);
+		pdf_drop_obj(ctx, font);
+		pdf_drop_obj(ctx, res);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* How many parsed arrays and dicts the xref holds. */
+static int
+count_cached(fz_context *ctx, pdf_document *doc)
+{
+	int i, n = pdf_xref_len(ctx, doc), cached = 0;
+	for (i = 1; i < n; i++)
+		if (pdf_obj_last_used(ctx, pdf_get_xref_entry_no_null(ctx, doc, i)->obj) >= 0)
+			cached++;
+	return cached;
+}
+
+static fz_buffer *
+print_object(fz_context *ctx, pdf_document *doc, int num)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 256);
+	fz_output *out = NULL;
+	pdf_obj *obj = NULL;
+
+	fz_var(out);
+	fz_var(obj);
+
+	fz_try(ctx)
+	{
+		obj = pdf_load_object(ctx, doc, num);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_print_obj(ctx, out, obj, 1, 0);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* Load page i and look up the objects it uses. */
+static void
+walk_page(fz_context *ctx, pdf_document *doc, int i)
+{
+	pdf_page *page = pdf_load_page(ctx, doc, i);
+	pdf_obj *font;
+
+	font = pdf_dict_getp(ctx, page->obj, "Resources/Font/F1");
+	CHECK_STR(pdf_dict_get_name(ctx, font, PDF_NAME(BaseFont)), "Helvetica");
+	CHECK(pdf_is_stream(ctx, pdf_dict_get(ctx, page->obj, PDF_NAME(Contents))));
+	CHECK(pdf_dict_get_int(ctx, pdf_dict_get(ctx, page->obj, PDF_NAME(Contents)), PDF_NAME(Length)) > 0);
+	fz_drop_page(ctx, &page->super);
+}
+
+/*
+	With a small budget, walking every page keeps the cache bounded,
+	objects that were dropped load again the same as in a document
+	that keeps everything, and objects held elsewhere or edited are
+	never dropped.
+*/
+static void
+check_eviction(fz_context *ctx, const char *options)
+{
+	fz_buffer *file = NULL;
+	fz_stream *stm = NULL;
+	pdf_document *doc = NULL;
+	pdf_document *ref = NULL;
+	fz_buffer *a = NULL, *b = NULL;
+	pdf_obj *kept = NULL;
+	pdf_obj *obj;
+	int i, n, k, kept_num, dirty_num, cached, evicted, max_cached = 0;
+
+	fz_var(file);
+	fz_var(stm);
+	fz_var(doc);
+	fz_var(ref);
+	fz_var(a);
+	fz_var(b);
+	fz_var(kept);
+
+	fz_try(ctx)
+	{
+		file = make_paged_file(ctx, options);
+		stm = fz_open_buffer(ctx, file);
+		doc = pdf_open_document_with_stream(ctx, stm);
+		fz_drop_stream(ctx, stm);
+		stm = fz_open_buffer(ctx, file);
+		ref = pdf_open_document_with_stream(ctx, stm);
+		fz_drop_stream(ctx, stm);
+		stm = NULL;
+
+		pdf_set_object_cache_size(ctx, doc, CACHE_BUDGET);
+		CHECK_INT(pdf_count_pages(ctx, doc), CACHE_PAGES);
+
+		/* Hold a reference to the first page's font, and edit the
+		 * second page's resources. */
+		obj = pdf_dict_getp(ctx, pdf_lookup_page_obj(ctx, doc, 0), "Resources/Font/F1");
+		kept_num = pdf_to_num(ctx, obj);
+		kept = pdf_keep_obj(ctx, pdf_resolve_indirect(ctx, obj));
+		obj = pdf_dict_get(ctx, pdf_lookup_page_obj(ctx, doc, 1), PDF_NAME(Resources));
+		dirty_num = pdf_to_num(ctx, obj);
+		pdf_dict_puts_drop(ctx, obj, "Marked", PDF_TRUE);
+		CHECK(kept_num > 0 && dirty_num > 0 && kept_num != dirty_num);
+
+		for (k = 0; k < 2; k++)
+		{
+			for (i = 0; i < CACHE_PAGES; i++)
+			{
+				walk_page(ctx, doc, i);
+				cached = count_cached(ctx, doc);
+				max_cached = fz_maxi(max_cached, cached);
+			}
+		}
+		/* Trimming waits for a page load, and never drops what the
+		 * last two pages used. */
+		CHECK(max_cached <= CACHE_BUDGET + 2 * CACHE_PER_PAGE);
+
+		n = pdf_xref_len(ctx, doc);
+		CHECK_INT(n, pdf_xref_len(ctx, ref));
+		evicted = 0;
+		for (i = 1; i < n; i++)
+			if (pdf_get_xref_entry_no_null(ctx, doc, i)->obj == NULL)
+				evicted++;
+		CHECK(evicted >= CACHE_PAGES * CACHE_PER_PAGE / 2);
+
+		CHECK(pdf_get_xref_entry_no_null(ctx, doc, kept_num)->obj == kept);
+		obj = pdf_load_object(ctx, doc, dirty_num);
+		CHECK(pdf_dict_gets(ctx, obj, "Marked") == PDF_TRUE);
+		pdf_drop_obj(ctx, obj);
+
+		for (i = 1; i < n; i++)
+		{
+			if (i == dirty_num)
+				continue;
+			a = print_object(ctx, doc, i);
+			b = print_object(ctx, ref, i);
+			if (a->len != b->len || memcmp(a->data, b->data, a->len))
+			{
+				fprintf(stderr, "%s: object %d differs after eviction\n", options, i);
+				mu_test_failures++;
+			}
+			fz_drop_buffer(ctx, a);
+			a = NULL;
+			fz_drop_buffer(ctx, b);
+			b = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, a);
+		fz_drop_buffer(ctx, b);
+		pdf_drop_obj(ctx, kept);
+		pdf_drop_document(ctx, ref);
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, file);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Open buf with an object arena, and load obj num from it. */
+static pdf_document *
+open_with_arena(fz_context *ctx, fz_buffer *buf, int num, pdf_obj **obj)
+{
+	fz_stream *stm = fz_open_buffer(ctx, buf);
+	pdf_document *doc = NULL;
+
+	fz_try(ctx)
+	{
+		doc = pdf_open_document_with_stream(ctx, stm);
+		pdf_enable_object_arena(ctx, doc);
+		*obj = pdf_load_object(ctx, doc, num);
+	}
+	fz_always(ctx)
+		fz_drop_stream(ctx, stm);
+	fz_catch(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+/* Two documents with object arenas share one store. Emptying the
+ * store for one must leave the keys of the other alone. */
+static void
+check_arena_store(fz_context *ctx)
+{
+	pdf_document *doc = NULL, *a = NULL, *b = NULL;
+	pdf_obj *obj = NULL, *key_a = NULL, *key_b = NULL;
+	fz_colorspace *cs = NULL, *found = NULL;
+	fz_buffer *buf = NULL;
+	fz_output *out = NULL;
+	int num_a, num_b;
+
+	fz_var(doc);
+	fz_var(a);
+	fz_var(b);
+	fz_var(obj);
+	fz_var(key_a);
+	fz_var(key_b);
+	fz_var(cs);
+	fz_var(found);
+	fz_var(buf);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		obj = pdf_add_new_dict(ctx, doc, 1);
+		pdf_dict_put_int(ctx, obj, PDF_NAME(N), 1);
+		num_a = pdf_to_num(ctx, obj);
+		pdf_drop_obj(ctx, obj);
+		obj = pdf_add_new_dict(ctx, doc, 1);
+		pdf_dict_put_int(ctx, obj, PDF_NAME(N), 2);
+		num_b = pdf_to_num(ctx, obj);
+		pdf_drop_obj(ctx, obj);
+		obj = NULL;
+		buf = fz_new_buffer(ctx, 1024);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_write_document(ctx, doc, out, NULL);
+		fz_close_output(ctx, out);
+
+		a = open_with_arena(ctx, buf, num_a, &key_a);
+		b = open_with_arena(ctx, buf, num_b, &key_b);
+		CHECK(pdf_obj_in_arena(ctx, key_a));
+		CHECK(pdf_obj_in_arena(ctx, key_b));
+		CHECK(pdf_get_bound_document(ctx, key_a) == a);
+
+		cs = fz_new_colorspace(ctx, FZ_COLORSPACE_GRAY, 0, 1, "test");
+		pdf_store_item(ctx, key_a, cs, 1);
+		pdf_store_item(ctx, key_b, cs, 1);
+
+		pdf_empty_store(ctx, a);
+		found = pdf_find_item(ctx, fz_drop_colorspace_imp, key_a);
+		CHECK(found == NULL);
+		fz_drop_colorspace(ctx, found);
+		found = pdf_find_item(ctx, fz_drop_colorspace_imp, key_b);
+		CHECK(found == cs);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_colorspace(ctx, found);
+		fz_drop_colorspace(ctx, cs);
+		pdf_drop_obj(ctx, key_a);
+		pdf_drop_obj(ctx, key_b);
+		pdf_drop_obj(ctx, obj);
+		pdf_drop_document(ctx, a);
+		pdf_drop_document(ctx, b);
+		pdf_drop_document(ctx, doc);
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	pdf_document *doc = NULL;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return 1;
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		check_ints(ctx, doc);
+		check_names(ctx, doc);
+		check_object_cache(ctx);
+		check_eviction(ctx, "");
+		check_eviction(ctx, "objstms");
+		check_arena_store(ctx);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+	return mu_test_result("object-test");
+}
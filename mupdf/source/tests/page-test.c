@@ -0,0 +1,166 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * page-test - Look pages up in page trees whose /Count values lie,
+ * and check each lookup finds the page a full walk of the tree does.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+#define NKIDS 70
+
+static pdf_obj *
+add_page(fz_context *ctx, pdf_document *doc, pdf_obj *parent)
+{
+	pdf_obj *page = pdf_add_new_dict(ctx, doc, 3);
+	pdf_dict_put(ctx, page, PDF_NAME(Type), PDF_NAME(Page));
+	pdf_dict_put(ctx, page, PDF_NAME(Parent), parent);
+	pdf_dict_put_rect(ctx, page, PDF_NAME(MediaBox), fz_make_rect(0, 0, 100, 100));
+	return page;
+}
+
+/*
+	A root with more kids than can be checked one by one. The first
+	kid is a node holding two pages that claims to hold only one; the
+	others are pages. The root's own /Count is right.
+
+	want[] gets the object number of each page, in order.
+*/
+static void
+make_tree(fz_context *ctx, pdf_document *doc, int *want)
+{
+	pdf_obj *root = NULL;
+	pdf_obj *pages = NULL;
+	pdf_obj *kids = NULL;
+	pdf_obj *node = NULL;
+	pdf_obj *node_kids = NULL;
+	pdf_obj *page = NULL;
+	int i, n = 0;
+
+	fz_var(root);
+	fz_var(pages);
+	fz_var(node);
+	fz_var(page);
+
+	fz_try(ctx)
+	{
+		root = pdf_add_new_dict(ctx, doc, 2);
+		pdf_dict_put(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root), root);
+		pages = pdf_add_new_dict(ctx, doc, 3);
+		pdf_dict_put(ctx, root, PDF_NAME(Type), PDF_NAME(Catalog));
+		pdf_dict_put(ctx, root, PDF_NAME(Pages), pages);
+		pdf_dict_put(ctx, pages, PDF_NAME(Type), PDF_NAME(Pages));
+		pdf_dict_put_int(ctx, pages, PDF_NAME(Count), NKIDS + 1);
+		kids = pdf_dict_put_array(ctx, pages, PDF_NAME(Kids), NKIDS);
+
+		node = pdf_add_new_dict(ctx, doc, 4);
+		pdf_dict_put(ctx, node, PDF_NAME(Type), PDF_NAME(Pages));
+		pdf_dict_put(ctx, node, PDF_NAME(Parent), pages);
+		pdf_dict_put_int(ctx, node, PDF_NAME(Count), 1);
+		node_kids = pdf_dict_put_array(ctx, node, PDF_NAME(Kids), 2);
+		pdf_array_push(ctx, kids, node);
+		for (i = 0; i < 2; i++)
+		{
+			page = add_page(ctx, doc, node);
+			pdf_array_push(ctx, node_kids, page);
+			want[n++] = pdf_to_num(ctx, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+		}
+
+		for (i = 1; i < NKIDS; i++)
+		{
+			page = add_page(ctx, doc, pages);
+			pdf_array_push(ctx, kids, page);
+			want[n++] = pdf_to_num(ctx, page);
+			pdf_drop_obj(ctx, page);
+			page = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, page);
+		pdf_drop_obj(ctx, node);
+		pdf_drop_obj(ctx, pages);
+		pdf_drop_obj(ctx, root);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* In order, from the end backwards, and one at a time after a reload. */
+static void
+check_lookups(fz_context *ctx, pdf_document *doc, const int *want)
+{
+	int i, n = NKIDS + 1;
+
+	CHECK_INT(pdf_count_pages(ctx, doc), n);
+
+	for (i = 0; i < n; i++)
+		CHECK_INT(pdf_to_num(ctx, pdf_lookup_page_obj(ctx, doc, i)), want[i]);
+
+	pdf_drop_page_tree_internal(ctx, doc);
+	for (i = n - 1; i >= 0; i--)
+		CHECK_INT(pdf_to_num(ctx, pdf_lookup_page_obj(ctx, doc, i)), want[i]);
+
+	for (i = 0; i < n; i++)
+	{
+		pdf_drop_page_tree_internal(ctx, doc);
+		CHECK_INT(pdf_to_num(ctx, pdf_lookup_page_obj(ctx, doc, i)), want[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	pdf_document *doc = NULL;
+	int want[NKIDS + 1];
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return 1;
+
+	fz_var(doc);
+
+	/* The page tree is broken on purpose. */
+	fz_set_warning_callback(ctx, NULL, NULL);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		make_tree(ctx, doc, want);
+		check_lookups(ctx, doc, want);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+	return mu_test_result("page-test");
+}
@@ -0,0 +1,603 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * repair-test - Repair xref-less files whose stream lengths can't be
+ * trusted, so that the endstream scan has to find the end of each
+ * stream, and check the lengths it recovers. Saved repair data must
+ * not be used for any other version of the file.
+ *
+ * "repair-test bench [megabytes]" times repair against the saved data.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+#include <time.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+/* Stream data that ends in near misses of the keyword. */
+static const char *stream_data[] =
+{
+	"0 0 1 rg 10 10 100 100 re f",
+	"abc endstr",
+	"endstre",
+	"eendst",
+	"",
+};
+
+#define NSTREAMS (int)nelem(stream_data)
+
+/*
+	A memory stream that hands out at most 'chunk' bytes at a time, so
+	the keyword straddles buffer refills at every possible offset.
+*/
+typedef struct
+{
+	fz_buffer *buf;
+	size_t chunk;
+	size_t pos;
+} chunked;
+
+static int
+next_chunked(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	chunked *state = stm->state;
+	size_t n = fz_minz(state->chunk, state->buf->len - state->pos);
+	if (n == 0)
+		return EOF;
+	stm->rp = state->buf->data + state->pos;
+	stm->wp = stm->rp + n;
+	state->pos += n;
+	stm->pos = (int64_t)state->pos;
+	return *stm->rp++;
+}
+
+static void
+seek_chunked(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	chunked *state = stm->state;
+	if (whence == SEEK_CUR)
+		offset += stm->pos;
+	else if (whence == SEEK_END)
+		offset += (int64_t)state->buf->len;
+	if (offset < 0)
+		offset = 0;
+	if (offset > (int64_t)state->buf->len)
+		offset = (int64_t)state->buf->len;
+	state->pos = (size_t)offset;
+	stm->pos = offset;
+	stm->rp = stm->wp = state->buf->data;
+}
+
+static void
+drop_chunked(fz_context *ctx, void *state_)
+{
+	chunked *state = state_;
+	fz_drop_buffer(ctx, state->buf);
+	fz_free(ctx, state);
+}
+
+static fz_stream *
+open_chunked(fz_context *ctx, fz_buffer *buf, size_t chunk)
+{
+	chunked *state = fz_malloc_struct(ctx, chunked);
+	fz_stream *stm;
+	state->buf = fz_keep_buffer(ctx, buf);
+	state->chunk = chunk;
+	fz_try(ctx)
+		stm = fz_new_stream(ctx, state, next_chunked, drop_chunked);
+	fz_catch(ctx)
+	{
+		drop_chunked(ctx, state);
+		fz_rethrow(ctx);
+	}
+	stm->seek = seek_chunked;
+	return stm;
+}
+
+/*
+	A file with no xref table. The first stream has no /Length, the
+	others refer to a length object that does not exist, so every one
+	of them has to be scanned for.
+*/
+static fz_buffer *
+make_file(fz_context *ctx)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1024);
+	int i;
+
+	fz_try(ctx)
+	{
+		fz_append_string(ctx, buf, "%PDF-1.7\n");
+		fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Kids[3 0 R]/Count 1>>\nendobj\n");
+		fz_append_string(ctx, buf, "3 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 200 200]/Contents 10 0 R>>\nendobj\n");
+		for (i = 0; i < NSTREAMS; i++)
+		{
+			if (i == 0)
+				fz_append_printf(ctx, buf, "%d 0 obj\n<<>>stream\n", 10 + i);
+			else
+				fz_append_printf(ctx, buf, "%d 0 obj\n<</Length 99 0 R>>stream\n", 10 + i);
+			fz_append_string(ctx, buf, stream_data[i]);
+			fz_append_string(ctx, buf, "endstream\nendobj\n");
+		}
+		fz_append_string(ctx, buf, "trailer\n<</Root 1 0 R>>\n%%EOF\n");
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static void
+check_file(fz_context *ctx, fz_buffer *file, size_t chunk)
+{
+	pdf_document *doc = NULL;
+	fz_stream *stm = NULL;
+	fz_buffer *data = NULL;
+	int i;
+
+	fz_var(doc);
+	fz_var(stm);
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		stm = open_chunked(ctx, file, chunk);
+		doc = pdf_open_document_with_stream(ctx, stm);
+
+		CHECK(pdf_was_repaired(ctx, doc));
+		CHECK_INT(pdf_count_pages(ctx, doc), 1);
+
+		for (i = 0; i < NSTREAMS; i++)
+		{
+			pdf_obj *obj = pdf_load_object(ctx, doc, 10 + i);
+			size_t len = strlen(stream_data[i]);
+
+			CHECK(pdf_obj_num_is_stream(ctx, doc, 10 + i));
+			CHECK_INT(pdf_dict_get_int(ctx, obj, PDF_NAME(Length)), len);
+			pdf_drop_obj(ctx, obj);
+
+			data = pdf_load_raw_stream_number(ctx, doc, 10 + i);
+			CHECK_INT(data->len, len);
+			CHECK(data->len == len && !memcmp(data->data, stream_data[i], len));
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, data);
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "chunk %d: %s\n", (int)chunk, fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+#define LONG_LEN 20000
+#define EDIT_AT 10000
+
+enum { EDIT_NONE, EDIT_STREAM, EDIT_GAP };
+
+/* The same length, so that either can fill the gap between objects. */
+static const char gap_comment[] = "%                 \n";
+static const char gap_object[] = "20 0 obj 42 endobj\n";
+
+/*
+	A file with one long stream and no xref table, large enough that
+	the accelerator seeks over its data. EDIT_STREAM writes "endstream"
+	over the middle of the data, which cuts the stream short, and
+	EDIT_GAP adds an object between two others. Neither changes the
+	file length.
+*/
+static fz_buffer *
+make_long_file(fz_context *ctx, int edit)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, LONG_LEN + 1024);
+	int i;
+
+	fz_try(ctx)
+	{
+		fz_append_string(ctx, buf, "%PDF-1.7\n");
+		fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Kids[]/Count 0>>\nendobj\n");
+		fz_append_string(ctx, buf, edit == EDIT_GAP ? gap_object : gap_comment);
+		fz_append_string(ctx, buf, "10 0 obj\n<</Length 99 0 R>>stream\n");
+		for (i = 0; i < LONG_LEN; i++)
+		{
+			if (edit == EDIT_STREAM && i >= EDIT_AT && i < EDIT_AT + 9)
+				fz_append_byte(ctx, buf, "endstream"[i - EDIT_AT]);
+			else
+				fz_append_byte(ctx, buf, 'x');
+		}
+		fz_append_string(ctx, buf, "endstream\nendobj\n");
+		fz_append_string(ctx, buf, "trailer\n<</Root 1 0 R>>\n%%EOF\n");
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static fz_buffer *
+save_accelerator(fz_context *ctx, pdf_document *doc)
+{
+	fz_buffer *accel = fz_new_buffer(ctx, 1024);
+	fz_output *out = NULL;
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		out = fz_new_output_with_buffer(ctx, accel);
+		pdf_write_repair_accelerator(ctx, doc, out);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, accel);
+		fz_rethrow(ctx);
+	}
+	return accel;
+}
+
+/* Length of the data of object 10, and the value of object 20 or -1. */
+static void
+check_long_file(fz_context *ctx, pdf_document *doc, int64_t want_len, int want_gap)
+{
+	fz_buffer *data = pdf_load_raw_stream_number(ctx, doc, 10);
+	pdf_obj *obj = NULL;
+	int gap = -1;
+
+	CHECK_INT(data->len, want_len);
+	fz_drop_buffer(ctx, data);
+
+	if (pdf_xref_len(ctx, doc) > 20)
+	{
+		obj = pdf_load_object(ctx, doc, 20);
+		if (pdf_is_int(ctx, obj))
+			gap = pdf_to_int(ctx, obj);
+		pdf_drop_obj(ctx, obj);
+	}
+	CHECK_INT(gap, want_gap);
+}
+
+static void
+check_stream_open(fz_context *ctx, fz_buffer *file, fz_buffer *accel, int64_t want_len, int want_gap)
+{
+	fz_stream *stm = fz_open_buffer(ctx, file);
+	fz_stream *astm = NULL;
+	pdf_document *doc = NULL;
+
+	fz_var(astm);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		astm = fz_open_buffer(ctx, accel);
+		doc = pdf_open_accelerated_document_with_stream(ctx, stm, astm);
+		check_long_file(ctx, doc, want_len, want_gap);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, astm);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+check_file_open(fz_context *ctx, const char *path, const char *apath, int64_t want_len, int want_gap)
+{
+	pdf_document *doc = pdf_open_accelerated_document(ctx, path, apath);
+
+	fz_try(ctx)
+		check_long_file(ctx, doc, want_len, want_gap);
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/*
+	Saved repair data is only used for the very file it was made from.
+	Edits to the bytes the repair lexed are caught by the digest; edits
+	inside stream data only by the modification time of a file opened
+	by name.
+*/
+static void
+check_accelerator(fz_context *ctx, const char *path, const char *apath)
+{
+	fz_buffer *file = NULL;
+	fz_buffer *edited = NULL;
+	fz_buffer *accel = NULL;
+	fz_stream *stm = NULL;
+	pdf_document *doc = NULL;
+	struct utimbuf times;
+
+	fz_var(file);
+	fz_var(edited);
+	fz_var(accel);
+	fz_var(stm);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		CHECK_INT(strlen(gap_object), strlen(gap_comment));
+		file = make_long_file(ctx, EDIT_NONE);
+
+		stm = fz_open_buffer(ctx, file);
+		doc = pdf_open_document_with_stream(ctx, stm);
+		CHECK(pdf_was_repaired(ctx, doc));
+		accel = save_accelerator(ctx, doc);
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+
+		check_stream_open(ctx, file, accel, LONG_LEN, -1);
+
+		edited = make_long_file(ctx, EDIT_GAP);
+		CHECK_INT(edited->len, file->len);
+		check_stream_open(ctx, edited, accel, LONG_LEN, 42);
+		fz_drop_buffer(ctx, edited);
+		edited = NULL;
+
+		/* Stream data is not hashed, so without a stamp the stale
+		 * length is used. */
+		edited = make_long_file(ctx, EDIT_STREAM);
+		check_stream_open(ctx, edited, accel, LONG_LEN, -1);
+		fz_drop_buffer(ctx, accel);
+		accel = NULL;
+
+		/* With one, the same edit is caught. */
+		fz_save_buffer(ctx, file, path);
+		times.actime = times.modtime = fz_stat_mtime(path) - 10;
+		utime(path, &times);
+		doc = pdf_open_document(ctx, path);
+		accel = save_accelerator(ctx, doc);
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+		fz_save_buffer(ctx, accel, apath);
+
+		check_file_open(ctx, path, apath, LONG_LEN, -1);
+		fz_save_buffer(ctx, edited, path);
+		check_file_open(ctx, path, apath, EDIT_AT, -1);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, accel);
+		fz_drop_buffer(ctx, edited);
+		fz_drop_buffer(ctx, file);
+		remove(path);
+		remove(apath);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "accelerator: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+enum { BENCH_DIRECT, BENCH_INDIRECT, BENCH_OBJECTS };
+
+static const char *bench_name[] = { "direct /Length", "indirect /Length", "small objects" };
+
+/*
+	An xref-less file of about 'size' bytes: one megabyte streams whose
+	Length is right, or refers to an object that does not exist, or
+	small objects each followed by a short stream.
+*/
+static fz_buffer *
+make_bench_file(fz_context *ctx, int kind, size_t size)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, size + 1024);
+	unsigned char *data = NULL;
+	unsigned int seed = 1;
+	size_t i, len = kind == BENCH_OBJECTS ? 200 : 1 << 20;
+	int num = 10;
+
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		data = fz_malloc(ctx, len);
+		for (i = 0; i < len; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			data[i] = seed >> 16;
+		}
+		fz_append_string(ctx, buf, "%PDF-1.7\n");
+		fz_append_string(ctx, buf, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+		fz_append_string(ctx, buf, "2 0 obj\n<</Type/Pages/Kids[]/Count 0>>\nendobj\n");
+		while (buf->len < size)
+		{
+			if (kind == BENCH_OBJECTS)
+			{
+				fz_append_printf(ctx, buf, "%d 0 obj\n<</Type/Annot/Subtype/Square/Rect[0 0 100 100]/C[1 0 0]/Contents(note %d)>>\nendobj\n", num, num);
+				num++;
+			}
+			if (kind == BENCH_INDIRECT)
+				fz_append_printf(ctx, buf, "%d 0 obj\n<</Length 9 0 R>>stream\n", num++);
+			else
+				fz_append_printf(ctx, buf, "%d 0 obj\n<</Length %d>>stream\n", num++, (int)len);
+			fz_append_data(ctx, buf, data, len);
+			fz_append_string(ctx, buf, "\nendstream\nendobj\n");
+		}
+		fz_append_string(ctx, buf, "trailer\n<</Root 1 0 R>>\n%%EOF\n");
+	}
+	fz_always(ctx)
+		fz_free(ctx, data);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* Best of five opens, in seconds of processor time. */
+static double
+time_open(fz_context *ctx, const char *path, const char *apath)
+{
+	pdf_document *doc;
+	double t, best = 0;
+	clock_t start;
+	int i;
+
+	for (i = 0; i < 5; i++)
+	{
+		start = clock();
+		doc = pdf_open_accelerated_document(ctx, path, apath);
+		t = (double)(clock() - start) / CLOCKS_PER_SEC;
+		pdf_drop_document(ctx, doc);
+		if (i == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+/*
+	repair-test bench [megabytes]: time a plain open, which repairs,
+	against an accelerated one, for each kind of file. Not part of
+	make check; fails if the accelerator loses.
+*/
+static void
+bench(fz_context *ctx, size_t size, const char *path, const char *apath)
+{
+	fz_buffer *file = NULL;
+	fz_buffer *accel = NULL;
+	pdf_document *doc = NULL;
+	double repair, accelerated;
+	int kind;
+
+	fz_var(file);
+	fz_var(accel);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		for (kind = 0; kind < (int)nelem(bench_name); kind++)
+		{
+			file = make_bench_file(ctx, kind, size);
+			fz_save_buffer(ctx, file, path);
+			doc = pdf_open_document(ctx, path);
+			accel = save_accelerator(ctx, doc);
+			fz_save_buffer(ctx, accel, apath);
+			pdf_drop_document(ctx, doc);
+			doc = NULL;
+
+			repair = time_open(ctx, path, NULL);
+			accelerated = time_open(ctx, path, apath);
+			printf("%s, %d MB, %d KB of accelerator data: repair %.4fs, accelerated %.4fs\n",
+				bench_name[kind], (int)(file->len >> 20), (int)(accel->len >> 10), repair, accelerated);
+			if (accelerated >= repair)
+			{
+				fprintf(stderr, "%s: accelerated open is not faster\n", bench_name[kind]);
+				mu_test_failures++;
+			}
+
+			fz_drop_buffer(ctx, accel);
+			accel = NULL;
+			fz_drop_buffer(ctx, file);
+			file = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_buffer(ctx, accel);
+		fz_drop_buffer(ctx, file);
+		remove(path);
+		remove(apath);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "bench: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_buffer *file = NULL;
+	char path[1024], apath[1024];
+	size_t chunk;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return 1;
+
+	fz_var(file);
+
+	/* Every file is broken on purpose. */
+	fz_set_error_callback(ctx, NULL, NULL);
+	fz_set_warning_callback(ctx, NULL, NULL);
+
+	snprintf(path, sizeof path, "%s.pdf", argv[0]);
+	snprintf(apath, sizeof apath, "%s.accel", argv[0]);
+
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+	{
+		bench(ctx, (size_t)(argc > 2 ? atoi(argv[2]) : 150) << 20, path, apath);
+		fz_drop_context(ctx);
+		return mu_test_result("repair-test bench");
+	}
+
+	fz_try(ctx)
+	{
+		file = make_file(ctx);
+		for (chunk = 1; chunk <= 11; chunk++)
+			check_file(ctx, file, chunk);
+		check_file(ctx, file, file->len);
+		check_accelerator(ctx, path, apath);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, file);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+	return mu_test_result("repair-test");
+}
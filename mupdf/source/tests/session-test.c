@@ -0,0 +1,358 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * session-test - Clean the CAJ fixture through a clean session, with
+ * and without threads, and from base64 text, and check it matches a
+ * one-shot clean. Also check the base64 codec the web build relies on.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+#include "thread-imp.h"
+
+#include <stdlib.h>
+
+static char *
+read_file(const char *path, int *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *data = NULL;
+	long n;
+
+	*len = 0;
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0)
+	{
+		data = malloc(n);
+		if (data && fread(data, 1, n, f) == (size_t)n)
+			*len = (int)n;
+	}
+	fclose(f);
+	return data;
+}
+
+static int
+same_result(mupdf_clean_result *a, mupdf_clean_result *b)
+{
+	return a && b && a->data && b->data && a->length == b->length && !memcmp(a->data, b->data, a->length);
+}
+
+static int
+has_objstm(mupdf_clean_result *r)
+{
+	static const char tag[] = "/ObjStm";
+	int i;
+
+	for (i = 0; r && r->data && i + (int)sizeof tag - 1 <= r->length; i++)
+		if (!memcmp(r->data + i, tag, sizeof tag - 1))
+			return 1;
+	return 0;
+}
+
+static int
+count_pages(mupdf_clean_result *r)
+{
+	fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	fz_stream *stm = NULL;
+	pdf_document *doc = NULL;
+	int n = -1;
+
+	if (!ctx || !r || !r->data)
+	{
+		fz_drop_context(ctx);
+		return -1;
+	}
+
+	fz_var(stm);
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		stm = fz_open_memory(ctx, (unsigned char *)r->data, r->length);
+		doc = pdf_open_document_with_stream(ctx, stm);
+		n = pdf_count_pages(ctx, doc);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		n = -1;
+
+	fz_drop_context(ctx);
+	return n;
+}
+
+/* Chunks from the streaming entry points, gathered back into one. */
+static char *streamed = NULL;
+static int streamed_len = 0;
+
+static void
+gather(const char *data, int length)
+{
+	char *grown = realloc(streamed, streamed_len + length);
+	if (!grown)
+	{
+		mu_test_failures++;
+		return;
+	}
+	streamed = grown;
+	memcpy(streamed + streamed_len, data, length);
+	streamed_len += length;
+}
+
+/* Decode with both entry points, and check the result. */
+static void
+check_decode(fz_context *ctx, const char *text, size_t n, const unsigned char *want, size_t want_len)
+{
+	fz_buffer *buf = fz_new_buffer_from_base64(ctx, text, n);
+	char *copy = fz_malloc(ctx, n / 4 * 3 + 3 + n);
+	size_t len;
+
+	CHECK(buf->len == want_len && !memcmp(buf->data, want, want_len));
+	fz_drop_buffer(ctx, buf);
+
+	memcpy(copy, text, n);
+	len = fz_decode_base64(ctx, (unsigned char *)copy, copy, n);
+	CHECK(len == want_len && !memcmp(copy, want, want_len));
+	fz_free(ctx, copy);
+}
+
+/* Known answers, long enough runs to take the block paths, every
+ * alignment of the padding, and line breaks and bad characters. */
+static void
+check_base64(fz_context *ctx)
+{
+	static const char *vectors[][2] =
+	{
+		{ "", "" },
+		{ "f", "Zg==" },
+		{ "fo", "Zm8=" },
+		{ "foo", "Zm9v" },
+		{ "foob", "Zm9vYg==" },
+		{ "fooba", "Zm9vYmE=" },
+		{ "foobar", "Zm9vYmFy" },
+	};
+	unsigned char data[300];
+	char text[500];
+	fz_buffer *enc = NULL;
+	size_t i, k, n;
+
+	fz_var(enc);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < nelem(vectors); i++)
+		{
+			n = strlen(vectors[i][0]);
+			enc = fz_new_buffer(ctx, 16);
+			fz_append_base64(ctx, enc, (const unsigned char *)vectors[i][0], n, 0);
+			CHECK_STR(fz_string_from_buffer(ctx, enc), vectors[i][1]);
+			fz_drop_buffer(ctx, enc);
+			enc = NULL;
+			check_decode(ctx, vectors[i][1], strlen(vectors[i][1]), (const unsigned char *)vectors[i][0], n);
+		}
+
+		/* "foobar" is a whole number of groups, so repeats of it
+		 * encode to repeats of its encoding. */
+		for (k = 0; k < 50; k++)
+		{
+			memcpy(data + k * 6, "foobar", 6);
+			memcpy(text + k * 8, "Zm9vYmFy", 8);
+		}
+		enc = fz_new_buffer(ctx, 512);
+		fz_append_base64(ctx, enc, data, 300, 0);
+		CHECK(enc->len == 400 && !memcmp(enc->data, text, 400));
+		fz_drop_buffer(ctx, enc);
+		enc = NULL;
+		check_decode(ctx, text, 400, data, 300);
+
+		/* Decoding stops at the first bad character. */
+		text[100] = '!';
+		check_decode(ctx, text, 400, data, 75);
+
+		for (k = 0; k < sizeof data; k++)
+			data[k] = (unsigned char)(k * 7 + (k >> 3) * 13);
+		for (n = 0; n <= sizeof data; n++)
+		{
+			for (k = 0; k < 2; k++)
+			{
+				enc = fz_new_buffer(ctx, 512);
+				fz_append_base64(ctx, enc, data, n, (int)k);
+				/* An empty size means a terminated string. */
+				fz_terminate_buffer(ctx, enc);
+				check_decode(ctx, (const char *)enc->data, enc->len, data, n);
+				fz_drop_buffer(ctx, enc);
+				enc = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, enc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "base64: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/* The web build's path: base64 text written into memory from
+ * mupdf_clean_alloc, decoded in place and streamed out. */
+static void
+check_stream_base64(mupdf_clean_session *session, const char *input, int len, char *outline, mupdf_clean_result *once)
+{
+	fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	fz_buffer *enc = NULL;
+	char *text;
+	int k, n;
+
+	if (!ctx)
+	{
+		mu_test_failures++;
+		return;
+	}
+
+	fz_var(enc);
+
+	fz_try(ctx)
+	{
+		/* With line breaks and without. */
+		for (k = 0; k < 2; k++)
+		{
+			enc = fz_new_buffer(ctx, len / 3 * 4 + 4);
+			fz_append_base64(ctx, enc, (const unsigned char *)input, len, k);
+			text = mupdf_clean_alloc((int)enc->len);
+			CHECK(text != NULL);
+			if (text)
+			{
+				memcpy(text, enc->data, enc->len);
+				streamed_len = 0;
+				n = mupdf_clean_session_stream_base64(session, text, (int)enc->len, outline, 4096, gather);
+				CHECK_INT(n, once->length);
+				CHECK(streamed_len == once->length && !memcmp(streamed, once->data, once->length));
+				mupdf_clean_free(text);
+			}
+			fz_drop_buffer(ctx, enc);
+			enc = NULL;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, enc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "stream base64: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = mu_test_file(argc > 1 ? argv[1] : NULL, "sample.caj");
+	mupdf_clean_session *session = NULL;
+	mupdf_clean_session *clone = NULL;
+	mupdf_clean_result *once = NULL;
+	mupdf_clean_result *first = NULL;
+	mupdf_clean_result *again = NULL;
+	mupdf_clean_result *cloned = NULL;
+	mupdf_clean_result *compact = NULL;
+	char outline[] = "1 1 One\n2 2 One.One\n";
+	fz_context *ctx;
+	char *input;
+	int len;
+
+	input = read_file(path, &len);
+	CHECK(input != NULL && len > 0);
+	if (!input)
+		return mu_test_result("session-test");
+
+	once = mupdf_clean_run(input, len, outline);
+	CHECK(once && once->data && once->length > 4 && !memcmp(once->data, "%PDF", 4));
+
+	/* A session has to work whether or not there are threads. */
+	session = mupdf_clean_session_new(0);
+	CHECK(session != NULL);
+	if (session)
+	{
+		first = mupdf_clean_session_run(session, input, len, outline);
+		CHECK(same_result(first, once));
+
+		/* The second run starts with warm caches. */
+		again = mupdf_clean_session_run(session, input, len, outline);
+		CHECK(same_result(again, once));
+
+		/* Only sessions with locks can be cloned. */
+		clone = mupdf_clean_session_clone(session);
+		if (fz_threads_available())
+		{
+			CHECK(clone != NULL);
+			if (clone)
+			{
+				cloned = mupdf_clean_session_run(clone, input, len, outline);
+				CHECK(same_result(cloned, once));
+			}
+		}
+		else
+			CHECK(clone == NULL);
+
+		if (once)
+			check_stream_base64(session, input, len, outline, once);
+
+		/* Compacting is opt in: it changes the bytes, not the pages. */
+		CHECK(!has_objstm(once));
+		mupdf_clean_session_set_compact(session, 1);
+		compact = mupdf_clean_session_run(session, input, len, outline);
+		CHECK(compact && compact->data && has_objstm(compact));
+		CHECK(!same_result(compact, once));
+		CHECK(count_pages(compact) > 0);
+		CHECK_INT(count_pages(compact), count_pages(once));
+		mupdf_clean_session_set_compact(session, 0);
+	}
+
+	mupdf_clean_result_free(compact);
+	mupdf_clean_result_free(cloned);
+	mupdf_clean_result_free(again);
+	mupdf_clean_result_free(first);
+	mupdf_clean_result_free(once);
+	mupdf_clean_session_free(clone);
+	mupdf_clean_session_free(session);
+	free(input);
+	free(streamed);
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	CHECK(ctx != NULL);
+	if (ctx)
+	{
+		/* Some of the base64 is broken on purpose. */
+		fz_set_warning_callback(ctx, NULL, NULL);
+		check_base64(ctx);
+		fz_drop_context(ctx);
+	}
+
+	return mu_test_result(fz_threads_available() ? "session-test" : "session-test (no threads)");
+}
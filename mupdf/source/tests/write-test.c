@@ -0,0 +1,613 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * write-test - Save a document with streams of every kind the writer
+ * treats differently, serially and with compress-threads, and check
+ * that both give the same bytes and that the streams survive.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+#include "mu-test.h"
+
+#include "thread-imp.h"
+
+/* The writer's workers run on clones, which need real locks. */
+static fz_mutex *mutexes[FZ_LOCK_MAX];
+
+static void lock(void *user, int i)
+{
+	fz_lock_mutex(mutexes[i]);
+}
+
+static void unlock(void *user, int i)
+{
+	fz_unlock_mutex(mutexes[i]);
+}
+
+enum { PLAIN, FLATE, HEX, HEX_FLATE, BITMAP, NOISE, BROKEN, NKINDS };
+
+#define NSTREAMS 60
+
+static int nums[NSTREAMS];
+static int
+noise(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0xff;
+}
+
+/* Stream i's decoded contents. */
+static fz_buffer *
+make_data(fz_context *ctx, int i)
+{
+	int kind = i % NKINDS;
+	fz_buffer *buf = fz_new_buffer(ctx, 1024);
+	unsigned int seed = i;
+	int k;
+
+	fz_try(ctx)
+	{
+		if (kind == BITMAP)
+		{
+			/* 64x64, one bit per pixel, mostly white. */
+			for (k = 0; k < 64 * 8; k++)
+				fz_append_byte(ctx, buf, (k / 8) % 9 == i % 9 ? 0x0f : 0x00);
+		}
+		else if (kind == NOISE)
+		{
+			for (k = 0; k < 4096; k++)
+				fz_append_byte(ctx, buf, noise(&seed));
+		}
+		else
+		{
+			for (k = 0; k < 200 + i * 37; k++)
+				fz_append_printf(ctx, buf, "%d %d m %d %d l S\n", i, k, k, i);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+static fz_buffer *
+deflate(fz_context *ctx, fz_buffer *data)
+{
+	size_t len;
+	unsigned char *enc = fz_new_deflated_data_from_buffer(ctx, &len, data, FZ_DEFLATE_DEFAULT);
+	return fz_new_buffer_from_data(ctx, enc, len);
+}
+
+static fz_buffer *
+hex(fz_context *ctx, fz_buffer *data)
+{
+	fz_buffer *out = fz_new_buffer(ctx, data->len * 2 + 1);
+	size_t k;
+
+	for (k = 0; k < data->len; k++)
+		fz_append_printf(ctx, out, "%02x", data->data[k]);
+	fz_append_byte(ctx, out, '>');
+	return out;
+}
+
+static pdf_document *
+make_document(fz_context *ctx)
+{
+	pdf_document *doc = pdf_create_document(ctx);
+	fz_buffer *data = NULL;
+	fz_buffer *enc = NULL;
+	pdf_obj *dict = NULL;
+	fz_buffer *tmp = NULL;
+	pdf_obj *ref = NULL;
+	pdf_obj *page;
+	pdf_obj *contents;
+	pdf_obj *filter;
+	int i, kind;
+
+	fz_var(data);
+	fz_var(enc);
+	fz_var(tmp);
+	fz_var(dict);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		page = pdf_add_page(ctx, doc, fz_make_rect(0, 0, 100, 100), 0, NULL, NULL);
+		pdf_insert_page(ctx, doc, -1, page);
+		pdf_drop_obj(ctx, page);
+		page = pdf_lookup_page_obj(ctx, doc, 0);
+		contents = pdf_dict_put_array(ctx, page, PDF_NAME(Contents), NSTREAMS);
+
+		for (i = 0; i < NSTREAMS; i++)
+		{
+			kind = i % NKINDS;
+			data = make_data(ctx, i);
+			dict = pdf_new_dict(ctx, doc, 4);
+			if (kind == BITMAP)
+			{
+				pdf_dict_put(ctx, dict, PDF_NAME(Type), PDF_NAME(XObject));
+				pdf_dict_put(ctx, dict, PDF_NAME(Subtype), PDF_NAME(Image));
+				pdf_dict_put_int(ctx, dict, PDF_NAME(Width), 64);
+				pdf_dict_put_int(ctx, dict, PDF_NAME(Height), 64);
+				pdf_dict_put_int(ctx, dict, PDF_NAME(BitsPerComponent), 1);
+				pdf_dict_put(ctx, dict, PDF_NAME(ColorSpace), PDF_NAME(DeviceGray));
+			}
+			if (kind == FLATE || kind == BROKEN)
+			{
+				enc = deflate(ctx, data);
+				if (kind == BROKEN)
+					enc->len /= 2;
+				pdf_dict_put(ctx, dict, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+			}
+			else if (kind == HEX)
+			{
+				enc = hex(ctx, data);
+				pdf_dict_put(ctx, dict, PDF_NAME(Filter), PDF_NAME(ASCIIHexDecode));
+			}
+			else if (kind == HEX_FLATE)
+			{
+				tmp = deflate(ctx, data);
+				enc = hex(ctx, tmp);
+				fz_drop_buffer(ctx, tmp);
+				tmp = NULL;
+				filter = pdf_dict_put_array(ctx, dict, PDF_NAME(Filter), 2);
+				pdf_array_push(ctx, filter, PDF_NAME(ASCIIHexDecode));
+				pdf_array_push(ctx, filter, PDF_NAME(FlateDecode));
+			}
+			else
+				enc = fz_keep_buffer(ctx, data);
+
+			ref = pdf_add_stream(ctx, doc, enc, dict, 1);
+			nums[i] = pdf_to_num(ctx, ref);
+			if (kind != BITMAP)
+				pdf_array_push(ctx, contents, ref);
+
+			pdf_drop_obj(ctx, ref);
+			ref = NULL;
+			pdf_drop_obj(ctx, dict);
+			dict = NULL;
+			fz_drop_buffer(ctx, enc);
+			enc = NULL;
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, dict);
+		fz_drop_buffer(ctx, enc);
+		fz_drop_buffer(ctx, tmp);
+		fz_drop_buffer(ctx, data);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
+static fz_buffer *
+save(fz_context *ctx, pdf_document *doc, const char *options)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 1 << 16);
+	fz_output *out = NULL;
+	pdf_write_options opts;
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		pdf_parse_write_options(ctx, &opts, options);
+		out = fz_new_output_with_buffer(ctx, buf);
+		pdf_write_document(ctx, doc, out, &opts);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* Every stream that could be decoded before still decodes the same. */
+static void
+check_streams(fz_context *ctx, fz_buffer *file)
+{
+	fz_stream *stm = fz_open_buffer(ctx, file);
+	pdf_document *doc = NULL;
+	fz_buffer *data = NULL;
+	fz_buffer *want = NULL;
+	int i;
+
+	fz_var(doc);
+	fz_var(data);
+	fz_var(want);
+
+	fz_try(ctx)
+	{
+		doc = pdf_open_document_with_stream(ctx, stm);
+		for (i = 0; i < NSTREAMS; i++)
+		{
+			if (i % NKINDS == BROKEN)
+				continue;
+			want = make_data(ctx, i);
+			data = pdf_load_stream_number(ctx, doc, nums[i]);
+			CHECK(data->len == want->len && !memcmp(data->data, want->data, want->len));
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+			fz_drop_buffer(ctx, want);
+			want = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, data);
+		fz_drop_buffer(ctx, want);
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+check_options(fz_context *ctx, pdf_document *doc, const char *options, const char *threaded, int renumbered)
+{
+	fz_buffer *serial = NULL;
+	fz_buffer *parallel = NULL;
+
+	fz_var(serial);
+	fz_var(parallel);
+
+	fz_try(ctx)
+	{
+		serial = save(ctx, doc, options);
+		parallel = save(ctx, doc, threaded);
+		CHECK_INT(parallel->len, serial->len);
+		CHECK(parallel->len == serial->len && !memcmp(parallel->data, serial->data, serial->len));
+		if (!renumbered)
+			check_streams(ctx, parallel);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, serial);
+		fz_drop_buffer(ctx, parallel);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", threaded, fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+static int
+count_objstms(fz_context *ctx, pdf_document *doc)
+{
+	int num, n = 0;
+
+	for (num = 1; num < pdf_xref_len(ctx, doc); num++)
+	{
+		pdf_obj *obj;
+		if (!pdf_obj_num_is_stream(ctx, doc, num))
+			continue;
+		obj = pdf_load_object(ctx, doc, num);
+		if (pdf_dict_get(ctx, obj, PDF_NAME(Type)) == PDF_NAME(ObjStm))
+			n++;
+		pdf_drop_obj(ctx, obj);
+	}
+	return n;
+}
+
+/* An output that fails once it has been given a number of bytes. */
+static void
+write_limited(fz_context *ctx, void *state, const void *data, size_t n)
+{
+	size_t *left = state;
+	if (n > *left)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "out of space");
+	*left -= n;
+}
+
+/* The object streams are taken out of the document again after every
+ * save, and the saved file has no holes in its xref. */
+static void
+check_objstms(fz_context *ctx)
+{
+	static const size_t limits[] = { 0, 100, 10000, 100000 };
+	pdf_document *doc = NULL;
+	pdf_document *saved = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	fz_output *out = NULL;
+	pdf_write_options opts;
+	size_t left;
+	int i, num, packed = 0;
+
+	fz_var(doc);
+	fz_var(saved);
+	fz_var(buf);
+	fz_var(stm);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		doc = make_document(ctx);
+		pdf_parse_write_options(ctx, &opts, "objstms,compress");
+		for (i = 0; i < (int)nelem(limits); i++)
+		{
+			left = limits[i];
+			out = fz_new_output(ctx, 0, &left, write_limited, NULL, NULL);
+			fz_try(ctx)
+			{
+				pdf_write_document(ctx, doc, out, &opts);
+				fz_close_output(ctx, out);
+			}
+			fz_always(ctx)
+			{
+				fz_drop_output(ctx, out);
+				out = NULL;
+			}
+			fz_catch(ctx)
+				left = 0;
+			CHECK_INT(left, 0);
+			CHECK_INT(count_objstms(ctx, doc), 0);
+		}
+
+		buf = save(ctx, doc, "garbage=4,objstms,compress");
+		CHECK_INT(count_objstms(ctx, doc), 0);
+
+		stm = fz_open_buffer(ctx, buf);
+		saved = pdf_open_document_with_stream(ctx, stm);
+		CHECK(!pdf_was_repaired(ctx, saved));
+		CHECK(count_objstms(ctx, saved) > 0);
+		for (num = 1; num < pdf_xref_len(ctx, saved); num++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry_no_null(ctx, saved, num);
+			CHECK(entry->type == 'n' || entry->type == 'o');
+			packed += entry->type == 'o';
+		}
+		CHECK(packed > 0);
+		CHECK_INT(pdf_count_pages(ctx, saved), 1);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		pdf_drop_document(ctx, saved);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "objstms: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/* Noise is only stored as-is when asked to. */
+static void
+check_incompressible(fz_context *ctx)
+{
+	pdf_document *doc = NULL;
+	pdf_document *saved = NULL;
+	fz_buffer *data = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	pdf_obj *ref = NULL;
+	pdf_obj *obj;
+	unsigned int seed = 1;
+	int i, k, num;
+
+	fz_var(doc);
+	fz_var(saved);
+	fz_var(data);
+	fz_var(buf);
+	fz_var(stm);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		data = fz_new_buffer(ctx, 1 << 16);
+		for (k = 0; k < 1 << 16; k++)
+			fz_append_byte(ctx, data, noise(&seed));
+		ref = pdf_add_stream(ctx, doc, data, NULL, 0);
+		num = pdf_to_num(ctx, ref);
+
+		for (i = 0; i < 2; i++)
+		{
+			buf = save(ctx, doc, i ? "compress,skip-incompressible" : "compress");
+			stm = fz_open_buffer(ctx, buf);
+			saved = pdf_open_document_with_stream(ctx, stm);
+			obj = pdf_load_object(ctx, saved, num);
+			CHECK(pdf_dict_get(ctx, obj, PDF_NAME(Filter)) == (i ? NULL : PDF_NAME(FlateDecode)));
+			pdf_drop_obj(ctx, obj);
+			pdf_drop_document(ctx, saved);
+			saved = NULL;
+			fz_drop_stream(ctx, stm);
+			stm = NULL;
+			fz_drop_buffer(ctx, buf);
+			buf = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_document(ctx, saved);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, data);
+		pdf_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "incompressible: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+/* Saving over the file the document was opened from, when it was
+ * opened mapped, stops reading through the mapping first. Plain
+ * fz_open_file never maps. */
+static void
+check_save_in_place(fz_context *ctx, const char *path)
+{
+	pdf_document *doc = NULL;
+	pdf_document *saved = NULL;
+	fz_buffer *want = NULL;
+	fz_buffer *data = NULL;
+	fz_stream *stm = NULL;
+	pdf_write_options opts;
+	pdf_obj *obj;
+	int i;
+
+	fz_var(doc);
+	fz_var(saved);
+	fz_var(want);
+	fz_var(data);
+	fz_var(stm);
+
+	fz_try(ctx)
+	{
+		doc = make_document(ctx);
+		pdf_save_document(ctx, doc, path, NULL);
+		pdf_drop_document(ctx, doc);
+		doc = NULL;
+
+		for (i = 0; i < 2; i++)
+		{
+			stm = fz_open_file(ctx, path);
+			CHECK(!fz_stream_is_memory(ctx, stm));
+			fz_drop_stream(ctx, stm);
+			stm = fz_open_file_mapped(ctx, path);
+			doc = pdf_open_document_with_stream(ctx, stm);
+			fz_drop_stream(ctx, stm);
+			stm = NULL;
+#ifdef __linux__
+			CHECK(fz_stream_maps_file(ctx, doc->file, path));
+#endif
+			want = pdf_load_stream_number(ctx, doc, nums[0]);
+			pdf_parse_write_options(ctx, &opts, i ? "incremental" : "compress,garbage");
+			if (i)
+				pdf_update_object(ctx, doc, nums[1], PDF_TRUE);
+			pdf_save_document(ctx, doc, path, &opts);
+			CHECK(!fz_stream_maps_file(ctx, doc->file, path));
+
+			/* The document still reads from its original contents. */
+			data = pdf_load_stream_number(ctx, doc, nums[0]);
+			CHECK(data->len == want->len && !memcmp(data->data, want->data, want->len));
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+
+			saved = pdf_open_document(ctx, path);
+			data = pdf_load_stream_number(ctx, saved, nums[0]);
+			CHECK(data->len == want->len && !memcmp(data->data, want->data, want->len));
+			if (i)
+			{
+				obj = pdf_load_object(ctx, saved, nums[1]);
+				CHECK(obj == PDF_TRUE);
+				pdf_drop_obj(ctx, obj);
+			}
+			fz_drop_buffer(ctx, data);
+			data = NULL;
+			fz_drop_buffer(ctx, want);
+			want = NULL;
+			pdf_drop_document(ctx, saved);
+			saved = NULL;
+			pdf_drop_document(ctx, doc);
+			doc = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, data);
+		fz_drop_buffer(ctx, want);
+		pdf_drop_document(ctx, saved);
+		pdf_drop_document(ctx, doc);
+		fz_drop_stream(ctx, stm);
+		remove(path);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "save in place: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	fz_locks_context locks = { NULL, lock, unlock };
+	char path[1024];
+	fz_context *ctx;
+	pdf_document *doc = NULL;
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		if ((mutexes[i] = fz_new_mutex()) == NULL)
+			break;
+
+	/* Without threads the pooled save has to match the serial one too. */
+	ctx = fz_new_context(NULL, i == FZ_LOCK_MAX ? &locks : NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+		return 1;
+
+	fz_var(doc);
+
+	/* One stream is broken on purpose. */
+	fz_set_error_callback(ctx, NULL, NULL);
+	fz_set_warning_callback(ctx, NULL, NULL);
+
+	fz_try(ctx)
+	{
+		doc = make_document(ctx);
+		check_options(ctx, doc, "compress", "compress,compress-threads=4", 0);
+		check_options(ctx, doc, "compress-images", "compress-images,compress-threads=3", 0);
+		check_options(ctx, doc, "decompress,compress", "decompress,compress,compress-threads=4", 0);
+		check_options(ctx, doc, "decompress,compress,ascii", "decompress,compress,ascii,compress-threads=2", 0);
+		check_options(ctx, doc, "garbage=4,compress,compression-effort=9", "garbage=4,compress,compression-effort=9,compress-threads=8", 1);
+		check_objstms(ctx);
+		check_incompressible(ctx);
+		snprintf(path, sizeof path, "%s.pdf", argv[0]);
+		check_save_in_place(ctx, path);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		mu_test_failures++;
+	}
+
+	fz_drop_context(ctx);
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		fz_drop_mutex(mutexes[i]);
+	return mu_test_result("write-test");
+}
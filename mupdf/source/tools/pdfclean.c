@@ -95,6 +95,7 @@ __attribute__((__used__)) void wasm_export() {
 	
 	mupdf_clean(data,len,unused);
 	mupdf_clean_length(data,len,unused);
+	mupdf_clean_result_free(mupdf_clean_run(data,len,unused));
 }
 
 int pdfclean_main(int argc, char **argv)